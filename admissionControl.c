@@ -0,0 +1,227 @@
+#define _CRT_RAND_S
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "admissionControl.h"
+#include "serverConfig.h"
+#include "errorLogger.h"
+
+//how many stripes (and locks) the table is split into. has to be a power of 2
+#define ADMISSION_NUM_OF_STRIPES 256
+
+//how many entries of its stripe an address can end up in. 16 entries are 4 cache lines
+#define ADMISSION_MAX_PROBES 16
+
+//tokens are kept in thousandths of a connection, so a rate in connections per second is also the refill per millisecond
+#define TOKEN_SCALE 1000u
+
+typedef struct
+{
+    uint32_t ip;//network byte order. 0 (0.0.0.0, which never connects) while the entry has never been used
+    uint32_t numOfConnections;
+    uint32_t tokens;//in thousandths of a connection
+    uint32_t lastRefillMs;//the low 32 bits of getMonotonicMicroseconds() / 1000 when tokens was last topped up
+}AdmissionEntry;
+
+//s_stripeMutexes[i] guards the entries [i * s_stripeSize, (i + 1) * s_stripeSize)
+static AdmissionEntry* s_entries = NULL;
+static size_t s_stripeSize = 0;//a power of 2
+static CRITICAL_SECTION s_stripeMutexes[ADMISSION_NUM_OF_STRIPES];
+static uint64_t s_hashKey = 0;
+
+//the bucket limits from g_serverConfig, in thousandths of a connection
+static uint32_t s_maxTokens = 0;
+static uint32_t s_tokensPerMs = 0;
+
+static uint32_t nowMs(void)
+{
+    return (uint32_t)(getMonotonicMicroseconds() / 1000);
+}
+
+static uint64_t hashAddress(uint32_t ip)
+{
+    uint64_t x = (ip ^ s_hashKey) * 0x9E3779B97F4A7C15ull;
+    return x ^ (x >> 29);
+}
+
+//the tokens entry would have right now. an entry that was untouched for more than 49 days (when the
+//millisecond clock wraps) could be short changed, but a bucket that old has had no connections for long enough to be full
+static uint32_t refilledTokens(AdmissionEntry const* entry, uint32_t now)
+{
+    uint64_t const refill = (uint64_t)(uint32_t)(now - entry->lastRefillMs) * s_tokensPerMs;
+    return (uint32_t)min((uint64_t)entry->tokens + refill, (uint64_t)s_maxTokens);
+}
+
+//An entry with no connections and a full bucket is the same as an empty one, so it can be given to another address.
+//Entries are never emptied, so the entries of an address are always before the first entry that was never used.
+static bool isReusable(AdmissionEntry const* entry, uint32_t now)
+{
+    return entry->ip == 0 || (entry->numOfConnections == 0 && refilledTokens(entry, now) == s_maxTokens);
+}
+
+static CRITICAL_SECTION* stripeMutex(uint64_t hash)
+{
+    return s_stripeMutexes + (hash & (ADMISSION_NUM_OF_STRIPES - 1));
+}
+
+//the entry in addr's stripe that is i probes away from where it hashes to. lock the stripe before calling
+static AdmissionEntry* probe(uint64_t hash, size_t i)
+{
+    size_t const stripe = (size_t)(hash & (ADMISSION_NUM_OF_STRIPES - 1));
+    size_t const slot = (size_t)((hash >> 8) + i) & (s_stripeSize - 1);
+    return s_entries + stripe * s_stripeSize + slot;
+}
+
+void admissionControlInit(size_t maxConnections)
+{
+    assert( ! s_entries );
+
+    //room for twice as many addresses as there can be connections, so a stripe is never short of entries that can be reused
+    s_stripeSize = ADMISSION_MAX_PROBES;
+    while(s_stripeSize * ADMISSION_NUM_OF_STRIPES < 2 * maxConnections)
+        s_stripeSize <<= 1;
+
+    s_entries = calloc(s_stripeSize * ADMISSION_NUM_OF_STRIPES, sizeof(AdmissionEntry));
+    if( ! s_entries )
+    {
+        logError("calloc failed to allocate the admission control table", 0);
+        exit(0);
+    }
+
+    unsigned int keyHalves[2] = {0};
+    if(rand_s(keyHalves) || rand_s(keyHalves + 1))
+    {
+        logError("rand_s() failed to generate a key for the admission control table", 0);
+        exit(0);
+    }
+    s_hashKey = ((uint64_t)keyHalves[0] << 32) | keyHalves[1];
+
+    for(int i = 0; i < ADMISSION_NUM_OF_STRIPES; ++i)
+        InitializeCriticalSection(s_stripeMutexes + i);
+
+    s_maxTokens = (uint32_t)min(g_serverConfig.connectBurstPerIP * TOKEN_SCALE, (size_t)UINT32_MAX);
+    s_tokensPerMs = (uint32_t)min(g_serverConfig.connectRatePerIP, (size_t)UINT32_MAX);
+
+    logInfo("admission control: %zu connections per second and %zu open connections per ip (bursts of %zu), %llu KB table",
+        g_serverConfig.connectRatePerIP, g_serverConfig.connectionsPerIP, g_serverConfig.connectBurstPerIP,
+        (unsigned long long)(s_stripeSize * ADMISSION_NUM_OF_STRIPES * sizeof(AdmissionEntry) / 1024));
+}
+
+size_t getAdmissionBytesPerConnection(void)
+{
+    //two entries per connection, and up to twice that since the stripes are rounded up to a power of 2
+    return 4 * sizeof(AdmissionEntry);
+}
+
+//The entry of ip, or a reusable entry of its stripe that is taken for it. NULL if the stripe has no room for it.
+//The caller holds the stripe's mutex
+static AdmissionEntry* findEntry(uint32_t ip, uint64_t hash, uint32_t now)
+{
+    AdmissionEntry* reusable = NULL;
+    for(size_t i = 0; i < ADMISSION_MAX_PROBES; ++i)
+    {
+        AdmissionEntry* candidate = probe(hash, i);
+        if(candidate->ip == ip)
+            return candidate;
+
+        if( ! reusable && isReusable(candidate, now) )
+            reusable = candidate;
+
+        if(candidate->ip == 0)
+            break;//addr is not in the table
+    }
+
+    if(reusable)
+    {
+        reusable->ip = ip;
+        reusable->numOfConnections = 0;
+        reusable->tokens = s_maxTokens;
+        reusable->lastRefillMs = now;
+    }
+
+    return reusable;
+}
+
+AdmissionResult admissionAcquire(IN_ADDR addr)
+{
+    assert(s_entries);//assert that admissionControlInit() has been called
+
+    uint32_t const ip = addr.s_addr;
+    uint64_t const hash = hashAddress(ip);
+    uint32_t const now = nowMs();
+
+    CRITICAL_SECTION* mutex = stripeMutex(hash);
+    EnterCriticalSection(mutex);
+
+    AdmissionEntry* entry = findEntry(ip, hash, now);
+    if( ! entry )
+    {
+        LeaveCriticalSection(mutex);
+        return ADMISSION_TABLE_FULL;
+    }
+
+    entry->tokens = refilledTokens(entry, now);
+    entry->lastRefillMs = now;
+
+    AdmissionResult result = ADMISSION_OK;
+    if(entry->tokens < TOKEN_SCALE)
+        result = ADMISSION_RATE_LIMITED;
+    else if(entry->numOfConnections >= g_serverConfig.connectionsPerIP)
+        result = ADMISSION_TOO_MANY_CONNECTIONS;
+    else
+    {
+        entry->tokens -= TOKEN_SCALE;
+        ++entry->numOfConnections;
+    }
+
+    LeaveCriticalSection(mutex);
+    return result;
+}
+
+bool admissionAdopt(IN_ADDR addr)
+{
+    assert(s_entries);//assert that admissionControlInit() has been called
+
+    uint32_t const ip = addr.s_addr;
+    uint64_t const hash = hashAddress(ip);
+
+    CRITICAL_SECTION* mutex = stripeMutex(hash);
+    EnterCriticalSection(mutex);
+
+    AdmissionEntry* entry = findEntry(ip, hash, nowMs());
+    if(entry)
+        ++entry->numOfConnections;
+
+    LeaveCriticalSection(mutex);
+    return entry != NULL;
+}
+
+void admissionRelease(IN_ADDR addr)
+{
+    uint32_t const ip = addr.s_addr;
+    uint64_t const hash = hashAddress(ip);
+
+    CRITICAL_SECTION* mutex = stripeMutex(hash);
+    EnterCriticalSection(mutex);
+
+    //an entry with connections open is never reused, so it is still where admissionAcquire() left it
+    for(size_t i = 0; i < ADMISSION_MAX_PROBES; ++i)
+    {
+        AdmissionEntry* entry = probe(hash, i);
+        if(entry->ip == ip)
+        {
+            assert(entry->numOfConnections > 0);
+            --entry->numOfConnections;
+            break;
+        }
+
+        if(entry->ip == 0)
+            break;
+    }
+
+    LeaveCriticalSection(mutex);
+}
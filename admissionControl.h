@@ -0,0 +1,47 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <winsock2.h>
+
+//Per source IP admission control. The acceptor threads ask it about every connection before it gets anywhere near
+//the lobby or the connection pool, so a host that opens connections as fast as it can only costs an accept()
+//and a reset per connection. Every IPv4 address with connections open (or that connected recently) has an entry with
+//-a token bucket that limits how fast it can open new connections (CHESS_SERVER_CONNECT_RATE_PER_IP and CHESS_SERVER_CONNECT_BURST_PER_IP)
+//-how many connections it has open, which is capped at CHESS_SERVER_CONNECTIONS_PER_IP (see serverConfig.h)
+//
+//The entries are in a fixed size open addressing hash table with room for twice as many addresses as there can be connections.
+//It is split into stripes with a lock each, and an address only ever probes the entries of its own stripe, so the
+//acceptor threads and the threads that close connections rarely wait on each other. The hash is keyed with rand_s()
+//so which addresses share a stripe can not be picked from the outside.
+
+typedef enum
+{
+    ADMISSION_OK,
+    ADMISSION_RATE_LIMITED,//the address opened connections faster than its token bucket allows
+    ADMISSION_TOO_MANY_CONNECTIONS,//the address already has CHESS_SERVER_CONNECTIONS_PER_IP connections open
+    ADMISSION_TABLE_FULL//every entry the address could go in belongs to an address that is still being tracked
+}AdmissionResult;
+
+//Has to be called once before the acceptor threads are started. maxConnections is the capacity of the connection pool.
+//Exits if the table can not be allocated.
+void admissionControlInit(size_t maxConnections);
+
+//The most bytes the table takes per connection the pool can hold, for the memory budget.
+size_t getAdmissionBytesPerConnection(void);
+
+//Thread safe and O(1). Called for every accepted socket. If it returns ADMISSION_OK the connection counts
+//towards addr's limit until admissionRelease() is called for it.
+AdmissionResult admissionAcquire(IN_ADDR addr);
+
+//Thread safe and O(1). Counts a connection that is already open (one a server that is being upgraded handed over, see hotUpgrade.h)
+//towards addr's limit, without checking the rate or the limit. Returns false if the table has no room for addr
+bool admissionAdopt(IN_ADDR addr);
+
+//Thread safe and O(1). Called once a connection that admissionAcquire() let in is closed.
+void admissionRelease(IN_ADDR addr);
+
+#endif //ADMISSION_CONTROL_H
@@ -0,0 +1,173 @@
+//Benchmarks lookups in the lobby's uniqueID index (connectionIndex.h) from 10 up to 100k connected players.
+//For every size it measures the average latency of lookups that hit and lookups that miss,
+//lookups while another thread keeps inserting and removing IDs (like the acceptor and game threads do),
+//and the slowest single insert while the index was growing (to show that there are no stop-the-world rehashes).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+
+#include "connectionIndex.h"
+
+#define NUM_OF_LOOKUPS 4000000
+#define CHURN_ID_COUNT 1024
+
+typedef struct
+{
+    ConnectionIndex* index;
+    uint32_t const* churnIDs;
+    volatile LONG shouldStop;
+    volatile LONG64 numOfWrites;
+}ChurnArgs;
+
+static uint64_t s_rngState = 0x9E3779B97F4A7C15ull;
+
+//xorshift64*
+static uint32_t nextRandom(void)
+{
+    s_rngState ^= s_rngState >> 12;
+    s_rngState ^= s_rngState << 25;
+    s_rngState ^= s_rngState >> 27;
+    return (uint32_t)((s_rngState * 2685821657736338717ull) >> 32);
+}
+
+static uint32_t nextRandomID(void)
+{
+    uint32_t id = 0;
+    do id = nextRandom();
+    while(id == CONNECTION_INDEX_EMPTY_KEY || id == CONNECTION_INDEX_TOMBSTONE_KEY);
+    return id;
+}
+
+static double nsPerTick(void)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return 1e9 / (double)freq.QuadPart;
+}
+
+static uint64_t now(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)t.QuadPart;
+}
+
+//time NUM_OF_LOOKUPS lookups of ids[random index]. returns the average ns per lookup
+static double timeLookups(ConnectionIndex const* index, uint32_t const* ids, size_t numOfIDs, uint64_t* sink)
+{
+    //pick the lookup order up front so the rng is not part of the measurement
+    uint32_t* order = malloc(NUM_OF_LOOKUPS * sizeof(uint32_t));
+    if( ! order ) exit(EXIT_FAILURE);
+    for(size_t i = 0; i < NUM_OF_LOOKUPS; ++i)
+        order[i] = ids[nextRandom() % numOfIDs];
+
+    uint64_t const start = now();
+    for(size_t i = 0; i < NUM_OF_LOOKUPS; ++i)
+    {
+        uint32_t handle = 0;
+        if(connectionIndexLookup(index, order[i], &handle))
+            *sink += handle;
+    }
+    uint64_t const end = now();
+
+    free(order);
+    return (double)(end - start) * nsPerTick() / NUM_OF_LOOKUPS;
+}
+
+static unsigned __stdcall churnThreadStart(void* arg)
+{
+    ChurnArgs* churn = arg;
+    while( ! churn->shouldStop )
+    {
+        for(size_t i = 0; i < CHURN_ID_COUNT; ++i)
+            connectionIndexInsert(churn->index, churn->churnIDs[i], (uint32_t)i);
+        for(size_t i = 0; i < CHURN_ID_COUNT; ++i)
+            connectionIndexRemove(churn->index, churn->churnIDs[i]);
+
+        InterlockedExchangeAdd64(&churn->numOfWrites, 2 * CHURN_ID_COUNT);
+    }
+    return 0;
+}
+
+static void benchmarkSize(size_t numOfPlayers, uint64_t* sink)
+{
+    ConnectionIndex index;
+    if( ! connectionIndexInit(&index, 16) )
+        exit(EXIT_FAILURE);
+
+    uint32_t* ids = malloc(numOfPlayers * sizeof(uint32_t));
+    uint32_t* missingIDs = malloc(numOfPlayers * sizeof(uint32_t));
+    uint32_t* churnIDs = malloc(CHURN_ID_COUNT * sizeof(uint32_t));
+    if( ! ids || ! missingIDs || ! churnIDs ) exit(EXIT_FAILURE);
+
+    //start small so the index has to grow the whole way up to numOfPlayers
+    uint64_t slowestInsert = 0;
+    for(size_t i = 0; i < numOfPlayers;)
+    {
+        ids[i] = nextRandomID();
+        uint64_t const start = now();
+        bool const inserted = connectionIndexInsert(&index, ids[i], (uint32_t)i);
+        uint64_t const elapsed = now() - start;
+
+        if(inserted)
+        {
+            if(elapsed > slowestInsert) slowestInsert = elapsed;
+            ++i;
+        }
+    }
+
+    for(size_t i = 0; i < numOfPlayers; ++i)
+    {
+        uint32_t unused = 0;
+        do missingIDs[i] = nextRandomID();
+        while(connectionIndexLookup(&index, missingIDs[i], &unused));
+    }
+
+    for(size_t i = 0; i < CHURN_ID_COUNT; ++i)
+    {
+        uint32_t unused = 0;
+        do churnIDs[i] = nextRandomID();
+        while(connectionIndexLookup(&index, churnIDs[i], &unused));
+    }
+
+    double const hitNs = timeLookups(&index, ids, numOfPlayers, sink);
+    double const missNs = timeLookups(&index, missingIDs, numOfPlayers, sink);
+
+    ChurnArgs churn = {.index = &index, .churnIDs = churnIDs, .shouldStop = 0, .numOfWrites = 0};
+    //_beginthreadex() since a _beginthread() handle is closed by the CRT when the thread ends, so it can not be waited on
+    HANDLE churnThread = (HANDLE)_beginthreadex(NULL, 0, churnThreadStart, &churn, 0, NULL);
+    double const churnHitNs = timeLookups(&index, ids, numOfPlayers, sink);
+    InterlockedExchange(&churn.shouldStop, 1);
+    WaitForSingleObject(churnThread, INFINITE);
+    CloseHandle(churnThread);
+
+    printf("%10zu | %12.1f | %13.1f | %18.1f | %16lld | %17.2f\n", numOfPlayers, hitNs, missNs, 
+        churnHitNs, (long long)churn.numOfWrites, (double)slowestInsert * nsPerTick() / 1000.0);
+
+    free(churnIDs);
+    free(missingIDs);
+    free(ids);
+    connectionIndexDestroy(&index);
+}
+
+int main(void)
+{
+    size_t const sizes[] = {10, 100, 1000, 10000, 100000};
+    uint64_t sink = 0;
+
+    printf("%10s | %12s | %13s | %18s | %16s | %17s\n", "players", "hit ns/op", "miss ns/op", 
+        "hit+churn ns/op", "churn writes", "worst insert us");
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        benchmarkSize(sizes[i], &sink);
+
+    //print the sink so the lookups cant be optimized away
+    printf("\n(checksum %llu)\n", (unsigned long long)sink);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+//Benchmarks the code every message goes through: the recv() framing and message dispatch of the lobby (lobbyManager.c)
+//and of the game workers (gameManager.c and messageFramer.c). The real code is fed synthetic byte streams through a mock socket
+//(framingBench.h), cut into recv() chunks in a few ways: one message per recv(), messages with their header split across two recv()s,
+//many messages per recv() (not lined up with message boundaries), and recv()s that fill the whole read buffer.
+//For every stream it reports ns/message, allocations/message, and whether every message was dispatched.
+//
+//usage: framingBench [numOfMessages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framingBench.h"
+#include "messageFramer.h"
+#include "chessNetworkProtocol.h"
+#include "errorLogger.h"
+#include "idAllocator.h"
+#include "metrics.h"
+
+#define DEFAULT_NUM_OF_MESSAGES 1000000
+
+//none of these are ever real sockets
+#define READER_SOCK ((SOCKET)0x10000)
+#define OTHER_SOCK ((SOCKET)0x10001)
+
+#define MANY_PER_RECV_CHUNK_SIZE 100
+
+MockSocket g_mockSocket;
+uint64_t g_numOfAllocations = 0;
+
+static int s_lastError = 0;
+
+int benchWSARecv(SOCKET sock, LPWSABUF buffers, DWORD numOfBuffers, LPDWORD numBytesReceived,
+    LPDWORD flags, LPWSAOVERLAPPED overlapped, LPWSAOVERLAPPED_COMPLETION_ROUTINE completionRoutine)
+{
+    MockSocket* mock = &g_mockSocket;
+    if(sock != mock->sock || mock->pos == mock->dataSize)
+    {
+        s_lastError = WSAEWOULDBLOCK;
+        return SOCKET_ERROR;
+    }
+
+    if(mock->chunkLeft == 0)
+    {
+        mock->chunkLeft = mock->chunkSizes[mock->nextChunk];
+        mock->nextChunk = (mock->nextChunk + 1) % mock->numOfChunkSizes;
+    }
+
+    //fill the buffers in order with what is left of the chunk. a real recv() with no room returns 0 too
+    size_t total = 0;
+    for(DWORD i = 0; i < numOfBuffers && mock->chunkLeft > 0 && mock->pos < mock->dataSize; ++i)
+    {
+        size_t numBytes = min(mock->chunkLeft, (size_t)buffers[i].len);
+        numBytes = min(numBytes, mock->dataSize - mock->pos);
+
+        memcpy(buffers[i].buf, mock->data + mock->pos, numBytes);
+        mock->pos += numBytes;
+        mock->chunkLeft -= numBytes;
+        total += numBytes;
+    }
+
+    *numBytesReceived = (DWORD)total;
+    return 0;
+}
+
+int benchWSASend(SOCKET sock, LPWSABUF buffers, DWORD numOfBuffers, LPDWORD numBytesSent,
+    DWORD flags, LPWSAOVERLAPPED overlapped, LPWSAOVERLAPPED_COMPLETION_ROUTINE completionRoutine)
+{
+    DWORD total = 0;
+    for(DWORD i = 0; i < numOfBuffers; ++i)
+        total += buffers[i].len;
+
+    *numBytesSent = total;
+    return 0;
+}
+
+int benchCloseSocket(SOCKET sock)
+{
+    return 0;
+}
+
+int benchGetLastError(void)
+{
+    return s_lastError;
+}
+
+void benchSetLastError(int error)
+{
+    s_lastError = error;
+}
+
+void* benchMalloc(size_t size)
+{
+    ++g_numOfAllocations;
+    return malloc(size);
+}
+
+void* benchCalloc(size_t count, size_t size)
+{
+    ++g_numOfAllocations;
+    return calloc(count, size);
+}
+
+void* benchRealloc(void* ptr, size_t size)
+{
+    ++g_numOfAllocations;
+    return realloc(ptr, size);
+}
+
+//how many messages consumeMessage() has seen so far
+static uint64_t numOfDispatchedMessages(void)
+{
+    uint64_t total = 0;
+    for(int i = 0; i < METRIC_MESSAGE_TYPE_SLOTS; ++i)
+        total += g_metricsShard->messagesIn[i];
+
+    return total;
+}
+
+static double nsPerTick(void)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return 1e9 / (double)freq.QuadPart;
+}
+
+static uint64_t now(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)t.QuadPart;
+}
+
+//a stream of numOfMessages messages repeating the messages in pattern. returns its size
+static size_t buildStream(char* stream, size_t numOfMessages, char const* const* pattern, size_t patternSize)
+{
+    size_t streamSize = 0;
+    for(size_t i = 0; i < numOfMessages; ++i)
+    {
+        char const* msg = pattern[i % patternSize];
+        memcpy(stream + streamSize, msg, (uint8_t)msg[1]);
+        streamSize += (uint8_t)msg[1];
+    }
+
+    return streamSize;
+}
+
+//lobby members ask the other member to play and turn them down, over and over. only the first request is outstanding,
+//the rest get a PAIR_REQUEST_TOO_SOON_MSGTYPE (and the declines an ID_NOT_IN_LOBBY_MSGTYPE, since the other member never asked)
+static size_t buildLobbyStream(char* stream, size_t numOfMessages, uint32_t otherID)
+{
+    uint32_t const nwByteOrderOtherID = htonl(otherID);
+    char pairRequest[PAIR_REQUEST_MSGSIZE] = {PAIR_REQUEST_MSGTYPE, PAIR_REQUEST_MSGSIZE};
+    char pairDecline[PAIR_DECLINE_MSGSIZE] = {PAIR_DECLINE_MSGTYPE, PAIR_DECLINE_MSGSIZE};
+    memcpy(pairRequest + 2, &nwByteOrderOtherID, sizeof(nwByteOrderOtherID));
+    memcpy(pairDecline + 2, &nwByteOrderOtherID, sizeof(nwByteOrderOtherID));
+
+    char const* const pattern[] = {pairRequest, pairDecline};
+    return buildStream(stream, numOfMessages, pattern, sizeof(pattern) / sizeof(pattern[0]));
+}
+
+//a player moving and offering draws their opponent keeps declining. a mix of 10 and 2 byte messages
+static size_t buildGameStream(char* stream, size_t numOfMessages, uint32_t unused)
+{
+    char const move[MOVE_MSGSIZE] = {MOVE_MSGTYPE, MOVE_MSGSIZE, 6, 0, 5, 2};
+    char const drawOffer[DRAW_OFFER_MSGSIZE] = {DRAW_OFFER_MSGTYPE, DRAW_OFFER_MSGSIZE};
+    char const drawDecline[DRAW_DECLINE_MSGSIZE] = {DRAW_DECLINE_MSGTYPE, DRAW_DECLINE_MSGSIZE};
+
+    char const* const pattern[] = {move, drawOffer, move, drawDecline};
+    return buildStream(stream, numOfMessages, pattern, sizeof(pattern) / sizeof(pattern[0]));
+}
+
+typedef struct
+{
+    char const* name;
+    size_t const* chunkSizes;
+    size_t numOfChunkSizes;
+}ChunkPattern;
+
+typedef struct
+{
+    char const* name;
+    uint32_t (*reset)(void);//returns the uniqueID the reader's messages are about
+    size_t (*buildStream)(char* stream, size_t numOfMessages, uint32_t otherID);
+    bool (*drain)(void);
+}FramingPath;
+
+static uint32_t resetLobby(void) {return lobbyFramingReset(READER_SOCK, OTHER_SOCK);}
+static uint32_t resetGame(void) {gameFramingReset(READER_SOCK, OTHER_SOCK); return 0;}
+
+static void runStream(FramingPath const* path, ChunkPattern const* chunks, char* stream, size_t numOfMessages)
+{
+    size_t const streamSize = path->buildStream(stream, numOfMessages, path->reset());
+
+    memset(&g_mockSocket, 0, sizeof(g_mockSocket));
+    g_mockSocket.sock = READER_SOCK;
+    g_mockSocket.data = stream;
+    g_mockSocket.dataSize = streamSize;
+    g_mockSocket.chunkSizes = chunks->chunkSizes;
+    g_mockSocket.numOfChunkSizes = chunks->numOfChunkSizes;
+
+    uint64_t const dispatchedBefore = numOfDispatchedMessages();
+    uint64_t const allocationsBefore = g_numOfAllocations;
+
+    uint64_t const start = now();
+    bool const isStillOpen = path->drain();
+    uint64_t const end = now();
+
+    uint64_t const numOfDispatched = numOfDispatchedMessages() - dispatchedBefore;
+    uint64_t const numOfAllocations = g_numOfAllocations - allocationsBefore;
+    double const perMessage = numOfDispatched ? 1.0 / (double)numOfDispatched : 0.0;
+
+    char result[64] = "ok";
+    if( ! isStillOpen )
+        snprintf(result, sizeof(result), "connection closed after %zu bytes", g_mockSocket.pos);
+    else if(numOfDispatched != numOfMessages)
+        snprintf(result, sizeof(result), "%llu messages stuck in the buffer", (unsigned long long)(numOfMessages - numOfDispatched));
+
+    printf("%-6s %-24s %10llu / %-10zu %9.1f ns/msg %7.3f allocs/msg  %s\n", path->name, chunks->name,
+        (unsigned long long)numOfDispatched, numOfMessages, (double)(end - start) * nsPerTick() * perMessage,
+        (double)numOfAllocations * perMessage, result);
+}
+
+int main(int argc, char** argv)
+{
+    size_t numOfMessages = DEFAULT_NUM_OF_MESSAGES;
+    if(argc > 1) numOfMessages = (size_t)strtoull(argv[1], NULL, 10);
+    if(numOfMessages == 0)
+    {
+        fprintf(stderr, "usage: framingBench [numOfMessages]\n");
+        return EXIT_FAILURE;
+    }
+
+    WSADATA wsaData;
+    if(WSAStartup(MAKEWORD(2,2), &wsaData) || ! idAllocatorInit())
+        return EXIT_FAILURE;
+
+    //logging stays on stderr (no writer thread), and only errors get through
+    g_logLevel = LOG_LEVEL_ERROR;
+
+    metricsInit();
+    metricsRegisterThread();
+    lobbyFramingInit();
+
+    //the biggest message is 10 bytes
+    char* stream = malloc(numOfMessages * 10);
+    if( ! stream )
+    {
+        fprintf(stderr, "malloc failed\n");
+        return EXIT_FAILURE;
+    }
+
+    FramingPath const lobbyPath = {"lobby", resetLobby, buildLobbyStream, lobbyFramingDrain};
+    FramingPath const gamePath = {"game", resetGame, buildGameStream, gameFramingDrain};
+
+    size_t const lobbyPerMessage[] = {PAIR_REQUEST_MSGSIZE};
+    size_t const lobbySplitHeader[] = {1, PAIR_REQUEST_MSGSIZE - 1};
+    size_t const fullReadBuff[] = {MESSAGE_FRAMER_CAPACITY};
+    size_t const gamePerMessage[] = {MOVE_MSGSIZE, DRAW_OFFER_MSGSIZE, MOVE_MSGSIZE, DRAW_DECLINE_MSGSIZE};
+    size_t const gameSplitHeader[] = {1, MOVE_MSGSIZE - 1, 1, DRAW_OFFER_MSGSIZE - 1, 1, MOVE_MSGSIZE - 1, 1, DRAW_DECLINE_MSGSIZE - 1};
+    size_t const manyPerRecv[] = {MANY_PER_RECV_CHUNK_SIZE};
+
+    #define CHUNKS(name, sizes) {name, sizes, sizeof(sizes) / sizeof(sizes[0])}
+    ChunkPattern const lobbyChunks[] =
+    {
+        CHUNKS("one message per recv", lobbyPerMessage),
+        CHUNKS("split headers", lobbySplitHeader),
+        CHUNKS("many messages per recv", manyPerRecv),
+        CHUNKS("full read buffer", fullReadBuff)
+    };
+    ChunkPattern const gameChunks[] =
+    {
+        CHUNKS("one message per recv", gamePerMessage),
+        CHUNKS("split headers", gameSplitHeader),
+        CHUNKS("many messages per recv", manyPerRecv),
+        CHUNKS("full read buffer", fullReadBuff)
+    };
+    #undef CHUNKS
+
+    printf("%zu messages per stream\n\n", numOfMessages);
+
+    for(size_t i = 0; i < sizeof(lobbyChunks) / sizeof(lobbyChunks[0]); ++i)
+        runStream(&lobbyPath, lobbyChunks + i, stream, numOfMessages);
+
+    for(size_t i = 0; i < sizeof(gameChunks) / sizeof(gameChunks[0]); ++i)
+        runStream(&gamePath, gameChunks + i, stream, numOfMessages);
+
+    free(stream);
+    WSACleanup();
+    return EXIT_SUCCESS;
+}
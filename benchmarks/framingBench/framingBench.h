@@ -0,0 +1,93 @@
+#ifndef FRAMING_BENCH_H
+#define FRAMING_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+
+//The framing bench compiles lobbyManager.c, gameManager.c, messageFramer.c and networkWrite.c into its own translation units
+//(lobbyFraming.c and gameFraming.c) with the socket calls and the allocator swapped out by the macros below.
+//So the real recv() parsing and message dispatch code runs against a mock socket that hands out a synthetic byte stream.
+
+//The mock socket that the framing code reads from. Every WSARecv() on it returns the next chunk of data,
+//with the chunk sizes taken from chunkSizes in a loop (a chunk is cut short if the caller asks for less).
+//Once the data runs out WSARecv() fails with WSAEWOULDBLOCK. Every other socket reads nothing and takes everything sent to it.
+typedef struct
+{
+    SOCKET sock;
+    char const* data;
+    size_t dataSize;
+    size_t pos;
+
+    size_t const* chunkSizes;
+    size_t numOfChunkSizes;
+    size_t nextChunk;
+    size_t chunkLeft;//bytes left of the chunk that was cut short
+
+}MockSocket;
+
+extern MockSocket g_mockSocket;
+
+//every malloc(), calloc() and realloc() made by the code under test
+extern uint64_t g_numOfAllocations;
+
+int benchWSARecv(SOCKET sock, LPWSABUF buffers, DWORD numOfBuffers, LPDWORD numBytesReceived,
+    LPDWORD flags, LPWSAOVERLAPPED overlapped, LPWSAOVERLAPPED_COMPLETION_ROUTINE completionRoutine);
+int benchWSASend(SOCKET sock, LPWSABUF buffers, DWORD numOfBuffers, LPDWORD numBytesSent,
+    DWORD flags, LPWSAOVERLAPPED overlapped, LPWSAOVERLAPPED_COMPLETION_ROUTINE completionRoutine);
+int benchCloseSocket(SOCKET sock);
+int benchGetLastError(void);
+void benchSetLastError(int error);
+void* benchMalloc(size_t size);
+void* benchCalloc(size_t count, size_t size);
+void* benchRealloc(void* ptr, size_t size);
+
+//lobbyFraming.c. runs the lobby's read and dispatch path (onPollReady() and flushLobbyConnections())
+
+//has to be called once before anything else in here (gameFraming.c puts players back in the lobby too)
+void lobbyFramingInit(void);
+
+//empty the lobby and put a member reading from readerSock and one more member in it.
+//returns the uniqueID of the other member (the one the reader's messages are about)
+uint32_t lobbyFramingReset(SOCKET readerSock, SOCKET otherSock);
+
+//read and dispatch until g_mockSocket runs out of data. returns false if the lobby closed the reader
+bool lobbyFramingDrain(void);
+
+//gameFraming.c. runs a game worker's read and relay path (onPollReady() and the flush of the opponent)
+
+void gameFramingReset(SOCKET readerSock, SOCKET opponentSock);
+
+//read and relay until g_mockSocket runs out of data. returns false if the game ended
+bool gameFramingDrain(void);
+
+//Only defined by the translation units that include the server's .c files.
+//Everything the server's .c files include is included above (or right here) first, so the macros dont touch the declarations.
+#ifdef FRAMING_BENCH_MOCK_CALLS
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ws2tcpip.h>
+#include <process.h>
+
+#define WSARecv(sock, buffers, numOfBuffers, numBytesReceived, flags, overlapped, completionRoutine) \
+    benchWSARecv(sock, buffers, numOfBuffers, numBytesReceived, flags, overlapped, completionRoutine)
+#define WSASend(sock, buffers, numOfBuffers, numBytesSent, flags, overlapped, completionRoutine) \
+    benchWSASend(sock, buffers, numOfBuffers, numBytesSent, flags, overlapped, completionRoutine)
+#define closesocket(sock) benchCloseSocket(sock)
+#define WSAGetLastError() benchGetLastError()
+#define WSASetLastError(error) benchSetLastError(error)
+#define malloc(size) benchMalloc(size)
+#define calloc(count, size) benchCalloc(count, size)
+#define realloc(ptr, size) benchRealloc(ptr, size)
+
+#endif //FRAMING_BENCH_MOCK_CALLS
+
+#endif //FRAMING_BENCH_H
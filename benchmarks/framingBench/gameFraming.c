@@ -0,0 +1,46 @@
+//A game worker's code compiled against the mock socket. See framingBench.h
+
+#define FRAMING_BENCH_MOCK_CALLS
+#include "framingBench.h"
+
+#include "gameManager.c"
+
+//players[0] reads from the mock socket and players[1] is their opponent. both are from the connection pool.
+//the game is not resumable and has no journal, so only the forwarding is measured
+static ChessGame s_game;
+
+void gameFramingReset(SOCKET readerSock, SOCKET opponentSock)
+{
+    SOCKET const socks[2] = {readerSock, opponentSock};
+    for(int i = 0; i < 2; ++i)
+    {
+        if(s_game.players[i])
+            connectionPoolFree(s_game.players[i]);
+
+        SOCKADDR_IN addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        s_game.players[i] = connectionPoolAlloc(socks[i], &addr);
+    }
+}
+
+bool gameFramingDrain(void)
+{
+    //the same steps as one worker loop iteration where only the reader's socket was ready
+    while(g_mockSocket.pos < g_mockSocket.dataSize)
+    {
+        if( ! onPollReady(&s_game, 0) )
+        {
+            //the game is over, so the players were closed (or put back in the lobby)
+            s_game.players[0] = s_game.players[1] = NULL;
+            return false;
+        }
+
+        if(networkFlush(s_game.players[1]->socket, &s_game.players[1]->out) == SOCKET_ERROR)
+            return false;
+    }
+
+    return true;
+}
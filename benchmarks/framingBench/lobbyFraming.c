@@ -0,0 +1,69 @@
+//The lobby threads' code (and networkWrite.c and messageFramer.c, which the lobby and the game workers share)
+//compiled against the mock socket. See framingBench.h
+
+#define FRAMING_BENCH_MOCK_CALLS
+#include "framingBench.h"
+
+#include "networkWrite.c"
+#include "messageFramer.c"
+#include "lobbyManager.c"
+
+static uint32_t s_readerID = 0;
+
+void lobbyFramingInit(void)
+{
+    //room for the two lobby members and the two players of gameFraming.c, in one shard so that the stream never goes through an inbox
+    g_serverConfig.lobbyThreads = 1;
+    connectionPoolInit(CONNECTION_POOL_CHUNK_SIZE);
+    admissionControlInit(CONNECTION_POOL_CHUNK_SIZE);
+    lobbyManagerInit();
+}
+
+uint32_t lobbyFramingReset(SOCKET readerSock, SOCKET otherSock)
+{
+    LobbyShard* shard = s_lobbyShards;
+    size_t unusedRange = 0;
+
+    //players that gameFraming.c put back in the lobby are still in the inbox
+    drainWakeupSocket(&shard->wakeup);
+    takeLobbyMail(shard, &unusedRange, false);
+
+    while(shard->numOfConnections > 0)
+        closeLobbyConnection(shard, shard->connections[0], &unusedRange, true);
+
+    SOCKADDR_IN addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    lobbyInsert((ConnectionHandle)connectionPoolAlloc(readerSock, &addr)->handle, false);
+    lobbyInsert((ConnectionHandle)connectionPoolAlloc(otherSock, &addr)->handle, false);
+    drainWakeupSocket(&shard->wakeup);
+    takeLobbyMail(shard, &unusedRange, false);
+
+    //send the NEW_ID_MSGTYPEs
+    flushLobbyConnections(shard);
+
+    s_readerID = shard->connections[0]->uniqueID;
+    return shard->connections[1]->uniqueID;
+}
+
+bool lobbyFramingDrain(void)
+{
+    LobbyShard* shard = s_lobbyShards;
+    Connection* reader = lookupLobbyConnection(shard, s_readerID);
+    if( ! reader )
+        return false;
+
+    //the same steps as one lobby loop iteration where only the reader's socket was ready
+    while(g_mockSocket.pos < g_mockSocket.dataSize)
+    {
+        size_t lobbyConnectionRange = shard->numOfConnections;
+        if(onPollReady(shard, reader, &lobbyConnectionRange))
+            return false;
+
+        flushLobbyConnections(shard);
+    }
+
+    return true;
+}
@@ -0,0 +1,835 @@
+//A headless load generator that plays chess against the server over the real wire protocol (chessNetworkProtocol.h).
+//It opens numOfClients connections and splits them into fixed couples. Each couple:
+//-waits for both NEW_ID_MSGTYPEs, then pairs up with PAIR_REQUEST_MSGTYPE / PAIR_ACCEPT_MSGTYPE
+//-plays movesPerGame knight shuffle moves (always legal), then agrees to a draw and a rematch
+//-plays the rematch, then either resigns and declines the next rematch, or unpairs (every other match)
+//-goes back to the lobby and does it all again until the time is up
+//A few games (disconnectPercent) end with one of the players just closing their socket and reconnecting.
+//Both clients of a couple live on the same thread, so the move relay latency is measured with one clock.
+//When the server is on a loopback address every client connects from its own 127.1.x.y address, the way players
+//on different hosts would, so the server's per IP limits (see admissionControl.h) only see each client's own connections.
+//
+//floodThreads threads connect and close again as fast as they can from 127.0.0.2 (a single misbehaving host),
+//to see how the real clients' connect latency holds up while the server turns the flood away.
+//
+//With matchmaking set to 1 the couples are only used for the client addresses: every client in the lobby sends a FIND_GAME_MSGTYPE
+//with its own made up rating and plays whoever the server pairs it with, on whichever thread that client is.
+//The move relay latency is not measured then (the opponent's send time is on another client), the FIND_GAME to PAIRING_COMPLETE time is.
+//
+//usage: loadGenerator [numOfClients] [seconds] [movesPerGame] [disconnectPercent] [host] [port] [floodThreads] [matchmaking]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <process.h>
+
+#include "chessNetworkProtocol.h"
+#include "metrics.h"
+
+#define NUM_OF_THREADS 4
+#define MAX_FLOOD_THREADS 16
+#define THREAD_STACKSIZE 64000
+
+//how many clients of one thread can be between connect() and their first NEW_ID_MSGTYPE at once.
+//keeps the ramp up from just filling the lobby and getting SERVER_FULL_MSGTYPE back
+#define MAX_PENDING_CONNECTS_PER_THREAD 8
+
+//how long to wait before connecting again after SERVER_FULL_MSGTYPE or a failed connect()
+#define RECONNECT_BACKOFF_NS 50000000ull
+
+//how long to wait before trying to pair again after every game worker was full
+#define PAIR_RETRY_NS 10000000ull
+
+typedef enum
+{
+    CLIENT_IDLE,//not connected. connects again at reconnectAtNs
+    CLIENT_CONNECTING,//waiting on a non blocking connect()
+    CLIENT_WAITING_FOR_ID,//connected, waiting on the first NEW_ID_MSGTYPE
+    CLIENT_IN_LOBBY,
+    CLIENT_PAIRING,//sent or got a PAIR_REQUEST_MSGTYPE, or sent a FIND_GAME_MSGTYPE
+    CLIENT_IN_GAME,
+    CLIENT_LEAVING_GAME//the game is over, waiting on the NEW_ID_MSGTYPE of the lobby
+}ClientState;
+
+typedef struct Client
+{
+    SOCKET sock;
+    ClientState state;
+    uint32_t id;
+    struct Client* partner;
+
+    //the requester sends the PAIR_REQUEST_MSGTYPE and measures the pairing latency
+    bool isRequester;
+
+    Side side;
+    int ply;//half moves played in this game
+    int gameInMatch;//0 for the first game after pairing, 1 for the rematch
+    int numOfMatches;
+    int disconnectAtPly;//-1 if this client is not going to disconnect in this game
+
+    uint64_t connectStartNs;
+    uint64_t pairRequestNs;//when the PAIR_REQUEST_MSGTYPE (or FIND_GAME_MSGTYPE) was sent
+    uint64_t lastMoveSentNs;
+    uint64_t retryAtNs;//when to reconnect (CLIENT_IDLE) or to pair again (CLIENT_IN_LOBBY)
+
+    char recvBuff[256];
+    size_t recvSize;
+
+    bool hasConnectedBefore;
+
+    //sent with FIND_GAME_MSGTYPE
+    uint16_t rating;
+
+    //the loopback address this client connects from, or INADDR_ANY if the server is not on a loopback address
+    IN_ADDR sourceAddr;
+
+}Client;
+
+typedef struct
+{
+    uint64_t connectHistogram[METRIC_HISTOGRAM_BUCKETS];//connect() to NEW_ID_MSGTYPE
+    uint64_t pairingHistogram[METRIC_HISTOGRAM_BUCKETS];//PAIR_REQUEST_MSGTYPE to PAIRING_COMPLETE_MSGTYPE
+    uint64_t relayHistogram[METRIC_HISTOGRAM_BUCKETS];//one client sending a MOVE_MSGTYPE to the other receiving it
+    uint64_t matchmakingHistogram[METRIC_HISTOGRAM_BUCKETS];//FIND_GAME_MSGTYPE to PAIRING_COMPLETE_MSGTYPE
+
+    uint64_t connectAttempts, connectFailures, serverFullRejects, connectionsLost;
+    uint64_t gamesStarted, gameWorkersFull, draws, rematches, resigns, unpairs;
+    uint64_t randomDisconnects, opponentsClosed, idNotInLobby, unexpectedMessages;
+    uint64_t pairNoResponses, pairRequestsTooSoon;
+
+}LoadStats;
+
+typedef struct
+{
+    Client* clients;
+    size_t numOfClients;
+    WSAPOLLFD* pollFds;
+    Client** polledClients;//polledClients[i] is the client of pollFds[i]
+    uint64_t rngState;
+    LoadStats stats;
+}LoadThread;
+
+static SOCKADDR_IN s_serverAddr;
+static int s_movesPerGame = 40;
+static int s_disconnectPercent = 5;
+static size_t s_numOfClients = 1000;
+static bool s_useMatchmaking = false;
+
+//the flood threads count the connections they got through connect()
+static volatile LONG64 s_floodConnects = 0;
+#define FLOOD_SOURCE_ADDR "127.0.0.2"
+
+static volatile LONG s_shouldStop = 0;
+static volatile LONG s_numOfThreadsDone = 0;
+
+//for the ramp up time. the clients that have gotten their first NEW_ID_MSGTYPE
+static volatile LONG s_numOfClientsConnected = 0;
+static volatile LONG64 s_allConnectedNs = 0;
+
+static double s_nsPerTick = 0.0;
+
+static uint64_t nowNs(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart * s_nsPerTick);
+}
+
+//xorshift64*
+static uint32_t nextRandom(LoadThread* thread)
+{
+    thread->rngState ^= thread->rngState >> 12;
+    thread->rngState ^= thread->rngState << 25;
+    thread->rngState ^= thread->rngState >> 27;
+    return (uint32_t)((thread->rngState * 2685821657736338717ull) >> 32);
+}
+
+static void record(uint64_t* histogram, uint64_t ns)
+{
+    ++histogram[metricBucketIndex(ns)];
+}
+
+static void closeClient(Client* client, uint64_t retryAtNs)
+{
+    if(client->sock != INVALID_SOCKET)
+        closesocket(client->sock);
+
+    client->sock = INVALID_SOCKET;
+    client->state = CLIENT_IDLE;
+    client->recvSize = 0;
+    client->retryAtNs = retryAtNs;
+}
+
+static bool sendMsg(LoadThread* thread, Client* client, char const* msg, int msgSize)
+{
+    //the messages are tiny and the socket buffer is almost always empty, so a short send is treated as a lost connection
+    if(send(client->sock, msg, msgSize, 0) != msgSize)
+    {
+        ++thread->stats.connectionsLost;
+        closeClient(client, nowNs() + RECONNECT_BACKOFF_NS);
+        return false;
+    }
+
+    return true;
+}
+
+static void sendHeaderOnly(LoadThread* thread, Client* client, MessageType type, MessageSize size)
+{
+    char msg[2] = {(char)type, (char)size};
+    sendMsg(thread, client, msg, sizeof(msg));
+}
+
+static void sendWithID(LoadThread* thread, Client* client, MessageType type, MessageSize size, uint32_t id)
+{
+    char msg[6] = {(char)type, (char)size};
+    uint32_t const nwByteOrderID = htonl(id);
+    memcpy(msg + 2, &nwByteOrderID, sizeof(nwByteOrderID));
+    sendMsg(thread, client, msg, sizeof(msg));
+}
+
+//white shuffles the g1 knight to f3 and back, and black shuffles the b8 knight to c6 and back
+static void sendNextMove(LoadThread* thread, Client* client)
+{
+    bool const isOut = (client->ply / 2) % 2 == 0;
+    char msg[MOVE_MSGSIZE] = {MOVE_MSGTYPE, MOVE_MSGSIZE};
+    if(client->side == WHITE)
+    {
+        msg[2] = isOut ? 6 : 5; msg[3] = isOut ? 0 : 2;
+        msg[4] = isOut ? 5 : 6; msg[5] = isOut ? 2 : 0;
+    }
+    else
+    {
+        msg[2] = isOut ? 1 : 2; msg[3] = isOut ? 7 : 5;
+        msg[4] = isOut ? 2 : 1; msg[5] = isOut ? 5 : 7;
+    }
+
+    client->lastMoveSentNs = nowNs();
+    ++client->ply;
+    sendMsg(thread, client, msg, sizeof(msg));
+}
+
+static void startGame(LoadThread* thread, Client* client)
+{
+    client->state = CLIENT_IN_GAME;
+    client->ply = 0;
+    client->disconnectAtPly = -1;
+
+    //the requester (or white, when the opponent is whoever the server picked) decides for both players if this game ends with someone pulling the plug
+    bool const decidesDisconnect = s_useMatchmaking ? client->side == WHITE : client->isRequester;
+    if(decidesDisconnect && (int)(nextRandom(thread) % 100) < s_disconnectPercent)
+        client->disconnectAtPly = 1 + (int)(nextRandom(thread) % (uint32_t)s_movesPerGame);
+
+    if(client->side == WHITE)
+        sendNextMove(thread, client);
+}
+
+//called on the client that received the last move of the game
+static void endGame(LoadThread* thread, Client* client)
+{
+    if(client->gameInMatch == 0)
+    {
+        sendHeaderOnly(thread, client, DRAW_OFFER_MSGTYPE, DRAW_OFFER_MSGSIZE);
+    }
+    else if(client->numOfMatches % 2)
+    {
+        ++thread->stats.unpairs;
+        client->state = CLIENT_LEAVING_GAME;
+        sendHeaderOnly(thread, client, UNPAIR_MSGTYPE, UNPAIR_MSGSIZE);
+    }
+    else
+    {
+        ++thread->stats.resigns;
+        sendHeaderOnly(thread, client, RESIGN_MSGTYPE, RESIGN_MSGSIZE);
+    }
+}
+
+static void startRematch(LoadThread* thread, Client* client)
+{
+    client->gameInMatch = 1;
+    client->side = (client->side == WHITE) ? BLACK : WHITE;
+    startGame(thread, client);
+}
+
+static void tryToPair(LoadThread* thread, Client* requester, uint64_t now)
+{
+    Client* partner = requester->partner;
+    if(requester->state != CLIENT_IN_LOBBY || partner->state != CLIENT_IN_LOBBY || now < requester->retryAtNs)
+        return;
+
+    requester->state = CLIENT_PAIRING;
+    requester->pairRequestNs = now;
+    sendWithID(thread, requester, PAIR_REQUEST_MSGTYPE, PAIR_REQUEST_MSGSIZE, partner->id);
+}
+
+static void tryToFindGame(LoadThread* thread, Client* client, uint64_t now)
+{
+    if(client->state != CLIENT_IN_LOBBY || now < client->retryAtNs)
+        return;
+
+    client->state = CLIENT_PAIRING;
+    client->pairRequestNs = now;
+
+    char msg[FIND_GAME_MSGSIZE] = {FIND_GAME_MSGTYPE, FIND_GAME_MSGSIZE};
+    uint16_t const nwByteOrderRating = htons(client->rating);
+    memcpy(msg + 2, &nwByteOrderRating, sizeof(nwByteOrderRating));
+    sendMsg(thread, client, msg, sizeof(msg));
+}
+
+static void onMessage(LoadThread* thread, Client* client, char const* msg)
+{
+    LoadStats* stats = &thread->stats;
+    uint64_t const now = nowNs();
+
+    switch(msg[0])
+    {
+    case NEW_ID_MSGTYPE:
+    {
+        uint32_t nwByteOrderID = 0;
+        memcpy(&nwByteOrderID, msg + 2, sizeof(nwByteOrderID));
+        client->id = ntohl(nwByteOrderID);
+
+        if(client->state == CLIENT_WAITING_FOR_ID)
+        {
+            record(stats->connectHistogram, now - client->connectStartNs);
+            if( ! client->hasConnectedBefore && InterlockedIncrement(&s_numOfClientsConnected) == (LONG)s_numOfClients )
+                s_allConnectedNs = (LONG64)now;
+            client->hasConnectedBefore = true;
+        }
+
+        client->state = CLIENT_IN_LOBBY;
+        client->retryAtNs = 0;
+        break;
+    }
+    case SERVER_FULL_MSGTYPE:
+    {
+        if(client->state == CLIENT_WAITING_FOR_ID)
+        {
+            //the lobby was full. the server closes the connection
+            ++stats->serverFullRejects;
+            closeClient(client, now + RECONNECT_BACKOFF_NS);
+        }
+        else
+        {
+            //every game worker was full. both players stay in the lobby
+            ++stats->gameWorkersFull;
+            client->state = CLIENT_IN_LOBBY;
+            client->retryAtNs = now + PAIR_RETRY_NS;
+        }
+        break;
+    }
+    case PAIR_REQUEST_MSGTYPE:
+    {
+        uint32_t nwByteOrderID = 0;
+        memcpy(&nwByteOrderID, msg + 2, sizeof(nwByteOrderID));
+        client->state = CLIENT_PAIRING;
+        sendWithID(thread, client, PAIR_ACCEPT_MSGTYPE, PAIR_ACCEPT_MSGSIZE, ntohl(nwByteOrderID));
+        break;
+    }
+    case ID_NOT_IN_LOBBY_MSGTYPE:
+    {
+        ++stats->idNotInLobby;
+        client->state = CLIENT_IN_LOBBY;
+        client->retryAtNs = now + PAIR_RETRY_NS;
+        break;
+    }
+    case PAIR_NORESPONSE_MSGTYPE:
+    case PAIR_REQUEST_TOO_SOON_MSGTYPE:
+    {
+        //the partner never answered (they always do, so something got lost), or a request was sent while one was outstanding
+        if(msg[0] == PAIR_NORESPONSE_MSGTYPE)
+            ++stats->pairNoResponses;
+        else
+            ++stats->pairRequestsTooSoon;
+
+        client->state = CLIENT_IN_LOBBY;
+        client->retryAtNs = now + PAIR_RETRY_NS;
+        break;
+    }
+    case PAIRING_COMPLETE_MSGTYPE:
+    {
+        if(s_useMatchmaking)
+        {
+            record(stats->matchmakingHistogram, now - client->pairRequestNs);
+            if(msg[2] == WHITE) ++stats->gamesStarted;
+        }
+        else if(client->isRequester)
+        {
+            record(stats->pairingHistogram, now - client->pairRequestNs);
+            ++stats->gamesStarted;
+        }
+
+        client->side = (Side)msg[2];
+        client->gameInMatch = 0;
+        ++client->numOfMatches;
+        startGame(thread, client);
+        break;
+    }
+    case MOVE_MSGTYPE:
+    {
+        if( ! s_useMatchmaking )
+            record(stats->relayHistogram, now - client->partner->lastMoveSentNs);
+        ++client->ply;
+
+        if(client->ply == client->disconnectAtPly)
+        {
+            ++stats->randomDisconnects;
+            closeClient(client, now);
+        }
+        else if(client->ply >= s_movesPerGame)
+        {
+            endGame(thread, client);
+        }
+        else
+        {
+            sendNextMove(thread, client);
+        }
+        break;
+    }
+    case DRAW_OFFER_MSGTYPE:
+    {
+        sendHeaderOnly(thread, client, DRAW_ACCEPT_MSGTYPE, DRAW_ACCEPT_MSGSIZE);
+        break;
+    }
+    case DRAW_ACCEPT_MSGTYPE:
+    {
+        ++stats->draws;
+        sendHeaderOnly(thread, client, REMATCH_REQUEST_MSGTYPE, REMATCH_REQUEST_MSGSIZE);
+        break;
+    }
+    case RESIGN_MSGTYPE:
+    {
+        sendHeaderOnly(thread, client, REMATCH_REQUEST_MSGTYPE, REMATCH_REQUEST_MSGSIZE);
+        break;
+    }
+    case REMATCH_REQUEST_MSGTYPE:
+    {
+        if(client->gameInMatch == 0)
+        {
+            ++stats->rematches;
+            sendHeaderOnly(thread, client, REMATCH_ACCEPT_MSGTYPE, REMATCH_ACCEPT_MSGSIZE);
+            if(client->state == CLIENT_IN_GAME) startRematch(thread, client);
+        }
+        else
+        {
+            //the server ends the game and puts both players back in the lobby
+            client->state = CLIENT_LEAVING_GAME;
+            sendHeaderOnly(thread, client, REMATCH_DECLINE_MSGTYPE, REMATCH_DECLINE_MSGSIZE);
+        }
+        break;
+    }
+    case REMATCH_ACCEPT_MSGTYPE: {startRematch(thread, client); break;}
+    case REMATCH_DECLINE_MSGTYPE: {client->state = CLIENT_LEAVING_GAME; break;}
+    case UNPAIR_MSGTYPE: {client->state = CLIENT_LEAVING_GAME; break;}
+    case OPPONENT_CLOSED_CONNECTION_MSGTYPE:
+    {
+        ++stats->opponentsClosed;
+        client->state = CLIENT_LEAVING_GAME;
+        break;
+    }
+    case OPPONENT_RECONNECTING_MSGTYPE:
+    {
+        //the clients here never resume, so dont wait out the grace period for a partner who disconnected at random
+        ++stats->opponentsClosed;
+        client->state = CLIENT_LEAVING_GAME;
+        sendHeaderOnly(thread, client, UNPAIR_MSGTYPE, UNPAIR_MSGSIZE);
+        break;
+    }
+    case RESUME_TOKEN_MSGTYPE: break;
+    case SPECTATE_ID_MSGTYPE: break;
+    default: ++stats->unexpectedMessages;
+    }
+}
+
+static void onReadable(LoadThread* thread, Client* client)
+{
+    int const numBytesReceived = recv(client->sock, client->recvBuff + client->recvSize,
+        (int)(sizeof(client->recvBuff) - client->recvSize), 0);
+
+    if(numBytesReceived <= 0)
+    {
+        if(numBytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+            return;
+
+        //the server closes the connection after a SERVER_FULL_MSGTYPE, which is already counted
+        if(client->state != CLIENT_IDLE) ++thread->stats.connectionsLost;
+        closeClient(client, nowNs() + RECONNECT_BACKOFF_NS);
+        return;
+    }
+
+    client->recvSize += numBytesReceived;
+
+    //handle every whole message in the buffer
+    size_t consumed = 0;
+    while(client->recvSize - consumed >= 2)
+    {
+        size_t const msgSize = (uint8_t)client->recvBuff[consumed + 1];
+        if(msgSize < 2)
+        {
+            ++thread->stats.unexpectedMessages;
+            closeClient(client, nowNs() + RECONNECT_BACKOFF_NS);
+            return;
+        }
+
+        if(client->recvSize - consumed < msgSize)
+            break;
+
+        onMessage(thread, client, client->recvBuff + consumed);
+        if(client->state == CLIENT_IDLE)
+            return;//the message closed the connection
+
+        consumed += msgSize;
+    }
+
+    memmove(client->recvBuff, client->recvBuff + consumed, client->recvSize - consumed);
+    client->recvSize -= consumed;
+}
+
+static void startConnect(LoadThread* thread, Client* client, uint64_t now)
+{
+    ++thread->stats.connectAttempts;
+    client->connectStartNs = now;
+
+    client->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    unsigned long nonBlocking = 1;
+    BOOL const noDelay = TRUE;
+    if(client->sock == INVALID_SOCKET || ioctlsocket(client->sock, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+    {
+        ++thread->stats.connectFailures;
+        closeClient(client, now + RECONNECT_BACKOFF_NS);
+        return;
+    }
+
+    setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof(noDelay));
+
+    SOCKADDR_IN sourceAddr;
+    memset(&sourceAddr, 0, sizeof(sourceAddr));
+    sourceAddr.sin_family = AF_INET;
+    sourceAddr.sin_addr = client->sourceAddr;
+    if(client->sourceAddr.s_addr != htonl(INADDR_ANY) && bind(client->sock, (SOCKADDR*)&sourceAddr, sizeof(sourceAddr)) == SOCKET_ERROR)
+    {
+        ++thread->stats.connectFailures;
+        closeClient(client, now + RECONNECT_BACKOFF_NS);
+        return;
+    }
+
+    if(connect(client->sock, (SOCKADDR*)&s_serverAddr, sizeof(s_serverAddr)) == SOCKET_ERROR &&
+       WSAGetLastError() != WSAEWOULDBLOCK)
+    {
+        ++thread->stats.connectFailures;
+        closeClient(client, now + RECONNECT_BACKOFF_NS);
+        return;
+    }
+
+    client->state = CLIENT_CONNECTING;
+}
+
+static void onConnectDone(LoadThread* thread, Client* client)
+{
+    int err = 0;
+    int errLen = sizeof(err);
+    if(getsockopt(client->sock, SOL_SOCKET, SO_ERROR, (char*)&err, &errLen) == SOCKET_ERROR || err)
+    {
+        ++thread->stats.connectFailures;
+        closeClient(client, nowNs() + RECONNECT_BACKOFF_NS);
+        return;
+    }
+
+    client->state = CLIENT_WAITING_FOR_ID;
+}
+
+static void __stdcall loadThreadStart(void* arg)
+{
+    LoadThread* thread = arg;
+
+    while( ! s_shouldStop )
+    {
+        uint64_t const now = nowNs();
+
+        //start connecting the clients that are due, without too many connects in flight at once
+        size_t numOfPendingConnects = 0;
+        for(size_t i = 0; i < thread->numOfClients; ++i)
+        {
+            ClientState const state = thread->clients[i].state;
+            numOfPendingConnects += (state == CLIENT_CONNECTING || state == CLIENT_WAITING_FOR_ID);
+        }
+
+        size_t numOfPolled = 0;
+        for(size_t i = 0; i < thread->numOfClients; ++i)
+        {
+            Client* client = thread->clients + i;
+            if(client->state == CLIENT_IDLE && now >= client->retryAtNs && numOfPendingConnects < MAX_PENDING_CONNECTS_PER_THREAD)
+            {
+                startConnect(thread, client, now);
+                numOfPendingConnects += (client->state == CLIENT_CONNECTING);
+            }
+
+            if(s_useMatchmaking)
+                tryToFindGame(thread, client, now);
+            else if(client->isRequester)
+                tryToPair(thread, client, now);
+
+            if(client->state == CLIENT_IDLE)
+                continue;
+
+            WSAPOLLFD* pollFd = thread->pollFds + numOfPolled;
+            pollFd->fd = client->sock;
+            pollFd->events = (client->state == CLIENT_CONNECTING) ? POLLWRNORM : POLLRDNORM;
+            pollFd->revents = 0;
+            thread->polledClients[numOfPolled++] = client;
+        }
+
+        if(numOfPolled == 0)
+        {
+            Sleep(1);
+            continue;
+        }
+
+        //wake up now and then to start connects and pairings that are due
+        if(WSAPoll(thread->pollFds, (ULONG)numOfPolled, 1) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "WSAPoll() failed with %d\n", WSAGetLastError());
+            break;
+        }
+
+        for(size_t i = 0; i < numOfPolled; ++i)
+        {
+            Client* client = thread->polledClients[i];
+            short const revents = thread->pollFds[i].revents;
+            if( ! revents || client->state == CLIENT_IDLE )
+                continue;//nothing happened, or the client was closed by its partner's message
+
+            if(client->state == CLIENT_CONNECTING)
+                onConnectDone(thread, client);
+            else
+                onReadable(thread, client);
+        }
+    }
+
+    for(size_t i = 0; i < thread->numOfClients; ++i)
+        closeClient(thread->clients + i, 0);
+
+    InterlockedIncrement(&s_numOfThreadsDone);
+}
+
+//connect from FLOOD_SOURCE_ADDR and close right away, over and over
+static void __stdcall floodThreadStart(void* arg)
+{
+    SOCKADDR_IN sourceAddr;
+    memset(&sourceAddr, 0, sizeof(sourceAddr));
+    sourceAddr.sin_family = AF_INET;
+    InetPtonA(AF_INET, FLOOD_SOURCE_ADDR, &sourceAddr.sin_addr);
+
+    while( ! s_shouldStop )
+    {
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if(sock == INVALID_SOCKET)
+            continue;
+
+        if(bind(sock, (SOCKADDR*)&sourceAddr, sizeof(sourceAddr)) != SOCKET_ERROR &&
+           connect(sock, (SOCKADDR*)&s_serverAddr, sizeof(s_serverAddr)) != SOCKET_ERROR)
+        {
+            InterlockedIncrement64(&s_floodConnects);
+        }
+
+        closesocket(sock);
+    }
+
+    InterlockedIncrement(&s_numOfThreadsDone);
+}
+
+static uint64_t histogramPercentile(uint64_t const* histogram, double percentile)
+{
+    uint64_t totalCount = 0;
+    for(uint32_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+        totalCount += histogram[i];
+
+    uint64_t const rank = (uint64_t)(totalCount * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += histogram[i];
+        if(seen >= rank && histogram[i])
+            return (i + 1 < METRIC_HISTOGRAM_BUCKETS) ? metricBucketLowestValue(i + 1) - 1 : UINT64_MAX;
+    }
+
+    return 0;
+}
+
+static void printHistogram(char const* name, uint64_t const* histogram)
+{
+    uint64_t count = 0;
+    for(uint32_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+        count += histogram[i];
+
+    printf("%-22s %10llu | p50 %9.1f us | p99 %9.1f us | p99.9 %9.1f us | max %9.1f us\n", name, (unsigned long long)count,
+        histogramPercentile(histogram, 50.0) / 1000.0, histogramPercentile(histogram, 99.0) / 1000.0,
+        histogramPercentile(histogram, 99.9) / 1000.0, histogramPercentile(histogram, 100.0) / 1000.0);
+}
+
+static void addStats(LoadStats* total, LoadStats const* stats)
+{
+    for(uint32_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+    {
+        total->connectHistogram[i] += stats->connectHistogram[i];
+        total->pairingHistogram[i] += stats->pairingHistogram[i];
+        total->relayHistogram[i] += stats->relayHistogram[i];
+        total->matchmakingHistogram[i] += stats->matchmakingHistogram[i];
+    }
+
+    uint64_t* totalCounters = &total->connectAttempts;
+    uint64_t const* counters = &stats->connectAttempts;
+    size_t const numOfCounters = (sizeof(LoadStats) - offsetof(LoadStats, connectAttempts)) / sizeof(uint64_t);
+    for(size_t i = 0; i < numOfCounters; ++i)
+        totalCounters[i] += counters[i];
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 10;
+    char const* host = "127.0.0.1";
+    uint16_t port = 42069;
+    int numOfFloodThreads = 0;
+
+    if(argc > 1) s_numOfClients = (size_t)strtoul(argv[1], NULL, 10);
+    if(argc > 2) seconds = atoi(argv[2]);
+    if(argc > 3) s_movesPerGame = atoi(argv[3]);
+    if(argc > 4) s_disconnectPercent = atoi(argv[4]);
+    if(argc > 5) host = argv[5];
+    if(argc > 6) port = (uint16_t)atoi(argv[6]);
+    if(argc > 7) numOfFloodThreads = atoi(argv[7]);
+    if(argc > 8) s_useMatchmaking = atoi(argv[8]) != 0;
+
+    //every couple lives on one thread
+    s_numOfClients -= s_numOfClients % (2 * NUM_OF_THREADS);
+    if(s_numOfClients == 0 || seconds <= 0 || s_movesPerGame < 1 || numOfFloodThreads < 0 || numOfFloodThreads > MAX_FLOOD_THREADS)
+    {
+        fprintf(stderr, "usage: loadGenerator [numOfClients (at least %d)] [seconds] [movesPerGame] [disconnectPercent] [host] [port] "
+            "[floodThreads (up to %d)] [matchmaking (0 or 1)]\n", 2 * NUM_OF_THREADS, MAX_FLOOD_THREADS);
+        return EXIT_FAILURE;
+    }
+
+    WSADATA wsaData;
+    if(WSAStartup(MAKEWORD(2,2), &wsaData))
+    {
+        fprintf(stderr, "WSAStartup() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    s_nsPerTick = 1e9 / (double)frequency.QuadPart;
+
+    memset(&s_serverAddr, 0, sizeof(s_serverAddr));
+    s_serverAddr.sin_family = AF_INET;
+    s_serverAddr.sin_port = htons(port);
+    if(InetPtonA(AF_INET, host, &s_serverAddr.sin_addr) != 1)
+    {
+        fprintf(stderr, "%s is not a valid ipv4 address\n", host);
+        return EXIT_FAILURE;
+    }
+
+    //127.0.0.0/8 is all loopback, so the clients can each have their own address
+    bool const isLoopbackServer = (ntohl(s_serverAddr.sin_addr.s_addr) >> 24) == 127;
+
+    printf("%zu clients, %d seconds, %d moves per game, %d%% of games end with a disconnect, server %s:%hu, %d flood threads, %s\n\n",
+        s_numOfClients, seconds, s_movesPerGame, s_disconnectPercent, host, port, numOfFloodThreads,
+        s_useMatchmaking ? "paired by matchmaking" : "paired by friend code");
+
+    static LoadThread threads[NUM_OF_THREADS];
+    size_t const clientsPerThread = s_numOfClients / NUM_OF_THREADS;
+    for(int t = 0; t < NUM_OF_THREADS; ++t)
+    {
+        LoadThread* thread = threads + t;
+        thread->numOfClients = clientsPerThread;
+        thread->clients = calloc(clientsPerThread, sizeof(Client));
+        thread->pollFds = calloc(clientsPerThread, sizeof(WSAPOLLFD));
+        thread->polledClients = calloc(clientsPerThread, sizeof(Client*));
+        thread->rngState = 0x9E3779B97F4A7C15ull * (t + 1);
+        if( ! thread->clients || ! thread->pollFds || ! thread->polledClients )
+        {
+            fprintf(stderr, "calloc failed\n");
+            return EXIT_FAILURE;
+        }
+
+        for(size_t i = 0; i < clientsPerThread; ++i)
+        {
+            Client* client = thread->clients + i;
+            client->sock = INVALID_SOCKET;
+            client->state = CLIENT_IDLE;
+            client->partner = thread->clients + (i ^ 1);
+            client->isRequester = (i % 2) == 0;
+
+            //800 to 2000, most of them around 1400
+            client->rating = (uint16_t)(800 + nextRandom(thread) % 601 + nextRandom(thread) % 601);
+
+            //127.1.0.1, 127.1.0.2 and so on
+            uint32_t const clientNumber = (uint32_t)(t * clientsPerThread + i + 1);
+            client->sourceAddr.s_addr = isLoopbackServer ? htonl((127u << 24) | (1u << 16) | clientNumber) : htonl(INADDR_ANY);
+        }
+    }
+
+    uint64_t const startNs = nowNs();
+    for(int t = 0; t < NUM_OF_THREADS; ++t)
+        _beginthread(loadThreadStart, THREAD_STACKSIZE, threads + t);
+
+    for(int t = 0; t < numOfFloodThreads; ++t)
+        _beginthread(floodThreadStart, THREAD_STACKSIZE, NULL);
+
+    Sleep((DWORD)seconds * 1000);
+    InterlockedExchange(&s_shouldStop, 1);
+    while(s_numOfThreadsDone < NUM_OF_THREADS + numOfFloodThreads)
+        Sleep(1);
+
+    double const elapsedSeconds = (nowNs() - startNs) / 1e9;
+
+    static LoadStats total;
+    for(int t = 0; t < NUM_OF_THREADS; ++t)
+        addStats(&total, &threads[t].stats);
+
+    if(s_allConnectedNs)
+    {
+        double const rampSeconds = (s_allConnectedNs - (LONG64)startNs) / 1e9;
+        printf("all %zu clients connected in %.3f s (%.0f connections/s)\n", s_numOfClients, rampSeconds, s_numOfClients / rampSeconds);
+    }
+    else
+    {
+        printf("only %ld of %zu clients ever got into the lobby\n", s_numOfClientsConnected, s_numOfClients);
+    }
+
+    printf("connect attempts %llu, failed %llu, rejected with SERVER_FULL %llu, connections lost %llu\n",
+        (unsigned long long)total.connectAttempts, (unsigned long long)total.connectFailures,
+        (unsigned long long)total.serverFullRejects, (unsigned long long)total.connectionsLost);
+    printf("games %llu (%.0f/s), every game worker full %llu, draws %llu, rematches %llu, resigns %llu, unpairs %llu\n",
+        (unsigned long long)total.gamesStarted, total.gamesStarted / elapsedSeconds, (unsigned long long)total.gameWorkersFull,
+        (unsigned long long)total.draws, (unsigned long long)total.rematches, (unsigned long long)total.resigns, (unsigned long long)total.unpairs);
+    printf("random disconnects %llu, opponent closed %llu, id not in lobby %llu, unexpected messages %llu\n",
+        (unsigned long long)total.randomDisconnects, (unsigned long long)total.opponentsClosed,
+        (unsigned long long)total.idNotInLobby, (unsigned long long)total.unexpectedMessages);
+    printf("pair requests with no response %llu, pair requests too soon %llu\n\n",
+        (unsigned long long)total.pairNoResponses, (unsigned long long)total.pairRequestsTooSoon);
+
+    if(numOfFloodThreads > 0)
+        printf("flood: %lld connects from %s (%.0f/s)\n\n", (long long)s_floodConnects, FLOOD_SOURCE_ADDR, s_floodConnects / elapsedSeconds);
+
+    uint64_t numOfMoves = 0;
+    for(uint32_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+        numOfMoves += total.relayHistogram[i];
+
+    if( ! s_useMatchmaking )
+        printf("%.0f moves relayed/s\n", numOfMoves / elapsedSeconds);
+    printHistogram("connect to NEW_ID", total.connectHistogram);
+    printHistogram("pairing", total.pairingHistogram);
+    printHistogram("matchmaking", total.matchmakingHistogram);
+    printHistogram("move relay", total.relayHistogram);
+
+    WSACleanup();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+//Correctness suite and benchmark for the server side move validation (chessRules.h).
+//
+//perft(n) is the number of move sequences n plies deep from a position. The counts of the standard test positions
+//below are known, so if the move generator gets any rule wrong (castling through check, en passant pins, promotions...)
+//some count comes out different. Every position is also checked against chessPlayMoveMessage(), the function the game
+//workers actually call: at every node down to VALIDATION_DEPTH the MOVE_MSGTYPE of every legal move has to be accepted,
+//and every other from/to/promotion a client could send has to be rejected.
+//
+//Then it times chessPlayMoveMessage() on the moves of random games, which is the cost per MOVE_MSGTYPE
+//when CHESS_SERVER_VALIDATE_MOVES is on.
+//
+//perft.exe [maxDepth]   (the deepest counts take a while in a debug build, so maxDepth defaults to 5)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "chessRules.h"
+
+#define MAX_PERFT_DEPTH 5
+#define VALIDATION_DEPTH 2
+#define NUM_OF_RANDOM_GAMES 20000
+#define MAX_GAME_PLIES 200
+
+typedef struct
+{
+    char const* name;
+    char const* fen;
+    uint64_t counts[MAX_PERFT_DEPTH];//0 where the count is too slow to run
+}PerftPosition;
+
+//https://www.chessprogramming.org/Perft_Results
+static PerftPosition const s_positions[] =
+{
+    {"start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", {20, 400, 8902, 197281, 4865609}},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", {48, 2039, 97862, 4085603, 0}},
+    {"position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", {14, 191, 2812, 43238, 674624}},
+    {"position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", {6, 264, 9467, 422333, 0}},
+    {"position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", {44, 1486, 62379, 2103487, 0}},
+    {"position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", {46, 2079, 89890, 3894594, 0}},
+};
+
+static uint64_t s_rngState = 0x9E3779B97F4A7C15ull;
+
+//xorshift64*
+static uint32_t nextRandom(void)
+{
+    s_rngState ^= s_rngState >> 12;
+    s_rngState ^= s_rngState << 25;
+    s_rngState ^= s_rngState >> 27;
+    return (uint32_t)((s_rngState * 2685821657736338717ull) >> 32);
+}
+
+static double nsPerTick(void)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return 1e9 / (double)freq.QuadPart;
+}
+
+static uint64_t now(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)t.QuadPart;
+}
+
+static uint64_t perft(ChessPosition const* position, unsigned depth)
+{
+    ChessMove moves[CHESS_MAX_MOVES];
+    size_t const numOfMoves = chessGenerateMoves(position, moves);
+    if(depth == 1)
+        return numOfMoves;
+
+    uint64_t nodes = 0;
+    for(size_t i = 0; i < numOfMoves; ++i)
+    {
+        ChessPosition after = *position;
+        chessMakeMove(&after, moves[i]);
+        nodes += perft(&after, depth - 1);
+    }
+
+    return nodes;
+}
+
+static Side sideToMove(ChessPosition const* position)
+{
+    return position->sideToMove == CHESS_WHITE ? WHITE : BLACK;
+}
+
+//field by field, since the padding of ChessPosition is not always copied
+static bool arePositionsEqual(ChessPosition const* a, ChessPosition const* b)
+{
+    return memcmp(a->byType, b->byType, sizeof(a->byType)) == 0 && memcmp(a->byColor, b->byColor, sizeof(a->byColor)) == 0 &&
+           memcmp(a->squares, b->squares, sizeof(a->squares)) == 0 && a->sideToMove == b->sideToMove &&
+           a->castleRights == b->castleRights && a->epSquare == b->epSquare;
+}
+
+static bool isInMoveList(ChessMove const* moves, size_t numOfMoves, ChessMove move)
+{
+    for(size_t i = 0; i < numOfMoves; ++i)
+        if(moves[i].from == move.from && moves[i].to == move.to && moves[i].promotion == move.promotion)
+            return true;
+
+    return false;
+}
+
+//Check chessPlayMoveMessage() against chessGenerateMoves() in position: every legal move is accepted (and leaves the same position
+//as chessMakeMove()), a move with a wrong byte is not, and no move outside the list is accepted no matter what the other bytes say.
+static bool validatePosition(ChessPosition const* position)
+{
+    static ChessPieceType const promotions[] = {CHESS_PAWN, CHESS_QUEEN, CHESS_ROOK, CHESS_KNIGHT, CHESS_BISHOP};//indexed by ChessPromoType
+    ChessMove moves[CHESS_MAX_MOVES];
+    size_t const numOfMoves = chessGenerateMoves(position, moves);
+    Side const side = sideToMove(position);
+    char msg[MOVE_MSGSIZE];
+
+    for(size_t i = 0; i < numOfMoves; ++i)
+    {
+        ChessPosition made = *position, played = *position;
+        chessMakeMove(&made, moves[i]);
+        chessMoveToMessage(position, moves[i], msg);
+
+        if(chessPlayMoveMessage(&played, side, msg) != CHESS_MOVE_OK || ! arePositionsEqual(&made, &played))
+            return false;
+
+        //the wrong player, a flipped capture flag or wrong castling rights
+        ChessPosition unchanged = *position;
+        if(chessPlayMoveMessage(&unchanged, side == WHITE ? BLACK : WHITE, msg) != CHESS_MOVE_NOT_YOUR_TURN)
+            return false;
+
+        msg[9] = ! msg[9];
+        if(chessPlayMoveMessage(&unchanged, side, msg) != CHESS_MOVE_BAD_CAPTURE_FLAG)
+            return false;
+
+        msg[9] = ! msg[9];
+        msg[8] ^= CHESS_CASTLE_BLACK_LONG;
+        if(chessPlayMoveMessage(&unchanged, side, msg) != CHESS_MOVE_BAD_CASTLE_RIGHTS)
+            return false;
+
+        if( ! arePositionsEqual(&unchanged, position) )
+            return false;
+    }
+
+    //everything else: any from, any to, and any promotion, with the capture flag and castling rights bytes a client would send
+    for(int from = 0; from < 64; ++from)
+    {
+        if(position->squares[from] == CHESS_EMPTY_SQUARE || (position->squares[from] >> 3) != position->sideToMove)
+            continue;
+
+        for(int to = 0; to < 64; ++to)
+        {
+            for(size_t p = 0; p < sizeof(promotions) / sizeof(promotions[0]); ++p)
+            {
+                ChessMove const move = {(uint8_t)from, (uint8_t)to, (uint8_t)promotions[p]};
+                if(isInMoveList(moves, numOfMoves, move))
+                    continue;
+
+                for(int captureFlag = 0; captureFlag < 2; ++captureFlag)
+                {
+                    ChessPosition unchanged = *position;
+                    memset(msg, 0, sizeof(msg));
+                    msg[0] = MOVE_MSGTYPE;
+                    msg[1] = MOVE_MSGSIZE;
+                    msg[2] = (char)(from & 7);
+                    msg[3] = (char)(from >> 3);
+                    msg[4] = (char)(to & 7);
+                    msg[5] = (char)(to >> 3);
+                    msg[6] = (char)p;//the ChessPromoType, in the same order as promotions
+                    msg[9] = (char)captureFlag;
+
+                    if(chessPlayMoveMessage(&unchanged, side, msg) == CHESS_MOVE_OK)
+                        return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool validateTree(ChessPosition const* position, unsigned depth)
+{
+    if( ! validatePosition(position) )
+        return false;
+
+    if(depth == 0)
+        return true;
+
+    ChessMove moves[CHESS_MAX_MOVES];
+    size_t const numOfMoves = chessGenerateMoves(position, moves);
+    for(size_t i = 0; i < numOfMoves; ++i)
+    {
+        ChessPosition after = *position;
+        chessMakeMove(&after, moves[i]);
+        if( ! validateTree(&after, depth - 1) )
+            return false;
+    }
+
+    return true;
+}
+
+//Record the messages of NUM_OF_RANDOM_GAMES random games, then time replaying all of them with chessPlayMoveMessage().
+//returns false if a move that was legal when recorded is rejected when replayed
+static bool benchmarkValidation(void)
+{
+    char (*msgs)[MOVE_MSGSIZE] = malloc((size_t)NUM_OF_RANDOM_GAMES * MAX_GAME_PLIES * MOVE_MSGSIZE);
+    uint16_t* gameLengths = malloc(NUM_OF_RANDOM_GAMES * sizeof(uint16_t));
+    if( ! msgs || ! gameLengths ) exit(EXIT_FAILURE);
+
+    size_t numOfMsgs = 0;
+    for(size_t game = 0; game < NUM_OF_RANDOM_GAMES; ++game)
+    {
+        ChessPosition position;
+        ChessMove moves[CHESS_MAX_MOVES];
+        chessPositionInit(&position);
+
+        uint16_t plies = 0;
+        for(; plies < MAX_GAME_PLIES; ++plies)
+        {
+            size_t const numOfMoves = chessGenerateMoves(&position, moves);
+            if(numOfMoves == 0)
+                break;
+
+            ChessMove const move = moves[nextRandom() % numOfMoves];
+            chessMoveToMessage(&position, move, msgs[numOfMsgs++]);
+            chessMakeMove(&position, move);
+        }
+
+        gameLengths[game] = plies;
+    }
+
+    bool allAccepted = true;
+    char const* msg = msgs[0];
+    uint64_t const start = now();
+    for(size_t game = 0; game < NUM_OF_RANDOM_GAMES; ++game)
+    {
+        ChessPosition position;
+        chessPositionInit(&position);
+        for(uint16_t ply = 0; ply < gameLengths[game]; ++ply, msg += MOVE_MSGSIZE)
+            allAccepted &= chessPlayMoveMessage(&position, sideToMove(&position), msg) == CHESS_MOVE_OK;
+    }
+    uint64_t const end = now();
+
+    printf("\nvalidated %zu moves of %d random games: %.1f ns/move\n", numOfMsgs, NUM_OF_RANDOM_GAMES,
+        (double)(end - start) * nsPerTick() / (double)numOfMsgs);
+
+    free(gameLengths);
+    free(msgs);
+    return allAccepted;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned maxDepth = (argc > 1) ? (unsigned)atoi(argv[1]) : MAX_PERFT_DEPTH;
+    if(maxDepth < 1 || maxDepth > MAX_PERFT_DEPTH)
+        maxDepth = MAX_PERFT_DEPTH;
+
+    uint64_t const initStart = now();
+    chessRulesInit();
+    printf("chessRulesInit: %.2f ms\n\n", (double)(now() - initStart) * nsPerTick() / 1e6);
+
+    bool passed = true;
+    uint64_t totalNodes = 0, totalTicks = 0;
+
+    printf("%-12s | %5s | %12s | %12s | %s\n", "position", "depth", "nodes", "Mnodes/s", "result");
+    for(size_t i = 0; i < sizeof(s_positions) / sizeof(s_positions[0]); ++i)
+    {
+        PerftPosition const* test = s_positions + i;
+        ChessPosition position;
+        if( ! chessPositionFromFen(&position, test->fen) )
+        {
+            printf("%-12s | bad fen\n", test->name);
+            passed = false;
+            continue;
+        }
+
+        for(unsigned depth = 1; depth <= maxDepth && test->counts[depth - 1]; ++depth)
+        {
+            uint64_t const start = now();
+            uint64_t const nodes = perft(&position, depth);
+            uint64_t const ticks = now() - start;
+            bool const isRight = nodes == test->counts[depth - 1];
+
+            totalNodes += nodes;
+            totalTicks += ticks;
+            passed &= isRight;
+
+            printf("%-12s | %5u | %12llu | %12.2f | %s\n", test->name, depth, (unsigned long long)nodes,
+                (double)nodes * 1000.0 / ((double)ticks * nsPerTick() + 1.0), isRight ? "ok" : "FAIL");
+        }
+
+        bool const isValid = validateTree(&position, VALIDATION_DEPTH);
+        passed &= isValid;
+        printf("%-12s | move validation to depth %d: %s\n", test->name, VALIDATION_DEPTH, isValid ? "ok" : "FAIL");
+    }
+
+    printf("\nperft: %llu nodes, %.2f Mnodes/s\n", (unsigned long long)totalNodes,
+        (double)totalNodes * 1000.0 / ((double)totalTicks * nsPerTick() + 1.0));
+
+    passed &= benchmarkValidation();
+
+    printf("\n%s\n", passed ? "ok" : "FAIL");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -23,9 +23,195 @@ Side
     INVALID = 0, WHITE, BLACK
 }Side;
 
+//Which way a message type can be sent. A bit mask
+typedef enum
+{
+    MSG_CLIENT_TO_SERVER = 1,
+    MSG_SERVER_TO_CLIENT = 2,
+    MSG_BOTH_WAYS = MSG_CLIENT_TO_SERVER | MSG_SERVER_TO_CLIENT
+}MessageDirection;
+
+//Where the client is when a message type is sent: in the lobby (waiting to pair up with someone) or in a chess game.
+//On the server these are the lobby threads and the game worker threads.
+typedef enum
+{
+    MSG_IN_LOBBY = 0,
+    MSG_IN_GAME,
+    NUM_OF_MESSAGE_STATES
+}MessageState;
+
+//Every message type in the protocol. Everything else in this file (the MessageType and MessageSize enums and the lookup
+//functions at the bottom) is generated from this one table, so the type, size, direction and state of a message can not get out of sync.
+//A new message type is added by adding a line to the end of the table (the position in the table is the MessageType value,
+//so the order of the lines must never change).
+//
+//X(name, size in bytes with the 2 byte header, MessageDirection, MessageState)
+//
+//MOVE: The layout of the MOVE_MSGTYPE type of message (class ChessMove defined in move.h client code):
+// |0|1|2|3|4|5|6|7|8|9|
+//byte 0 will be the MOVE_MSGTYPE  <--- header bytes
+//byte 1 will be the MOVE_MSGSIZE  <---
+//
+//byte 2 will be the file (0-7) the piece if moving from   <--- source square
+//byte 3 will be the rank (0-7) the piece if moving from   <---
+// 
+//byte 4 will be the file (0-7) the piece if moving to   <--- destination square
+//byte 5 will be the rank (0-7) the piece if moving to   <---
+// 
+//byte 6 will be the PromoType (enum defined in (client source)moveInfo.h) of the promotion if there is one
+//byte 7 will be the MoveInfo (enum defined in (client source)moveInfo.h)
+//byte 8 will be the ChessMove::rightsToRevoke as an unsigned char
+//byte 9 will be the ChessMove::wasCapture bool
+//
+//The reason why enum ChessMove::PromoTypes and enum ChessMove::MoveTypes are only defined in the client source is
+//because they are only used as that type there (in the client source). Those bytes are not cast to/de-serialized to
+//their enum types on the server. This message is simply forwarded along from one player/client to the other durring a chess game.
+//
+//RESIGN: Sent to tell your opponent that you are resigning.
+//DRAW_OFFER: Sent to offer a draw to the opponent.
+//DRAW_ACCEPT: Sent to accept a draw offer.
+//DRAW_DECLINE: Sent to decline a draw offer.
+//REMATCH_REQUEST: Sent to request a rematch at the end of a chess game.
+//REMATCH_ACCEPT: Sent to accept a rematch request.
+//
+//PAIRING_COMPLETE: The server is indicating to the client that the pairing proccess is complete. After the first two header bytes,
+//the next byte is the side the client is playing as (the Side enum defined at the top of this file).
+//
+//PAIR_REQUEST: Sent in order to request to pair up and play chess with a potential opponent.
+//The 4 bytes after the first two header bytes will be a network byte order 
+//uint32_t unique identifier (kind of like a friend code).
+//When this message is being sent from client to server,
+//the ID is the ID of the person you wish to play against.
+//When this message is being sent from server to client, 
+//the ID is the ID of the person who sent the pair request to the server origonally.
+//
+//PAIR_ACCEPT: Sent to the server from the client, when the client accepts a PAIR_REQUEST_MSGTYPE.
+//The 4 bytes after the first two header bytes will be a network byte order uint32_t unique identifier
+//of the person who orrigonally sent the PAIR_REQUEST_MSGTYPE.
+//
+//PAIR_DECLINE: When the opponent declines a request to be paired up.
+//The 4 bytes after the first two header bytes will be a network byte order uint32_t unique identifier.
+//When this message is being sent from client to server, the ID will be the ID of the player
+//who you want to send a pair decline message to. When this message is being sent from server to client,
+//the ID will be the ID of the player who sent the pair decline message to the server origonally.
+//
+//PAIR_NORESPONSE: Sent when the potential opponent does not respond in less than PAIR_REQUEST_TIMEOUT_SECS
+//(defined in lobbyManager.c for server and chessNetworking.h for client) 
+//seconds to a PAIR_REQUEST_MSGTYPE with either a PAIR_DECLINE_MSGTYPE or a PAIR_ACCEPT_MSGTYPE.
+//
+//SERVER_FULL: Sent when someone connects but the server is full.
+//
+//ID_NOT_IN_LOBBY: Sent when a player tries to supply an ID
+//of another player which is not in the lobby (or they supply their own ID).
+//The invalid ID is sent back to the client in this message.
+//
+//UNPAIR: Sent when in a chess game, and one of the two players wants to disconnect 
+//from the other and go back into the lobby.
+//
+//OPPONENT_CLOSED_CONNECTION: Sent to signify that an opponent lost connection/closed their game.
+//REMATCH_DECLINE: Sent to decline a REMATCH_REQUEST_MSGTYPE
+//
+//PAIR_REQUEST_TOO_SOON: Sent to tell the player that they are sending pair requests too quickly.
+//You have to wait PAIR_REQUEST_TIMEOUT_SECS
+//(defined in lobbyManager.c for server and chessNetworking.h for client)
+//before sending another PAIR_REQUEST_MESSAGE.
+//
+//NEW_ID: The 4 bytes after the first two header bytes will be a network byte order uint32_t from the server to the client which represents
+//their unique identifier on the server. It is effectively their "friend code" for pairing up with other players.
+//
+//FIND_GAME: Sent to the server to be paired up with whoever the server finds, instead of with a friend code.
+//The 2 bytes after the first two header bytes will be a network byte order uint16_t rating of the player
+//(anything above 4095 is treated as 4095). The player waits in the server's matchmaking queue (see matchmaking.h) until
+//someone close enough to their rating comes along, and the range of ratings they can be paired with widens the longer they wait.
+//When they are paired they get a PAIRING_COMPLETE_MSGTYPE like with a PAIR_ACCEPT_MSGTYPE (or a SERVER_FULL_MSGTYPE if every
+//game is taken, after which they are not in the queue anymore). A FIND_GAME_MSGTYPE sent while already in the queue is ignored.
+//
+//CANCEL_FIND_GAME: Sent to the server to leave the matchmaking queue. Ignored if the player is not in it.
+//
+//RESUME_TOKEN: Sent to both players right after PAIRING_COMPLETE_MSGTYPE. The 8 bytes after the first two header bytes are a
+//network byte order uint64_t token that lets the player get back into this game if their connection drops (see RESUME_GAME_MSGTYPE).
+//A client that does not resume games can ignore it.
+//
+//RESUME_GAME: Sent to the server from the lobby by a player whose connection to a game dropped, on their new connection.
+//The 8 bytes after the first two header bytes are the network byte order uint64_t token from RESUME_TOKEN_MSGTYPE,
+//and the 4 bytes after that are a network byte order uint32_t count of the messages the client received from their opponent
+//since PAIRING_COMPLETE_MSGTYPE (the messages from the server itself, like OPPONENT_RECONNECTING_MSGTYPE, are not counted).
+//The game waits CHESS_SERVER_RESUME_GRACE_SECS (see serverConfig.h on the server) for a player whose connection dropped,
+//and it survives a restart of the server in that time too. The token stays valid for the whole game (rematches included),
+//so a player can resume as many times as they need to.
+//
+//GAME_RESUMED: The answer to a RESUME_GAME_MSGTYPE that put the player back into their game. After the first two header bytes,
+//the next byte is the side the client is playing as now (the Side enum), and the 4 bytes after that are a network byte order uint32_t
+//count of the messages the server received from this client since PAIRING_COMPLETE_MSGTYPE, so the client knows which of its last
+//messages never made it (and can send them again). Every message the opponent sent past the count in the RESUME_GAME_MSGTYPE
+//follows it, the same as if the connection never dropped.
+//
+//RESUME_FAILED: The answer to a RESUME_GAME_MSGTYPE whose token is not the token of a game that is waiting for someone
+//(the game ended or the grace period ran out). The client stays in the lobby, and gets a NEW_ID_MSGTYPE if it had to leave it.
+//
+//OPPONENT_RECONNECTING: Sent in a game when the opponent's connection dropped. The game goes on, and the messages sent to them
+//are kept until they come back (OPPONENT_RESUMED_MSGTYPE) or their grace period runs out (OPPONENT_CLOSED_CONNECTION_MSGTYPE).
+//
+//OPPONENT_RESUMED: Sent in a game when the opponent came back with RESUME_GAME_MSGTYPE.
+//
+//SPECTATE_ID: Sent to both players after RESUME_TOKEN_MSGTYPE (and after GAME_RESUMED_MSGTYPE). The 4 bytes after the first two
+//header bytes are a network byte order uint32_t that anyone can use to watch the game (see SPECTATE_MSGTYPE), like a friend code.
+//
+//SPECTATE: Sent to the server from the lobby to watch a game. The 4 bytes after the first two header bytes are the network byte order
+//SPECTATE_ID of the game. The client leaves the lobby and gets a SPECTATE_START_MSGTYPE, or stays in it and gets a SPECTATE_FAILED_MSGTYPE.
+//A spectator can only send UNPAIR_MSGTYPE (to stop watching). A spectator who falls too far behind the game is disconnected.
+//
+//SPECTATE_FAILED: The answer to a SPECTATE_MSGTYPE whose ID is not the ID of a running game (or the game can not be watched right now).
+//The client stays in the lobby, and gets a NEW_ID_MSGTYPE if it had to leave it.
+//
+//SPECTATE_START: The first message a spectator gets. The 2 bytes after the first two header bytes are a network byte order uint16_t
+//count of the SPECTATED_MESSAGE_MSGTYPEs right after it, which are the moves of the current game so far (of the last rematch,
+//if there was one). Every message after those is live.
+//
+//SPECTATED_MESSAGE: A message one of the players sent in a game that is being watched. After the first two header bytes, the next byte
+//is the side of the player who sent it (the Side enum), and the rest is their message as is (header included), padded with zeros to 10 bytes.
+//
+//SPECTATE_ENDED: Sent to a spectator when the game they were watching ended, or after they sent UNPAIR_MSGTYPE.
+//They are back in the lobby and get a NEW_ID_MSGTYPE next.
+#define CHESS_MESSAGE_TABLE(X) \
+    X(MOVE,                       10, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(RESIGN,                      2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(DRAW_OFFER,                  2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(DRAW_ACCEPT,                 2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(DRAW_DECLINE,                2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(REMATCH_REQUEST,             2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(REMATCH_ACCEPT,              2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(PAIRING_COMPLETE,            3, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(PAIR_REQUEST,                6, MSG_BOTH_WAYS,        MSG_IN_LOBBY) \
+    X(PAIR_ACCEPT,                 6, MSG_CLIENT_TO_SERVER, MSG_IN_LOBBY) \
+    X(PAIR_DECLINE,                6, MSG_BOTH_WAYS,        MSG_IN_LOBBY) \
+    X(PAIR_NORESPONSE,             2, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(SERVER_FULL,                 2, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(ID_NOT_IN_LOBBY,             6, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(UNPAIR,                      2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(OPPONENT_CLOSED_CONNECTION,  2, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(REMATCH_DECLINE,             2, MSG_BOTH_WAYS,        MSG_IN_GAME)  \
+    X(PAIR_REQUEST_TOO_SOON,       2, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(NEW_ID,                      6, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(FIND_GAME,                   4, MSG_CLIENT_TO_SERVER, MSG_IN_LOBBY) \
+    X(CANCEL_FIND_GAME,            2, MSG_CLIENT_TO_SERVER, MSG_IN_LOBBY) \
+    X(RESUME_TOKEN,               10, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(RESUME_GAME,                14, MSG_CLIENT_TO_SERVER, MSG_IN_LOBBY) \
+    X(GAME_RESUMED,                7, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(RESUME_FAILED,               2, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(OPPONENT_RECONNECTING,       2, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(OPPONENT_RESUMED,            2, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(SPECTATE_ID,                 6, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(SPECTATE,                    6, MSG_CLIENT_TO_SERVER, MSG_IN_LOBBY) \
+    X(SPECTATE_FAILED,             2, MSG_SERVER_TO_CLIENT, MSG_IN_LOBBY) \
+    X(SPECTATE_START,              4, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(SPECTATED_MESSAGE,          13, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)  \
+    X(SPECTATE_ENDED,              2, MSG_SERVER_TO_CLIENT, MSG_IN_GAME)
+
 //This MessageType enum (1 byte) will be the first byte of every message.
 //The next enum below this one (MessageSize) will be the second byte of every message,
 //and will signify the size in bytes of the whole message including the two byte header.
+#define CHESS_MESSAGE_TYPE_ENUM(name, size, direction, state) name##_MSGTYPE,
 typedef enum
 #ifdef __cplusplus
 struct
@@ -35,124 +221,15 @@ MessageType
  : uint8_t
 #endif
 {
-    //(client to server and server to client)
-    //The layout of the MOVE_MSGTYPE type of message (class ChessMove defined in move.h client code):
-    // |0|1|2|3|4|5|6|7|8|9|
-    //byte 0 will be the MOVE_MSGTYPE  <--- header bytes
-    //byte 1 will be the MOVE_MSGSIZE  <---
-    //
-    //byte 2 will be the file (0-7) the piece if moving from   <--- source square
-    //byte 3 will be the rank (0-7) the piece if moving from   <---
-    // 
-    //byte 4 will be the file (0-7) the piece if moving to   <--- destination square
-    //byte 5 will be the rank (0-7) the piece if moving to   <---
-    // 
-    //byte 6 will be the PromoType (enum defined in (client source)moveInfo.h) of the promotion if there is one
-    //byte 7 will be the MoveInfo (enum defined in (client source)moveInfo.h)
-    //byte 8 will be the ChessMove::rightsToRevoke as an unsigned char
-    //byte 9 will be the ChessMove::wasCapture bool
-    //
-    //The reason why enum ChessMove::PromoTypes and enum ChessMove::MoveTypes are only defined in the client source is
-    //because they are only used as that type there (in the client source). Those bytes are not cast to/de-serialized to
-    //their enum types on the server. This message is simply forwarded along from one player/client to the other durring a chess game.
-    MOVE_MSGTYPE,
-
-    //(client to server and server to client)
-    //Sent to tell your opponent that you are resigning.
-    RESIGN_MSGTYPE,
-
-    //(client to server and server to client)
-    //Sent to offer a draw to the opponent.
-    DRAW_OFFER_MSGTYPE,
-
-    //(client to server and server to client)
-    //Sent to accept a draw offer.
-    DRAW_ACCEPT_MSGTYPE,
-
-    //(client to server and server to client)
-    //Sent to decline a draw offer.
-    DRAW_DECLINE_MSGTYPE,
-
-    //(client to server and server to client)
-    //Sent to request a rematch at the end of a chess game.
-    REMATCH_REQUEST_MSGTYPE,
-
-    //(client to server and server to client)
-    //Sent to accept a rematch request.
-    REMATCH_ACCEPT_MSGTYPE,
-
-    //(from server to client only)
-    //The server is indicating to the client that
-    //the pairing proccess is complete. After the first two header bytes, the next byte
-    //is the side the client is playing as (the Side enum defined at the top of this file).
-    PAIRING_COMPLETE_MSGTYPE,
-
-    //Sent in order to (client to server and server to client)
-    //request to pair up and play chess with a potential opponent.
-    //The 4 bytes after the first two header bytes will be a network byte order 
-    //uint32_t unique identifier (kind of like a friend code).
-    //When this message is being sent from client to server,
-    //the ID is the ID of the person you wish to play against.
-    //When this message is being sent from server to client, 
-    //the ID is the ID of the person who sent the pair request to the server origonally.
-    PAIR_REQUEST_MSGTYPE,
-
-    //Sent to the server from the client, when the client accepts a PAIR_REQUEST_MSGTYPE.
-    //The 4 bytes after the first two header bytes will be a network byte order uint32_t unique identifier
-    //of the person who orrigonally sent the PAIR_REQUEST_MSGTYPE.
-    PAIR_ACCEPT_MSGTYPE,
-
-    //When the opponent declines a request to be paired up.
-    //The 4 bytes after the first two header bytes will be a network byte order uint32_t unique identifier.
-    //When this message is being sent from client to server, the ID will be the ID of the player
-    //who you want to send a pair decline message to. When this message is being sent from server to client,
-    //the ID will be the ID of the player who sent the pair decline message to the server origonally.
-    PAIR_DECLINE_MSGTYPE,
-
-    //Sent from the server to the client when the potential opponent 
-    //does not respond in less than PAIR_REQUEST_TIMEOUT_SECS
-    //(defined in lobbyConnectionsManager.c for server and chessNetworking.h for client) 
-    //seconds to a PAIR_REQUEST_MSGTYPE with either a PAIR_DECLINE_MSGTYPE or a PAIR_ACCEPT_MSGTYPE.
-    PAIR_NORESPONSE_MSGTYPE,
-
-    //Sent (from server to client only) 
-    //when someone connects but the server is full.
-    SERVER_FULL_MSGTYPE,
-
-    //Sent (from server to client only) when a player tries to supply an ID
-    //of another player which is not in the lobby (or they supply their own ID).
-    //The invalid ID is sent back to the client in this message.
-    ID_NOT_IN_LOBBY_MSGTYPE,
-
-    //Sent (from server to client and client to server)
-    //when in a chess game, and one of the two players wants to disconnect 
-    //from the other and go back into the lobby.
-    UNPAIR_MSGTYPE,
-
-    //Sent (from server to client only) to signify that an opponent lost connection/closed their game.
-    OPPONENT_CLOSED_CONNECTION_MSGTYPE,
-
-    //Sent (from client to server and server to client) to decline a REMATCH_REQUEST_MSGTYPE
-    REMATCH_DECLINE_MSGTYPE,
-
-    //Sent (from server to client only) to tell the player that they are sending pair requests too quickly.
-    //You have to wait PAIR_REQUEST_TIMEOUT_SECS
-    //(defined in lobbyConnectionsManager.c for server and chessNetworking.h for client)
-    //before sending another PAIR_REQUEST_MESSAGE.
-    PAIR_REQUEST_TOO_SOON_MSGTYPE,
-
-    //(from server to client only)
-    //The 4 bytes after the first two header bytes will be a network byte order uint32_t from the server to the client which represents
-    //their unique identifier on the server. It is effectively their "friend code" for pairing up with other players.
-    NEW_ID_MSGTYPE
-
+    CHESS_MESSAGE_TABLE(CHESS_MESSAGE_TYPE_ENUM)
 }MessageType;
+#undef CHESS_MESSAGE_TYPE_ENUM
 
 //The size in bytes of the different types of messages (MessageType enum above).
-//There will be the same number of enum values here as in MessageType, since the enum values here
-//correspond to the same enum name above in the MessageType enum, but with _MSGSIZE instead of _MSGTYPE appended to the enum name.
+//The enum values here have the same name as in the MessageType enum, but with _MSGSIZE instead of _MSGTYPE appended to the enum name.
 //Every message will have a two byte header where the first byte is the MessageType enum,
 //and the second byte is this MessageSize enum to signify the size of the whole message (header included).
+#define CHESS_MESSAGE_SIZE_ENUM(name, size, direction, state) name##_MSGSIZE = size,
 typedef enum
 #ifdef __cplusplus
 struct
@@ -162,26 +239,75 @@ MessageSize
  : uint8_t
 #endif
 {
-    MOVE_MSGSIZE = 10,
-    RESIGN_MSGSIZE = 2,
-    DRAW_OFFER_MSGSIZE = 2,
-    DRAW_ACCEPT_MSGSIZE = 2,
-    DRAW_DECLINE_MSGSIZE = 2,
-    REMATCH_REQUEST_MSGSIZE = 2,
-    REMATCH_ACCEPT_MSGSIZE = 2,
-    PAIR_REQUEST_MSGSIZE = 6,
-    PAIR_ACCEPT_MSGSIZE = 6,
-    PAIR_DECLINE_MSGSIZE = 6,
-    PAIR_COMPLETE_MSGSIZE = 3,
-    PAIR_NORESPONSE_MSGSIZE = 2,
-    SERVER_FULL_MSGSIZE = 2,
-    ID_NOT_IN_LOBBY_MSGSIZE = 6,
-    UNPAIR_MSGSIZE = 2,
-    OPPONENT_CLOSED_CONNECTION_MSGSIZE = 2,
-    REMATCH_DECLINE_MSGSIZE = 2,
-    PAIR_REQUEST_TOO_SOON_MSGSIZE = 2,
-    NEW_ID_MSGSIZE = 6
-
+    CHESS_MESSAGE_TABLE(CHESS_MESSAGE_SIZE_ENUM)
+    PAIR_COMPLETE_MSGSIZE = PAIRING_COMPLETE_MSGSIZE//the old name
 }MessageSize;
+#undef CHESS_MESSAGE_SIZE_ENUM
+
+#define CHESS_MESSAGE_COUNT_ONE(name, size, direction, state) + 1
+enum {NUM_OF_MESSAGE_TYPES = 0 CHESS_MESSAGE_TABLE(CHESS_MESSAGE_COUNT_ONE)};
+#undef CHESS_MESSAGE_COUNT_ONE
+
+//The lookup functions below index a table generated from CHESS_MESSAGE_TABLE with the first byte of a message.
+//They take the raw byte off the wire, so they all handle a msgType that is not a MessageType.
+
+//the size of a msgType message (header included), or 0 if msgType is not a MessageType
+static inline uint8_t messageSize(uint8_t msgType)
+{
+    #define CHESS_MESSAGE_SIZE(name, size, direction, state) size,
+    static const uint8_t sizes[NUM_OF_MESSAGE_TYPES] = {CHESS_MESSAGE_TABLE(CHESS_MESSAGE_SIZE)};
+    #undef CHESS_MESSAGE_SIZE
+    return msgType < NUM_OF_MESSAGE_TYPES ? sizes[msgType] : 0;
+}
+
+//the MessageType enum name of msgType, for logging
+static inline char const* messageTypeName(uint8_t msgType)
+{
+    #define CHESS_MESSAGE_NAME(name, size, direction, state) #name "_MSGTYPE",
+    static char const* const names[NUM_OF_MESSAGE_TYPES] = {CHESS_MESSAGE_TABLE(CHESS_MESSAGE_NAME)};
+    #undef CHESS_MESSAGE_NAME
+    return msgType < NUM_OF_MESSAGE_TYPES ? names[msgType] : "INVALID_MSGTYPE";
+}
+
+//the MessageDirection bit mask of msgType, or 0 if msgType is not a MessageType
+static inline uint8_t messageDirection(uint8_t msgType)
+{
+    #define CHESS_MESSAGE_DIRECTION(name, size, direction, state) direction,
+    static const uint8_t directions[NUM_OF_MESSAGE_TYPES] = {CHESS_MESSAGE_TABLE(CHESS_MESSAGE_DIRECTION)};
+    #undef CHESS_MESSAGE_DIRECTION
+    return msgType < NUM_OF_MESSAGE_TYPES ? directions[msgType] : 0;
+}
+
+//the MessageState msgType is sent in. only call this with a valid msgType
+static inline MessageState messageState(uint8_t msgType)
+{
+    #define CHESS_MESSAGE_STATE(name, size, direction, state) state,
+    static const uint8_t states[NUM_OF_MESSAGE_TYPES] = {CHESS_MESSAGE_TABLE(CHESS_MESSAGE_STATE)};
+    #undef CHESS_MESSAGE_STATE
+    return (MessageState)states[msgType];
+}
+
+//The size a client has to send a msgType message with while they are in state, or 0 if a client
+//can not send msgType in state (or at all). Validating a message from a client is one load from this and a compare with its size.
+static inline uint8_t clientMessageSize(uint8_t msgType, MessageState state)
+{
+    #define CHESS_CLIENT_MESSAGE_SIZE(name, size, direction, state, inState) \
+        (((direction) & MSG_CLIENT_TO_SERVER) && (state) == (inState) ? (size) : 0),
+    #define CHESS_CLIENT_MESSAGE_SIZE_IN_LOBBY(name, size, direction, state) \
+        CHESS_CLIENT_MESSAGE_SIZE(name, size, direction, state, MSG_IN_LOBBY)
+    #define CHESS_CLIENT_MESSAGE_SIZE_IN_GAME(name, size, direction, state) \
+        CHESS_CLIENT_MESSAGE_SIZE(name, size, direction, state, MSG_IN_GAME)
+
+    static const uint8_t sizes[NUM_OF_MESSAGE_STATES][NUM_OF_MESSAGE_TYPES] =
+    {
+        {CHESS_MESSAGE_TABLE(CHESS_CLIENT_MESSAGE_SIZE_IN_LOBBY)},
+        {CHESS_MESSAGE_TABLE(CHESS_CLIENT_MESSAGE_SIZE_IN_GAME)}
+    };
+
+    #undef CHESS_CLIENT_MESSAGE_SIZE_IN_GAME
+    #undef CHESS_CLIENT_MESSAGE_SIZE_IN_LOBBY
+    #undef CHESS_CLIENT_MESSAGE_SIZE
+    return msgType < NUM_OF_MESSAGE_TYPES ? sizes[state][msgType] : 0;
+}
 
-#endif //CHESS_NETWORK_PROTOCOL_H
\ No newline at end of file
+#endif //CHESS_NETWORK_PROTOCOL_H
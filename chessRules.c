@@ -0,0 +1,606 @@
+#include <assert.h>
+#include <string.h>
+#include <intrin.h>
+
+#ifdef CHESS_RULES_USE_PEXT
+#include <immintrin.h>
+#endif
+
+#include "chessRules.h"
+
+#define BIT(square) (1ull << (square))
+
+#define FILE_A 0x0101010101010101ull
+#define FILE_H (FILE_A << 7)
+#define RANK_1 0xFFull
+#define RANK_8 (RANK_1 << 56)
+
+#define PIECE(color, type) (uint8_t)(((color) << 3) | (type))
+#define PIECE_COLOR(piece) ((piece) >> 3)
+#define PIECE_TYPE(piece) ((piece) & 7)
+
+//where the rook or bishop attacks of one square are in s_rookAttacks or s_bishopAttacks
+typedef struct
+{
+    uint64_t mask;//the squares whose pieces can block the slider, without the edges of the board
+    uint64_t magic;
+    uint64_t* attacks;
+    unsigned shift;
+}SliderTable;
+
+//every subset of the masks of the 64 squares: 102400 rook and 5248 bishop entries (800 KB and 41 KB)
+static uint64_t s_rookAttacks[0x19000];
+static uint64_t s_bishopAttacks[0x1480];
+static SliderTable s_rookTables[64];
+static SliderTable s_bishopTables[64];
+
+static uint64_t s_knightAttacks[64];
+static uint64_t s_kingAttacks[64];
+static uint64_t s_pawnAttacks[2][64];//the squares a pawn of a color on a square attacks
+
+//a move from or to a square keeps only these castling rights (a king or a rook moved, or a rook was captured)
+static uint8_t s_castleRightsKept[64];
+
+static int const s_rookDirections[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+static int const s_bishopDirections[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+static int squareFile(int square) {return square & 7;}
+static int squareRank(int square) {return square >> 3;}
+
+static unsigned popCount(uint64_t bits)
+{
+    unsigned count = 0;
+    for(; bits; bits &= bits - 1)
+        ++count;
+
+    return count;
+}
+
+static int popLowestSquare(uint64_t* bits)
+{
+    unsigned long index = 0;
+    _BitScanForward64(&index, *bits);
+    *bits &= *bits - 1;
+    return (int)index;
+}
+
+static int lowestSquare(uint64_t bits)
+{
+    unsigned long index = 0;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+}
+
+//the squares reached from square by the (file, rank) steps, as long as they stay on the board
+static uint64_t stepAttacks(int square, int const (*steps)[2], size_t numOfSteps)
+{
+    uint64_t attacks = 0;
+    for(size_t i = 0; i < numOfSteps; ++i)
+    {
+        int const file = squareFile(square) + steps[i][0];
+        int const rank = squareRank(square) + steps[i][1];
+        if(file >= 0 && file < 8 && rank >= 0 && rank < 8)
+            attacks |= BIT(file + 8 * rank);
+    }
+
+    return attacks;
+}
+
+//the slow way, for building the tables: walk every direction until the edge or a piece
+static uint64_t slidingAttacks(int square, uint64_t occupied, int const (*directions)[2])
+{
+    uint64_t attacks = 0;
+    for(int i = 0; i < 4; ++i)
+    {
+        int file = squareFile(square) + directions[i][0];
+        int rank = squareRank(square) + directions[i][1];
+        for(; file >= 0 && file < 8 && rank >= 0 && rank < 8; file += directions[i][0], rank += directions[i][1])
+        {
+            attacks |= BIT(file + 8 * rank);
+            if(occupied & BIT(file + 8 * rank))
+                break;
+        }
+    }
+
+    return attacks;
+}
+
+static size_t sliderIndex(SliderTable const* table, uint64_t occupied)
+{
+#ifdef CHESS_RULES_USE_PEXT
+    return (size_t)_pext_u64(occupied, table->mask);
+#else
+    return (size_t)(((occupied & table->mask) * table->magic) >> table->shift);
+#endif
+}
+
+static uint64_t rookAttacks(int square, uint64_t occupied)
+{
+    SliderTable const* table = s_rookTables + square;
+    return table->attacks[sliderIndex(table, occupied)];
+}
+
+static uint64_t bishopAttacks(int square, uint64_t occupied)
+{
+    SliderTable const* table = s_bishopTables + square;
+    return table->attacks[sliderIndex(table, occupied)];
+}
+
+#ifndef CHESS_RULES_USE_PEXT
+//xorshift64*. the magics only have to work, so the seeds are fixed and every start finds the same ones
+static uint64_t nextRandom(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+//A magic is a number that maps every subset of the mask to a different index (or to the index of a subset with the same attacks).
+//Try random numbers with few bits set until one does, and fill table->attacks with it.
+static void findMagic(SliderTable* table, uint64_t const* occupancies, uint64_t const* references, size_t numOfSubsets, int square)
+{
+    //seeds that find the magics of each rank after few tries (the ones Stockfish uses)
+    static uint64_t const seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+
+    //which try last wrote each entry, so the entries do not have to be cleared between tries
+    static unsigned tries[4096];
+    static unsigned tryNumber = 0;
+
+    uint64_t rngState = seeds[squareRank(square)];
+    for(size_t i = 0; i < numOfSubsets;)
+    {
+        do
+        {
+            table->magic = nextRandom(&rngState) & nextRandom(&rngState) & nextRandom(&rngState);
+        }while(popCount((table->magic * table->mask) >> 56) < 6);
+
+        ++tryNumber;
+        for(i = 0; i < numOfSubsets; ++i)
+        {
+            size_t const index = sliderIndex(table, occupancies[i]);
+            if(tries[index] < tryNumber)
+            {
+                tries[index] = tryNumber;
+                table->attacks[index] = references[i];
+            }
+            else if(table->attacks[index] != references[i])
+            {
+                break;//two subsets with different attacks collide, so try the next magic
+            }
+        }
+    }
+}
+#endif
+
+//fill tables and attacks for every square
+static void initSliderTables(SliderTable* tables, uint64_t* attacks, int const (*directions)[2])
+{
+    static uint64_t occupancies[4096];
+    static uint64_t references[4096];
+    size_t offset = 0;
+
+    for(int square = 0; square < 64; ++square)
+    {
+        SliderTable* table = tables + square;
+
+        //pieces on the edges never block anything further out
+        uint64_t const edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * squareRank(square)))) |
+                               ((FILE_A | FILE_H) & ~(FILE_A << squareFile(square)));
+        table->mask = slidingAttacks(square, 0, directions) & ~edges;
+        table->shift = 64 - popCount(table->mask);
+        table->attacks = attacks + offset;
+
+        //every subset of the mask (the carry rippler trick)
+        size_t numOfSubsets = 0;
+        uint64_t subset = 0;
+        do
+        {
+            occupancies[numOfSubsets] = subset;
+            references[numOfSubsets] = slidingAttacks(square, subset, directions);
+            ++numOfSubsets;
+            subset = (subset - table->mask) & table->mask;
+        }while(subset);
+
+        offset += numOfSubsets;
+
+#ifdef CHESS_RULES_USE_PEXT
+        for(size_t i = 0; i < numOfSubsets; ++i)
+            table->attacks[sliderIndex(table, occupancies[i])] = references[i];
+#else
+        findMagic(table, occupancies, references, numOfSubsets, square);
+#endif
+    }
+}
+
+void chessRulesInit(void)
+{
+    static int const knightSteps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    static int const kingSteps[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+    static int const whitePawnSteps[2][2] = {{-1, 1}, {1, 1}};
+    static int const blackPawnSteps[2][2] = {{-1, -1}, {1, -1}};
+
+    for(int square = 0; square < 64; ++square)
+    {
+        s_knightAttacks[square] = stepAttacks(square, knightSteps, 8);
+        s_kingAttacks[square] = stepAttacks(square, kingSteps, 8);
+        s_pawnAttacks[CHESS_WHITE][square] = stepAttacks(square, whitePawnSteps, 2);
+        s_pawnAttacks[CHESS_BLACK][square] = stepAttacks(square, blackPawnSteps, 2);
+        s_castleRightsKept[square] = CHESS_CASTLE_ALL;
+    }
+
+    s_castleRightsKept[0] = (uint8_t)~CHESS_CASTLE_WHITE_LONG & CHESS_CASTLE_ALL;//a1
+    s_castleRightsKept[7] = (uint8_t)~CHESS_CASTLE_WHITE_SHORT & CHESS_CASTLE_ALL;//h1
+    s_castleRightsKept[4] = (uint8_t)~(CHESS_CASTLE_WHITE_SHORT | CHESS_CASTLE_WHITE_LONG) & CHESS_CASTLE_ALL;//e1
+    s_castleRightsKept[56] = (uint8_t)~CHESS_CASTLE_BLACK_LONG & CHESS_CASTLE_ALL;//a8
+    s_castleRightsKept[63] = (uint8_t)~CHESS_CASTLE_BLACK_SHORT & CHESS_CASTLE_ALL;//h8
+    s_castleRightsKept[60] = (uint8_t)~(CHESS_CASTLE_BLACK_SHORT | CHESS_CASTLE_BLACK_LONG) & CHESS_CASTLE_ALL;//e8
+
+    initSliderTables(s_rookTables, s_rookAttacks, s_rookDirections);
+    initSliderTables(s_bishopTables, s_bishopAttacks, s_bishopDirections);
+}
+
+static void clearPosition(ChessPosition* position)
+{
+    memset(position, 0, sizeof(*position));
+    memset(position->squares, CHESS_EMPTY_SQUARE, sizeof(position->squares));
+    position->epSquare = CHESS_NO_SQUARE;
+}
+
+static void putPiece(ChessPosition* position, uint8_t piece, int square)
+{
+    position->byType[PIECE_TYPE(piece)] |= BIT(square);
+    position->byColor[PIECE_COLOR(piece)] |= BIT(square);
+    position->squares[square] = piece;
+}
+
+static void removePiece(ChessPosition* position, int square)
+{
+    uint8_t const piece = position->squares[square];
+    position->byType[PIECE_TYPE(piece)] &= ~BIT(square);
+    position->byColor[PIECE_COLOR(piece)] &= ~BIT(square);
+    position->squares[square] = CHESS_EMPTY_SQUARE;
+}
+
+void chessPositionInit(ChessPosition* position)
+{
+    bool const isValid = chessPositionFromFen(position, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    assert(isValid);
+    (void)isValid;
+}
+
+bool chessPositionFromFen(ChessPosition* position, char const* fen)
+{
+    static char const pieceLetters[] = "pnbrqk";
+    clearPosition(position);
+
+    //the board, from a8 to h1
+    int file = 0, rank = 7;
+    for(; *fen && *fen != ' '; ++fen)
+    {
+        char const c = *fen;
+        if(c == '/')
+        {
+            if(file != 8 || rank == 0)
+                return false;
+
+            file = 0;
+            --rank;
+        }
+        else if(c >= '1' && c <= '8')
+        {
+            file += c - '0';
+        }
+        else
+        {
+            char const lower = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+            char const* letter = strchr(pieceLetters, lower);
+            if( ! letter || ! lower || file > 7 )
+                return false;
+
+            putPiece(position, PIECE(c == lower ? CHESS_BLACK : CHESS_WHITE, letter - pieceLetters), file + 8 * rank);
+            ++file;
+        }
+
+        if(file > 8)
+            return false;
+    }
+
+    if(file != 8 || rank != 0 || *fen++ != ' ')
+        return false;
+
+    if(*fen == 'w' || *fen == 'b')
+        position->sideToMove = (*fen++ == 'w') ? CHESS_WHITE : CHESS_BLACK;
+    else
+        return false;
+
+    if(*fen++ != ' ')
+        return false;
+
+    for(; *fen && *fen != ' '; ++fen)
+    {
+        switch(*fen)
+        {
+        case 'K': position->castleRights |= CHESS_CASTLE_WHITE_SHORT; break;
+        case 'Q': position->castleRights |= CHESS_CASTLE_WHITE_LONG; break;
+        case 'k': position->castleRights |= CHESS_CASTLE_BLACK_SHORT; break;
+        case 'q': position->castleRights |= CHESS_CASTLE_BLACK_LONG; break;
+        case '-': break;
+        default: return false;
+        }
+    }
+
+    if(*fen++ != ' ')
+        return false;
+
+    if(fen[0] >= 'a' && fen[0] <= 'h' && fen[1] >= '1' && fen[1] <= '8')
+        position->epSquare = (uint8_t)((fen[0] - 'a') + 8 * (fen[1] - '1'));
+    else if(fen[0] != '-')
+        return false;
+
+    //exactly one king each
+    return popCount(position->byType[CHESS_KING] & position->byColor[CHESS_WHITE]) == 1 &&
+           popCount(position->byType[CHESS_KING] & position->byColor[CHESS_BLACK]) == 1;
+}
+
+static uint64_t occupiedSquares(ChessPosition const* position)
+{
+    return position->byColor[CHESS_WHITE] | position->byColor[CHESS_BLACK];
+}
+
+//is square attacked by a piece of byColor
+static bool isAttacked(ChessPosition const* position, int square, int byColor)
+{
+    uint64_t const attackers = position->byColor[byColor];
+    uint64_t const occupied = occupiedSquares(position);
+    uint64_t const queens = position->byType[CHESS_QUEEN];
+
+    return (s_pawnAttacks[byColor ^ 1][square] & attackers & position->byType[CHESS_PAWN]) ||
+           (s_knightAttacks[square] & attackers & position->byType[CHESS_KNIGHT]) ||
+           (s_kingAttacks[square] & attackers & position->byType[CHESS_KING]) ||
+           (bishopAttacks(square, occupied) & attackers & (position->byType[CHESS_BISHOP] | queens)) ||
+           (rookAttacks(square, occupied) & attackers & (position->byType[CHESS_ROOK] | queens));
+}
+
+static bool isKingAttacked(ChessPosition const* position, int color)
+{
+    return isAttacked(position, lowestSquare(position->byType[CHESS_KING] & position->byColor[color]), color ^ 1);
+}
+
+//the castling destinations of the king of color on kingSquare that are legal right now
+static uint64_t castleTargets(ChessPosition const* position, int color, int kingSquare)
+{
+    uint8_t const shortRight = (color == CHESS_WHITE) ? CHESS_CASTLE_WHITE_SHORT : CHESS_CASTLE_BLACK_SHORT;
+    uint8_t const longRight = (color == CHESS_WHITE) ? CHESS_CASTLE_WHITE_LONG : CHESS_CASTLE_BLACK_LONG;
+    int const homeSquare = (color == CHESS_WHITE) ? 4 : 60;
+
+    //the rights are taken away as soon as the king or the rook moves, so with a right the king and rook are still at home
+    if( ! (position->castleRights & (shortRight | longRight)) || kingSquare != homeSquare || isAttacked(position, homeSquare, color ^ 1) )
+        return 0;
+
+    uint64_t const occupied = occupiedSquares(position);
+    uint64_t targets = 0;
+
+    if((position->castleRights & shortRight) && ! (occupied & (BIT(homeSquare + 1) | BIT(homeSquare + 2))) &&
+       ! isAttacked(position, homeSquare + 1, color ^ 1) && ! isAttacked(position, homeSquare + 2, color ^ 1))
+    {
+        targets |= BIT(homeSquare + 2);
+    }
+
+    if((position->castleRights & longRight) && ! (occupied & (BIT(homeSquare - 1) | BIT(homeSquare - 2) | BIT(homeSquare - 3))) &&
+       ! isAttacked(position, homeSquare - 1, color ^ 1) && ! isAttacked(position, homeSquare - 2, color ^ 1))
+    {
+        targets |= BIT(homeSquare - 2);
+    }
+
+    return targets;
+}
+
+//The squares the piece on from can move to, not counting whether it leaves its own king in check.
+//For a pawn this includes the last rank (as a promotion) and the en passant square.
+static uint64_t pieceTargets(ChessPosition const* position, int from)
+{
+    uint8_t const piece = position->squares[from];
+    int const color = PIECE_COLOR(piece);
+    uint64_t const own = position->byColor[color];
+    uint64_t const occupied = occupiedSquares(position);
+
+    switch(PIECE_TYPE(piece))
+    {
+    case CHESS_PAWN:
+    {
+        int const forward = (color == CHESS_WHITE) ? 8 : -8;
+        int const startRank = (color == CHESS_WHITE) ? 1 : 6;
+        uint64_t targets = 0;
+
+        //a pawn is never on the last rank, so one square forward is always on the board
+        if( ! (occupied & BIT(from + forward)) )
+        {
+            targets |= BIT(from + forward);
+            if(squareRank(from) == startRank && ! (occupied & BIT(from + 2 * forward)))
+                targets |= BIT(from + 2 * forward);
+        }
+
+        uint64_t const epBit = (position->epSquare != CHESS_NO_SQUARE) ? BIT(position->epSquare) : 0;
+        return targets | (s_pawnAttacks[color][from] & (position->byColor[color ^ 1] | epBit));
+    }
+    case CHESS_KNIGHT: return s_knightAttacks[from] & ~own;
+    case CHESS_BISHOP: return bishopAttacks(from, occupied) & ~own;
+    case CHESS_ROOK: return rookAttacks(from, occupied) & ~own;
+    case CHESS_QUEEN: return (bishopAttacks(from, occupied) | rookAttacks(from, occupied)) & ~own;
+    case CHESS_KING: return (s_kingAttacks[from] & ~own) | castleTargets(position, color, from);
+    default: return 0;
+    }
+}
+
+static bool isPromotionSquare(int color, int square)
+{
+    return squareRank(square) == ((color == CHESS_WHITE) ? 7 : 0);
+}
+
+static bool isCapture(ChessPosition const* position, ChessMove move)
+{
+    return position->squares[move.to] != CHESS_EMPTY_SQUARE ||
+           (PIECE_TYPE(position->squares[move.from]) == CHESS_PAWN && move.to == position->epSquare);
+}
+
+void chessMakeMove(ChessPosition* position, ChessMove move)
+{
+    uint8_t const piece = position->squares[move.from];
+    int const color = PIECE_COLOR(piece);
+    int const type = PIECE_TYPE(piece);
+
+    if(position->squares[move.to] != CHESS_EMPTY_SQUARE)
+        removePiece(position, move.to);
+    else if(type == CHESS_PAWN && move.to == position->epSquare)
+        removePiece(position, move.to + ((color == CHESS_WHITE) ? -8 : 8));
+
+    removePiece(position, move.from);
+    putPiece(position, (type == CHESS_PAWN && move.promotion != CHESS_PAWN) ? PIECE(color, move.promotion) : piece, move.to);
+
+    //castling moves the rook too
+    if(type == CHESS_KING && (move.to == move.from + 2 || move.to + 2 == move.from))
+    {
+        int const rookFrom = (move.to > move.from) ? move.from + 3 : move.from - 4;
+        int const rookTo = (move.to > move.from) ? move.from + 1 : move.from - 1;
+        uint8_t const rook = position->squares[rookFrom];
+        removePiece(position, rookFrom);
+        putPiece(position, rook, rookTo);
+    }
+
+    position->castleRights &= s_castleRightsKept[move.from] & s_castleRightsKept[move.to];
+    position->epSquare = (type == CHESS_PAWN && (move.to == move.from + 16 || move.to + 16 == move.from)) ?
+        (uint8_t)((move.from + move.to) / 2) : CHESS_NO_SQUARE;
+    position->sideToMove ^= 1;
+}
+
+//play move on a copy of position, and return false if it leaves the mover's king in check
+static bool tryMove(ChessPosition const* position, ChessMove move, ChessPosition* after)
+{
+    *after = *position;
+    chessMakeMove(after, move);
+    return ! isKingAttacked(after, position->sideToMove);
+}
+
+size_t chessGenerateMoves(ChessPosition const* position, ChessMove* moves)
+{
+    static uint8_t const promotions[4] = {CHESS_QUEEN, CHESS_ROOK, CHESS_BISHOP, CHESS_KNIGHT};
+    int const color = position->sideToMove;
+    size_t numOfMoves = 0;
+    ChessPosition after;
+
+    for(uint64_t pieces = position->byColor[color]; pieces;)
+    {
+        int const from = popLowestSquare(&pieces);
+        bool const isPawn = PIECE_TYPE(position->squares[from]) == CHESS_PAWN;
+
+        for(uint64_t targets = pieceTargets(position, from); targets;)
+        {
+            ChessMove move = {(uint8_t)from, (uint8_t)popLowestSquare(&targets), CHESS_PAWN};
+            if( ! tryMove(position, move, &after) )
+                continue;
+
+            if(isPawn && isPromotionSquare(color, move.to))
+            {
+                //the promoted piece can not change whether the king is in check, since it replaces the pawn
+                for(int i = 0; i < 4; ++i)
+                {
+                    move.promotion = promotions[i];
+                    moves[numOfMoves++] = move;
+                }
+            }
+            else
+            {
+                moves[numOfMoves++] = move;
+            }
+        }
+    }
+
+    assert(numOfMoves <= CHESS_MAX_MOVES);
+    return numOfMoves;
+}
+
+ChessMoveVerdict chessPlayMoveMessage(ChessPosition* position, Side side, char const* msg)
+{
+    uint8_t const* bytes = (uint8_t const*)msg;
+    int const color = (side == WHITE) ? CHESS_WHITE : CHESS_BLACK;
+    if(side == INVALID || color != position->sideToMove)
+        return CHESS_MOVE_NOT_YOUR_TURN;
+
+    if(bytes[2] > 7 || bytes[3] > 7 || bytes[4] > 7 || bytes[5] > 7)
+        return CHESS_MOVE_OFF_THE_BOARD;
+
+    ChessMove move = {(uint8_t)(bytes[2] + 8 * bytes[3]), (uint8_t)(bytes[4] + 8 * bytes[5]), CHESS_PAWN};
+    uint8_t const piece = position->squares[move.from];
+    if(piece == CHESS_EMPTY_SQUARE || PIECE_COLOR(piece) != color || ! (pieceTargets(position, move.from) & BIT(move.to)))
+        return CHESS_MOVE_ILLEGAL;
+
+    if(PIECE_TYPE(piece) == CHESS_PAWN && isPromotionSquare(color, move.to))
+    {
+        switch(bytes[6])
+        {
+        case CHESS_PROMO_QUEEN: move.promotion = CHESS_QUEEN; break;
+        case CHESS_PROMO_ROOK: move.promotion = CHESS_ROOK; break;
+        case CHESS_PROMO_KNIGHT: move.promotion = CHESS_KNIGHT; break;
+        case CHESS_PROMO_BISHOP: move.promotion = CHESS_BISHOP; break;
+        default: return CHESS_MOVE_BAD_PROMOTION;
+        }
+    }
+    else if(bytes[6] != CHESS_PROMO_NONE)
+    {
+        return CHESS_MOVE_BAD_PROMOTION;
+    }
+
+    if((bytes[9] != 0) != isCapture(position, move))
+        return CHESS_MOVE_BAD_CAPTURE_FLAG;
+
+    ChessPosition after;
+    if( ! tryMove(position, move, &after) )
+        return CHESS_MOVE_ILLEGAL;
+
+    if(bytes[8] != (position->castleRights & ~after.castleRights))
+        return CHESS_MOVE_BAD_CASTLE_RIGHTS;
+
+    *position = after;
+    return CHESS_MOVE_OK;
+}
+
+void chessMoveToMessage(ChessPosition const* position, ChessMove move, char* msg)
+{
+    memset(msg, 0, MOVE_MSGSIZE);
+    msg[0] = MOVE_MSGTYPE;
+    msg[1] = MOVE_MSGSIZE;
+    msg[2] = (char)squareFile(move.from);
+    msg[3] = (char)squareRank(move.from);
+    msg[4] = (char)squareFile(move.to);
+    msg[5] = (char)squareRank(move.to);
+
+    switch(move.promotion)
+    {
+    case CHESS_QUEEN: msg[6] = CHESS_PROMO_QUEEN; break;
+    case CHESS_ROOK: msg[6] = CHESS_PROMO_ROOK; break;
+    case CHESS_KNIGHT: msg[6] = CHESS_PROMO_KNIGHT; break;
+    case CHESS_BISHOP: msg[6] = CHESS_PROMO_BISHOP; break;
+    default: msg[6] = CHESS_PROMO_NONE;
+    }
+
+    ChessPosition after = *position;
+    chessMakeMove(&after, move);
+    msg[8] = (char)(position->castleRights & ~after.castleRights);
+    msg[9] = isCapture(position, move);
+}
+
+char const* chessMoveVerdictName(ChessMoveVerdict verdict)
+{
+    switch(verdict)
+    {
+    case CHESS_MOVE_OK: return "ok";
+    case CHESS_MOVE_NOT_YOUR_TURN: return "not their turn";
+    case CHESS_MOVE_OFF_THE_BOARD: return "off the board";
+    case CHESS_MOVE_ILLEGAL: return "illegal move";
+    case CHESS_MOVE_BAD_PROMOTION: return "bad promotion";
+    case CHESS_MOVE_BAD_CASTLE_RIGHTS: return "bad castling rights";
+    case CHESS_MOVE_BAD_CAPTURE_FLAG: return "bad capture flag";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef CHESS_RULES_H
+#define CHESS_RULES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chessNetworkProtocol.h"
+
+//The rules of chess, for the server side move validation of the game workers (see CHESS_SERVER_VALIDATE_MOVES in serverConfig.h)
+//and for the perft benchmark (benchmarks/perft). A position is a set of bitboards plus a piece per square.
+//Knight, king and pawn attacks come from tables, and rook, bishop and queen attacks from magic bitboards
+//(or from PEXT when CHESS_RULES_USE_PEXT is defined, for cpus with a fast BMI2 pext instruction), so checking one
+//move is a handful of table lookups plus one copy of the position. No move list is generated to check a move.
+//
+//A square is file + 8 * rank, with the same files and ranks (0-7) as MOVE_MSGTYPE, so a1 is 0 and h8 is 63.
+//Nothing here is thread safe except reading the tables after chessRulesInit(), and a position belongs to one thread.
+
+typedef enum
+{
+    CHESS_PAWN,
+    CHESS_KNIGHT,
+    CHESS_BISHOP,
+    CHESS_ROOK,
+    CHESS_QUEEN,
+    CHESS_KING,
+    CHESS_NUM_OF_PIECE_TYPES
+}ChessPieceType;
+
+#define CHESS_WHITE 0
+#define CHESS_BLACK 1
+
+#define CHESS_NO_SQUARE 64
+
+//what ChessPosition::squares holds for an empty square
+#define CHESS_EMPTY_SQUARE 0xFF
+
+//The castling rights bits, which are also the bits of the rightsToRevoke byte of MOVE_MSGTYPE
+//(ChessMove::rightsToRevoke in the client)
+#define CHESS_CASTLE_WHITE_SHORT 1
+#define CHESS_CASTLE_WHITE_LONG 2
+#define CHESS_CASTLE_BLACK_SHORT 4
+#define CHESS_CASTLE_BLACK_LONG 8
+#define CHESS_CASTLE_ALL 15
+
+//The PromoType byte of MOVE_MSGTYPE (enum PromoType in moveInfo.h of the client). 0 on every move that is not a promotion
+typedef enum
+{
+    CHESS_PROMO_NONE = 0,
+    CHESS_PROMO_QUEEN,
+    CHESS_PROMO_ROOK,
+    CHESS_PROMO_KNIGHT,
+    CHESS_PROMO_BISHOP
+}ChessPromoType;
+
+typedef struct
+{
+    uint64_t byType[CHESS_NUM_OF_PIECE_TYPES];
+    uint64_t byColor[2];
+
+    //(color << 3) | ChessPieceType of the piece on every square, or CHESS_EMPTY_SQUARE
+    uint8_t squares[64];
+
+    uint8_t sideToMove;//CHESS_WHITE or CHESS_BLACK
+    uint8_t castleRights;//CHESS_CASTLE_ bits
+
+    //the square a pawn that just moved two squares skipped over, or CHESS_NO_SQUARE
+    uint8_t epSquare;
+
+}ChessPosition;
+
+//castling is the king moving two squares. promotion is the ChessPieceType the pawn becomes, or CHESS_PAWN if the move is not a promotion
+typedef struct
+{
+    uint8_t from;
+    uint8_t to;
+    uint8_t promotion;
+}ChessMove;
+
+//more than any position can have
+#define CHESS_MAX_MOVES 256
+
+//why chessPlayMoveMessage() did not play a move
+typedef enum
+{
+    CHESS_MOVE_OK,
+    CHESS_MOVE_NOT_YOUR_TURN,
+    CHESS_MOVE_OFF_THE_BOARD,//a file or rank byte past 7
+    CHESS_MOVE_ILLEGAL,//not a legal move of one of the mover's pieces
+    CHESS_MOVE_BAD_PROMOTION,//a pawn reached the last rank without a valid PromoType, or a PromoType on any other move
+    CHESS_MOVE_BAD_CASTLE_RIGHTS,//rightsToRevoke is not the castling rights the move takes away
+    CHESS_MOVE_BAD_CAPTURE_FLAG//wasCapture does not say whether the move captures (en passant included)
+}ChessMoveVerdict;
+
+//Has to be called once before anything else here. Builds the attack tables (and finds the magic numbers), which takes tens of ms.
+void chessRulesInit(void);
+
+//the starting position
+void chessPositionInit(ChessPosition* position);
+
+//the first four fields of a FEN (the move counters are ignored). returns false if fen is not valid
+bool chessPositionFromFen(ChessPosition* position, char const* fen);
+
+//Write every legal move of the side to move into moves (room for CHESS_MAX_MOVES) and return how many there are.
+//For perft, the server never needs a move list.
+size_t chessGenerateMoves(ChessPosition const* position, ChessMove* moves);
+
+//play move, which has to be legal
+void chessMakeMove(ChessPosition* position, ChessMove move);
+
+//Check the MOVE_MSGTYPE msg (header included) sent by the player playing side, and play it if it is legal and every byte
+//the server can check is right: the squares, the PromoType, rightsToRevoke and wasCapture. The MoveInfo byte is not checked.
+//position is only changed if CHESS_MOVE_OK is returned.
+ChessMoveVerdict chessPlayMoveMessage(ChessPosition* position, Side side, char const* msg);
+
+//Fill in the MOVE_MSGTYPE (header included) a client would send for move in position. move has to be legal. MoveInfo is left 0
+void chessMoveToMessage(ChessPosition const* position, ChessMove move, char* msg);
+
+//for logging
+char const* chessMoveVerdictName(ChessMoveVerdict verdict);
+
+#endif //CHESS_RULES_H
@@ -0,0 +1,249 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "connectionIndex.h"
+#include "errorLogger.h"
+
+//grow when more than 3/4 of the slots are used (keys and tombstones)
+#define MAX_LOAD_NUMERATOR   3
+#define MAX_LOAD_DENOMINATOR 4
+
+//number of old table slots migrated by every write while the index is growing.
+//the migration is always done well before the new table reaches its max load.
+#define MIGRATION_STEP 8
+
+#define MAKE_SLOT(key, handle) ((LONG64)(((uint64_t)(key) << 32) | (uint32_t)(handle)))
+#define SLOT_KEY(slot)    ((uint32_t)((uint64_t)(slot) >> 32))
+#define SLOT_HANDLE(slot) ((uint32_t)(slot))
+
+//fibonacci hashing. spreads sequential IDs across the table
+static size_t hashID(ConnectionIndexTable const* table, uint32_t uniqueID)
+{
+    return (size_t)((uniqueID * 2654435769u) >> table->hashShift);
+}
+
+static ConnectionIndexTable* tableCreate(size_t capacity)
+{
+    size_t powerOf2 = 16;
+    uint32_t log2 = 4;
+    while(powerOf2 < capacity)
+    {
+        powerOf2 <<= 1;
+        ++log2;
+    }
+
+    //calloc makes every slot CONNECTION_INDEX_EMPTY_KEY
+    ConnectionIndexTable* table = calloc(1, sizeof(ConnectionIndexTable) + powerOf2 * sizeof(LONG64));
+    if( ! table )
+    {
+        logError("calloc failed to allocate a connection index table", 0);
+        return NULL;
+    }
+
+    table->capacity = powerOf2;
+    table->hashShift = 32 - log2;
+    return table;
+}
+
+//returns the slot holding uniqueID or NULL
+static volatile LONG64* tableFind(ConnectionIndexTable* table, uint32_t uniqueID)
+{
+    size_t const mask = table->capacity - 1;
+    for(size_t i = hashID(table, uniqueID);; i = (i + 1) & mask)
+    {
+        LONG64 const slot = ReadAcquire64(table->slots + i);
+        uint32_t const key = SLOT_KEY(slot);
+
+        if(key == uniqueID) return table->slots + i;
+        if(key == CONNECTION_INDEX_EMPTY_KEY) return NULL;
+    }
+}
+
+//uniqueID must not already be in table. returns true if an empty slot (not a tombstone) was used
+static bool tableInsert(ConnectionIndexTable* table, uint32_t uniqueID, uint32_t handle)
+{
+    size_t const mask = table->capacity - 1;
+    for(size_t i = hashID(table, uniqueID);; i = (i + 1) & mask)
+    {
+        uint32_t const key = SLOT_KEY(table->slots[i]);
+        if(key == CONNECTION_INDEX_EMPTY_KEY || key == CONNECTION_INDEX_TOMBSTONE_KEY)
+        {
+            WriteRelease64(table->slots + i, MAKE_SLOT(uniqueID, handle));
+            return key == CONNECTION_INDEX_EMPTY_KEY;
+        }
+    }
+}
+
+//migrate up to numOfSlots slots of the old table. lock writeMutex before calling
+static void migrateSome(ConnectionIndex* index, size_t numOfSlots)
+{
+    ConnectionIndexTable* const table = index->table;
+    ConnectionIndexTable* const oldTable = table->migratingFrom;
+    if( ! oldTable ) return;
+
+    //numOfSlots can be SIZE_MAX (finish the migration), so dont let migrationPos + numOfSlots wrap around
+    size_t const end = (numOfSlots >= oldTable->capacity - index->migrationPos) ?
+        oldTable->capacity : index->migrationPos + numOfSlots;
+    for(; index->migrationPos < end; ++index->migrationPos)
+    {
+        //the entry stays in the old table too, so a reader that
+        //already looked in the new table can still find it in the old one
+        LONG64 const slot = oldTable->slots[index->migrationPos];
+        uint32_t const key = SLOT_KEY(slot);
+        if(key != CONNECTION_INDEX_EMPTY_KEY && key != CONNECTION_INDEX_TOMBSTONE_KEY)
+        {
+            if(tableInsert(table, key, SLOT_HANDLE(slot)))
+                ++index->numOfUsedSlots;
+        }
+    }
+
+    if(index->migrationPos == oldTable->capacity)
+    {
+        //release store. readers who see NULL are guaranteed to see every migrated slot
+        InterlockedExchangePointer((void* volatile*)&table->migratingFrom, NULL);
+        oldTable->nextRetired = index->retiredTables;
+        index->retiredTables = oldTable;
+    }
+}
+
+//start migrating to a new table if the current one is too full. lock writeMutex before calling
+static bool growIfNeeded(ConnectionIndex* index)
+{
+    ConnectionIndexTable* const table = index->table;
+    if((index->numOfUsedSlots + 1) * MAX_LOAD_DENOMINATOR <= table->capacity * MAX_LOAD_NUMERATOR)
+        return true;
+
+    //never have more than one migration going on at a time
+    migrateSome(index, SIZE_MAX);
+    assert( ! table->migratingFrom );
+
+    //if the table is mostly tombstones just rebuild it at the same size
+    size_t const newCapacity = (index->numOfKeys * 2 >= table->capacity) ? table->capacity * 2 : table->capacity;
+    ConnectionIndexTable* newTable = tableCreate(newCapacity);
+    if( ! newTable ) return false;
+
+    newTable->migratingFrom = table;
+    index->migrationPos = 0;
+    index->numOfUsedSlots = 0;
+
+    //release store, so readers see newTable->migratingFrom along with newTable
+    InterlockedExchangePointer((void* volatile*)&index->table, newTable);
+    return true;
+}
+
+bool connectionIndexInit(ConnectionIndex* index, size_t initialCapacity)
+{
+    memset(index, 0, sizeof(*index));
+    index->table = tableCreate(initialCapacity * MAX_LOAD_DENOMINATOR / MAX_LOAD_NUMERATOR + 1);
+    if( ! index->table ) return false;
+
+    InitializeCriticalSection(&index->writeMutex);
+    return true;
+}
+
+void connectionIndexDestroy(ConnectionIndex* index)
+{
+    ConnectionIndexTable* table = index->table;
+    if(table && table->migratingFrom)
+    {
+        table->migratingFrom->nextRetired = index->retiredTables;
+        index->retiredTables = table->migratingFrom;
+    }
+
+    free(table);
+
+    while(index->retiredTables)
+    {
+        ConnectionIndexTable* next = index->retiredTables->nextRetired;
+        free(index->retiredTables);
+        index->retiredTables = next;
+    }
+
+    DeleteCriticalSection(&index->writeMutex);
+    index->table = NULL;
+}
+
+bool connectionIndexInsert(ConnectionIndex* index, uint32_t uniqueID, uint32_t handle)
+{
+    assert(uniqueID != CONNECTION_INDEX_EMPTY_KEY && uniqueID != CONNECTION_INDEX_TOMBSTONE_KEY);
+
+    EnterCriticalSection(&index->writeMutex);
+
+    migrateSome(index, MIGRATION_STEP);
+
+    bool inserted = false;
+    ConnectionIndexTable* oldTable = index->table->migratingFrom;
+    if( ! tableFind(index->table, uniqueID) && ! (oldTable && tableFind(oldTable, uniqueID)) && growIfNeeded(index) )
+    {
+        //new keys only go into the newest table
+        if(tableInsert(index->table, uniqueID, handle))
+            ++index->numOfUsedSlots;
+
+        ++index->numOfKeys;
+        inserted = true;
+    }
+
+    LeaveCriticalSection(&index->writeMutex);
+    return inserted;
+}
+
+bool connectionIndexUpdate(ConnectionIndex* index, uint32_t uniqueID, uint32_t handle)
+{
+    EnterCriticalSection(&index->writeMutex);
+
+    //a key that is being migrated can be in both tables, so keep both copies up to date
+    ConnectionIndexTable* const table = index->table;
+    volatile LONG64* slot = tableFind(table, uniqueID);
+    volatile LONG64* oldSlot = table->migratingFrom ? tableFind(table->migratingFrom, uniqueID) : NULL;
+
+    if(slot) WriteRelease64(slot, MAKE_SLOT(uniqueID, handle));
+    if(oldSlot) WriteRelease64(oldSlot, MAKE_SLOT(uniqueID, handle));
+
+    LeaveCriticalSection(&index->writeMutex);
+    return slot || oldSlot;
+}
+
+bool connectionIndexRemove(ConnectionIndex* index, uint32_t uniqueID)
+{
+    EnterCriticalSection(&index->writeMutex);
+
+    migrateSome(index, MIGRATION_STEP);
+
+    ConnectionIndexTable* const table = index->table;
+    volatile LONG64* slot = tableFind(table, uniqueID);
+    volatile LONG64* oldSlot = table->migratingFrom ? tableFind(table->migratingFrom, uniqueID) : NULL;
+
+    if(slot) WriteRelease64(slot, MAKE_SLOT(CONNECTION_INDEX_TOMBSTONE_KEY, 0));
+    if(oldSlot) WriteRelease64(oldSlot, MAKE_SLOT(CONNECTION_INDEX_TOMBSTONE_KEY, 0));
+
+    bool const removed = slot || oldSlot;
+    if(removed) --index->numOfKeys;
+
+    LeaveCriticalSection(&index->writeMutex);
+    return removed;
+}
+
+bool connectionIndexLookup(ConnectionIndex const* index, uint32_t uniqueID, uint32_t* handleOut)
+{
+    if(uniqueID == CONNECTION_INDEX_EMPTY_KEY || uniqueID == CONNECTION_INDEX_TOMBSTONE_KEY)
+        return false;
+
+    //read migratingFrom before probing the table. if it is already NULL, every key of the
+    //old table was migrated before we look. otherwise the old table still has every key it had.
+    ConnectionIndexTable* const table = ReadPointerAcquire((PVOID const volatile*)&index->table);
+    ConnectionIndexTable* const oldTable = ReadPointerAcquire((PVOID const volatile*)&table->migratingFrom);
+
+    volatile LONG64* slot = tableFind(table, uniqueID);
+    if( ! slot && oldTable ) 
+        slot = tableFind(oldTable, uniqueID);
+
+    if( ! slot ) return false;
+
+    //the slot could have been removed since tableFind() read it
+    LONG64 const value = ReadAcquire64(slot);
+    if(SLOT_KEY(value) != uniqueID) return false;
+
+    *handleOut = SLOT_HANDLE(value);
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef CONNECTION_INDEX_H
+#define CONNECTION_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+//These two uniqueIDs are reserved by the index to mark empty and deleted slots,
+//so they must never be handed out to a player.
+#define CONNECTION_INDEX_EMPTY_KEY     0u
+#define CONNECTION_INDEX_TOMBSTONE_KEY UINT32_MAX
+
+//Each slot packs a uniqueID (high 32 bits) and a connection handle (low 32 bits)
+//so that a slot is always read and written with a single 64 bit load/store.
+typedef struct ConnectionIndexTable
+{
+    //While the index is growing, this points at the smaller table that is still being migrated.
+    //Readers check it when a key is not found in this table. It is set to NULL once the migration is done.
+    struct ConnectionIndexTable* volatile migratingFrom;
+
+    //retired tables are kept in a list until connectionIndexDestroy(), since
+    //a reader might still be probing one (they only add up to the size of the current table)
+    struct ConnectionIndexTable* nextRetired;
+
+    size_t capacity;//always a power of 2
+    uint32_t hashShift;
+    volatile LONG64 slots[];
+
+}ConnectionIndexTable;
+
+//A thread safe open addressing (linear probing) hash table that maps a player's uniqueID to a connection handle.
+//Lookups never take a lock, so a lobby thread can read while other threads insert or remove.
+//Writers are serialized by writeMutex. Growing the table is incremental: every write migrates
+//a few slots of the old table, so no single call ever has to rehash the whole table.
+typedef struct
+{
+    ConnectionIndexTable* volatile table;
+
+    CRITICAL_SECTION writeMutex;
+
+    //the next slot of table->migratingFrom to migrate
+    size_t migrationPos;
+
+    //number of live keys, and the number of slots in table that are not empty (keys + tombstones)
+    size_t numOfKeys;
+    size_t numOfUsedSlots;
+
+    ConnectionIndexTable* retiredTables;
+
+}ConnectionIndex;
+
+//returns false if the initial table could not be allocated
+bool connectionIndexInit(ConnectionIndex* index, size_t initialCapacity);
+void connectionIndexDestroy(ConnectionIndex* index);
+
+//returns false if uniqueID is already in the index (or if growing the table failed)
+bool connectionIndexInsert(ConnectionIndex* index, uint32_t uniqueID, uint32_t handle);
+
+//change the handle that uniqueID maps to. returns false if uniqueID is not in the index
+bool connectionIndexUpdate(ConnectionIndex* index, uint32_t uniqueID, uint32_t handle);
+
+//returns false if uniqueID is not in the index
+bool connectionIndexRemove(ConnectionIndex* index, uint32_t uniqueID);
+
+//lock free. returns false if uniqueID is not in the index, otherwise writes its handle to handleOut
+bool connectionIndexLookup(ConnectionIndex const* index, uint32_t uniqueID, uint32_t* handleOut);
+
+#endif //CONNECTION_INDEX_H
@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "connectionPool.h"
+#include "errorLogger.h"
+
+#define HANDLE_INDEX(handle) ((handle) & CONNECTION_POOL_MAX_CAPACITY)
+#define HANDLE_GENERATION(handle) ((uint32_t)(handle) >> CONNECTION_HANDLE_INDEX_BITS)
+#define MAKE_HANDLE(generation, index) (((uint32_t)(generation) << CONNECTION_HANDLE_INDEX_BITS) | (uint32_t)(index))
+
+#define NO_FREE_CONNECTION UINT32_MAX
+
+//s_chunks[i] holds the connections with the indices [i * CONNECTION_POOL_CHUNK_SIZE, (i + 1) * CONNECTION_POOL_CHUNK_SIZE).
+//a chunk pointer is NULL until the pool grows into it, and then it never changes
+static Connection* volatile* s_chunks = NULL;
+static size_t s_maxCapacity = 0;
+static volatile size_t s_capacity = 0;
+
+//The free connections, linked through Connection::nextFree. It is a queue rather than a stack, so a freed connection
+//is only reused after every other free connection was, which keeps its generation from wrapping around quickly.
+static uint32_t s_freeHead = NO_FREE_CONNECTION;//next index to hand out
+static uint32_t s_freeTail = NO_FREE_CONNECTION;
+
+//allocations come from the acceptor threads and frees from the lobby and the game workers.
+//both only hold it for a couple of loads and stores (unless the pool has to grow)
+static CRITICAL_SECTION s_poolMutex;
+
+static Connection* connectionAt(size_t index)
+{
+    Connection* chunk = ReadPointerAcquire((PVOID const volatile*)(s_chunks + index / CONNECTION_POOL_CHUNK_SIZE));
+    return chunk ? chunk + (index & (CONNECTION_POOL_CHUNK_SIZE - 1)) : NULL;
+}
+
+//lock s_poolMutex before calling
+static void pushFree(Connection* connection, uint32_t index)
+{
+    connection->nextFree = NO_FREE_CONNECTION;
+
+    if(s_freeTail == NO_FREE_CONNECTION)
+        s_freeHead = index;
+    else
+        connectionAt(s_freeTail)->nextFree = index;
+
+    s_freeTail = index;
+}
+
+//allocate the next chunk and put its connections in the free list. lock s_poolMutex before calling.
+//returns false if the pool is already as big as it can get (or calloc failed)
+static bool growPool(void)
+{
+    size_t const oldCapacity = s_capacity;
+    if(oldCapacity >= s_maxCapacity)
+        return false;
+
+    Connection* chunk = calloc(CONNECTION_POOL_CHUNK_SIZE, sizeof(Connection));
+    if( ! chunk )
+    {
+        logError("calloc failed to grow the connection pool", 0);
+        return false;
+    }
+
+    size_t const newCapacity = min(oldCapacity + CONNECTION_POOL_CHUNK_SIZE, s_maxCapacity);
+    for(size_t i = oldCapacity; i < newCapacity; ++i)
+    {
+        Connection* connection = chunk + (i - oldCapacity);
+        connection->handle = (LONG)MAKE_HANDLE(1, i);
+        connection->socket = INVALID_SOCKET;
+    }
+
+    //release store, so connectionPoolGet() on another thread sees the initialized connections
+    InterlockedExchangePointer((PVOID volatile*)(s_chunks + oldCapacity / CONNECTION_POOL_CHUNK_SIZE), chunk);
+    s_capacity = newCapacity;
+
+    for(size_t i = oldCapacity; i < newCapacity; ++i)
+        pushFree(chunk + (i - oldCapacity), (uint32_t)i);
+
+    logInfo("the connection pool grew to %zu connections (%llu KB)", newCapacity,
+        (unsigned long long)(newCapacity * sizeof(Connection) / 1024));
+    return true;
+}
+
+void connectionPoolInit(size_t maxCapacity)
+{
+    assert( ! s_chunks );
+    assert(maxCapacity > 0 && maxCapacity <= CONNECTION_POOL_MAX_CAPACITY);
+
+    size_t const numOfChunks = (maxCapacity + CONNECTION_POOL_CHUNK_SIZE - 1) / CONNECTION_POOL_CHUNK_SIZE;
+    s_chunks = calloc(numOfChunks, sizeof(Connection*));
+    if( ! s_chunks )
+    {
+        logError("calloc failed to allocate the chunk table of the connection pool", 0);
+        exit(0);
+    }
+
+    s_maxCapacity = maxCapacity;
+    InitializeCriticalSection(&s_poolMutex);
+}
+
+size_t connectionPoolMaxCapacity(void)
+{
+    return s_maxCapacity;
+}
+
+size_t connectionPoolCapacity(void)
+{
+    return s_capacity;
+}
+
+#define STATE_BIT(state) (1u << CONNECTION_##state)
+
+//the states each state can go to (see ConnectionState)
+static uint32_t const s_nextStates[NUM_OF_CONNECTION_STATES] =
+{
+    [CONNECTION_FREE]        = STATE_BIT(ACCEPTED),
+    [CONNECTION_ACCEPTED]    = STATE_BIT(IN_LOBBY) | STATE_BIT(HANDED_OVER) | STATE_BIT(FREE),
+    [CONNECTION_IN_LOBBY]    = STATE_BIT(HANDED_OVER) | STATE_BIT(FREE),
+    [CONNECTION_HANDED_OVER] = STATE_BIT(PLAYING) | STATE_BIT(SPECTATING) | STATE_BIT(IN_LOBBY) | STATE_BIT(FREE),
+    [CONNECTION_PLAYING]     = STATE_BIT(IN_LOBBY) | STATE_BIT(LEAVING) | STATE_BIT(CLOSING) | STATE_BIT(FREE),
+    [CONNECTION_SPECTATING]  = STATE_BIT(IN_LOBBY) | STATE_BIT(LEAVING) | STATE_BIT(CLOSING) | STATE_BIT(FREE),
+    [CONNECTION_LEAVING]     = STATE_BIT(IN_LOBBY),
+    [CONNECTION_CLOSING]     = STATE_BIT(FREE),
+};
+
+void connectionSetState(Connection* connection, ConnectionState state)
+{
+    assert(s_nextStates[connection->state] & (1u << state));
+    connection->state = state;
+}
+
+Connection* connectionPoolAlloc(SOCKET sock, SOCKADDR_IN const* addr)
+{
+    assert(s_chunks);//assert that connectionPoolInit() has been called
+
+    EnterCriticalSection(&s_poolMutex);
+
+    if(s_freeHead == NO_FREE_CONNECTION && ! growPool())
+    {
+        LeaveCriticalSection(&s_poolMutex);
+        return NULL;
+    }
+
+    Connection* connection = connectionAt(s_freeHead);
+    s_freeHead = connection->nextFree;
+    if(s_freeHead == NO_FREE_CONNECTION)
+        s_freeTail = NO_FREE_CONNECTION;
+
+    LeaveCriticalSection(&s_poolMutex);
+
+    //the handle was already moved to the next generation by connectionPoolFree()
+    connectionSetState(connection, CONNECTION_ACCEPTED);
+    connection->socket = sock;
+    connection->addr = *addr;
+    InetNtopA(addr->sin_family, &addr->sin_addr, connection->ipStr, INET6_ADDRSTRLEN);
+    messageFramerInit(&connection->in);
+    outBufferInit(&connection->out);
+    connection->isReadPaused = false;
+    connection->uniqueID = 0;
+    connection->isFlushScheduled = false;
+    connection->isDisconnecting = false;
+    connection->pairRequestTargetID = 0;
+    connection->isPairRequestDeclined = false;
+    timerNodeInit(&connection->pairRequestTimer);
+    matchmakingNodeInit(&connection->matchmakingNode);
+    connection->side = INVALID;
+    connection->lastRecvNs = 0;
+    registeredIOSocketInit(&connection->rio);
+
+    return connection;
+}
+
+void connectionPoolFree(Connection* connection)
+{
+    uint32_t const index = HANDLE_INDEX((uint32_t)connection->handle);
+    assert(connectionAt(index) == connection);
+
+    //make every handle to this connection stale before anyone can allocate it again
+    uint32_t generation = HANDLE_GENERATION((uint32_t)connection->handle) + 1;
+    if(HANDLE_GENERATION(MAKE_HANDLE(generation, 0)) == 0)
+        generation = 1;
+
+    connectionSetState(connection, CONNECTION_FREE);
+    WriteRelease((volatile LONG*)&connection->handle, (LONG)MAKE_HANDLE(generation, index));
+    connection->socket = INVALID_SOCKET;
+    registeredIOSocketClosed(&connection->rio);
+
+    EnterCriticalSection(&s_poolMutex);
+    pushFree(connection, index);
+    LeaveCriticalSection(&s_poolMutex);
+}
+
+Connection* connectionPoolGet(ConnectionHandle handle)
+{
+    size_t const index = HANDLE_INDEX(handle);
+    if(handle == CONNECTION_HANDLE_NONE || index >= s_maxCapacity)
+        return NULL;
+
+    Connection* connection = connectionAt(index);
+    if( ! connection )
+        return NULL;
+
+    return ((ConnectionHandle)ReadAcquire(&connection->handle) == handle) ? connection : NULL;
+}
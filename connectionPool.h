@@ -0,0 +1,164 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "chessNetworkProtocol.h"
+#include "messageFramer.h"
+#include "networkWrite.h"
+#include "timerWheel.h"
+#include "matchmaking.h"
+#include "registeredIO.h"
+
+//Every client connection lives in one pool. The pool grows on demand, CONNECTION_POOL_CHUNK_SIZE connections at a time,
+//up to the capacity it was created with (see the memory budget in serverConfig.h). Chunks are never moved or freed,
+//so a connection never moves or gets copied while it is in use: the lobby and the game workers only keep pointers to it,
+//and it is handed from one thread to another (lobby -> game worker -> lobby) as a ConnectionHandle.
+//
+//A handle is the index of the connection in the pool plus a generation that is bumped every time the connection is freed.
+//So a handle that outlived its connection (or a handle that was held on to after the slot was reused) is detected
+//by connectionPoolGet() instead of pointing at someone else's connection.
+//
+//A connection is owned by one thread at a time (the acceptor thread that accepted it until lobbyInsert(), then a lobby thread,
+//then a game worker after startChessGame() and so on), and only the owner reads or writes it.
+typedef uint32_t ConnectionHandle;
+
+//never a valid handle
+#define CONNECTION_HANDLE_NONE 0u
+
+//the low bits of a handle are the index, the rest is the generation (which is never 0)
+#define CONNECTION_HANDLE_INDEX_BITS 20
+#define CONNECTION_POOL_MAX_CAPACITY ((1u << CONNECTION_HANDLE_INDEX_BITS) - 1)
+
+//how many connections the pool allocates at a time. must be a power of 2
+#define CONNECTION_POOL_CHUNK_SIZE 1024
+
+//Where a connection is in its life, which also says which thread owns it. Every step goes through connectionSetState(),
+//which asserts that it is one of these (so a connection handed on twice, or freed by a thread that does not own it, is caught
+//where it happens instead of when two threads trip over it later):
+//
+//  FREE -> ACCEPTED                        connectionPoolAlloc() on the acceptor thread (or in main() for a hot upgrade)
+//  ACCEPTED -> IN_LOBBY                    lobbyInsert()
+//  ACCEPTED -> HANDED_OVER                a player or spectator a hot upgrade handed over (see gameManagerTakeOver())
+//  IN_LOBBY -> HANDED_OVER                 the lobby took them out to start, resume or watch a game
+//  HANDED_OVER -> PLAYING | SPECTATING     the game worker took them (see gameManager.c)
+//  HANDED_OVER -> IN_LOBBY                 the game could not be started, resumed or watched after all
+//(a lobby member who moves from one lobby shard to another stays IN_LOBBY, see lobbyManager.c)
+//  PLAYING -> IN_LOBBY                     the game is over for them
+//  SPECTATING -> IN_LOBBY                  the game they watched ended, or they stopped watching
+//  PLAYING | SPECTATING -> LEAVING         the game is over for them, but Registered I/O still has something of theirs in flight
+//  PLAYING | SPECTATING -> CLOSING         they were closed, but Registered I/O still has something of theirs in flight
+//  LEAVING -> IN_LOBBY, CLOSING -> FREE    what was in flight completed
+//  anything else but LEAVING -> FREE       connectionPoolFree() by the owner, after closing the socket
+typedef enum
+{
+    CONNECTION_FREE,
+    CONNECTION_ACCEPTED,
+    CONNECTION_IN_LOBBY,
+    CONNECTION_HANDED_OVER,
+    CONNECTION_PLAYING,
+    CONNECTION_SPECTATING,
+    CONNECTION_LEAVING,
+    CONNECTION_CLOSING,
+    NUM_OF_CONNECTION_STATES
+}ConnectionState;
+
+typedef struct Connection
+{
+    //the handle of this connection right now. it changes when the connection is freed, which is what makes old handles stale
+    volatile LONG handle;
+
+    //the index of the next connection in the pool's free list while this one is free
+    uint32_t nextFree;
+
+    //only changed with connectionSetState()
+    ConnectionState state;
+
+    SOCKET socket;
+    SOCKADDR_IN addr;
+    char ipStr[INET6_ADDRSTRLEN];
+
+    //bytes received from this connection that are not a whole message yet.
+    //kept when the connection goes between the lobby and a game, so nothing that was already received is lost
+    MessageFramer in;
+
+    //bytes waiting to be sent on this connection. flushed by whoever owns the connection right now,
+    //so whatever a game queued is still sent (before anything from the lobby) after the connection goes back to the lobby
+    OutBuffer out;
+
+    //true while the owner stops reading from this connection because of backpressure (see OUT_BUFFER_HIGH_WATERMARK).
+    //in the lobby it is this connection's own write queue, in a game it is the opponent's
+    bool isReadPaused;
+
+    //only used while the connection is in the lobby
+
+    //Everyone connected and in the lobby has a unique identifier from idAllocator.h.
+    //It is the key of the hash table index of their lobby shard (see connectionIndex.h), and says which shard that is.
+    //A player gets a new ID every time they are put into the lobby, and keeps it while they move between shards.
+    uint32_t uniqueID;
+
+    //where this connection is in its lobby shard's array of members (and so in its WSAPoll() set)
+    uint32_t lobbyIndex;
+
+    //true while uniqueID is in its lobby shard's list of connections to flush
+    bool isFlushScheduled;
+
+    //set when this member went past their write queue limit or sending to them failed.
+    //they are closed at the end of the lobby loop iteration
+    bool isDisconnecting;
+
+    //The uniqueID of the lobby member this member sent their last PAIR_REQUEST_MSGTYPE to (0 if none). While pairRequestTimer
+    //is scheduled the request is outstanding and the member can not send another one (they get PAIR_REQUEST_TOO_SOON_MSGTYPE).
+    //The timer goes off PAIR_REQUEST_TIMEOUT_SECS after the request, and sends a PAIR_NORESPONSE_MSGTYPE if it was never answered.
+    uint32_t pairRequestTargetID;
+    bool isPairRequestDeclined;
+    TimerNode pairRequestTimer;
+
+    //queued while this member is waiting in the lobby's matchmaking queue (they sent a FIND_GAME_MSGTYPE)
+    MatchmakingNode matchmakingNode;
+
+    //only used while the connection is in a chess game
+
+    Side side;//white or black pieces
+
+    //getMonotonicNanoseconds() right after the last recv() from this player. for METRIC_HISTOGRAM_FORWARD_LATENCY
+    uint64_t lastRecvNs;
+
+    //the request queue of the socket once a game worker used Registered I/O with it (see registeredIO.h).
+    //it stays tied to that worker's completion queue until the socket is closed, even while the connection is somewhere else
+    RegisteredIOSocket rio;
+
+}Connection;
+
+//Has to be called once before any connection is allocated. Only the chunk table is allocated up front.
+//Exits if it can not be allocated.
+void connectionPoolInit(size_t maxCapacity);
+
+//the most connections the pool will ever hold
+size_t connectionPoolMaxCapacity(void);
+
+//how many connections the pool has allocated memory for so far
+size_t connectionPoolCapacity(void);
+
+//Thread safe. Takes a connection out of the pool for a newly accepted socket. O(1), except when the pool
+//has to grow by a chunk. Returns NULL if every connection is in use and the pool can not grow any more.
+Connection* connectionPoolAlloc(SOCKET sock, SOCKADDR_IN const* addr);
+
+//Thread safe and O(1). Gives the connection back to the pool (the socket has to be closed by the caller).
+//Every handle to it is stale from now on.
+void connectionPoolFree(Connection* connection);
+
+//Move the connection to the next state of its life (see ConnectionState). Only the thread that owns the connection calls this,
+//and a hand over to another thread sets the state before the handle is passed on
+void connectionSetState(Connection* connection, ConnectionState state);
+
+//Returns the connection handle refers to, or NULL if handle is stale (or CONNECTION_HANDLE_NONE).
+//Only the thread that owns the connection (or that it is being handed to) may use what this returns.
+Connection* connectionPoolGet(ConnectionHandle handle);
+
+#endif //CONNECTION_POOL_H
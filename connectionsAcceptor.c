@@ -12,12 +12,29 @@
 #include "errorLogger.h"
 #include "lobbyManager.h"
 #include "chessNetworkProtocol.h"
+#include "metrics.h"
+#include "serverConfig.h"
+#include "connectionsAcceptor.h"
+#include "admissionControl.h"
+#include "wakeupSocket.h"
+#include "hotUpgrade.h"
 
 #define RECV_MESSAGE_BUFSIZE 256
 #define PORT 42069
 
-extern CONDITION_VARIABLE g_lobbyEmptyCond;
-extern CRITICAL_SECTION   g_lobbyMutex;
+//how many connections an acceptor thread takes out of the backlog before it goes back to WSAPoll()
+#define ACCEPT_BATCH_SIZE 64
+
+//how long an acceptor thread waits before trying again after accept() (or WSAPoll()) failed for a reason other than an empty backlog
+#define ACCEPT_ERROR_BACKOFF_MS 10
+
+static SOCKET s_listenSocket = INVALID_SOCKET;
+
+//Signaled (and never drained) when the server is handed over to a new process, which stops every acceptor thread.
+//The last one to stop sets s_acceptorsStoppedEvent
+static WakeupSocket s_stopWakeup;
+static volatile LONG s_numOfRunningAcceptors = 0;
+static HANDLE s_acceptorsStoppedEvent = NULL;
 
 //returns a valid listen socket file discriptor
 static SOCKET createListenSocket(char const* ip, uint16_t port)
@@ -45,10 +62,12 @@ static SOCKET createListenSocket(char const* ip, uint16_t port)
     }
     else hints.sin_addr.s_addr = INADDR_ANY;
     
-    listenSockfd = socket(PF_INET, SOCK_STREAM, 0);
-    if(listenSockfd == SOCKET_ERROR)
+    //accepted sockets inherit the flag, which they need to get a request queue of Registered I/O (see registeredIO.h)
+    DWORD const socketFlags = g_serverConfig.registeredIO ? (WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO) : WSA_FLAG_OVERLAPPED;
+    listenSockfd = WSASocketA(PF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, socketFlags);
+    if(listenSockfd == INVALID_SOCKET)
     {
-        logError("a call to socket() failed when trying to make the listen socket", WSAGetLastError());
+        logError("a call to WSASocket() failed when trying to make the listen socket", WSAGetLastError());
         WSACleanup();     
         exit(EXIT_FAILURE);
     }
@@ -76,52 +95,169 @@ void printConnection(SOCKADDR_IN* addr)
 {
     char buff[INET6_ADDRSTRLEN] = {0};
     InetNtopA(AF_INET, &addr->sin_addr, buff, sizeof(buff));
-    const char* currentTime = getCurrentTime();
-    printf("%s:%hu connected\nat %s\n\n", buff, addr->sin_port, currentTime);
+    logDebug("%s:%hu connected", buff, ntohs(addr->sin_port));
+}
+
+//Reset a connection that admission control turned away. A linger time of 0 makes closesocket() send a RST
+//instead of going through the FIN handshake, so the server keeps no TIME_WAIT state for the flood.
+static void throttleConnection(SOCKET socketFd)
+{
+    struct linger const hardClose = {1, 0};
+    setsockopt(socketFd, SOL_SOCKET, SO_LINGER, (char const*)&hardClose, sizeof(hardClose));
+    closesocket(socketFd);
+    metricsAdd(METRIC_CONNECTIONS_THROTTLED, 1);
+}
+
+//set up a socket that accept() just returned and hand it to the lobby, or turn it away if the lobby is full
+static void onAccepted(SOCKET socketFd, SOCKADDR_IN* addrInfo)
+{
+    //before anything else, so a host that floods the server with connections never gets near the lobby or the connection pool
+    AdmissionResult const admission = admissionAcquire(addrInfo->sin_addr);
+    if(admission != ADMISSION_OK)
+    {
+        if(admission == ADMISSION_TABLE_FULL)
+            logWarn("the admission control table has no room for another address");
+
+        throttleConnection(socketFd);
+        return;
+    }
+
+    printConnection(addrInfo);
+
+    //the server coalesces its own writes (see networkWrite.h), so nagle's algorithm would only add latency
+    BOOL const noDelay = TRUE;
+    setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof(noDelay));
+
+    //the lobby and the game workers never block on a client's socket (see networkWrite.h)
+    unsigned long nonBlocking = 1;
+    if(ioctlsocket(socketFd, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+    {
+        logError("ioctlsocket() failed to make an accepted socket non blocking", WSAGetLastError());
+        closesocket(socketFd);
+        admissionRelease(addrInfo->sin_addr);
+        return;
+    }
+
+    //the place in the lobby is reserved first (without a lock), so a full lobby does not take a connection out of the pool
+    Connection* connection = NULL;
+    if(lobbyReserveRoom())
+    {
+        connection = connectionPoolAlloc(socketFd, addrInfo);
+        if( ! connection )
+            lobbyCancelReservation();
+    }
+
+    if( ! connection )
+    {
+        char buff[SERVER_FULL_MSGSIZE] = {SERVER_FULL_MSGTYPE, SERVER_FULL_MSGSIZE};
+        send(socketFd, buff, sizeof(buff), 0);
+        closesocket(socketFd);
+        admissionRelease(addrInfo->sin_addr);
+        metricsAdd(METRIC_CONNECTIONS_REJECTED, 1);
+    }
+    else
+    {
+        metricsAdd(METRIC_CONNECTIONS_ACCEPTED, 1);
+        //lobbyInsert() only queues the connection for a lobby thread and wakes it up if it is blocked in WSAPoll()
+        lobbyInsert((ConnectionHandle)connection->handle, true);
+    }
 }
 
 static void acceptNewConnections(SOCKET listenSocket)
 {
-    int addrlen = (int)sizeof(SOCKADDR_IN);
-    puts("server started and is accepting connections...");
+    metricsRegisterThread();
+
+    WSAPOLLFD pollFds[2];
+    pollFds[0].fd = listenSocket;
+    pollFds[0].events = POLLRDNORM;
+    pollFds[1].fd = s_stopWakeup.sock;
+    pollFds[1].events = POLLRDNORM;
 
     while(true)
     {
-        SOCKADDR_IN addrInfo;
-        memset(&addrInfo, 0, sizeof(addrInfo));
-        SOCKET socketFd = accept(listenSocket, (SOCKADDR*)&addrInfo, &addrlen);
-        if(socketFd == SOCKET_ERROR)
+        //every acceptor thread is woken up when the backlog goes from empty to not empty.
+        //the ones that lose the race for the connections just get WSAEWOULDBLOCK from accept() and poll again
+        pollFds[0].revents = pollFds[1].revents = 0;
+        if(WSAPoll(pollFds, 2, -1) == SOCKET_ERROR)
         {
-            logError("accept() failed ", WSAGetLastError());
-            exit(1);
+            logError("WSAPoll() failed on the listen socket", WSAGetLastError());
+            Sleep(ACCEPT_ERROR_BACKOFF_MS);
+            continue;
         }
 
-        printConnection(&addrInfo);
-
-        if(getAvailableLobbyRoom() == 0)
+        //the server is being handed over (see connectionsAcceptorHandOver()). whatever is in the backlog is left for the new process
+        if(pollFds[1].revents)
         {
-            char buff[SERVER_FULL_MSGSIZE] = {SERVER_FULL_MSGTYPE, SERVER_FULL_MSGSIZE};
-            send(socketFd, buff, sizeof(buff), 0);
-            closesocket(socketFd);
+            if(InterlockedDecrement(&s_numOfRunningAcceptors) == 0)
+                SetEvent(s_acceptorsStoppedEvent);
+
+            return;
         }
-        else
+
+        //drain the backlog in a batch instead of going back to WSAPoll() for every connection
+        for(int i = 0; i < ACCEPT_BATCH_SIZE; ++i)
         {
-            bool lobbyWasEmpty = isLobbyEmpty();
-            lobbyInsert(socketFd, &addrInfo);
-            if(lobbyWasEmpty)
+            SOCKADDR_IN addrInfo;
+            int addrlen = (int)sizeof(addrInfo);
+            memset(&addrInfo, 0, sizeof(addrInfo));
+
+            SOCKET socketFd = accept(listenSocket, (SOCKADDR*)&addrInfo, &addrlen);
+            if(socketFd == INVALID_SOCKET)
             {
-                puts("waking the lobby thread up");
-                WakeConditionVariable(&g_lobbyEmptyCond);
+                int const error = WSAGetLastError();
+                if(error == WSAEWOULDBLOCK || error == WSAECONNRESET)
+                    break;//the backlog is empty (or the client gave up while it was in the backlog)
+
+                //most likely out of sockets or buffer space. dont spin on it
+                logError("accept() failed ", error);
+                Sleep(ACCEPT_ERROR_BACKOFF_MS);
+                break;
             }
+
+            onAccepted(socketFd, &addrInfo);
         }
     }
 }
 
-//this is the only function exposed in the .h meant to be the start of a new pthread.
-//there is only meant to be 1 thread spawned from this
-void __stdcall acceptConnectionsThreadStart(void* ptr)
+SOCKET connectionsAcceptorInit(SOCKET handedOverSocket)
 {
-    srand((unsigned)time(NULL));
-    SOCKET listenSocket = createListenSocket(NULL, PORT);
-    acceptNewConnections(listenSocket);
-}
\ No newline at end of file
+    SOCKET listenSocket = handedOverSocket != INVALID_SOCKET ? handedOverSocket : createListenSocket(NULL, PORT);
+
+    //the acceptor threads share this socket, so none of them can block in accept() while the others drain the backlog
+    unsigned long nonBlocking = 1;
+    if(ioctlsocket(listenSocket, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+    {
+        logError("ioctlsocket() failed to make the listen socket non blocking", WSAGetLastError());
+        closesocket(listenSocket);
+        WSACleanup();
+        exit(EXIT_FAILURE);
+    }
+
+    s_acceptorsStoppedEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if( ! s_acceptorsStoppedEvent || ! wakeupSocketInit(&s_stopWakeup) )
+    {
+        logError("could not make what stops the acceptor threads", (int)GetLastError());
+        exit(EXIT_FAILURE);
+    }
+
+    s_listenSocket = listenSocket;
+    s_numOfRunningAcceptors = (LONG)g_serverConfig.acceptThreads;
+
+    logInfo("server %s and is accepting connections on port %d with %zu threads...",
+        handedOverSocket != INVALID_SOCKET ? "took over" : "started", PORT, g_serverConfig.acceptThreads);
+    return listenSocket;
+}
+
+void __stdcall acceptConnectionsThreadStart(void* listenSocket)
+{
+    acceptNewConnections((SOCKET)(uintptr_t)listenSocket);
+}
+
+void connectionsAcceptorHandOver(HotUpgradeBuffer* buffer)
+{
+    signalWakeupSocket(&s_stopWakeup);
+    WaitForSingleObject(s_acceptorsStoppedEvent, INFINITE);
+
+    //if it can not be duplicated, the new process makes its own once the old one exited (and let go of the port)
+    hotUpgradeWriteListenSocket(buffer, s_listenSocket);
+}
@@ -1,12 +1,25 @@
 #ifndef CONNECTIONS_ACCEPTOR_H
 #define CONNECTIONS_ACCEPTOR_H
 
-//the size of the stack that the accept connections thread uses in bytes
+#include <winsock2.h>
+
+#include "hotUpgrade.h"
+
+//the size of the stack that each accept connections thread uses in bytes
 #define ACCEPT_CONNECTIONS_STACKSIZE 64000
 
-//this is the only function exposed in the .h meant to be the start of a
-//new pthread. only 1 thread will work with this and 
-//subsequent threads will immediately return
-void __stdcall acceptConnectionsThreadStart(void*);
+//Makes the listen socket that every acceptor thread shares. It is non blocking, and each acceptor thread
+//waits for it in WSAPoll() and then takes up to a batch of connections out of the backlog.
+//Exits if the socket can not be made. Call it once, after lobbyManagerInit(), with the listen socket a hot upgrade
+//handed over (see hotUpgrade.h), or INVALID_SOCKET to make a new one.
+SOCKET connectionsAcceptorInit(SOCKET handedOverSocket);
+
+//the start of an acceptor thread. start g_serverConfig.acceptThreads of them (see serverConfig.h),
+//each with the socket from connectionsAcceptorInit() (cast to a void*) as their argument
+void __stdcall acceptConnectionsThreadStart(void* listenSocket);
+
+//Called by the hot upgrade thread. Stops every acceptor thread, waits until they stopped, and writes the listen socket
+//for the new process. Connections that come in from then on wait in the backlog until the new process accepts them
+void connectionsAcceptorHandOver(HotUpgradeBuffer* buffer);
 
 #endif //CONNECTIONS_ACCEPTOR_H
\ No newline at end of file
@@ -3,59 +3,317 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdbool.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <process.h>
 
-//updated by calling getCurrentTime()
-static char timeBuff[64] = {0};
+#include "errorLogger.h"
 
-const char* getCurrentTime()
+#define LOG_WRITER_STACKSIZE 64000
+
+//how many log messages can wait for the writer thread. it has to be a power of 2.
+//messages logged while the ring is full are dropped and counted
+#define LOG_RING_CAPACITY 4096
+
+//longer messages are cut off
+#define LOG_RECORD_TEXT_SIZE 240
+
+//the writer thread collects formatted lines in these before each fwrite()
+#define LOG_BATCH_SIZE (64 * 1024)
+
+//one slot of the ring. sequence tells producers and the writer whose turn it is to use the slot (same scheme as idAllocator.c)
+typedef struct
+{
+    volatile LONG64 sequence;
+    time_t time;
+    LogLevel level;
+    char text[LOG_RECORD_TEXT_SIZE];
+}LogRecord;
+
+volatile long g_logLevel = LOG_LEVEL_INFO;
+
+static LogRecord s_logRing[LOG_RING_CAPACITY];
+static LONG64 s_logHead = 0;//next slot to write out. only touched while s_drainMutex is locked
+static volatile LONG64 s_logTail = 0;//next slot to fill
+static volatile LONG64 s_numOfDroppedRecords = 0;
+
+//errorLog.txt. opened once by loggerInit()
+static FILE* s_logFile = NULL;
+
+static volatile LONG s_isLoggerRunning = 0;
+
+//the writer sleeps on s_writerCond when there is nothing to write.
+//producers only touch the lock if s_isWriterSleeping says they have to wake it up
+static CRITICAL_SECTION s_writerMutex;
+static CONDITION_VARIABLE s_writerCond;
+static volatile LONG s_isWriterSleeping = 0;
+
+//only one thread at a time writes out the ring (the writer thread, or loggerShutdown())
+static CRITICAL_SECTION s_drainMutex;
+
+static char s_consoleBatch[LOG_BATCH_SIZE];
+static char s_fileBatch[LOG_BATCH_SIZE];
+
+static char const* const s_levelNames[] = {"trace", "debug", "info", "warn", "error", "none"};
+
+char const* getCurrentTime(char* buff, size_t buffSize)
 {
     time_t t;
     time(&t);
-    ctime_s(timeBuff, sizeof(timeBuff), &t);
-    return timeBuff;
+    ctime_s(buff, buffSize, &t);
+    return buff;
 }
 
-//logs an error message and a corresponding error number if the error number is not 0.
-//also prints the error message and number to stderr.
-void logError(char const* errMsg, int errorNumber)
+uint64_t getMonotonicMicroseconds(void)
 {
-    char errNumStr[256] = {0};
+    static LARGE_INTEGER frequency = {0};
+    if(frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);//never changes, so it doesnt matter if two threads race here
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
 
-    if(errorNumber != 0)
+    //split the conversion up so counter * 1000000 cant overflow
+    uint64_t const seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t const remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000 + remainder * 1000000 / frequency.QuadPart;
+}
+
+uint64_t getMonotonicNanoseconds(void)
+{
+    static LARGE_INTEGER frequency = {0};
+    if(frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    uint64_t const seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t const remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000 + remainder * 1000000000 / frequency.QuadPart;
+}
+
+static bool isLogRingEmpty(void)
+{
+    return ReadAcquire64(&s_logRing[s_logHead & (LOG_RING_CAPACITY - 1)].sequence) != s_logHead + 1;
+}
+
+static void wakeLogWriter(void)
+{
+    //the compare exchange is a full barrier, so either the writer sees the record that was
+    //just published when it checks the ring before sleeping, or we see that it is sleeping
+    if(InterlockedCompareExchange(&s_isWriterSleeping, 0, 1) == 1)
     {
-        FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM, NULL, 
-            errorNumber, 0, errNumStr, sizeof(errNumStr), NULL); 
+        EnterCriticalSection(&s_writerMutex);
+        WakeConditionVariable(&s_writerCond);
+        LeaveCriticalSection(&s_writerMutex);
     }
+}
 
-    FILE* fileStream;
-    errno_t err = fopen_s(&fileStream, "errorLog.txt", "a");
-
-    const char* timeStr = getCurrentTime();
+void logWrite(LogLevel level, char const* format, ...)
+{
+    va_list args;
+    va_start(args, format);
 
-    if(err)
+    if( ! s_isLoggerRunning )
     {
-        fprintf(stderr, "error trying to open errorLog.txt\nerror message that would have been logged: ");
-        if(errNumStr) fprintf(stderr, "%s (%s) at %s", errMsg, errNumStr, timeStr);
-        else fprintf(stderr, "%s at ", timeStr);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+        va_end(args);
+        return;
     }
-    else
+
+    //claim a slot. the message is formatted straight into it
+    LONG64 pos = s_logTail;
+    LogRecord* record = NULL;
+    while( ! record )
     {
-        if(errorNumber != 0)
+        LogRecord* slot = s_logRing + (pos & (LOG_RING_CAPACITY - 1));
+        LONG64 const diff = ReadAcquire64(&slot->sequence) - pos;
+
+        if(diff == 0)
         {
-            const char* formatStr = "\n\n%s errnum=%d %s at %s\n\n";
-            fprintf(fileStream, formatStr, errMsg, errorNumber, errNumStr, timeStr);
-            fprintf(stderr, formatStr, errMsg, errorNumber, errNumStr, timeStr);
+            LONG64 const prevPos = InterlockedCompareExchange64(&s_logTail, pos + 1, pos);
+            if(prevPos == pos) record = slot;
+            else pos = prevPos;
         }
-        else 
+        else if(diff < 0)
         {
-            const char* formatStr = "\n\n%s at %s";
-            fprintf(fileStream, formatStr, errMsg, timeStr);
-            fprintf(stderr, formatStr, errMsg, timeStr);
+            //full. the writer thread can not keep up, so drop the message instead of waiting on it
+            InterlockedIncrement64(&s_numOfDroppedRecords);
+            va_end(args);
+            return;
         }
+        else pos = s_logTail;
+    }
+
+    record->time = time(NULL);
+    record->level = level;
+    vsnprintf(record->text, sizeof(record->text), format, args);
+    va_end(args);
+
+    WriteRelease64(&record->sequence, pos + 1);
+    wakeLogWriter();
+}
+
+static void flushBatch(FILE* stream, char* batch, size_t* batchSize)
+{
+    if(*batchSize == 0)
+        return;
 
-        fclose(fileStream);
-    }  
-}
\ No newline at end of file
+    fwrite(batch, 1, *batchSize, stream);
+    fflush(stream);
+    *batchSize = 0;
+}
+
+static void appendToBatch(FILE* stream, char* batch, size_t* batchSize, char const* line, size_t lineSize)
+{
+    if(*batchSize + lineSize > LOG_BATCH_SIZE)
+        flushBatch(stream, batch, batchSize);
+
+    memcpy(batch + *batchSize, line, lineSize);
+    *batchSize += lineSize;
+}
+
+//write out every record that is in the ring. the writes are batched, so a burst of
+//log messages costs one fwrite() instead of one per message
+static void drainLogRing(void)
+{
+    EnterCriticalSection(&s_drainMutex);
+
+    size_t consoleBatchSize = 0, fileBatchSize = 0;
+
+    //the time stamp only changes once a second, so only format it when it does
+    time_t lastTime = 0;
+    char timeStr[32] = {0};
+
+    LONG64 const numOfDropped = InterlockedExchange64(&s_numOfDroppedRecords, 0);
+    if(numOfDropped > 0)
+    {
+        char line[128] = {0};
+        int const lineSize = snprintf(line, sizeof(line), "[warn] %lld log messages were dropped\n", (long long)numOfDropped);
+        appendToBatch(stdout, s_consoleBatch, &consoleBatchSize, line, (size_t)lineSize);
+    }
+
+    while( ! isLogRingEmpty() )
+    {
+        LogRecord* record = s_logRing + (s_logHead & (LOG_RING_CAPACITY - 1));
+
+        if(record->time != lastTime)
+        {
+            struct tm localTime;
+            localtime_s(&localTime, &record->time);
+            strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &localTime);
+            lastTime = record->time;
+        }
+
+        char line[LOG_RECORD_TEXT_SIZE + 64] = {0};
+        int lineSize = snprintf(line, sizeof(line), "%s [%s] %s\n", timeStr, s_levelNames[record->level], record->text);
+        if(lineSize >= (int)sizeof(line)) lineSize = (int)sizeof(line) - 1;
+
+        appendToBatch(stdout, s_consoleBatch, &consoleBatchSize, line, (size_t)lineSize);
+        if(record->level >= LOG_LEVEL_WARN && s_logFile)
+            appendToBatch(s_logFile, s_fileBatch, &fileBatchSize, line, (size_t)lineSize);
+
+        WriteRelease64(&record->sequence, s_logHead + LOG_RING_CAPACITY);
+        ++s_logHead;
+    }
+
+    flushBatch(stdout, s_consoleBatch, &consoleBatchSize);
+    if(s_logFile) flushBatch(s_logFile, s_fileBatch, &fileBatchSize);
+
+    LeaveCriticalSection(&s_drainMutex);
+}
+
+static void __stdcall logWriterThreadStart(void* arg)
+{
+    while(true)
+    {
+        drainLogRing();
+
+        EnterCriticalSection(&s_writerMutex);
+        InterlockedExchange(&s_isWriterSleeping, 1);
+        while(s_isWriterSleeping && isLogRingEmpty())
+            SleepConditionVariableCS(&s_writerCond, &s_writerMutex, INFINITE);
+        InterlockedExchange(&s_isWriterSleeping, 0);
+        LeaveCriticalSection(&s_writerMutex);
+    }
+}
+
+static LogLevel logLevelFromEnvironment(void)
+{
+    char const* levelStr = getenv("CHESS_SERVER_LOG_LEVEL");
+    if( ! levelStr )
+        return LOG_LEVEL_INFO;
+
+    for(int i = LOG_LEVEL_TRACE; i <= LOG_LEVEL_NONE; ++i)
+    {
+        if(strcmp(levelStr, s_levelNames[i]) == 0)
+            return (LogLevel)i;
+    }
+
+    fprintf(stderr, "unknown CHESS_SERVER_LOG_LEVEL %s. using info\n", levelStr);
+    return LOG_LEVEL_INFO;
+}
+
+void loggerInit(void)
+{
+    if(s_isLoggerRunning)
+        return;
+
+    for(LONG64 i = 0; i < LOG_RING_CAPACITY; ++i)
+        s_logRing[i].sequence = i;
+
+    g_logLevel = logLevelFromEnvironment();
+    if(g_logLevel < LOG_COMPILE_LEVEL)
+        fprintf(stderr, "log messages below %s were compiled out\n", s_levelNames[LOG_COMPILE_LEVEL]);
+
+    if(fopen_s(&s_logFile, "errorLog.txt", "a"))
+    {
+        fprintf(stderr, "error trying to open errorLog.txt. errors will only be logged to the console\n");
+        s_logFile = NULL;
+    }
+
+    InitializeCriticalSection(&s_writerMutex);
+    InitializeCriticalSection(&s_drainMutex);
+    InitializeConditionVariable(&s_writerCond);
+
+    s_isLoggerRunning = 1;
+    _beginthread(logWriterThreadStart, LOG_WRITER_STACKSIZE, NULL);
+
+    atexit(loggerShutdown);
+}
+
+void loggerShutdown(void)
+{
+    if(s_isLoggerRunning)
+        drainLogRing();
+}
+
+//logs an error message and a corresponding error number (with its description) if the error number is not 0.
+void logError(char const* errMsg, int errorNumber)
+{
+    if(LOG_LEVEL_ERROR < g_logLevel)
+        return;
+
+    if(errorNumber == 0)
+    {
+        logWrite(LOG_LEVEL_ERROR, "%s", errMsg);
+        return;
+    }
+
+    char errNumStr[256] = {0};
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL,
+        errorNumber, 0, errNumStr, sizeof(errNumStr), NULL);
+
+    //the system messages end with a new line
+    size_t errNumStrLen = strlen(errNumStr);
+    while(errNumStrLen > 0 && (errNumStr[errNumStrLen - 1] == '\n' || errNumStr[errNumStrLen - 1] == '\r'))
+        errNumStr[--errNumStrLen] = '\0';
+
+    logWrite(LOG_LEVEL_ERROR, "%s errnum=%d %s", errMsg, errorNumber, errNumStr);
+}
@@ -1,7 +1,61 @@
 #ifndef ERROR_LOGGER_H
 #define ERROR_LOGGER_H
 
-const char* getCurrentTime();
+#include <stdint.h>
+#include <stddef.h>
+
+//Everything the server logs is formatted into a lock free multi producer ring, and a background writer thread
+//drains it in batches to the console (and errorLog.txt for warnings and errors, which stays open).
+//So the lobby and the game workers never wait on console or file I/O.
+
+typedef enum
+{
+    LOG_LEVEL_TRACE,//every forwarded message
+    LOG_LEVEL_DEBUG,//lobby messages
+    LOG_LEVEL_INFO,//connections coming and going and server startup
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE
+}LogLevel;
+
+//log statements below this level are compiled out, and their arguments are not even evaluated.
+//can be overridden from the compiler command line (/D LOG_COMPILE_LEVEL=0 for everything)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+//Log statements below this level are skipped at runtime. Picked by loggerInit() from the
+//CHESS_SERVER_LOG_LEVEL environment variable (trace, debug, info, warn, error or none). defaults to info
+extern volatile long g_logLevel;
+
+#define LOG_AT_LEVEL(level, ...) \
+    do { if((level) >= LOG_COMPILE_LEVEL && (level) >= g_logLevel) logWrite((level), __VA_ARGS__); } while(0)
+
+//printf style logging. a new line is added to every message
+#define logTrace(...) LOG_AT_LEVEL(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define logDebug(...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define logInfo(...)  LOG_AT_LEVEL(LOG_LEVEL_INFO,  __VA_ARGS__)
+#define logWarn(...)  LOG_AT_LEVEL(LOG_LEVEL_WARN,  __VA_ARGS__)
+
+//start the log writer thread. until this is called, messages are written straight to stderr
+void loggerInit(void);
+
+//write out everything that has been logged so far. called on exit
+void loggerShutdown(void);
+
+//use the log macros above instead
+void logWrite(LogLevel level, char const* format, ...);
+
+//writes the current local time into buff and returns it
+char const* getCurrentTime(char* buff, size_t buffSize);
+
+//microseconds from an arbitrary starting point. used to measure how long things take
+uint64_t getMonotonicMicroseconds(void);
+
+//same as getMonotonicMicroseconds() but in nanoseconds (the resolution depends on QueryPerformanceCounter())
+uint64_t getMonotonicNanoseconds(void);
+
+//logs an error message and a corresponding error number (with its description) if the error number is not 0.
 void logError(char const* errMsg, int errorNumber);
 
-#endif //ERROR_LOGGER_H
\ No newline at end of file
+#endif //ERROR_LOGGER_H
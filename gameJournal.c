@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <process.h>
+
+#include "gameJournal.h"
+#include "errorLogger.h"
+
+#define JOURNAL_MAGIC "CHSJRNL1"
+
+//The first JOURNAL_HEADER_SIZE bytes of a file. The records start right after it
+typedef struct
+{
+    char magic[8];
+    uint64_t generation;
+    uint32_t checksum;//of magic and generation
+    uint32_t padding;
+}JournalFileHeader;
+
+#define JOURNAL_HEADER_SIZE 64
+
+//a record is padded to this, so every header is aligned
+#define JOURNAL_RECORD_ALIGNMENT 8
+
+static GameJournal* s_journals = NULL;
+static size_t s_numOfJournals = 0;
+
+//how many journals the last run left behind (see gameJournalDeleteStaleFiles())
+static size_t s_numOfOldJournals = 0;
+
+//set by gameJournalCommit() when the flusher is asleep
+static HANDLE s_flushEvent = NULL;
+
+//FNV-1a, seeded with the generation, so the records that an older generation left past the end of
+//the newer records in a reused file never pass as records of the newer one
+static uint32_t journalChecksum(uint64_t generation, void const* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < 8; ++i)
+    {
+        hash ^= (uint8_t)(generation >> (8 * i));
+        hash *= 16777619u;
+    }
+
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= ((uint8_t const*)data)[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t paddedRecordSize(size_t size)
+{
+    return (size + JOURNAL_RECORD_ALIGNMENT - 1) & ~(size_t)(JOURNAL_RECORD_ALIGNMENT - 1);
+}
+
+static void journalFileName(char* buff, size_t buffSize, size_t journalIndex, int fileIndex)
+{
+    snprintf(buff, buffSize, "gameJournal%zu.%d.bin", journalIndex, fileIndex);
+}
+
+//Read a whole journal file left by the last run. Returns NULL if there is no such file (or it can not be read)
+static char* readJournalFile(size_t journalIndex, int fileIndex, size_t* sizeOut)
+{
+    char name[64] = {0};
+    journalFileName(name, sizeof(name), journalIndex, fileIndex);
+
+    HANDLE const file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    char* contents = NULL;
+    LARGE_INTEGER fileSize;
+    if(GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= JOURNAL_HEADER_SIZE && (uint64_t)fileSize.QuadPart < ((uint64_t)1 << 40))
+    {
+        size_t const size = (size_t)fileSize.QuadPart;
+        contents = malloc(size);
+        if( ! contents )
+        {
+            logError("malloc failed to allocate the contents of a game journal file", 0);
+            exit(0);
+        }
+
+        //ReadFile() reads at most 4GB at a time
+        size_t numOfBytesRead = 0;
+        while(numOfBytesRead < size)
+        {
+            DWORD const chunk = (DWORD)min(size - numOfBytesRead, (size_t)1 << 30);
+            DWORD chunkRead = 0;
+            if( ! ReadFile(file, contents + numOfBytesRead, chunk, &chunkRead, NULL) || chunkRead == 0 )
+                break;
+            numOfBytesRead += chunkRead;
+        }
+
+        if(numOfBytesRead == size)
+        {
+            *sizeOut = size;
+        }
+        else
+        {
+            logError("could not read a game journal file. the games in it are lost", (int)GetLastError());
+            free(contents);
+            contents = NULL;
+        }
+    }
+
+    CloseHandle(file);
+    return contents;
+}
+
+//the generation of a file, or 0 if its header is not valid (a generation is never 0)
+static uint64_t journalFileGeneration(char const* contents)
+{
+    JournalFileHeader header;
+    memcpy(&header, contents, sizeof(header));
+    if(memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)))
+        return 0;
+
+    if(header.checksum != journalChecksum(header.generation, header.magic, sizeof(header.magic)))
+        return 0;
+
+    return header.generation;
+}
+
+//hand every record of one file to onRecord, up to the first one that is not whole. returns how many there were
+static size_t replayJournalFile(size_t journalIndex, char const* contents, size_t size, uint64_t generation,
+    JournalRecordCallback onRecord, void* ctx)
+{
+    size_t numOfRecords = 0;
+    size_t offset = JOURNAL_HEADER_SIZE;
+    while(offset + sizeof(JournalRecordHeader) <= size)
+    {
+        JournalRecordHeader header;
+        memcpy(&header, contents + offset, sizeof(header));
+        if( ! header.type || header.size < sizeof(header) || offset + header.size > size ||
+            header.size > sizeof(header) + JOURNAL_MAX_PAYLOAD_SIZE )
+            break;
+
+        char const* const record = contents + offset;
+        if(header.checksum != journalChecksum(generation, record + sizeof(header.checksum), header.size - sizeof(header.checksum)))
+            break;//torn by a crash, or left over from an older generation
+
+        JournalRecord const rec = {
+            (JournalRecordType)header.type,
+            header.playerIndex,
+            header.gameID,
+            record + sizeof(header),
+            header.size - sizeof(header)
+        };
+        onRecord(journalIndex, &rec, ctx);
+
+        ++numOfRecords;
+        offset += paddedRecordSize(header.size);
+    }
+
+    return numOfRecords;
+}
+
+//Replay the newest valid file of the journal the last run had at journalIndex. Returns false if neither of its files exists.
+//*generationOut and *fileIndexOut are the newest file (0 and 1 if there was none)
+static bool recoverJournal(size_t journalIndex, JournalRecordCallback onRecord, void* ctx, uint64_t* generationOut, int* fileIndexOut)
+{
+    char* contents[2] = {NULL};
+    size_t sizes[2] = {0};
+    uint64_t generations[2] = {0};
+    for(int i = 0; i < 2; ++i)
+    {
+        contents[i] = readJournalFile(journalIndex, i, sizes + i);
+        if(contents[i])
+            generations[i] = journalFileGeneration(contents[i]);
+    }
+
+    *generationOut = 0;
+    *fileIndexOut = 1;
+    bool const doesExist = contents[0] || contents[1];
+
+    int const newest = (generations[1] > generations[0]) ? 1 : 0;
+    if(generations[newest])
+    {
+        uint64_t const startUs = getMonotonicMicroseconds();
+        size_t const numOfRecords = replayJournalFile(journalIndex, contents[newest], sizes[newest], generations[newest], onRecord, ctx);
+        logInfo("recovered %zu records from game journal %zu (generation %llu) in %llu ms", numOfRecords, journalIndex,
+            (unsigned long long)generations[newest], (unsigned long long)((getMonotonicMicroseconds() - startUs) / 1000));
+
+        *generationOut = generations[newest];
+        *fileIndexOut = newest;
+    }
+    else if(doesExist)
+    {
+        logWarn("neither file of game journal %zu has a valid header. the games in it are lost", journalIndex);
+    }
+
+    free(contents[0]);
+    free(contents[1]);
+    return doesExist;
+}
+
+void gameJournalInit(size_t numOfJournals, size_t capacityBytes, JournalRecordCallback onRecord, void* ctx)
+{
+    assert( ! s_journals );
+    assert(numOfJournals <= JOURNAL_MAX_FILES);
+
+    s_journals = calloc(numOfJournals, sizeof(GameJournal));
+    s_flushEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if( ! s_journals || ! s_flushEvent )
+    {
+        logError("failed to allocate the game journals", (int)GetLastError());
+        exit(0);
+    }
+    s_numOfJournals = numOfJournals;
+
+    //the workers of the last run had journals 0 to s_numOfOldJournals - 1
+    for(size_t i = 0; i < JOURNAL_MAX_FILES; ++i)
+    {
+        uint64_t generation = 0;
+        int fileIndex = 1;
+        if( ! recoverJournal(i, onRecord, ctx, &generation, &fileIndex) )
+            break;
+
+        s_numOfOldJournals = i + 1;
+        if(i < numOfJournals)
+        {
+            s_journals[i].generation = generation;
+            s_journals[i].fileIndex = fileIndex;
+        }
+    }
+
+    for(size_t i = 0; i < numOfJournals; ++i)
+    {
+        GameJournal* journal = s_journals + i;
+        journal->index = i;
+        journal->capacity = capacityBytes;
+        journal->writeFileIndex = journal->fileIndex;
+        for(int j = 0; j < 2; ++j)
+            journal->files[j] = journal->mappings[j] = NULL;
+
+        journal->staging = malloc(JOURNAL_STAGING_SIZE);
+        if( ! journal->staging )
+        {
+            logError("malloc failed to allocate the staging buffer of a game journal", 0);
+            exit(0);
+        }
+
+        InitializeCriticalSection(&journal->mutex);
+    }
+}
+
+GameJournal* gameJournalGet(size_t index)
+{
+    assert(index < s_numOfJournals);
+    return s_journals + index;
+}
+
+//open (or create) one file of the journal's pair and map all of it. returns false if that fails
+static bool mapJournalFile(GameJournal* journal, int fileIndex)
+{
+    char name[64] = {0};
+    journalFileName(name, sizeof(name), journal->index, fileIndex);
+
+    HANDLE const file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        logError("CreateFileA() failed to open a game journal file", (int)GetLastError());
+        return false;
+    }
+
+    //the file is always exactly capacity bytes, so the mapping never has to grow
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)journal->capacity;
+    HANDLE mapping = NULL;
+    char* view = NULL;
+    if(SetFilePointerEx(file, size, NULL, FILE_BEGIN) && SetEndOfFile(file))
+    {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)journal->capacity >> 32),
+            (DWORD)journal->capacity, NULL);
+        if(mapping)
+            view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, journal->capacity);
+    }
+
+    if( ! view )
+    {
+        logError("failed to map a game journal file", (int)GetLastError());
+        if(mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    journal->files[fileIndex] = file;
+    journal->mappings[fileIndex] = mapping;
+    journal->views[fileIndex] = view;
+    return true;
+}
+
+static void disableJournal(GameJournal* journal, char const* reason)
+{
+    char errMsg[256] = {0};
+    snprintf(errMsg, sizeof(errMsg), "game journal %zu is disabled (%s). "
+        "the games of its worker can still be resumed, but they will not survive a restart", journal->index, reason);
+    logError(errMsg, 0);
+
+    journal->isDisabled = true;
+    journal->stagingSize = 0;
+}
+
+//copy the staging buffer to the end of the file being written. returns false if it does not fit
+static bool writeStaging(GameJournal* journal)
+{
+    if(journal->writeOffset + journal->stagingSize > journal->capacity)
+        return false;
+
+    memcpy(journal->views[journal->writeFileIndex] + journal->writeOffset, journal->staging, journal->stagingSize);
+    journal->writeOffset += journal->stagingSize;
+    journal->stagingSize = 0;
+    return true;
+}
+
+void gameJournalAppend(GameJournal* journal, JournalRecordType type, uint64_t gameID, uint8_t playerIndex, void const* payload, size_t payloadSize)
+{
+    assert(payloadSize <= JOURNAL_MAX_PAYLOAD_SIZE);
+
+    //after a record did not fit, everything up to the checkpoint is dropped. the checkpoint writes the games as they are then
+    if(journal->isDisabled || journal->needsCheckpoint)
+        return;
+
+    size_t const size = sizeof(JournalRecordHeader) + payloadSize;
+    size_t const paddedSize = paddedRecordSize(size);
+    if(journal->stagingSize + paddedSize > JOURNAL_STAGING_SIZE && ! writeStaging(journal))
+    {
+        if(journal->isCheckpointing)
+            disableJournal(journal, "the running games do not fit in CHESS_SERVER_JOURNAL_MB");
+        else
+            journal->needsCheckpoint = true;
+        return;
+    }
+
+    char* record = journal->staging + journal->stagingSize;
+    JournalRecordHeader header = {0, (uint16_t)size, (uint8_t)type, playerIndex, gameID};
+    memcpy(record, &header, sizeof(header));
+    if(payloadSize)
+        memcpy(record + sizeof(header), payload, payloadSize);
+    memset(record + size, 0, paddedSize - size);
+
+    header.checksum = journalChecksum(journal->generation, record + sizeof(header.checksum), size - sizeof(header.checksum));
+    memcpy(record, &header.checksum, sizeof(header.checksum));
+
+    journal->stagingSize += paddedSize;
+}
+
+void gameJournalCommit(GameJournal* journal, JournalCheckpointCallback checkpoint, void* ctx)
+{
+    if(journal->isDisabled || ( ! journal->stagingSize && ! journal->needsCheckpoint ))
+        return;
+
+    if( ! journal->needsCheckpoint && ! writeStaging(journal) )
+        journal->needsCheckpoint = true;
+
+    if(journal->needsCheckpoint)
+    {
+        gameJournalCheckpoint(journal, checkpoint, ctx);
+        return;
+    }
+
+    InterlockedExchange64(&journal->committedOffset, (LONG64)journal->writeOffset);
+
+    //only the first commit since the flusher last ran has to wake it up
+    if( ! InterlockedExchange(&journal->isFlushRequested, 1) )
+        SetEvent(s_flushEvent);
+}
+
+void gameJournalCheckpoint(GameJournal* journal, JournalCheckpointCallback checkpoint, void* ctx)
+{
+    if(journal->isDisabled)
+        return;
+
+    uint64_t const startUs = getMonotonicMicroseconds();
+    int const target = journal->fileIndex ^ 1;
+    if( ! journal->views[target] && ! mapJournalFile(journal, target) )
+    {
+        disableJournal(journal, "its file could not be created");
+        return;
+    }
+
+    //the records go into the other file with the next generation. the flusher keeps flushing the old file until the switch below
+    ++journal->generation;
+    journal->writeFileIndex = target;
+    journal->writeOffset = JOURNAL_HEADER_SIZE;
+    journal->stagingSize = 0;
+    journal->needsCheckpoint = false;
+
+    journal->isCheckpointing = true;
+    checkpoint(ctx);
+    journal->isCheckpointing = false;
+
+    if( ! journal->isDisabled && ! writeStaging(journal) )
+        disableJournal(journal, "the running games do not fit in CHESS_SERVER_JOURNAL_MB");
+
+    if(journal->isDisabled)
+        return;
+
+    //an empty record type ends the file, in case the file was used by an older generation that got further
+    char* const view = journal->views[target];
+    if(journal->writeOffset + sizeof(JournalRecordHeader) <= journal->capacity)
+        memset(view + journal->writeOffset, 0, sizeof(JournalRecordHeader));
+
+    //the records have to be on disk before the header that makes them the newest generation
+    FlushViewOfFile(view, journal->writeOffset + sizeof(JournalRecordHeader));
+    FlushFileBuffers(journal->files[target]);
+
+    JournalFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.generation = journal->generation;
+    header.checksum = journalChecksum(header.generation, header.magic, sizeof(header.magic));
+    memcpy(view, &header, sizeof(header));
+
+    FlushViewOfFile(view, sizeof(header));
+    FlushFileBuffers(journal->files[target]);
+
+    EnterCriticalSection(&journal->mutex);
+    journal->fileIndex = target;
+    journal->flushedOffset = journal->writeOffset;
+    InterlockedExchange64(&journal->committedOffset, (LONG64)journal->writeOffset);
+    LeaveCriticalSection(&journal->mutex);
+
+    logInfo("game journal %zu checkpointed %zu KB into generation %llu in %llu ms", journal->index, journal->writeOffset / 1024,
+        (unsigned long long)journal->generation, (unsigned long long)((getMonotonicMicroseconds() - startUs) / 1000));
+}
+
+void gameJournalDeleteStaleFiles(void)
+{
+    for(size_t i = s_numOfJournals; i < s_numOfOldJournals; ++i)
+    {
+        for(int j = 0; j < 2; ++j)
+        {
+            char name[64] = {0};
+            journalFileName(name, sizeof(name), i, j);
+            DeleteFileA(name);
+        }
+    }
+}
+
+//write out what was committed to one journal since the last flush
+static void flushJournal(GameJournal* journal)
+{
+    InterlockedExchange(&journal->isFlushRequested, 0);
+
+    EnterCriticalSection(&journal->mutex);
+
+    size_t const committedOffset = (size_t)journal->committedOffset;
+    if(committedOffset > journal->flushedOffset)
+    {
+        char* view = journal->views[journal->fileIndex];
+        if( ! FlushViewOfFile(view + journal->flushedOffset, committedOffset - journal->flushedOffset) ||
+            ! FlushFileBuffers(journal->files[journal->fileIndex]) )
+        {
+            logError("failed to write a game journal out to disk", (int)GetLastError());
+        }
+
+        journal->flushedOffset = committedOffset;
+    }
+
+    LeaveCriticalSection(&journal->mutex);
+}
+
+void __stdcall journalFlusherThreadStart(void* arg)
+{
+    while(true)
+    {
+        WaitForSingleObject(s_flushEvent, INFINITE);
+
+        //let the commits of the next few ms pile up, so they all go out with one FlushFileBuffers() per journal
+        Sleep(JOURNAL_FLUSH_INTERVAL_MS);
+
+        for(size_t i = 0; i < s_numOfJournals; ++i)
+        {
+            if(s_journals[i].isFlushRequested)
+                flushJournal(s_journals + i);
+        }
+    }
+}
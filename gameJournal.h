@@ -0,0 +1,145 @@
+#ifndef GAME_JOURNAL_H
+#define GAME_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+//An append only journal of the games of every game worker, so the games that were running survive a restart of the server
+//and their players can come back with their resume tokens (see RESUME_GAME_MSGTYPE in chessNetworkProtocol.h and gameManager.c).
+//
+//Every worker has its own pair of files (gameJournal<worker>.0.bin and gameJournal<worker>.1.bin in the working directory),
+//so the workers never share a cursor. The file that is being written is mapped into memory with CreateFileMapping(),
+//so appending a record is a memcpy. During a loop iteration a worker only appends to a small staging buffer, and
+//gameJournalCommit() copies it into the mapping after the iteration's sends (so a page fault on a fresh page of the file
+//never holds up a move). The JOURNAL_FLUSH_INTERVAL_MS flusher thread writes the committed part of every mapping out to disk
+//with FlushViewOfFile() and FlushFileBuffers() in batches, so the workers never wait on the disk either.
+//
+//When a worker's file is full, it writes a checkpoint of the games it is running into the other file of its pair (the finished games
+//are left out, so the journal never grows past what is running) and switches to it. The header of the new file is written last,
+//after the rest of it is on disk, so if the server dies in the middle of a checkpoint the older file is still the newest valid one.
+//
+//At startup gameJournalInit() reads the newest valid file of every pair left by the last run (even of workers that the server
+//no longer has, if it has fewer cpus now) and hands every record to a callback, which is how gameManagerInit() rebuilds the games.
+//The writing side of a journal is only used by the worker that owns it.
+
+//how long the flusher waits after the first commit before it writes everything out, so one FlushFileBuffers() covers many commits
+#define JOURNAL_FLUSH_INTERVAL_MS 50
+
+//the most game workers that can have a journal
+#define JOURNAL_MAX_FILES 256
+
+typedef enum
+{
+    JOURNAL_GAME_START = 1,//JournalGameStart payload
+    JOURNAL_GAME_MESSAGE,//the message (header included) that player playerIndex sent
+    JOURNAL_GAME_END//no payload
+}JournalRecordType;
+
+//Every record starts with this and is padded to a multiple of 8 bytes.
+//checksum covers the rest of the record, so a record torn by a crash ends the journal there.
+typedef struct
+{
+    uint32_t checksum;
+    uint16_t size;//the whole record without the padding
+    uint8_t type;//JournalRecordType. 0 where nothing was written yet
+    uint8_t playerIndex;
+    uint64_t gameID;
+}JournalRecordHeader;
+
+typedef struct
+{
+    uint64_t resumeTokens[2];
+    uint8_t sides[2];//the Side of both players at PAIRING_COMPLETE_MSGTYPE
+}JournalGameStart;
+
+//a record handed to the JournalRecordCallback of gameJournalInit(). payload is only valid during the call
+typedef struct
+{
+    JournalRecordType type;
+    uint8_t playerIndex;
+    uint64_t gameID;
+    void const* payload;
+    size_t payloadSize;
+}JournalRecord;
+
+//journalIndex is the worker the file belonged to in the last run
+typedef void (*JournalRecordCallback)(size_t journalIndex, JournalRecord const* record, void* ctx);
+
+//called by gameJournalCommit() when a checkpoint is needed. has to gameJournalAppend() the start and every message of every running game
+typedef void (*JournalCheckpointCallback)(void* ctx);
+
+typedef struct
+{
+    //Both files of the pair. A file is only opened (and grown to capacity) when a checkpoint is about to go into it,
+    //so the newest file of the last run is left alone until the new one is safely on disk
+    HANDLE files[2];
+    HANDLE mappings[2];
+    char* views[2];
+
+    //The flusher writes [flushedOffset, committedOffset) of files[fileIndex] out to disk. fileIndex is only changed
+    //by a checkpoint, with mutex held, so the flusher never flushes the wrong file
+    int fileIndex;
+    volatile LONG64 committedOffset;
+    size_t flushedOffset;
+    CRITICAL_SECTION mutex;
+
+    //Where the next record goes. Only used by the owner. During a checkpoint this is the other file of the pair,
+    //which the flusher does not know about until the checkpoint is done
+    int writeFileIndex;
+    size_t writeOffset;
+
+    //the records appended since the last gameJournalCommit()
+    char* staging;
+    size_t stagingSize;
+
+    size_t capacity;//of each file of the pair, in bytes
+    uint64_t generation;//of the records being written. the newer file of a pair has the higher one
+    size_t index;
+
+    //set when a record did not fit in the file, so the next gameJournalCommit() writes a checkpoint
+    bool needsCheckpoint;
+    bool isCheckpointing;
+
+    //set if a file of the pair can not be created, or even a checkpoint does not fit in capacity. nothing is journaled after that
+    bool isDisabled;
+
+    //set by gameJournalCommit() and cleared by the flusher, so only the first commit after a flush wakes it up
+    volatile LONG isFlushRequested;
+
+}GameJournal;
+
+//Has to be called once before the game workers start. Reads the journals left by the last run (calling onRecord for every record of them,
+//in the order they were written, one journal after the other) and then sets up numOfJournals journals of capacityBytes per file.
+//The caller has to gameJournalCheckpoint() every one of them (with whatever games it rebuilt from the records) before anything
+//else is appended. A journal whose files can not be created is disabled (and logged), the server runs without it.
+void gameJournalInit(size_t numOfJournals, size_t capacityBytes, JournalRecordCallback onRecord, void* ctx);
+
+GameJournal* gameJournalGet(size_t index);
+
+//Append a record to the staging buffer. It is only written to the file by the next gameJournalCommit()
+//(unless the staging buffer fills up first). payloadSize can be at most JOURNAL_MAX_PAYLOAD_SIZE
+#define JOURNAL_MAX_PAYLOAD_SIZE 64
+#define JOURNAL_STAGING_SIZE (64 * 1024)
+void gameJournalAppend(GameJournal* journal, JournalRecordType type, uint64_t gameID, uint8_t playerIndex, void const* payload, size_t payloadSize);
+
+//Copy what was appended since the last commit into the mapped file and let the flusher know there is something to write out.
+//If the file is full, checkpoint() is called to write the running games into the other file of the pair instead.
+void gameJournalCommit(GameJournal* journal, JournalCheckpointCallback checkpoint, void* ctx);
+
+//Start a new generation in the other file of the pair, call checkpoint() to append every running game, and switch to it once
+//it is on disk. Blocks on the disk, but only happens when a file fills up (and once at startup).
+void gameJournalCheckpoint(GameJournal* journal, JournalCheckpointCallback checkpoint, void* ctx);
+
+//Delete the files of the journals of the last run that have no worker now (their games were handed to other workers,
+//which already wrote them into their own journals). Called after every journal's first checkpoint.
+void gameJournalDeleteStaleFiles(void);
+
+//Writes the journals out to disk every JOURNAL_FLUSH_INTERVAL_MS while they are being written to, and blocks otherwise.
+#define JOURNAL_FLUSHER_STACKSIZE 64000
+void __stdcall journalFlusherThreadStart(void* arg);
+
+#endif //GAME_JOURNAL_H
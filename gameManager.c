@@ -1,302 +1,2734 @@
+#define _CRT_RAND_S
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
 #include <winsock2.h>
-#include <synchapi.h>//WakeConditionVariable()
 #include <process.h>
 #include <assert.h>
 
+#include "gameManager.h"
 #include "lobbyManager.h"
 #include "chessNetworkProtocol.h"
 #include "errorLogger.h"
 #include "networkWrite.h"
+#include "wakeupSocket.h"
+#include "messageFramer.h"
+#include "metrics.h"
+#include "serverConfig.h"
+#include "admissionControl.h"
+#include "chessRules.h"
+#include "connectionIndex.h"
+#include "timerWheel.h"
+#include "gameJournal.h"
+#include "spectatorFeed.h"
+#include "registeredIO.h"
+#include "hotUpgrade.h"
 
-extern CRITICAL_SECTION   g_lobbyMutex;
-extern CONDITION_VARIABLE g_gameManagerIsReadyCond;
-extern CONDITION_VARIABLE g_lobbyEmptyCond;
+//This C file is responsible for the pool of game worker threads. There is one worker per cpu core,
+//and each worker manages many chess games at once from a single WSAPoll() loop.
+//When two lobby members pair up, their lobby thread hands them to the least loaded worker with startChessGame().
+//When a game ends, the players who are still connected are put back into the lobby.
+//
+//Every message of a game is kept in the game's log (and appended to its worker's journal, see gameJournal.h), so a player whose
+//connection drops can come back with their resume token (RESUME_GAME_MSGTYPE, see chessNetworkProtocol.h) on a new connection and
+//get every message they missed. Until they do (or g_serverConfig.resumeGraceSecs runs out), the game goes on without them.
+//After a restart, gameManagerInit() rebuilds the games that were running from the journals, with both players away.
+//
+//Anyone can watch a running game with its spectate ID (SPECTATE_MSGTYPE). The spectators of a game are on the game's worker, after
+//the players in the poll set. Every message of the game is written once into the game's SpectatorFeed (see spectatorFeed.h),
+//and the spectators send straight out of it after the games were flushed, SPECTATOR_FLUSH_BATCH of them per loop iteration,
+//so a game with thousands of spectators does not hold up its players. A spectator who falls SPECTATOR_MAX_LAG_BYTES behind is disconnected.
+//
+//With g_serverConfig.registeredIO on, the players receive and send with Registered I/O (see registeredIO.h) instead of recv() and WSASend().
+//WSAPoll() still tells the worker who is readable, but the sends are never polled for, and every result is taken off the worker's
+//completion queue at once.
 
-#define STRINGIFY(x) #x
+//The most bytes of messages a game keeps for players who come back. a game with more than this (thousands of moves) is not resumable anymore
+#define GAME_LOG_MAX_BYTES (64 * 1024)
+#define GAME_LOG_INITIAL_CAPACITY 256
 
+//how many players coming back to a worker's games can wait for the worker at once (see resumeChessGame())
+#define RESUME_INBOX_CAPACITY 256
+
+//The keys of s_resumeIndex are the high 32 bits of a resume token (the low 32 bits are a secret that only the worker checks).
+//They map to the index of the game's worker in the high bits, and the game's slot in the low RESUME_SLOT_BITS.
+#define RESUME_SLOT_BITS 24
+
+//the end of a worker's list of free game slots
+#define GAME_SLOT_NONE UINT32_MAX
+
+//how many connections that want to watch a worker's games can wait for the worker at once (see spectateChessGame())
+#define SPECTATE_INBOX_CAPACITY 256
+
+//how far behind the game a spectator can fall before they are disconnected
+#define SPECTATOR_MAX_LAG_BYTES (128 * 1024)
+
+//a game whose moves so far take more than this can not be watched (thousands of moves, see buildCatchUp())
+#define SPECTATOR_MAX_CATCH_UP_SIZE (64 * 1024)
+
+//how many spectators with something to send are flushed in one loop iteration of a worker. the rest are flushed in the next one
+#define SPECTATOR_FLUSH_BATCH 256
+
+//the longest a worker that is waiting for Registered I/O to drain before a hot upgrade blocks in WSAPoll() (see handOverGames())
+#define HAND_OVER_POLL_MS 10
+
+struct ChessGame;
+
+//A connection watching a game. In a slot of its worker's spectatorSlots, and in the poll set after the players of every game
+typedef struct Spectator
+{
+    Connection* connection;
+
+    //NULL once the game ended. the spectator then sends the rest of the feed (the last message of which is SPECTATE_ENDED_MSGTYPE)
+    //and goes back to the lobby
+    struct ChessGame* game;
+
+    //the spectators of the same game. next is also the free list of spectatorSlots
+    struct Spectator* prev;
+    struct Spectator* next;
+
+    //what the spectator sent of the game's feed
+    SpectatorCursor cursor;
+
+    uint32_t pollIndex;
+
+    //the socket did not take everything, so wait for POLLWRNORM
+    bool isBlocked;
+}Spectator;
+
+//The players are connections from the connection pool (see connectionPool.h). The worker owns them while the game is running.
+//A game stays in the same slot of its worker's gameSlots from start to end, so a resume token can point at it.
+typedef struct ChessGame
+{
+    //NULL while that player is away: their connection dropped and the game waits for them to come back with RESUME_GAME_MSGTYPE
+    Connection* players[2];
+
+    //unique across restarts of the server. 0 while the slot is free
+    uint64_t gameID;
+
+    uint64_t resumeTokens[2];
+
+    //the side of each player now (they swap at every rematch), and at PAIRING_COMPLETE_MSGTYPE (for the journal)
+    Side sides[2];
+    Side startSides[2];
+
+    //where the game is in its worker's games array (and so which poll set registrations are its players')
+    uint32_t gameIndex;
+
+    //the next free slot while this one is free
+    uint32_t nextFree;
+
+    //true while the resume tokens are in s_resumeIndex and every message is kept in log. false until PAIRING_COMPLETE_MSGTYPE
+    //was sent, and after the log went past GAME_LOG_MAX_BYTES
+    bool isResumable;
+
+    //bit i is set when players[i] lost their connection in this loop iteration. they are made away by suspendLeftPlayers()
+    uint8_t leftPlayers;
+
+    //how many messages each player sent since PAIRING_COMPLETE_MSGTYPE (the counts of RESUME_GAME_MSGTYPE and GAME_RESUMED_MSGTYPE)
+    uint32_t numOfMessagesFrom[2];
+
+    //Every message of the game, each one after the index of the player who sent it. replayOffsets[i] is the next message of the log
+    //that players[i] still has to get while isReplaying[i], after they came back. New messages for them only go into the log until then
+    char* log;
+    uint32_t logSize;
+    uint32_t logCapacity;
+    uint32_t replayOffsets[2];
+    bool isReplaying[2];
+
+    //when players[i] went away (the clock of the worker's resume timers), and the timer that ends the game if one of them
+    //is away for longer than g_serverConfig.resumeGraceSecs
+    uint64_t leftAtMs[2];
+    TimerNode resumeTimer;
+
+    //the game's board, or NULL if move validation is off
+    ChessPosition* position;
+
+    //the journal of the game's worker, or NULL while the games are being recovered
+    GameJournal* journal;
+
+    //the ID of SPECTATE_MSGTYPE. in s_spectateIndex while the game is running, 0 if it has none
+    uint32_t spectateID;
+
+    //where the current game (since the last rematch) starts in log, for the catch-up of new spectators
+    uint32_t currentGameLogOffset;
+
+    //every message of the game as a SPECTATED_MESSAGE_MSGTYPE, started while the game has spectators
+    SpectatorFeed feed;
+    Spectator* spectators;
+
+    //the catch-up (see buildCatchUp()) of the spectators who joined since the last message, or NULL
+    SpectatorChunk* catchUp;
+
+}ChessGame;
+
+//two players handed over by startChessGame() that the worker has not picked up yet
+typedef struct
+{
+    ConnectionHandle players[2];
+}NewGame;
+
+//a player handed over by resumeChessGame() that the worker has not picked up yet
 typedef struct
 {
-    SOCKET sock;
-    Side side;//white or black pieces
-    SOCKADDR_IN addr;
-    char ipStr[INET6_ADDRSTRLEN];
-}Player;
+    ConnectionHandle player;
+    uint32_t gameSlot;
+    uint64_t resumeToken;
+    uint32_t numOfMessagesReceived;
+}ResumingPlayer;
 
-//helper func to reduce quitGame's size
-static void sendUnpairMessage(Player* p)
+//a connection handed over by spectateChessGame() that the worker has not picked up yet
+typedef struct
 {
-    char buff[2] = {UNPAIR_MSGTYPE, UNPAIR_MSGSIZE};
-    networkSendAll(p->sock, buff, sizeof buff);
+    ConnectionHandle spectator;
+    uint32_t gameSlot;
+    uint32_t spectateID;
+}NewSpectator;
+
+typedef struct
+{
+    size_t index;
+
+    //lets startChessGame() and resumeChessGame() interrupt the worker while it is blocked in WSAPoll()
+    WakeupSocket wakeup;
+
+    //Every game of this worker has a slot in gameSlots (s_maxGamesPerWorker of them). The running ones are also in games,
+    //which is kept packed for the poll set. Only touched by the worker thread.
+    //pollFds[0] is the wakeup socket, and games[i] is registered by pollFds[2i + 1] and pollFds[2i + 2]
+    //(an INVALID_SOCKET while that player is away).
+    ChessGame* gameSlots;
+    uint32_t firstFreeSlot;
+    ChessGame** games;
+    WSAPOLLFD* pollFds;
+    size_t numOfGames;
+
+    //The spectators (g_serverConfig.spectatorsPerWorker slots) are registered right after the games, by
+    //pollFds[2 * numOfGames + 1] to pollFds[2 * numOfGames + numOfSpectators]. pollFdSpectators has the spectator of each of those.
+    //A game that starts or ends moves (at most) two spectators, so the games stay in front
+    Spectator* spectatorSlots;
+    Spectator* firstFreeSpectator;
+    Spectator** pollFdSpectators;
+    size_t numOfSpectators;
+
+    //where the next loop iteration starts flushing the spectators (see serviceSpectators())
+    size_t spectatorFlushStart;
+
+    //positions[i] is the board of gameSlots[i]. NULL unless g_serverConfig.validateMoves is on
+    ChessPosition* positions;
+
+    //the low 48 bits of the gameID of the last game this worker started
+    uint64_t gameCounter;
+
+    //the resumeTimers of the games. on the clock of getWorkerNowMs()
+    TimerWheel resumeTimers;
+
+    GameJournal* journal;
+
+    //New games handed over by startChessGame(), and players handed over by resumeChessGame(), that the worker has not picked up yet.
+    CRITICAL_SECTION inboxMutex;
+    NewGame* inbox;
+    size_t inboxSize;
+    ResumingPlayer* resumeInbox;
+    size_t resumeInboxSize;
+    NewSpectator* spectateInbox;
+    size_t spectateInboxSize;
+
+    //the completion queue of the players that use Registered I/O on this worker. only used if g_serverConfig.registeredIO is on
+    RegisteredIOQueue rio;
+
+    //Players who left this worker's games while a receive or send of theirs was still in flight (see registeredIOIsIdle()).
+    //They go back to the lobby (or the pool, if their socket was closed) once it completed (see finishLeavingPlayers())
+    Connection** leavingPlayers;
+    size_t numOfLeavingPlayers;
+    size_t leavingPlayersCapacity;
+
+    //number of games owned by this worker plus the ones waiting in the inbox.
+    //used by startChessGame() to find the least loaded worker.
+    volatile LONG load;
+
+    //Set by gameManagerHandOver() when the server is handed over to a new process (see hotUpgrade.h). The worker stops posting receives,
+    //and once what was in flight completed (or handOverDeadlineUs passed) it writes its games into handOver, sets handedOverEvent and ends
+    volatile LONG isHandingOver;
+    uint64_t handOverDeadlineUs;
+    HotUpgradeBuffer handOver;
+    HANDLE handedOverEvent;
+
+}GameWorker;
+
+static GameWorker* s_gameWorkers = NULL;
+static size_t s_numOfGameWorkers = 0;
+
+//g_serverConfig.maxGames divided between the workers (rounded up)
+static size_t s_maxGamesPerWorker = 0;
+
+//the resume tokens of every resumable game (see RESUME_SLOT_BITS). written by the workers, read by the lobby threads
+static ConnectionIndex s_resumeIndex;
+
+//the spectate IDs of every running game. maps to the same as s_resumeIndex
+static ConnectionIndex s_spectateIndex;
+
+static uint64_t getWorkerNowMs(void)
+{
+    return getMonotonicMicroseconds() / 1000;
+}
+
+//true if p receives and sends with Registered I/O on worker
+static bool usesRegisteredIO(GameWorker const* worker, Connection const* p)
+{
+    return registeredIOIsAttached(&worker->rio, &p->rio);
+}
+
+//Hold on to a player who leaves their game while Registered I/O still has a receive or send of theirs in flight,
+//since its completion points at their connection. state is CONNECTION_LEAVING if they go back to the lobby, or CONNECTION_CLOSING
+//if they were closed. finishLeavingPlayers() lets them go once what was in flight completed
+static void parkLeavingPlayer(Connection* p, ConnectionState state)
+{
+    connectionSetState(p, state);
+
+    //only the worker whose completion queue p is tied to can have something of theirs in flight
+    GameWorker* worker = s_gameWorkers + p->rio.queue->owner;
+    if(worker->numOfLeavingPlayers == worker->leavingPlayersCapacity)
+    {
+        size_t const newCapacity = worker->leavingPlayersCapacity ? 2 * worker->leavingPlayersCapacity : 16;
+        Connection** newLeavingPlayers = realloc(worker->leavingPlayers, newCapacity * sizeof(Connection*));
+        if( ! newLeavingPlayers )
+        {
+            logError("realloc failed to grow the leaving players of a game worker", 0);
+            exit(0);
+        }
+
+        worker->leavingPlayers = newLeavingPlayers;
+        worker->leavingPlayersCapacity = newCapacity;
+    }
+
+    worker->leavingPlayers[worker->numOfLeavingPlayers++] = p;
 }
 
-//put the players back in the lobby and end this thread
-static void quitGame(Player* p1, Player* p2)
+//close a player's socket and give their connection back to the pool (and their place back to admission control)
+static void closePlayer(Connection* p)
 {
-    const bool lobbyWasEmpty = isLobbyEmpty();
+    closesocket(p->socket);
+    admissionRelease(p->addr.sin_addr);
+
+    //closing the socket fails what was in flight, but the completions are still coming
+    if( ! registeredIOIsIdle(&p->rio) )
+    {
+        p->socket = INVALID_SOCKET;
+        parkLeavingPlayer(p, CONNECTION_CLOSING);
+        return;
+    }
+
+    connectionPoolFree(p);
+}
 
-    if(p1)
+//helper func to reduce quitGame's size. the player is disconnected if the UNPAIR_MSGTYPE doesnt fit in their write queue
+static void putBackInLobby(Connection* p)
+{
+    char buff[2] = {UNPAIR_MSGTYPE, UNPAIR_MSGSIZE};
+    if(networkQueueSend(p->socket, &p->out, buff, sizeof buff) == SOCKET_ERROR)
     {
-        sendUnpairMessage(p1);
-        lobbyInsert(p1->sock, &p1->addr);
-        printf("putting %s back in the lobby\n", p1->ipStr);
+        char errMsg[256] = {0};
+        snprintf(errMsg, sizeof(errMsg), "%s went past their write queue limit or send() failed at the end of a game", p->ipStr);
+        logError(errMsg, WSAGetLastError());
+        closePlayer(p);
+        return;
     }
-    if(p2)
+
+    //the lobby owns the connection after this, so log first
+    logDebug("putting %s back in the lobby", p->ipStr);
+    if( ! registeredIOIsIdle(&p->rio) )
     {
-        sendUnpairMessage(p2);
-        lobbyInsert(p2->sock, &p2->addr);
-        printf("putting %s back in the lobby\n", p2->ipStr);
+        parkLeavingPlayer(p, CONNECTION_LEAVING);
+        return;
     }
 
-    if(lobbyWasEmpty) 
+    //players coming back from a game are always let back in, so they dont reserve a place first
+    lobbyInsert((ConnectionHandle)p->handle, false);
+}
+
+//give the players who left while something of theirs was in flight (see parkLeavingPlayer()) to the lobby or the pool, if it completed
+static void finishLeavingPlayers(GameWorker* worker)
+{
+    for(size_t i = 0; i < worker->numOfLeavingPlayers;)
     {
-        puts("waking the lobby thread up");
-        WakeConditionVariable(&g_lobbyEmptyCond);
+        Connection* p = worker->leavingPlayers[i];
+        if( ! registeredIOIsIdle(&p->rio) )
+        {
+            ++i;
+            continue;
+        }
+
+        worker->leavingPlayers[i] = worker->leavingPlayers[--worker->numOfLeavingPlayers];
+
+        //closePlayer() already closed the socket of the ones that are not going back to the lobby
+        if(p->state == CONNECTION_CLOSING)
+            connectionPoolFree(p);
+        else
+            lobbyInsert((ConnectionHandle)p->handle, false);
     }
+}
 
-    _endthread();
+//put the players who are still connected back in the lobby. whatever is still
+//queued for them is sent by the lobby, since their connection goes along with them.
+//the caller is responsible for closing a player passed as NULL.
+static void quitGame(Connection* p1, Connection* p2)
+{
+    if(p1) putBackInLobby(p1);
+    if(p2) putBackInLobby(p2);
+}
+
+//the name of a player for logging, or what they are if they are away
+static char const* playerName(Connection const* p)
+{
+    return p ? p->ipStr : "an opponent who is away";
 }
 
-static void forwardMessage(const char* msg, size_t msgSize, const char* msgType, Player* from, Player* to)
+//send a RESUME_FAILED_MSGTYPE to a player who could not be put back into their game, and put them back in the lobby
+static void failResume(Connection* p)
 {
-    printf("forwarding a %s message from %s to %s\n", msgType, from->ipStr, to->ipStr);
+    metricsAdd(METRIC_RESUMES_FAILED, 1);
 
-    if(networkSendAll(to->sock, msg, msgSize) == SOCKET_ERROR)
+    char const buff[RESUME_FAILED_MSGSIZE] = {RESUME_FAILED_MSGTYPE, RESUME_FAILED_MSGSIZE};
+    if(networkQueueSend(p->socket, &p->out, buff, sizeof buff) == SOCKET_ERROR)
     {
-        char buff[512] = {0};
-        snprintf(buff, sizeof(buff), "write() failed when sending msg from %s to %s\n", from->ipStr, to->ipStr);
-        logError(buff, WSAGetLastError());
-        closesocket(to->sock);
-        quitGame(NULL, from);
+        logError("send failed (or the write queue limit was exceeded) to a player who could not resume their game", WSAGetLastError());
+        closePlayer(p);
+        return;
     }
+
+    logInfo("%s could not resume their game. putting them back in the lobby", p->ipStr);
+    lobbyInsert((ConnectionHandle)p->handle, false);
 }
 
-static void handleInvalidMessageType(Player* from, Player* to)
+//returns false if resumeToken is not in s_resumeIndex, otherwise writes what it maps to to valueOut
+static bool lookupResumeToken(uint64_t resumeToken, uint32_t* valueOut)
 {
-    char const formatStr[] = "invalid message type sent from %s in a game against %s... uh oh";
-    char errMsgBuff[256] = {0};
-    sprintf_s(errMsgBuff, sizeof(errMsgBuff), formatStr, from->ipStr, to->ipStr);
-    logError(errMsgBuff, 0);
+    uint32_t const key = (uint32_t)(resumeToken >> 32);
+    if(key == CONNECTION_INDEX_EMPTY_KEY || key == CONNECTION_INDEX_TOMBSTONE_KEY)
+        return false;
 
-    char connectionClosedMsg[OPPONENT_CLOSED_CONNECTION_MSGSIZE] = {
-        OPPONENT_CLOSED_CONNECTION_MSGTYPE,
-        OPPONENT_CLOSED_CONNECTION_MSGSIZE
-    };
+    return connectionIndexLookup(&s_resumeIndex, key, valueOut);
+}
 
-    printf("sending a OPPONENT_CLOSED_CONNECTION_MSGTYPE to %s\n", to->ipStr);
+//Insert a random key that maps to value (see RESUME_SLOT_BITS) into index.
+//Returns the key, or 0 if rand_s() fails or no free key was found.
+static uint32_t insertRandomKey(ConnectionIndex* index, uint32_t value)
+{
+    for(int attempt = 0; attempt < 16; ++attempt)
+    {
+        unsigned int key = 0;
+        if(rand_s(&key))
+        {
+            logError("rand_s() failed to generate a key for a game", 0);
+            return 0;
+        }
 
-    networkSendAll(to->sock, connectionClosedMsg, sizeof(connectionClosedMsg));
+        if(key == CONNECTION_INDEX_EMPTY_KEY || key == CONNECTION_INDEX_TOMBSTONE_KEY)
+            continue;
 
-    closesocket(from->sock);
-    quitGame(NULL, to);
+        if(connectionIndexInsert(index, key, value))
+            return key;
+    }
+
+    logError("could not find a free key for a game", 0);
+    return 0;
 }
 
-//helper func to reduce consumeMessage size
-static void handleUnpairMessage(const char* msgBuff, Player* from, Player* to)
+//A new token for the game in value. Its key is already in s_resumeIndex.
+//Returns 0 (no token, so the player can not resume) if no key was found.
+static uint64_t newResumeToken(uint32_t value)
 {
-    quitGame(from, to);
+    unsigned int secret = 0;
+    if(rand_s(&secret))
+    {
+        logError("rand_s() failed to generate a resume token", 0);
+        return 0;
+    }
+
+    uint32_t const key = insertRandomKey(&s_resumeIndex, value);
+    return key ? ((uint64_t)key << 32) | secret : 0;
 }
 
-static void handleRematchDeclineMessage(const char* msgBuff, Player* from, Player* to)
+static uint32_t gameIndexValue(GameWorker const* worker, ChessGame const* game)
 {
-    forwardMessage(msgBuff, REMATCH_DECLINE_MSGSIZE, STRINGIFY(REMATCH_DECLINE_MSGTYPE), from, to);
-    quitGame(from, to);
+    return (uint32_t)(worker->index << RESUME_SLOT_BITS) | (uint32_t)(game - worker->gameSlots);
 }
 
-static void consumeMessage(const char* msgBuff, size_t* msgBuffCurrentSize, Player* from, Player* to)
+//Put the resume tokens of a game into s_resumeIndex. A game recovered from a journal keeps the tokens it had,
+//every other game gets new ones.
+static void registerResumeTokens(GameWorker* worker, ChessGame* game)
 {
-    size_t const msgSize = msgBuff[1];
-    assert(*msgBuffCurrentSize >= msgSize);
+    uint32_t const value = gameIndexValue(worker, game);
+    for(int i = 0; i < 2; ++i)
+    {
+        if( ! game->resumeTokens[i] )
+        {
+            game->resumeTokens[i] = newResumeToken(value);
+        }
+        else if( ! connectionIndexInsert(&s_resumeIndex, (uint32_t)(game->resumeTokens[i] >> 32), value) )
+        {
+            logWarn("a recovered game has the same resume token as another game. that player can not resume it");
+            game->resumeTokens[i] = 0;
+        }
+    }
+}
 
-    switch(msgBuff[0])
+static void unregisterResumeTokens(ChessGame* game)
+{
+    for(int i = 0; i < 2; ++i)
     {
-    case UNPAIR_MSGTYPE: {handleUnpairMessage(msgBuff, from, to); break;}
-    case MOVE_MSGTYPE: {forwardMessage(msgBuff, MOVE_MSGSIZE, STRINGIFY(MOVE_MSGTYPE), from, to); break;}
-    case RESIGN_MSGTYPE: {forwardMessage(msgBuff, RESIGN_MSGSIZE, STRINGIFY(RESIGN_MSGTYPE), from, to); break;}
-    case REMATCH_REQUEST_MSGTYPE: {forwardMessage(msgBuff, REMATCH_REQUEST_MSGSIZE, STRINGIFY(REMATCH_REQUEST_MSGTYPE), from, to); break;}
-    case REMATCH_ACCEPT_MSGTYPE: {forwardMessage(msgBuff, REMATCH_ACCEPT_MSGSIZE, STRINGIFY(REMATCH_ACCEPT_MSGTYPE), from, to); break;}
-    case REMATCH_DECLINE_MSGTYPE: {handleRematchDeclineMessage(msgBuff, from, to); break;}
-    case DRAW_ACCEPT_MSGTYPE: {forwardMessage(msgBuff, DRAW_ACCEPT_MSGSIZE, STRINGIFY(DRAW_ACCEPT_MSGSIZE), from, to); break;}
-    case DRAW_OFFER_MSGTYPE: {forwardMessage(msgBuff, DRAW_OFFER_MSGSIZE, STRINGIFY(DRAW_OFFER_MSGTYPE), from, to); break;}
-    case DRAW_DECLINE_MSGTYPE: {forwardMessage(msgBuff, DRAW_DECLINE_MSGSIZE, STRINGIFY(DRAW_DECLINE_MSGTYPE), from, to); break;}
-    default: {handleInvalidMessageType(from, to);}
+        if(game->resumeTokens[i])
+            connectionIndexRemove(&s_resumeIndex, (uint32_t)(game->resumeTokens[i] >> 32));
+        game->resumeTokens[i] = 0;
     }
+}
+
+//the game can not be resumed anymore. it ends in the journal, so it is not rebuilt after a restart either
+static void stopResuming(ChessGame* game)
+{
+    if( ! game->isResumable )
+        return;
+
+    if(game->journal)
+        gameJournalAppend(game->journal, JOURNAL_GAME_END, game->gameID, 0, NULL, 0);
+
+    unregisterResumeTokens(game);
+    free(game->log);
+    game->log = NULL;
+    game->logSize = game->logCapacity = 0;
+    game->isReplaying[0] = game->isReplaying[1] = false;
+    game->isResumable = false;
+}
 
-    //if there are extra bytes in the buffer past this message, move them to the front of the buffer
-    if(*msgBuffCurrentSize > msgSize)
+//Keep a message from players[fromIndex] in the game's log and in the journal. Returns false if the log is full
+static bool appendToGameLog(ChessGame* game, int fromIndex, char const* msg, size_t msgSize)
+{
+    uint32_t const entrySize = 1 + (uint32_t)msgSize;
+    if(game->logSize + entrySize > game->logCapacity)
     {
-        //memmove instead of memcpy since the pointers might overlap
-        memmove(msgBuff, msgBuff + msgSize, (*msgBuffCurrentSize) - msgSize);
+        if(game->logSize + entrySize > GAME_LOG_MAX_BYTES)
+            return false;
+
+        uint32_t const newCapacity = game->logCapacity ? min(2 * game->logCapacity, GAME_LOG_MAX_BYTES) : GAME_LOG_INITIAL_CAPACITY;
+        char* newLog = realloc(game->log, newCapacity);
+        if( ! newLog )
+        {
+            logError("realloc failed to grow the log of a game", 0);
+            exit(0);
+        }
+
+        game->log = newLog;
+        game->logCapacity = newCapacity;
     }
 
-    *msgBuffCurrentSize -= msgSize;
+    game->log[game->logSize] = (char)fromIndex;
+    memcpy(game->log + game->logSize + 1, msg, msgSize);
+    game->logSize += entrySize;
+
+    if(game->journal)
+        gameJournalAppend(game->journal, JOURNAL_GAME_MESSAGE, game->gameID, (uint8_t)fromIndex, msg, msgSize);
+
+    return true;
+}
+
+//the size of the log entry at offset (the index of the sender and the message)
+static uint32_t gameLogEntrySize(ChessGame const* game, uint32_t offset)
+{
+    return 1 + (uint8_t)game->log[offset + 2];
+}
+
+//queue the SPECTATE_ID_MSGTYPE of game for p. returns SOCKET_ERROR if it did not fit (see networkQueueSend())
+static int queueSpectateID(Connection* p, ChessGame const* game)
+{
+    char buff[SPECTATE_ID_MSGSIZE] = {SPECTATE_ID_MSGTYPE, SPECTATE_ID_MSGSIZE};
+    uint32_t const nwByteOrderID = htonl(game->spectateID);
+    memcpy(buff + 2, &nwByteOrderID, sizeof(nwByteOrderID));
+    return networkQueueSend(p->socket, &p->out, buff, sizeof(buff));
+}
+
+static void registerSpectateID(GameWorker* worker, ChessGame* game)
+{
+    game->spectateID = insertRandomKey(&s_spectateIndex, gameIndexValue(worker, game));
+}
+
+//write msg from players[fromIndex] to the game's spectators (if it has any)
+static void appendToSpectatorFeed(ChessGame* game, int fromIndex, char const* msg, size_t msgSize)
+{
+    if( ! spectatorFeedIsStarted(&game->feed) )
+        return;
+
+    //the catch-up does not have this message, so the next spectator needs a new one
+    spectatorChunkRelease(game->catchUp);
+    game->catchUp = NULL;
+
+    char buff[SPECTATED_MESSAGE_MSGSIZE] = {SPECTATED_MESSAGE_MSGTYPE, SPECTATED_MESSAGE_MSGSIZE, (char)game->sides[fromIndex]};
+    memcpy(buff + 3, msg, min(msgSize, sizeof(buff) - 3));
+    spectatorFeedAppend(&game->feed, buff, sizeof(buff));
 }
 
-static void sendPairingCompleteMsg(Player* p1, Player* p2)
+//The chunk a new spectator of game starts at: a SPECTATE_START_MSGTYPE and every move of the current game so far, which leads into
+//the feed from the next message on. Every spectator who joins before that message shares the same one.
+//returns NULL if the game has no log (it is not resumable) or too many moves to send
+static SpectatorChunk* buildCatchUp(ChessGame* game)
 {
-    char buff[PAIR_COMPLETE_MSGSIZE] = {PAIRING_COMPLETE_MSGTYPE, PAIR_COMPLETE_MSGSIZE};
-    char whiteOrBlackPieces = (rand() & 1) ? (char)WHITE : (char)BLACK;
+    if( ! game->isResumable )
+        return NULL;
+
+    SpectatorChunk* tail = spectatorFeedSplit(&game->feed);
+    if(game->catchUp && game->catchUp->next == tail)
+        return game->catchUp;
 
-    p1->side = whiteOrBlackPieces;
-    memcpy(buff + 2, &whiteOrBlackPieces, sizeof(whiteOrBlackPieces));
-    int p1SendResult = networkSendAll(p1->sock, buff, sizeof(buff));
+    spectatorChunkRelease(game->catchUp);
+    game->catchUp = NULL;
 
-    if(p1SendResult == SOCKET_ERROR)
+    uint32_t numOfMoves = 0;
+    for(uint32_t offset = game->currentGameLogOffset; offset < game->logSize; offset += gameLogEntrySize(game, offset))
     {
-        closesocket(p1->sock);
-        quitGame(NULL, p2);
+        if((uint8_t)game->log[offset + 1] == MOVE_MSGTYPE)
+            ++numOfMoves;
     }
 
-    whiteOrBlackPieces = (whiteOrBlackPieces == WHITE) ? BLACK : WHITE;//swap sides
+    size_t const catchUpSize = SPECTATE_START_MSGSIZE + (size_t)numOfMoves * SPECTATED_MESSAGE_MSGSIZE;
+    if(catchUpSize > SPECTATOR_MAX_CATCH_UP_SIZE)
+        return NULL;
 
-    p2->side = whiteOrBlackPieces;
-    memcpy(buff + 2, &whiteOrBlackPieces, sizeof(whiteOrBlackPieces));
-    int p2SendResult = networkSendAll(p2->sock, buff, sizeof(buff));
+    SpectatorChunk* catchUp = spectatorChunkNew((uint32_t)catchUpSize, tail);
+    char* out = catchUp->data;
+    out[0] = SPECTATE_START_MSGTYPE;
+    out[1] = SPECTATE_START_MSGSIZE;
+    uint16_t const nwByteOrderNumOfMoves = htons((uint16_t)numOfMoves);
+    memcpy(out + 2, &nwByteOrderNumOfMoves, sizeof(nwByteOrderNumOfMoves));
+    out += SPECTATE_START_MSGSIZE;
 
-    if(p2SendResult == SOCKET_ERROR)
+    //the players are on the sides they are on now since the start of the current game
+    for(uint32_t offset = game->currentGameLogOffset; offset < game->logSize; offset += gameLogEntrySize(game, offset))
     {
-        closesocket(p2->sock);
-        quitGame(NULL, p1);
+        if((uint8_t)game->log[offset + 1] != MOVE_MSGTYPE)
+            continue;
+
+        memset(out, 0, SPECTATED_MESSAGE_MSGSIZE);
+        out[0] = SPECTATED_MESSAGE_MSGTYPE;
+        out[1] = SPECTATED_MESSAGE_MSGSIZE;
+        out[2] = (char)game->sides[(uint8_t)game->log[offset]];
+        memcpy(out + 3, game->log + offset + 1, MOVE_MSGSIZE);
+        out += SPECTATED_MESSAGE_MSGSIZE;
     }
 
-    printf("sending PAIRING_COMPLETE_MSG to %s and %s\n", p1->ipStr, p2->ipStr);
+    catchUp->size = (uint32_t)catchUpSize;
+    catchUp->feedOffset = tail->feedOffset - catchUpSize;
+    game->catchUp = catchUp;
+    return catchUp;
 }
 
-static void handleSelectErr(Player* p1, Player* p2)
+static void stopSpectatorFeed(ChessGame* game)
 {
-    char errMsg[256] = {0};
-    snprintf(errMsg, sizeof(errMsg), "select failed in a game between %s and %s", p2->ipStr, p1->ipStr);
-    logError(errMsg, WSAGetLastError());
-    quitGame(p2, p1);
+    spectatorChunkRelease(game->catchUp);
+    game->catchUp = NULL;
+    spectatorFeedStop(&game->feed);
+}
+
+static size_t firstSpectatorPollIndex(GameWorker const* worker)
+{
+    return 2 * worker->numOfGames + 1;
+}
+
+static void moveSpectatorPollFd(GameWorker* worker, size_t from, size_t to)
+{
+    Spectator* spectator = worker->pollFdSpectators[from];
+    worker->pollFds[to] = worker->pollFds[from];
+    worker->pollFdSpectators[to] = spectator;
+    spectator->pollIndex = (uint32_t)to;
+}
+
+//The two poll set registrations after the last game are about to be taken by a new game.
+//Move the (at most two) spectators in them to the end. Called before numOfGames goes up
+static void makeRoomForGame(GameWorker* worker)
+{
+    size_t const first = firstSpectatorPollIndex(worker);
+    size_t const numOfMoved = min(worker->numOfSpectators, (size_t)2);
+    for(size_t i = 0; i < numOfMoved; ++i)
+        moveSpectatorPollFd(worker, first + i, first + max(worker->numOfSpectators, (size_t)2) + i);
 }
 
-//return true if the whole message has been received.
-static bool isMessageReady(const char* msgBuff, size_t currentSize)
+//The last game was removed from the poll set, so fill its two registrations with the (at most two) last spectators.
+//Called after numOfGames went down
+static void fillRoomOfGame(GameWorker* worker)
 {
-    size_t expectedMsgSize = msgBuff[1];
-    return expectedMsgSize <= currentSize;
+    size_t const first = firstSpectatorPollIndex(worker);
+    size_t const numOfMoved = min(worker->numOfSpectators, (size_t)2);
+    for(size_t i = 0; i < numOfMoved; ++i)
+        moveSpectatorPollFd(worker, first + 2 + worker->numOfSpectators - numOfMoved + i, first + i);
 }
 
-//handle when recv returns 0
-static void handleClosedConnection(const Player* closed, Player* opponent)
+//take a free spectator slot for p, who watches game from catchUp on, and poll their socket after the last spectator.
+//game is NULL for a spectator of a game that ended, who only sends the rest of catchUp
+static void addSpectator(GameWorker* worker, ChessGame* game, Connection* p, SpectatorChunk* catchUp)
 {
-    char const buff[OPPONENT_CLOSED_CONNECTION_MSGSIZE] = 
+    connectionSetState(p, CONNECTION_SPECTATING);
+    Spectator* spectator = worker->firstFreeSpectator;
+    worker->firstFreeSpectator = spectator->next;
+
+    memset(spectator, 0, sizeof(*spectator));
+    spectator->connection = p;
+    spectator->game = game;
+    spectatorCursorInit(&spectator->cursor, catchUp);
+
+    if(game)
     {
-        OPPONENT_CLOSED_CONNECTION_MSGTYPE, 
-        OPPONENT_CLOSED_CONNECTION_MSGSIZE
-    };
-    
-    if(networkSendAll(opponent->sock, buff, sizeof(buff)) == SOCKET_ERROR)
+        spectator->next = game->spectators;
+        if(game->spectators)
+            game->spectators->prev = spectator;
+        game->spectators = spectator;
+    }
+
+    size_t const pollIndex = firstSpectatorPollIndex(worker) + worker->numOfSpectators++;
+    spectator->pollIndex = (uint32_t)pollIndex;
+    worker->pollFdSpectators[pollIndex] = spectator;
+    worker->pollFds[pollIndex].fd = p->socket;
+    worker->pollFds[pollIndex].events = POLLRDNORM;
+    worker->pollFds[pollIndex].revents = 0;
+}
+
+//The spectator stops watching their game (the caller closes their connection or puts it back in the lobby).
+//The last spectator is moved into their poll set registration
+static void removeSpectator(GameWorker* worker, Spectator* spectator)
+{
+    ChessGame* game = spectator->game;
+    if(game)
     {
-        closesocket(opponent->sock);
-        _endthread();
+        if(spectator->prev) spectator->prev->next = spectator->next;
+        else game->spectators = spectator->next;
+        if(spectator->next) spectator->next->prev = spectator->prev;
+
+        if( ! game->spectators )
+            stopSpectatorFeed(game);
     }
-    
-    printf("connection from %s closed. Sending %s to %s\n", closed->ipStr, 
-        STRINGIFY(OPPONENT_CLOSED_CONNECTION_MSGTYPE), opponent->ipStr);
 
-    closesocket(closed->sock);
-    quitGame(NULL, opponent);
+    spectatorCursorRelease(&spectator->cursor);
+
+    size_t const lastPollIndex = firstSpectatorPollIndex(worker) + --worker->numOfSpectators;
+    if(spectator->pollIndex != lastPollIndex)
+        moveSpectatorPollFd(worker, lastPollIndex, spectator->pollIndex);
+
+    spectator->connection = NULL;
+    spectator->game = NULL;
+    spectator->next = worker->firstFreeSpectator;
+    worker->firstFreeSpectator = spectator;
 }
 
-//handle when recv returns SOCKET_ERROR
-static void handleRecvErr(const Player* errorFrom, Player* opponent)
+static void dropSpectator(GameWorker* worker, Spectator* spectator)
 {
-    char errMsg[256] = {0};
-    snprintf(errMsg, sizeof(errMsg), "recv failed from %s", errorFrom->ipStr);
-    logError(errMsg, WSAGetLastError());
-    closesocket(errorFrom->sock);
-    quitGame(NULL, opponent);
+    closePlayer(spectator->connection);
+    removeSpectator(worker, spectator);
 }
 
-//if this function returns, then recv did not return 0 or SOCKET_ERROR. The size_t returned
-//will be the number of bytes retrieved from recv.
-static int handleRecvResult(int const recvResult, const Player* receivedFrom, Player* opponent)
+//The game ended. Its spectators get a SPECTATE_ENDED_MSGTYPE after the rest of the feed, and then go back to the lobby
+//(see serviceSpectator()). The feed's chunks stay around for as long as a spectator still has to send them
+static void endSpectating(ChessGame* game)
 {
-    if(recvResult == SOCKET_ERROR) { handleRecvErr(receivedFrom, opponent); }
-    else if(recvResult == 0) { handleClosedConnection(receivedFrom, opponent); }
+    if( ! spectatorFeedIsStarted(&game->feed) )
+        return;
+
+    char const buff[SPECTATE_ENDED_MSGSIZE] = {SPECTATE_ENDED_MSGTYPE, SPECTATE_ENDED_MSGSIZE};
+    spectatorFeedAppend(&game->feed, buff, sizeof(buff));
+
+    for(Spectator* spectator = game->spectators; spectator;)
+    {
+        Spectator* next = spectator->next;
+        spectator->game = NULL;
+        spectator->prev = spectator->next = NULL;
+        spectator = next;
+    }
 
-    return recvResult;
+    game->spectators = NULL;
+    stopSpectatorFeed(game);
 }
 
-//called when select returns > 0 indicating that there are bytes ready to be read on a socket
-static void onSelectReady(Player* bytesReadyPlayer, Player* opponent, char* msgBuff, 
-    size_t msgBuffCapacity, size_t* msgBuffCurrentSize)
+//send a SPECTATE_FAILED_MSGTYPE to a connection that could not watch the game it asked for, and put it back in the lobby
+static void failSpectate(Connection* p)
 {
-    size_t buffRemainingSize = msgBuffCapacity - *msgBuffCurrentSize;
-
-    int numBytesReceived = handleRecvResult(
-        recv(bytesReadyPlayer->sock, msgBuff + *msgBuffCurrentSize, buffRemainingSize, 0),
-        bytesReadyPlayer, opponent
-    );
-    
-    *msgBuffCurrentSize += numBytesReceived;
+    char const buff[SPECTATE_FAILED_MSGSIZE] = {SPECTATE_FAILED_MSGTYPE, SPECTATE_FAILED_MSGSIZE};
+    if(networkQueueSend(p->socket, &p->out, buff, sizeof buff) == SOCKET_ERROR)
+    {
+        logError("send failed (or the write queue limit was exceeded) to a connection that could not watch a game", WSAGetLastError());
+        closePlayer(p);
+        return;
+    }
 
-    if(isMessageReady(msgBuff, *msgBuffCurrentSize))
-        consumeMessage(msgBuff, msgBuffCurrentSize, bytesReadyPlayer, opponent);
+    logDebug("%s could not watch the game they asked for. putting them back in the lobby", p->ipStr);
+    lobbyInsert((ConnectionHandle)p->handle, false);
 }
 
-//The lobby connections will be coppied into the stack for this thread.
-//this means they will be isolated from other game manager threads/lobby thread etc
-void __stdcall chessGameThreadStart(void* incommingLobbyConnections)
+//The spectator sent UNPAIR_MSGTYPE. whatever of the game they did not get yet is dropped, and they go back to the lobby
+static void stopWatching(GameWorker* worker, Spectator* spectator)
 {
-    srand((unsigned)time(NULL));
+    Connection* p = spectator->connection;
+    removeSpectator(worker, spectator);
 
-    //incommingLobbyConnections will point to an array of two LobbyConnection pointers
-    //where the first pointer will point to player1, and the second will point to player 2.
-    LobbyConnection** lobbyConnections = incommingLobbyConnections;
-    Player player1 =
+    char const buff[SPECTATE_ENDED_MSGSIZE] = {SPECTATE_ENDED_MSGTYPE, SPECTATE_ENDED_MSGSIZE};
+    if(networkQueueSend(p->socket, &p->out, buff, sizeof buff) == SOCKET_ERROR)
     {
-        .sock = lobbyConnections[0]->socket, 
-        .side = INVALID,
-        .addr = lobbyConnections[0]->addr
-    };
-    Player player2 =
+        closePlayer(p);
+        return;
+    }
+
+    logDebug("%s stopped watching a game. putting them back in the lobby", p->ipStr);
+    lobbyInsert((ConnectionHandle)p->handle, false);
+}
+
+//called when WSAPoll() indicates that there are bytes ready to be read on a spectator's socket.
+//returns false if the spectator was removed
+static bool onSpectatorReadable(GameWorker* worker, Spectator* spectator)
+{
+    Connection* p = spectator->connection;
+    int const numBytesReceived = messageFramerRecv(p->socket, &p->in, OUT_BUFFER_CAPACITY);
+    if(numBytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+        return true;
+
+    if(numBytesReceived <= 0)
     {
-        .sock = lobbyConnections[1]->socket, 
-        .side = INVALID,
-        .addr = lobbyConnections[1]->addr
-    };
+        logDebug("spectator %s disconnected", p->ipStr);
+        dropSpectator(worker, spectator);
+        return false;
+    }
 
-    //wake the lobby up because it is waiting for this thread to finish copying 
-    //lobby connections from the lobby into the ChessPair struct above.
-    //this is done to just be sure that this thread has started, has the data it needs,
-    //and its ready to start the chess game before the lobby thread proceeds
+    metricsAdd(METRIC_BYTES_IN, (uint64_t)numBytesReceived);
 
-    WakeConditionVariable(&g_gameManagerIsReadyCond);
-    
-    InetNtopA(player1.addr.sin_family, &player1.addr.sin_addr, player1.ipStr, sizeof(player1.ipStr));
-    InetNtopA(player2.addr.sin_family, &player2.addr.sin_addr, player2.ipStr, sizeof(player2.ipStr));
+    MessageView msg;
+    FramerResult const framerResult = messageFramerNext(&p->in, &msg);
+    if(framerResult == FRAMER_NEED_MORE_BYTES)
+        return true;
 
-    sendPairingCompleteMsg(&player1, &player2);
+    if(framerResult == FRAMER_MESSAGE_READY)
+    {
+        metricsCountMessage((uint8_t)msg.data[0]);
+        if((uint8_t)msg.data[0] == UNPAIR_MSGTYPE && msg.size == UNPAIR_MSGSIZE)
+        {
+            stopWatching(worker, spectator);
+            return false;
+        }
+    }
 
-    TIMEVAL tv = {.tv_usec = 10};
-    fd_set readSet;
+    logError("a spectator sent something other than UNPAIR_MSGTYPE", 0);
+    dropSpectator(worker, spectator);
+    return false;
+}
 
-    char player1Buff[2048] = {0};
-    size_t player1BuffCurrentSize = 0;
+//send what is queued for a spectator: whatever the lobby still had queued for them first, then the feed.
+//returns false if sending failed and the spectator was removed
+static bool flushSpectator(GameWorker* worker, Spectator* spectator)
+{
+    Connection* p = spectator->connection;
+    if( ! outBufferIsEmpty(&p->out) )
+    {
+        if(networkFlush(p->socket, &p->out) == SOCKET_ERROR)
+        {
+            logError("send failed to a spectator", WSAGetLastError());
+            dropSpectator(worker, spectator);
+            return false;
+        }
 
-    char player2Buff[2048] = {0};
-    size_t player2BuffCurrentSize = 0;
+        spectator->isBlocked = p->out.isBlocked;
+        if(spectator->isBlocked)
+            return true;
+    }
 
-    while(true)
+    if(spectatorCursorSend(&spectator->cursor, p->socket, &spectator->isBlocked) == SOCKET_ERROR)
     {
-        FD_ZERO(&readSet);
-        FD_SET(player1.sock, &readSet);
-        FD_SET(player2.sock, &readSet);
+        logError("send failed to a spectator", WSAGetLastError());
+        dropSpectator(worker, spectator);
+        return false;
+    }
 
-        int selectRet = select(0, &readSet, NULL, NULL, &tv);
+    return true;
+}
 
-        if(selectRet == SOCKET_ERROR) { handleSelectErr(&player1, &player2); }
-        else if(selectRet > 0)
-        {
-            if(FD_ISSET(player1.sock, &readSet))
-                onSelectReady(&player1, &player2, player1Buff, sizeof(player1Buff), &player1BuffCurrentSize);
+//Handle the poll events of a spectator, drop them if they fell too far behind, and flush them if *flushBudget allows it.
+//A spectator whose game ended goes back to the lobby once they sent all of it. returns false if the spectator was removed
+static bool serviceSpectator(GameWorker* worker, Spectator* spectator, size_t* flushBudget, bool* isFlushLeftOver)
+{
+    WSAPOLLFD* pollFd = worker->pollFds + spectator->pollIndex;
+    short const revents = pollFd->revents;
+    pollFd->revents = 0;
+
+    if(revents & POLLWRNORM)
+        spectator->isBlocked = spectator->connection->out.isBlocked = false;
+
+    if((revents & ~POLLWRNORM) && ! onSpectatorReadable(worker, spectator))
+        return false;
+
+    if(spectator->game && spectatorCursorLag(&spectator->cursor, &spectator->game->feed) > SPECTATOR_MAX_LAG_BYTES)
+    {
+        logInfo("spectator %s fell too far behind their game. disconnecting them", spectator->connection->ipStr);
+        metricsAdd(METRIC_SPECTATORS_DROPPED, 1);
+        dropSpectator(worker, spectator);
+        return false;
+    }
 
-            if(FD_ISSET(player2.sock, &readSet))
-                onSelectReady(&player2, &player1, player2Buff, sizeof(player2Buff), &player2BuffCurrentSize);
+    bool const hasPending = ! outBufferIsEmpty(&spectator->connection->out) || spectatorCursorHasPending(&spectator->cursor);
+    if(hasPending && ! spectator->isBlocked)
+    {
+        if( ! *flushBudget )
+        {
+            *isFlushLeftOver = true;
         }
+        else
+        {
+            --*flushBudget;
+            if( ! flushSpectator(worker, spectator) )
+                return false;
+        }
+    }
+
+    //the game ended and they got all of it
+    bool const isStillPending = ! outBufferIsEmpty(&spectator->connection->out) || spectatorCursorHasPending(&spectator->cursor);
+    if( ! spectator->game && ! isStillPending )
+    {
+        ConnectionHandle const handle = (ConnectionHandle)spectator->connection->handle;
+        logDebug("the game %s was watching ended. putting them back in the lobby", spectator->connection->ipStr);
+        removeSpectator(worker, spectator);
+        lobbyInsert(handle, false);
+        return false;
+    }
+
+    pollFd->events = POLLRDNORM | (spectator->isBlocked ? POLLWRNORM : 0);
+    return true;
+}
+
+//Service every spectator of the worker (see serviceSpectator()), starting where the last loop iteration's flush budget ran out.
+//Returns true if some spectators still have something to send, so the next WSAPoll() should not wait
+static bool serviceSpectators(GameWorker* worker)
+{
+    size_t flushBudget = SPECTATOR_FLUSH_BATCH;
+    bool isFlushLeftOver = false;
+
+    //a removed spectator is replaced by the last one, which is then serviced in their place.
+    //the last few can be serviced twice or wait for the next iteration, which does no harm
+    size_t const numOfSpectators = worker->numOfSpectators;
+    size_t i = worker->spectatorFlushStart;
+    for(size_t numOfServiced = 0; numOfServiced < numOfSpectators && worker->numOfSpectators; ++numOfServiced)
+    {
+        if(i >= worker->numOfSpectators)
+            i = 0;
+
+        Spectator* spectator = worker->pollFdSpectators[firstSpectatorPollIndex(worker) + i];
+        if(serviceSpectator(worker, spectator, &flushBudget, &isFlushLeftOver))
+            ++i;
+    }
+
+    worker->spectatorFlushStart = i;
+    return isFlushLeftOver;
+}
+
+//A player was away for longer than g_serverConfig.resumeGraceSecs (or their game can not wait for them anymore).
+//The players who are still there get an OPPONENT_CLOSED_CONNECTION_MSGTYPE and go back to the lobby. The caller ends the game
+static void forfeitAwayPlayers(ChessGame* game)
+{
+    char const buff[OPPONENT_CLOSED_CONNECTION_MSGSIZE] = {OPPONENT_CLOSED_CONNECTION_MSGTYPE, OPPONENT_CLOSED_CONNECTION_MSGSIZE};
+    for(int i = 0; i < 2; ++i)
+    {
+        Connection* p = game->players[i];
+        if( ! p )
+            continue;
+
+        logInfo("their opponent did not come back in time. sending %s to %s", messageTypeName(OPPONENT_CLOSED_CONNECTION_MSGTYPE), p->ipStr);
+        if(networkQueueSend(p->socket, &p->out, buff, sizeof(buff)) == SOCKET_ERROR)
+            closePlayer(p);
+        else
+            putBackInLobby(p);
     }
-}
\ No newline at end of file
+}
+
+//The game's log went past GAME_LOG_MAX_BYTES. The game goes on without being resumable, unless a player is away
+//(or still catching up after they came back), who could not get the rest of the game then. returns false if the game is over
+static bool handleFullGameLog(ChessGame* game)
+{
+    bool const isPlayerBehind = ! game->players[0] || ! game->players[1] || game->isReplaying[0] || game->isReplaying[1];
+    logWarn("a game went past %d bytes of messages, so it can not be resumed anymore%s", GAME_LOG_MAX_BYTES,
+        isPlayerBehind ? ". a player is away, so it ends" : "");
+
+    stopResuming(game);
+    if( ! isPlayerBehind )
+        return true;
+
+    forfeitAwayPlayers(game);
+    return false;
+}
+
+//A player's connection is gone (it was closed, or recv() or send() failed) and they were closed. A resumable game goes on without them
+//(they are made away by suspendLeftPlayers() before the game is flushed). Returns false if the game is not resumable,
+//so the caller has to end it
+static bool keepGameForLostPlayer(ChessGame* game, int index)
+{
+    closePlayer(game->players[index]);
+    game->players[index] = NULL;
+
+    if( ! game->isResumable )
+        return false;
+
+    game->leftPlayers |= (uint8_t)(1 << index);
+    return true;
+}
+
+//handle when sending to a player fails or they go past their write queue limit. the opponent is put back in the lobby
+//unless the game waits for the player to come back. returns false if the game is over
+static bool handleSendErr(ChessGame* game, int failedIndex)
+{
+    Connection* opponent = game->players[failedIndex ^ 1];
+
+    char buff[512] = {0};
+    snprintf(buff, sizeof(buff), "send failed (or the write queue limit was exceeded) to %s in a game against %s\n",
+        game->players[failedIndex]->ipStr, playerName(opponent));
+    logError(buff, WSAGetLastError());
+
+    if(keepGameForLostPlayer(game, failedIndex))
+        return true;
+
+    quitGame(NULL, opponent);
+    return false;
+}
+
+static void handleInvalidMessageType(ChessGame* game, int fromIndex)
+{
+    Connection* from = game->players[fromIndex];
+    Connection* to = game->players[fromIndex ^ 1];
+
+    char const formatStr[] = "invalid message type (or size) sent from %s in a game against %s... uh oh";
+    char errMsgBuff[256] = {0};
+    sprintf_s(errMsgBuff, sizeof(errMsgBuff), formatStr, from->ipStr, playerName(to));
+    logError(errMsgBuff, 0);
+
+    closePlayer(from);
+    if( ! to )
+        return;
+
+    char connectionClosedMsg[OPPONENT_CLOSED_CONNECTION_MSGSIZE] = {
+        OPPONENT_CLOSED_CONNECTION_MSGTYPE,
+        OPPONENT_CLOSED_CONNECTION_MSGSIZE
+    };
+
+    logDebug("sending a OPPONENT_CLOSED_CONNECTION_MSGTYPE to %s", to->ipStr);
+
+    networkQueueSend(to->socket, &to->out, connectionClosedMsg, sizeof(connectionClosedMsg));
+    quitGame(NULL, to);
+}
+
+//forward msg to the opponent as is (and keep it in the game's log). returns false if the game is over
+static bool forwardMessage(MessageView const* msg, ChessGame* game, int fromIndex)
+{
+    Connection* from = game->players[fromIndex];
+    Connection* to = game->players[fromIndex ^ 1];
+    logTrace("forwarding a %s message from %s to %s", messageTypeName((uint8_t)msg->data[0]), from->ipStr, playerName(to));
+
+    ++game->numOfMessagesFrom[fromIndex];
+    if(game->isResumable && ! appendToGameLog(game, fromIndex, msg->data, msg->size) && ! handleFullGameLog(game))
+        return false;
+
+    appendToSpectatorFeed(game, fromIndex, msg->data, msg->size);
+
+    //an opponent who is away (or still catching up after they came back) gets the message from the log
+    if( ! to || game->isReplaying[fromIndex ^ 1] )
+        return true;
+
+    //the message is sent when this game is flushed at the end of the worker's loop iteration
+    if(networkQueueSend(to->socket, &to->out, msg->data, msg->size) == SOCKET_ERROR)
+        return handleSendErr(game, fromIndex ^ 1);
+
+    metricsRecord(METRIC_HISTOGRAM_FORWARD_LATENCY, getMonotonicNanoseconds() - from->lastRecvNs);
+    return true;
+}
+
+//with move validation on, play the move on the game's board first, and end the game of a player who sends an illegal move
+static bool handleMoveMessage(MessageView const* msg, ChessGame* game, int fromIndex)
+{
+    if(game->position)
+    {
+        ChessMoveVerdict const verdict = chessPlayMoveMessage(game->position, game->sides[fromIndex], msg->data);
+        if(verdict != CHESS_MOVE_OK)
+        {
+            logInfo("%s sent a MOVE_MSGTYPE that is not legal (%s) in a game against %s", game->players[fromIndex]->ipStr,
+                chessMoveVerdictName(verdict), playerName(game->players[fromIndex ^ 1]));
+            metricsAdd(METRIC_ILLEGAL_MOVES, 1);
+            handleInvalidMessageType(game, fromIndex);
+            return false;
+        }
+    }
+
+    return forwardMessage(msg, game, fromIndex);
+}
+
+//the players swap sides at a rematch, and with move validation on the board goes back to the starting position
+static void startRematch(ChessGame* game)
+{
+    for(int i = 0; i < 2; ++i)
+    {
+        game->sides[i] = (game->sides[i] == WHITE) ? BLACK : WHITE;
+        if(game->players[i])
+            game->players[i]->side = game->sides[i];
+    }
+
+    if(game->position)
+        chessPositionInit(game->position);
+
+    game->currentGameLogOffset = game->logSize;
+}
+
+static bool handleRematchAcceptMessage(MessageView const* msg, ChessGame* game, int fromIndex)
+{
+    if( ! forwardMessage(msg, game, fromIndex) )
+        return false;
+
+    startRematch(game);
+    return true;
+}
+
+static bool handleUnpairMessage(MessageView const* msg, ChessGame* game, int fromIndex)
+{
+    quitGame(game->players[fromIndex], game->players[fromIndex ^ 1]);
+    return false;
+}
+
+static bool handleRematchDeclineMessage(MessageView const* msg, ChessGame* game, int fromIndex)
+{
+    if(forwardMessage(msg, game, fromIndex))
+        quitGame(game->players[fromIndex], game->players[fromIndex ^ 1]);
+
+    return false;
+}
+
+//returns false if the game is over. fromIndex is the player in game who sent msg
+typedef bool (*GameMessageHandler)(MessageView const* msg, ChessGame* game, int fromIndex);
+
+//indexed by MessageType. every type a client can send in a game (see CHESS_MESSAGE_TABLE) has a handler. checked in gameManagerInit()
+static GameMessageHandler const s_gameMessageHandlers[NUM_OF_MESSAGE_TYPES] =
+{
+    [MOVE_MSGTYPE] = handleMoveMessage,
+    [RESIGN_MSGTYPE] = forwardMessage,
+    [DRAW_OFFER_MSGTYPE] = forwardMessage,
+    [DRAW_ACCEPT_MSGTYPE] = forwardMessage,
+    [DRAW_DECLINE_MSGTYPE] = forwardMessage,
+    [REMATCH_REQUEST_MSGTYPE] = forwardMessage,
+    [REMATCH_ACCEPT_MSGTYPE] = handleRematchAcceptMessage,
+    [UNPAIR_MSGTYPE] = handleUnpairMessage,
+    [REMATCH_DECLINE_MSGTYPE] = handleRematchDeclineMessage
+};
+
+//returns false if the game is over
+static bool consumeMessage(MessageView const* msg, ChessGame* game, int fromIndex)
+{
+    uint8_t const msgType = (uint8_t)msg->data[0];
+    metricsCountMessage(msgType);
+
+    //0 for anything that is not a type a client can send in a game, which never matches a size the framer lets through
+    if(clientMessageSize(msgType, MSG_IN_GAME) != msg->size)
+    {
+        handleInvalidMessageType(game, fromIndex);
+        return false;
+    }
+
+    return s_gameMessageHandlers[msgType](msg, game, fromIndex);
+}
+
+//Pick the sides, and send PAIRING_COMPLETE_MSGTYPE, RESUME_TOKEN_MSGTYPE and SPECTATE_ID_MSGTYPE to both players. The game is resumable from then on.
+//returns false if the game is over
+static bool sendPairingCompleteMsg(GameWorker* worker, ChessGame* game)
+{
+    char buff[PAIRING_COMPLETE_MSGSIZE] = {PAIRING_COMPLETE_MSGTYPE, PAIRING_COMPLETE_MSGSIZE};
+    Side const firstSide = (rand() & 1) ? WHITE : BLACK;
+    game->sides[0] = game->startSides[0] = firstSide;
+    game->sides[1] = game->startSides[1] = (firstSide == WHITE) ? BLACK : WHITE;//swap sides
+
+    registerResumeTokens(worker, game);
+    registerSpectateID(worker, game);
+
+    for(int i = 0; i < 2; ++i)
+    {
+        Connection* p = game->players[i];
+        p->side = game->sides[i];
+        buff[2] = (char)game->sides[i];
+
+        char tokenMsg[RESUME_TOKEN_MSGSIZE] = {RESUME_TOKEN_MSGTYPE, RESUME_TOKEN_MSGSIZE};
+        uint32_t const nwByteOrderToken[2] = {htonl((uint32_t)(game->resumeTokens[i] >> 32)), htonl((uint32_t)game->resumeTokens[i])};
+        memcpy(tokenMsg + 2, nwByteOrderToken, sizeof(nwByteOrderToken));
+
+        if(networkQueueSend(p->socket, &p->out, buff, sizeof(buff)) == SOCKET_ERROR ||
+           networkQueueSend(p->socket, &p->out, tokenMsg, sizeof(tokenMsg)) == SOCKET_ERROR ||
+           queueSpectateID(p, game) == SOCKET_ERROR)
+        {
+            handleSendErr(game, i);
+            return false;
+        }
+    }
+
+    logDebug("sending PAIRING_COMPLETE_MSG to %s and %s", game->players[0]->ipStr, game->players[1]->ipStr);
+
+    game->isResumable = true;
+    if(game->journal)
+    {
+        JournalGameStart start;
+        memset(&start, 0, sizeof(start));
+        memcpy(start.resumeTokens, game->resumeTokens, sizeof(start.resumeTokens));
+        start.sides[0] = (uint8_t)game->startSides[0];
+        start.sides[1] = (uint8_t)game->startSides[1];
+        gameJournalAppend(game->journal, JOURNAL_GAME_START, game->gameID, 0, &start, sizeof(start));
+    }
+
+    return true;
+}
+
+//handle when recv returns 0. returns false if the game is over
+static bool handleClosedConnection(ChessGame* game, int closedIndex)
+{
+    Connection* opponent = game->players[closedIndex ^ 1];
+    if(game->isResumable)
+    {
+        logInfo("connection from %s closed. their game waits %zu seconds for them to come back",
+            game->players[closedIndex]->ipStr, g_serverConfig.resumeGraceSecs);
+        return keepGameForLostPlayer(game, closedIndex);
+    }
+
+    char const buff[OPPONENT_CLOSED_CONNECTION_MSGSIZE] =
+    {
+        OPPONENT_CLOSED_CONNECTION_MSGTYPE,
+        OPPONENT_CLOSED_CONNECTION_MSGSIZE
+    };
+
+    logInfo("connection from %s closed. Sending %s to %s", game->players[closedIndex]->ipStr,
+        messageTypeName(OPPONENT_CLOSED_CONNECTION_MSGTYPE), playerName(opponent));
+
+    closePlayer(game->players[closedIndex]);
+    if( ! opponent )
+        return false;
+
+    if(networkQueueSend(opponent->socket, &opponent->out, buff, sizeof(buff)) == SOCKET_ERROR)
+    {
+        closePlayer(opponent);
+        return false;
+    }
+
+    quitGame(NULL, opponent);
+    return false;
+}
+
+//handle when recv returns SOCKET_ERROR. returns false if the game is over
+static bool handleRecvErr(ChessGame* game, int errorIndex)
+{
+    char errMsg[256] = {0};
+    snprintf(errMsg, sizeof(errMsg), "recv failed from %s", game->players[errorIndex]->ipStr);
+    logError(errMsg, WSAGetLastError());
+
+    if(keepGameForLostPlayer(game, errorIndex))
+        return true;
+
+    quitGame(NULL, game->players[errorIndex ^ 1]);
+    return false;
+}
+
+//every message is forwarded as is, so dont read more from game->players[index] than fits in the opponent's write queue
+static size_t maxReceiveSize(ChessGame const* game, int index)
+{
+    Connection const* opponent = game->players[index ^ 1];
+    return opponent ? OUT_BUFFER_CAPACITY - outBufferSize(&opponent->out) : OUT_BUFFER_CAPACITY;
+}
+
+//called with what a receive from game->players[index] returned (the same as recv(), the bytes are in their MessageFramer).
+//returns false if the game is over
+static bool onReceived(ChessGame* game, int index, int numBytesReceived)
+{
+    Connection* bytesReadyPlayer = game->players[index];
+
+    if(numBytesReceived == SOCKET_ERROR)
+    {
+        if(WSAGetLastError() == WSAEWOULDBLOCK)
+            return true;//the socket is non blocking and there was nothing to read after all
+
+        return handleRecvErr(game, index);
+    }
+    else if(numBytesReceived == 0)
+    {
+        return handleClosedConnection(game, index);
+    }
+
+    bytesReadyPlayer->lastRecvNs = getMonotonicNanoseconds();
+    metricsAdd(METRIC_BYTES_IN, (uint64_t)numBytesReceived);
+
+    //forward every whole message that came in, straight out of the framer
+    MessageView msg;
+    FramerResult framerResult;
+    while((framerResult = messageFramerNext(&bytesReadyPlayer->in, &msg)) == FRAMER_MESSAGE_READY)
+    {
+        if( ! consumeMessage(&msg, game, index) )
+            return false;
+    }
+
+    if(framerResult == FRAMER_MALFORMED_MESSAGE)
+    {
+        handleInvalidMessageType(game, index);
+        return false;
+    }
+
+    return true;
+}
+
+//called when WSAPoll() indicates that there are bytes ready to be read on the socket of game->players[index].
+//returns false if the game is over
+static bool onPollReady(ChessGame* game, int index)
+{
+    Connection* bytesReadyPlayer = game->players[index];
+    metricsAdd(METRIC_GAME_IO_SYSCALLS, 1);
+    return onReceived(game, index, messageFramerRecv(bytesReadyPlayer->socket, &bytesReadyPlayer->in, maxReceiveSize(game, index)));
+}
+
+//Post a receive for every player who uses Registered I/O and that WSAPoll() found readable, and take the results of what completed
+//off the worker's completion queue. The games loop hands what was received to onReceived()
+static void postRegisteredReceives(GameWorker* worker)
+{
+    //nothing new goes in flight while the games are being handed over. what comes in waits in the socket for the new process
+    for(size_t i = 0; i < worker->numOfGames && ! ReadNoFence(&worker->isHandingOver); ++i)
+    {
+        ChessGame* game = worker->games[i];
+        for(int j = 0; j < 2; ++j)
+        {
+            Connection* p = game->players[j];
+            short const revents = worker->pollFds[2 * i + 1 + j].revents;
+            if( ! p || ! (revents & ~POLLWRNORM) || ! usesRegisteredIO(worker, p) || p->rio.isReceivePosted || p->rio.hasReceived )
+                continue;
+
+            //nothing fits in the opponent's write queue, so there is nothing to receive into (onPollReady() gets WSAEWOULDBLOCK then)
+            size_t const maxBytes = maxReceiveSize(game, j);
+            if(maxBytes)
+                registeredIOPostReceive(p, maxBytes);
+        }
+    }
+
+    registeredIODequeue(&worker->rio);
+}
+
+//Take what completed while the games were flushed, let the players who left go if they can, and have the worker woken up
+//when what is still in flight completes. Returns true if something that completed has to be handled right away
+//(see registeredIODequeue()), in which case the next WSAPoll() should not block
+static bool finishRegisteredIO(GameWorker* worker)
+{
+    bool const hasWorkLeft = registeredIODequeue(&worker->rio) > 0;
+    finishLeavingPlayers(worker);
+
+    if(worker->rio.numOfInFlight)
+        registeredIONotify(&worker->rio);
+
+    return hasWorkLeft;
+}
+
+//(re)schedule the game's resumeTimer for the first away player whose grace period runs out, or cancel it if no one is away
+static void scheduleResumeTimer(GameWorker* worker, ChessGame* game)
+{
+    timerWheelCancel(&worker->resumeTimers, &game->resumeTimer);
+
+    uint64_t deadlineMs = UINT64_MAX;
+    for(int i = 0; i < 2; ++i)
+    {
+        if( ! game->players[i] )
+            deadlineMs = min(deadlineMs, game->leftAtMs[i] + 1000 * (uint64_t)g_serverConfig.resumeGraceSecs);
+    }
+
+    //a deadline past the end of the wheel goes off early, and onResumeTimer() schedules it again
+    if(deadlineMs != UINT64_MAX)
+        timerWheelSchedule(&worker->resumeTimers, &game->resumeTimer, deadlineMs);
+}
+
+//Make the players who lost their connection in this loop iteration away. Their poll set registrations are cleared,
+//their opponent gets an OPPONENT_RECONNECTING_MSGTYPE and the game waits for them to come back.
+static void suspendLeftPlayers(GameWorker* worker, ChessGame* game, uint64_t nowMs)
+{
+    if( ! game->leftPlayers )
+        return;
+
+    while(game->leftPlayers)
+    {
+        int const index = (game->leftPlayers & 1) ? 0 : 1;
+        game->leftPlayers &= (uint8_t)~(1 << index);
+
+        WSAPOLLFD* pollFd = worker->pollFds + 2 * game->gameIndex + 1 + index;
+        pollFd->fd = INVALID_SOCKET;
+        pollFd->events = 0;
+        pollFd->revents = 0;
+
+        game->isReplaying[index] = false;
+        game->leftAtMs[index] = nowMs;
+        metricsAdd(METRIC_PLAYERS_AWAY, 1);
+
+        //if this fails the opponent is away too (the game is resumable), and the loop gets to them next
+        Connection* opponent = game->players[index ^ 1];
+        char const buff[OPPONENT_RECONNECTING_MSGSIZE] = {OPPONENT_RECONNECTING_MSGTYPE, OPPONENT_RECONNECTING_MSGSIZE};
+        if(opponent && networkQueueSend(opponent->socket, &opponent->out, buff, sizeof(buff)) == SOCKET_ERROR)
+            handleSendErr(game, index ^ 1);
+    }
+
+    scheduleResumeTimer(worker, game);
+}
+
+//Queue as much of the rest of the log for a player who came back as fits in their write queue. Every message from their opponent
+//past what they already had goes out in the order it was sent, before anything new.
+static void continueReplay(ChessGame* game, int index)
+{
+    Connection* p = game->players[index];
+    while(game->replayOffsets[index] < game->logSize)
+    {
+        uint32_t const offset = game->replayOffsets[index];
+        uint32_t const entrySize = gameLogEntrySize(game, offset);
+        if(game->log[offset] != (char)index)
+        {
+            //the rest is queued after this flush
+            if(OUT_BUFFER_CAPACITY - outBufferSize(&p->out) < entrySize - 1)
+                return;
+
+            networkQueueSend(p->socket, &p->out, game->log + offset + 1, entrySize - 1);
+        }
+
+        game->replayOffsets[index] = offset + entrySize;
+    }
+
+    game->isReplaying[index] = false;
+}
+
+//send what is queued for a player, with Registered I/O if they use it on worker.
+//returns SOCKET_ERROR if sending fails (or a send of theirs that was in flight failed)
+static int flushPlayer(GameWorker const* worker, Connection* p)
+{
+    if(usesRegisteredIO(worker, p))
+        return p->rio.hasSendFailed ? SOCKET_ERROR : registeredIOPostSend(p);
+
+    metricsAdd(METRIC_GAME_IO_SYSCALLS, 1);
+    return networkFlush(p->socket, &p->out);
+}
+
+//send whatever is queued for the two players if it is due (see OUTBOUND_LATENCY_CAP_US). this never blocks,
+//whatever a full socket does not take is sent after WSAPoll() reports POLLWRNORM for it (or stays in flight with Registered I/O).
+//nextDeadlineUs is lowered to the time at which a buffer that was held back has to be sent.
+//returns false if the game is over
+static bool flushGame(GameWorker* worker, size_t gameIndex, uint64_t nowUs, uint64_t* nextDeadlineUs)
+{
+    ChessGame* game = worker->games[gameIndex];
+    suspendLeftPlayers(worker, game, nowUs / 1000);
+
+    for(int i = 0; i < 2; ++i)
+    {
+        Connection* p = game->players[i];
+        if( ! p )
+            continue;
+
+        if(game->isReplaying[i])
+            continueReplay(game, i);
+
+        if(outBufferIsFlushDue(&p->out, nowUs) || (p->rio.hasSendFailed && usesRegisteredIO(worker, p)))
+        {
+            if(flushPlayer(worker, p) == SOCKET_ERROR)
+            {
+                if( ! handleSendErr(game, i) )
+                    return false;
+
+                //start over, so the OPPONENT_RECONNECTING_MSGTYPE for the opponent goes out in this iteration too
+                suspendLeftPlayers(worker, game, nowUs / 1000);
+                i = -1;
+            }
+        }
+        else if( ! outBufferIsEmpty(&p->out) && ! p->out.isBlocked )
+        {
+            *nextDeadlineUs = min(*nextDeadlineUs, outBufferFlushDeadline(&p->out));
+        }
+    }
+
+    //stop reading from a player while their opponent's queue is too full, and wait for POLLWRNORM while
+    //a player's socket is full (or the rest of what they missed is waiting for room in their queue).
+    //with Registered I/O, a receive that is in flight already has the socket, and a send that is completes on its own
+    for(int i = 0; i < 2; ++i)
+    {
+        Connection* p = game->players[i];
+        if( ! p )
+            continue;
+
+        Connection* opponent = game->players[i ^ 1];
+        bool const isReadPaused = opponent ? outBufferUpdateBackpressure(&opponent->out, &p->isReadPaused) : (p->isReadPaused = false);
+        bool const isReading = ! isReadPaused && ! p->rio.isReceivePosted;
+        bool const isWaitingToWrite = (p->out.isBlocked && ! usesRegisteredIO(worker, p)) || game->isReplaying[i];
+        worker->pollFds[2 * gameIndex + 1 + i].events = (isReading ? POLLRDNORM : 0) | (isWaitingToWrite ? POLLWRNORM : 0);
+    }
+
+    return true;
+}
+
+//Take a free slot for a new game (or one recovered from a journal) and add it to the worker's games, with both players away.
+//The caller has to have made sure there is room (see GameWorker::load).
+static ChessGame* addGame(GameWorker* worker, uint64_t gameID)
+{
+    assert(worker->firstFreeSlot != GAME_SLOT_NONE);
+    uint32_t const slot = worker->firstFreeSlot;
+    ChessGame* game = worker->gameSlots + slot;
+    worker->firstFreeSlot = game->nextFree;
+
+    memset(game, 0, sizeof(*game));
+    timerNodeInit(&game->resumeTimer);
+    game->gameID = gameID;
+    game->journal = worker->journal;
+    game->position = worker->positions ? worker->positions + slot : NULL;
+    if(game->position)
+        chessPositionInit(game->position);
+
+    makeRoomForGame(worker);
+    size_t const gameIndex = worker->numOfGames++;
+    game->gameIndex = (uint32_t)gameIndex;
+    worker->games[gameIndex] = game;
+
+    for(int i = 0; i < 2; ++i)
+    {
+        WSAPOLLFD* pollFd = worker->pollFds + 2 * gameIndex + 1 + i;
+        pollFd->fd = INVALID_SOCKET;
+        pollFd->events = 0;
+        pollFd->revents = 0;
+    }
+
+    return game;
+}
+
+//seat p as players[index] of game and poll their socket
+static void attachPlayer(GameWorker* worker, ChessGame* game, int index, Connection* p)
+{
+    connectionSetState(p, CONNECTION_PLAYING);
+    game->players[index] = p;
+
+    //what the lobby still had queued for this player stays in p->out, so it is sent before anything from the game
+    p->side = game->sides[index];
+    p->lastRecvNs = 0;
+    p->isReadPaused = false;
+
+    WSAPOLLFD* pollFd = worker->pollFds + 2 * game->gameIndex + 1 + index;
+    pollFd->fd = p->socket;
+    pollFd->events = POLLRDNORM;
+    pollFd->revents = 0;
+
+    //a player whose socket is tied to another worker's completion queue (or can not use RIO) uses recv() and WSASend() here.
+    //the bytes of a receive that completed while they were leaving their last game are in p->in already
+    if(g_serverConfig.registeredIO)
+        registeredIOAttach(&worker->rio, p);
+    p->rio.hasReceived = false;
+}
+
+//End a game whose players were already closed or put back in the lobby (or are away): it ends in the journal,
+//its resume tokens and spectate ID stop working, its spectators get the end of it, and its slot is freed.
+//The last game is swapped into its place along with its poll set registrations
+static void endGame(GameWorker* worker, size_t gameIndex)
+{
+    ChessGame* game = worker->games[gameIndex];
+    stopResuming(game);
+    unregisterResumeTokens(game);//the tokens of a game whose PAIRING_COMPLETE_MSGTYPE could not be sent
+    timerWheelCancel(&worker->resumeTimers, &game->resumeTimer);
+
+    if(game->spectateID)
+        connectionIndexRemove(&s_spectateIndex, game->spectateID);
+    game->spectateID = 0;
+    endSpectating(game);
+
+    game->gameID = 0;
+    game->nextFree = worker->firstFreeSlot;
+    worker->firstFreeSlot = (uint32_t)(game - worker->gameSlots);
+
+    size_t const lastIndex = worker->numOfGames - 1;
+    if(gameIndex != lastIndex)
+    {
+        worker->games[gameIndex] = worker->games[lastIndex];
+        worker->games[gameIndex]->gameIndex = (uint32_t)gameIndex;
+        worker->pollFds[2 * gameIndex + 1] = worker->pollFds[2 * lastIndex + 1];
+        worker->pollFds[2 * gameIndex + 2] = worker->pollFds[2 * lastIndex + 2];
+    }
+
+    --worker->numOfGames;
+    fillRoomOfGame(worker);
+    InterlockedDecrement(&worker->load);
+}
+
+//move the games waiting in the inbox over to this worker's games and start them
+static void takeNewGames(GameWorker* worker)
+{
+    EnterCriticalSection(&worker->inboxMutex);
+
+    for(size_t i = 0; i < worker->inboxSize; ++i)
+    {
+        assert(worker->numOfGames < s_maxGamesPerWorker);
+        ChessGame* game = addGame(worker, ((uint64_t)worker->index << 48) | ++worker->gameCounter);
+
+        for(int j = 0; j < 2; ++j)
+        {
+            //the lobby gave up the connection before handing over its handle, so it can not be stale
+            Connection* p = connectionPoolGet(worker->inbox[i].players[j]);
+            assert(p);
+            attachPlayer(worker, game, j, p);
+        }
+    }
+
+    size_t const numOfNewGames = worker->inboxSize;
+    worker->inboxSize = 0;
+
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    //the new games are at the back of worker->games. iterate backwards so
+    //that removing a game whose pairing failed doesnt move one we havent started yet
+    size_t const firstNewGame = worker->numOfGames - numOfNewGames;
+    for(size_t i = numOfNewGames; i-- > 0;)
+    {
+        size_t const gameIndex = firstNewGame + i;
+        if( ! sendPairingCompleteMsg(worker, worker->games[gameIndex]) )
+            endGame(worker, gameIndex);
+    }
+}
+
+//Seat a player who came back with RESUME_GAME_MSGTYPE as players[index] of game. They get a GAME_RESUMED_MSGTYPE (and the
+//SPECTATE_ID_MSGTYPE of the game) and then
+//every message from their opponent past the numOfMessagesReceived they already had (see continueReplay()).
+//If the game still had them connected (their old connection is dead but that was not noticed yet), the old connection is closed.
+static void resumePlayer(GameWorker* worker, ChessGame* game, int index, Connection* p, uint32_t numOfMessagesReceived)
+{
+    Connection* oldConnection = game->players[index];
+    if(oldConnection)
+    {
+        logInfo("%s resumed a game they were still connected to from %s. closing the old connection", p->ipStr, oldConnection->ipStr);
+        closePlayer(oldConnection);
+    }
+
+    attachPlayer(worker, game, index, p);
+    metricsAdd(METRIC_GAMES_RESUMED, 1);
+    logInfo("%s resumed their game against %s", p->ipStr, playerName(game->players[index ^ 1]));
+
+    //skip the messages from the opponent they already had
+    uint32_t offset = 0;
+    for(uint32_t numOfSkipped = 0; offset < game->logSize && numOfSkipped < numOfMessagesReceived; offset += gameLogEntrySize(game, offset))
+    {
+        if(game->log[offset] != (char)index)
+            ++numOfSkipped;
+    }
+
+    game->replayOffsets[index] = offset;
+    game->isReplaying[index] = true;
+    scheduleResumeTimer(worker, game);
+
+    char resumedMsg[GAME_RESUMED_MSGSIZE] = {GAME_RESUMED_MSGTYPE, GAME_RESUMED_MSGSIZE, (char)game->sides[index]};
+    uint32_t const nwByteOrderCount = htonl(game->numOfMessagesFrom[index]);
+    memcpy(resumedMsg + 3, &nwByteOrderCount, sizeof(nwByteOrderCount));
+
+    //if either send fails that player is away again, which flushGame() takes care of in this iteration
+    if(networkQueueSend(p->socket, &p->out, resumedMsg, sizeof(resumedMsg)) == SOCKET_ERROR || queueSpectateID(p, game) == SOCKET_ERROR)
+        handleSendErr(game, index);
+
+    Connection* opponent = game->players[index ^ 1];
+    char const opponentMsg[OPPONENT_RESUMED_MSGSIZE] = {OPPONENT_RESUMED_MSGTYPE, OPPONENT_RESUMED_MSGSIZE};
+    if(opponent && networkQueueSend(opponent->socket, &opponent->out, opponentMsg, sizeof(opponentMsg)) == SOCKET_ERROR)
+        handleSendErr(game, index ^ 1);
+}
+
+//put the players waiting in the resume inbox back into their games
+static void takeResumingPlayers(GameWorker* worker)
+{
+    //copied out, so the lobby threads can keep handing players over while they are being resumed
+    ResumingPlayer resuming[RESUME_INBOX_CAPACITY];
+
+    EnterCriticalSection(&worker->inboxMutex);
+    size_t const numOfResuming = worker->resumeInboxSize;
+    memcpy(resuming, worker->resumeInbox, numOfResuming * sizeof(ResumingPlayer));
+    worker->resumeInboxSize = 0;
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    for(size_t i = 0; i < numOfResuming; ++i)
+    {
+        //the lobby gave up the connection before handing over its handle, so it can not be stale
+        Connection* p = connectionPoolGet(resuming[i].player);
+        assert(p);
+
+        //the game might have ended (and its slot might even have been taken by another game) since the lobby looked up the token
+        ChessGame* game = worker->gameSlots + resuming[i].gameSlot;
+        int index = -1;
+        for(int j = 0; j < 2 && game->gameID && game->isResumable; ++j)
+        {
+            if(game->resumeTokens[j] == resuming[i].resumeToken)
+                index = j;
+        }
+
+        if(index < 0)
+            failResume(p);
+        else
+            resumePlayer(worker, game, index, p, resuming[i].numOfMessagesReceived);
+    }
+}
+
+//start sending their games to the connections waiting in the spectate inbox
+static void takeSpectators(GameWorker* worker)
+{
+    //copied out like in takeResumingPlayers()
+    NewSpectator newSpectators[SPECTATE_INBOX_CAPACITY];
+
+    EnterCriticalSection(&worker->inboxMutex);
+    size_t const numOfNewSpectators = worker->spectateInboxSize;
+    memcpy(newSpectators, worker->spectateInbox, numOfNewSpectators * sizeof(NewSpectator));
+    worker->spectateInboxSize = 0;
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    for(size_t i = 0; i < numOfNewSpectators; ++i)
+    {
+        //the lobby gave up the connection before handing over its handle, so it can not be stale
+        Connection* p = connectionPoolGet(newSpectators[i].spectator);
+        assert(p);
+
+        //the game might have ended since the lobby looked up the ID, same as in takeResumingPlayers()
+        ChessGame* game = worker->gameSlots + newSpectators[i].gameSlot;
+        if( ! game->gameID || game->spectateID != newSpectators[i].spectateID || worker->numOfSpectators >= g_serverConfig.spectatorsPerWorker )
+        {
+            failSpectate(p);
+            continue;
+        }
+
+        spectatorFeedStart(&game->feed);
+        SpectatorChunk* catchUp = buildCatchUp(game);
+        if( ! catchUp )
+        {
+            if( ! game->spectators )
+                stopSpectatorFeed(game);
+
+            failSpectate(p);
+            continue;
+        }
+
+        addSpectator(worker, game, p, catchUp);
+        metricsAdd(METRIC_SPECTATORS_JOINED, 1);
+        logDebug("%s started watching a game", p->ipStr);
+    }
+}
+
+//the resumeTimer of a game went off. ctx points at the worker and the nowMs of the loop iteration
+typedef struct
+{
+    GameWorker* worker;
+    uint64_t nowMs;
+}ResumeTimerContext;
+
+static void onResumeTimer(TimerNode* timer, void* ctx)
+{
+    ResumeTimerContext const* timerCtx = ctx;
+    ChessGame* game = (ChessGame*)((char*)timer - offsetof(ChessGame, resumeTimer));
+
+    bool hasGraceRunOut = false;
+    for(int i = 0; i < 2; ++i)
+    {
+        if( ! game->players[i] && game->leftAtMs[i] + 1000 * (uint64_t)g_serverConfig.resumeGraceSecs <= timerCtx->nowMs )
+            hasGraceRunOut = true;
+    }
+
+    //the timer wheel only reaches TIMER_WHEEL_MAX_DELAY_MS ahead, so a longer grace period takes a few timers
+    if( ! hasGraceRunOut )
+    {
+        scheduleResumeTimer(timerCtx->worker, game);
+        return;
+    }
+
+    forfeitAwayPlayers(game);
+    endGame(timerCtx->worker, game->gameIndex);
+}
+
+static void handlePollErr(void)
+{
+    //for now just log the error and poll again
+    logError("WSAPoll() failed in a game worker with error: ", WSAGetLastError());
+}
+
+//called by gameJournalCommit() and gameJournalCheckpoint(). writes every resumable game of the worker (ctx) into its journal
+static void checkpointWorkerGames(void* ctx)
+{
+    GameWorker* worker = ctx;
+    for(size_t i = 0; i < worker->numOfGames; ++i)
+    {
+        ChessGame const* game = worker->games[i];
+        if( ! game->isResumable )
+            continue;
+
+        JournalGameStart start;
+        memset(&start, 0, sizeof(start));
+        memcpy(start.resumeTokens, game->resumeTokens, sizeof(start.resumeTokens));
+        start.sides[0] = (uint8_t)game->startSides[0];
+        start.sides[1] = (uint8_t)game->startSides[1];
+        gameJournalAppend(worker->journal, JOURNAL_GAME_START, game->gameID, 0, &start, sizeof(start));
+
+        for(uint32_t offset = 0; offset < game->logSize; offset += gameLogEntrySize(game, offset))
+        {
+            gameJournalAppend(worker->journal, JOURNAL_GAME_MESSAGE, game->gameID, (uint8_t)game->log[offset],
+                game->log + offset + 1, gameLogEntrySize(game, offset) - 1);
+        }
+    }
+}
+
+//write a player (who has nothing of Registered I/O in flight) of a game being handed over
+static bool handOverPlayer(GameWorker* worker, ChessGame const* game, int index)
+{
+    Connection const* p = game->players[index];
+    if( ! registeredIOIsIdle(&p->rio) )
+        return false;
+
+    HotUpgradeConnection record;
+    memset(&record, 0, sizeof(record));
+    record.role = HOT_UPGRADE_PLAYER;
+    record.playerIndex = (uint8_t)index;
+    record.gameID = game->gameID;
+    return hotUpgradeWriteConnection(&worker->handOver, &record, p, NULL);
+}
+
+//write a spectator with what they did not get yet of their game's feed
+static bool handOverSpectator(GameWorker* worker, Spectator const* spectator)
+{
+    HotUpgradeConnection record;
+    memset(&record, 0, sizeof(record));
+    record.role = HOT_UPGRADE_SPECTATOR;
+    record.gameID = spectator->game ? spectator->game->gameID : 0;
+
+    size_t const pendingSize = spectatorCursorPendingSize(&spectator->cursor);
+    char* pending = malloc(pendingSize ? pendingSize : 1);
+    if( ! pending )
+    {
+        logError("malloc failed to copy what a spectator did not get yet of their game", 0);
+        exit(0);
+    }
+
+    spectatorCursorCopyPending(&spectator->cursor, pending);
+    record.pendingSize = (uint32_t)pendingSize;
+    bool const isHandedOver = hotUpgradeWriteConnection(&worker->handOver, &record, spectator->connection, pending);
+    free(pending);
+    return isHandedOver;
+}
+
+//Called at the end of a loop iteration once gameManagerHandOver() was called. Takes what the lobby handed over before it paused,
+//and writes every game, player and spectator of the worker for the new process once nothing of Registered I/O is in flight anymore
+//(or HOT_UPGRADE_DRAIN_MS passed, in which case the players with something in flight are left behind and can resume their game).
+//isRegisteredIOLeftOver is what finishRegisteredIO() returned. Returns true if the games were handed over, so the worker ends
+static bool handOverGames(GameWorker* worker, bool isRegisteredIOLeftOver)
+{
+    uint64_t const nowUs = getMonotonicMicroseconds();
+    if( ! worker->handOverDeadlineUs )
+        worker->handOverDeadlineUs = nowUs + HOT_UPGRADE_DRAIN_MS * 1000;
+
+    takeNewGames(worker);
+    takeResumingPlayers(worker);
+    takeSpectators(worker);
+
+    //a receive that completed has to go through its game first
+    if((worker->rio.numOfInFlight || isRegisteredIOLeftOver) && nowUs < worker->handOverDeadlineUs)
+        return false;
+
+    finishLeavingPlayers(worker);
+    size_t numOfLeftBehind = worker->numOfLeavingPlayers;
+
+    uint64_t const nowMs = nowUs / 1000;
+    for(size_t i = 0; i < worker->numOfGames; ++i)
+    {
+        ChessGame const* game = worker->games[i];
+
+        HotUpgradeGame record;
+        memset(&record, 0, sizeof(record));
+        record.gameID = game->gameID;
+        memcpy(record.resumeTokens, game->resumeTokens, sizeof(record.resumeTokens));
+        record.spectateID = game->spectateID;
+        record.logSize = game->logSize;
+        record.isResumable = game->isResumable;
+
+        for(int j = 0; j < 2; ++j)
+        {
+            record.replayOffsets[j] = game->replayOffsets[j];
+            record.isReplaying[j] = game->isReplaying[j];
+            record.sides[j] = (uint8_t)game->sides[j];
+            record.startSides[j] = (uint8_t)game->startSides[j];
+
+            //a player who left in this loop iteration was not made away yet (see suspendLeftPlayers())
+            if( ! game->players[j] )
+                record.awayMs[j] = (game->leftPlayers & (1 << j)) ? 0 : (uint32_t)min(nowMs - game->leftAtMs[j], (uint64_t)UINT32_MAX);
+            else if( ! handOverPlayer(worker, game, j) )
+                ++numOfLeftBehind;
+
+            //a player who could not be handed over is made away by the new process (see gameManagerTakeOver())
+            record.isConnected[j] = game->players[j] != NULL;
+        }
+
+        hotUpgradeWriteGame(&worker->handOver, &record, game->log);
+    }
+
+    for(size_t i = 0; i < worker->numOfSpectators; ++i)
+    {
+        if( ! handOverSpectator(worker, worker->pollFdSpectators[firstSpectatorPollIndex(worker) + i]) )
+            ++numOfLeftBehind;
+    }
+
+    if(numOfLeftBehind)
+        logWarn("a game worker could not hand over %zu of its connections. they are closed", numOfLeftBehind);
+
+    //the new process checkpoints the games into journals of its own, but if it does not take them over they come back from these
+    gameJournalCommit(worker->journal, checkpointWorkerGames, worker);
+    SetEvent(worker->handedOverEvent);
+    return true;
+}
+
+static void __stdcall gameWorkerThreadStart(void* arg)
+{
+    GameWorker* worker = arg;
+    srand((unsigned)time(NULL) ^ GetCurrentThreadId());
+    metricsRegisterThread();
+
+    //-1 (block forever) unless some output is being held back for coalescing or a player is away.
+    //0 the first time, so the resume timers of the games recovered by gameManagerInit() get scheduled into the timeout
+    int pollTimeoutMs = 0;
+
+    while(true)
+    {
+        //block until a player (or spectator) sends something, something of Registered I/O completes or startChessGame() wakes us up
+        ULONG const numOfPollFds = (ULONG)(2 * worker->numOfGames + 1 + worker->numOfSpectators);
+        metricsAdd(METRIC_GAME_IO_SYSCALLS, 1);
+        if(WSAPoll(worker->pollFds, numOfPollFds, pollTimeoutMs) == SOCKET_ERROR)
+        {
+            handlePollErr();
+            continue;
+        }
+
+        uint64_t const wakeUpNs = getMonotonicNanoseconds();
+
+        if(worker->pollFds[0].revents)
+        {
+            drainWakeupSocket(&worker->wakeup);
+            takeNewGames(worker);
+            takeResumingPlayers(worker);
+            takeSpectators(worker);
+        }
+
+        uint64_t const nowUs = getMonotonicMicroseconds();
+        uint64_t nextDeadlineUs = UINT64_MAX;
+
+        //end the games whose away players did not come back in time
+        ResumeTimerContext timerCtx = {worker, nowUs / 1000};
+        timerWheelExpire(&worker->resumeTimers, timerCtx.nowMs, onResumeTimer, &timerCtx);
+
+        if(g_serverConfig.registeredIO)
+            postRegisteredReceives(worker);
+
+        //games added by takeNewGames() have revents of 0, so they only get flushed until the next WSAPoll().
+        //everything queued for a game's players while handling its events is sent with one WSASend() per player
+        for(size_t i = 0; i < worker->numOfGames;)
+        {
+            ChessGame* game = worker->games[i];
+            bool isGameRunning = true;
+
+            for(int j = 0; j < 2 && isGameRunning; ++j)
+            {
+                //the player might have been lost while handling their opponent's messages
+                if( ! game->players[j] )
+                    continue;
+
+                //what postRegisteredReceives() (or an earlier iteration) got for them
+                Connection* p = game->players[j];
+                if(usesRegisteredIO(worker, p))
+                {
+                    if(p->rio.hasReceived)
+                        isGameRunning = onReceived(game, j, registeredIOTakeReceived(p));
+
+                    continue;
+                }
+
+                short const revents = worker->pollFds[2 * i + 1 + j].revents;
+
+                //the socket has room again, so flushGame() sends the rest of what is queued
+                if(revents & POLLWRNORM)
+                    game->players[j]->out.isBlocked = false;
+
+                if(revents & ~POLLWRNORM)
+                    isGameRunning = onPollReady(game, j);
+            }
+
+            if(isGameRunning)
+                isGameRunning = flushGame(worker, i, nowUs, &nextDeadlineUs);
+
+            //if the game ended, the last game was moved into slot i so look at slot i again
+            if(isGameRunning) ++i;
+            else endGame(worker, i);
+        }
+
+        //the spectators get what the games sent after the players did
+        bool const isSpectatorFlushLeftOver = serviceSpectators(worker);
+
+        //what was received or sent in the meantime is handled in the next iteration right away
+        bool const isRegisteredIOLeftOver = g_serverConfig.registeredIO && finishRegisteredIO(worker);
+
+        //what this iteration appended to the journal goes into the mapped file after everything was sent
+        gameJournalCommit(worker->journal, checkpointWorkerGames, worker);
+
+        pollTimeoutMs = (nextDeadlineUs == UINT64_MAX) ? -1 : (int)((nextDeadlineUs - nowUs + 999) / 1000);
+
+        uint64_t const timerDeadlineMs = timerWheelNextDeadline(&worker->resumeTimers);
+        if(timerDeadlineMs != UINT64_MAX)
+        {
+            int const timerTimeoutMs = (timerDeadlineMs > timerCtx.nowMs) ? (int)min(timerDeadlineMs - timerCtx.nowMs, (uint64_t)INT_MAX) : 0;
+            pollTimeoutMs = (pollTimeoutMs < 0) ? timerTimeoutMs : min(pollTimeoutMs, timerTimeoutMs);
+        }
+
+        //the spectators that did not fit in this iteration's batch are flushed in the next one right away
+        if(isSpectatorFlushLeftOver || isRegisteredIOLeftOver)
+            pollTimeoutMs = 0;
+
+        //the server is being handed over to a new process. until Registered I/O drained, look again every HAND_OVER_POLL_MS
+        if(ReadAcquire(&worker->isHandingOver))
+        {
+            if(handOverGames(worker, isRegisteredIOLeftOver))
+                return;
+
+            pollTimeoutMs = (pollTimeoutMs < 0) ? HAND_OVER_POLL_MS : min(pollTimeoutMs, HAND_OVER_POLL_MS);
+        }
+
+        metricsRecord(METRIC_HISTOGRAM_LOOP_ITERATION, getMonotonicNanoseconds() - wakeUpNs);
+    }
+}
+
+//A game of the last run, found by gameID while the journals are being read
+typedef struct
+{
+    uint64_t gameID;//0 if the entry is empty
+    ChessGame* game;
+    GameWorker* worker;
+    size_t journalIndex;//the journal it came from. the same game can be in two (see onRecoveredRecord())
+}RecoveredGame;
+
+typedef struct
+{
+    //open addressing with linear probing. capacity is a power of 2 and at least twice the most games there can be
+    RecoveredGame* entries;
+    size_t capacity;
+
+    size_t numOfGames;
+    size_t numOfDroppedGames;
+    uint64_t maxGameCounter;
+    uint64_t nowMs;
+}Recovery;
+
+//the games a hot upgrade handed over, by gameID. kept from gameManagerInit() until gameManagerTakeOver() seats their players
+static Recovery s_takeOver;
+
+//the entry of gameID, or the empty entry it would go in
+static RecoveredGame* findRecoveredGame(Recovery* recovery, uint64_t gameID)
+{
+    size_t i = (size_t)((gameID * 0x9E3779B97F4A7C15ull) >> 32) & (recovery->capacity - 1);
+    while(recovery->entries[i].gameID && recovery->entries[i].gameID != gameID)
+        i = (i + 1) & (recovery->capacity - 1);
+
+    return recovery->entries + i;
+}
+
+//empty entry and move the entries after it back, so every entry can still be found by probing from its hash
+static void removeRecoveredGame(Recovery* recovery, RecoveredGame* entry)
+{
+    size_t const mask = recovery->capacity - 1;
+    size_t hole = (size_t)(entry - recovery->entries);
+    for(size_t i = (hole + 1) & mask; recovery->entries[i].gameID; i = (i + 1) & mask)
+    {
+        size_t const home = (size_t)((recovery->entries[i].gameID * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask))
+        {
+            recovery->entries[hole] = recovery->entries[i];
+            hole = i;
+        }
+    }
+
+    recovery->entries[hole].gameID = 0;
+}
+
+//the worker a game from journalIndex goes to: the worker that had the journal, if the server still has it and it has room
+static GameWorker* pickRecoveryWorker(size_t journalIndex)
+{
+    GameWorker* worker = s_gameWorkers + journalIndex % s_numOfGameWorkers;
+    for(size_t i = 0; i < s_numOfGameWorkers && (size_t)worker->load >= s_maxGamesPerWorker; ++i)
+        worker = s_gameWorkers + i;
+
+    return ((size_t)worker->load < s_maxGamesPerWorker) ? worker : NULL;
+}
+
+//replay a message of a recovered game the same way it went when the game was running
+static void recoverGameMessage(ChessGame* game, uint8_t fromIndex, char const* msg, size_t msgSize)
+{
+    if(fromIndex > 1 || msgSize < 2 || msgSize > MESSAGE_FRAMER_MAX_MESSAGE_SIZE || (uint8_t)msg[1] != msgSize || ! game->isResumable)
+        return;
+
+    ++game->numOfMessagesFrom[fromIndex];
+    if( ! appendToGameLog(game, fromIndex, msg, msgSize) )
+    {
+        stopResuming(game);
+        return;
+    }
+
+    if((uint8_t)msg[0] == REMATCH_ACCEPT_MSGTYPE)
+    {
+        startRematch(game);
+    }
+    else if((uint8_t)msg[0] == MOVE_MSGTYPE && game->position &&
+        chessPlayMoveMessage(game->position, game->sides[fromIndex], msg) != CHESS_MOVE_OK)
+    {
+        //the last run did not check the moves of this game
+        logWarn("a recovered game has a move that is not legal. its moves are not checked anymore");
+        game->position = NULL;
+    }
+}
+
+//called by gameJournalInit() for every record of the journals of the last run. ctx is the Recovery
+static void onRecoveredRecord(size_t journalIndex, JournalRecord const* record, void* ctx)
+{
+    Recovery* recovery = ctx;
+    if( ! record->gameID )
+        return;
+
+    RecoveredGame* entry = findRecoveredGame(recovery, record->gameID);
+
+    if(record->type == JOURNAL_GAME_START)
+    {
+        JournalGameStart start;
+        if(record->payloadSize != sizeof(start))
+            return;
+
+        //If the last run was itself recovering and stopped before it deleted a journal it did not need anymore,
+        //the same game is in the journal that took it over too. That one is read first (it has a lower index) and wins
+        if(entry->gameID)
+            return;
+
+        GameWorker* worker = pickRecoveryWorker(journalIndex);
+        if( ! worker )
+        {
+            ++recovery->numOfDroppedGames;
+            return;
+        }
+
+        memcpy(&start, record->payload, sizeof(start));
+        ChessGame* game = addGame(worker, record->gameID);
+        InterlockedIncrement(&worker->load);
+        for(int i = 0; i < 2; ++i)
+        {
+            game->resumeTokens[i] = start.resumeTokens[i];
+            game->sides[i] = game->startSides[i] = (start.sides[i] == WHITE) ? WHITE : BLACK;
+            game->leftAtMs[i] = recovery->nowMs;
+        }
+        game->isResumable = true;
+
+        entry->gameID = record->gameID;
+        entry->game = game;
+        entry->worker = worker;
+        entry->journalIndex = journalIndex;
+        ++recovery->numOfGames;
+        recovery->maxGameCounter = max(recovery->maxGameCounter, record->gameID & (((uint64_t)1 << 48) - 1));
+        return;
+    }
+
+    //the messages of a game that was dropped (or that is in another journal too) are skipped
+    if( ! entry->gameID || entry->journalIndex != journalIndex )
+        return;
+
+    if(record->type == JOURNAL_GAME_MESSAGE)
+    {
+        recoverGameMessage(entry->game, record->playerIndex, record->payload, record->payloadSize);
+    }
+    else if(record->type == JOURNAL_GAME_END)
+    {
+        endGame(entry->worker, entry->game->gameIndex);
+        removeRecoveredGame(recovery, entry);
+        --recovery->numOfGames;
+    }
+}
+
+//the journals of the old process of a hot upgrade have the same games as its records, which are taken instead
+static void skipRecoveredRecord(size_t journalIndex, JournalRecord const* record, void* ctx)
+{
+}
+
+//Rebuild a game a hot upgrade handed over from its record: its log is played back like the records of a journal (see recoverGameMessage()),
+//and the rest of it (who is away, how far the players who came back are caught up) is taken from the record.
+//A game that is not resumable has no log, so it goes on without its board (its moves are not checked anymore)
+static void takeOverGame(Recovery* recovery, HotUpgradeGame const* record)
+{
+    RecoveredGame* entry = findRecoveredGame(recovery, record->gameID);
+    if( ! record->gameID || entry->gameID )
+        return;
+
+    GameWorker* worker = pickRecoveryWorker((size_t)(record->gameID >> 48));
+    if( ! worker )
+    {
+        ++recovery->numOfDroppedGames;
+        return;
+    }
+
+    ChessGame* game = addGame(worker, record->gameID);
+    InterlockedIncrement(&worker->load);
+    for(int i = 0; i < 2; ++i)
+    {
+        game->sides[i] = game->startSides[i] = (record->startSides[i] == WHITE) ? WHITE : BLACK;
+        game->leftAtMs[i] = recovery->nowMs - min((uint64_t)record->awayMs[i], recovery->nowMs);
+    }
+
+    game->isResumable = true;
+    char const* log = hotUpgradeGameLog(record);
+    for(uint32_t offset = 0; offset + 3 <= record->logSize && game->isResumable;)
+    {
+        uint32_t const entrySize = 1 + (uint8_t)log[offset + 2];
+        if(offset + entrySize > record->logSize)
+            break;
+
+        recoverGameMessage(game, (uint8_t)log[offset], log + offset + 1, entrySize - 1);
+        offset += entrySize;
+    }
+
+    if( ! record->isResumable || ! game->isResumable )
+    {
+        stopResuming(game);
+        game->position = NULL;
+        for(int i = 0; i < 2; ++i)
+            game->sides[i] = (record->sides[i] == WHITE) ? WHITE : BLACK;
+    }
+
+    for(int i = 0; i < 2 && game->isResumable; ++i)
+    {
+        game->resumeTokens[i] = record->resumeTokens[i];
+        game->isReplaying[i] = record->isReplaying[i] && record->replayOffsets[i] <= game->logSize;
+        game->replayOffsets[i] = game->isReplaying[i] ? record->replayOffsets[i] : 0;
+    }
+
+    //the spectators who are handed over still know the game by its spectate ID
+    if(record->spectateID && connectionIndexInsert(&s_spectateIndex, record->spectateID, gameIndexValue(worker, game)))
+        game->spectateID = record->spectateID;
+
+    entry->gameID = record->gameID;
+    entry->game = game;
+    entry->worker = worker;
+    ++recovery->numOfGames;
+    recovery->maxGameCounter = max(recovery->maxGameCounter, record->gameID & (((uint64_t)1 << 48) - 1));
+}
+
+//Rebuild the games that were running when the server last stopped from the game journals (or from the records of a hot upgrade,
+//if upgrade is not NULL), and start every worker's journal with a checkpoint of the games it got.
+//The games from the journals wait for both players to come back.
+static void recoverGames(HotUpgrade const* upgrade)
+{
+    uint64_t const startUs = getMonotonicMicroseconds();
+
+    Recovery recovery;
+    memset(&recovery, 0, sizeof(recovery));
+    recovery.nowMs = getWorkerNowMs();
+    recovery.capacity = 64;
+    while(recovery.capacity < 2 * getMaxNumOfGames())
+        recovery.capacity <<= 1;
+
+    recovery.entries = calloc(recovery.capacity, sizeof(RecoveredGame));
+    if( ! recovery.entries )
+    {
+        logError("calloc failed to allocate the table of recovered games", 0);
+        exit(0);
+    }
+
+    gameJournalInit(s_numOfGameWorkers, g_serverConfig.journalMB * 1024 * 1024, upgrade ? skipRecoveredRecord : onRecoveredRecord, &recovery);
+    for(size_t i = 0; upgrade && i < upgrade->numOfGames; ++i)
+        takeOverGame(&recovery, upgrade->games[i]);
+
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+    {
+        GameWorker* worker = s_gameWorkers + i;
+        worker->journal = gameJournalGet(i);
+        worker->gameCounter = recovery.maxGameCounter;
+
+        for(size_t j = 0; j < worker->numOfGames;)
+        {
+            //a game that was handed over goes on even if it is not resumable (see gameManagerTakeOver())
+            ChessGame* game = worker->games[j];
+            if( ! game->isResumable && ! upgrade )
+            {
+                endGame(worker, j);
+                continue;
+            }
+
+            game->journal = worker->journal;
+            if(game->isResumable)
+                registerResumeTokens(worker, game);
+            if( ! game->spectateID )
+                registerSpectateID(worker, game);
+            if( ! upgrade )
+                scheduleResumeTimer(worker, game);
+            ++j;
+        }
+
+        gameJournalCheckpoint(worker->journal, checkpointWorkerGames, worker);
+    }
+
+    //every game of a journal the server has no worker for now is in the journal of the worker that took it over
+    gameJournalDeleteStaleFiles();
+
+    //gameManagerTakeOver() looks the games up by their gameID
+    if(upgrade)
+        s_takeOver = recovery;
+    else
+        free(recovery.entries);
+
+    if(upgrade)
+    {
+        logInfo("took over %zu games in %llu ms", recovery.numOfGames, (unsigned long long)((getMonotonicMicroseconds() - startUs) / 1000));
+    }
+    else if(recovery.numOfGames || recovery.numOfDroppedGames)
+    {
+        logInfo("recovered %zu games from the game journals in %llu ms. they wait %zu seconds for their players to come back",
+            recovery.numOfGames, (unsigned long long)((getMonotonicMicroseconds() - startUs) / 1000), g_serverConfig.resumeGraceSecs);
+    }
+
+    if(recovery.numOfDroppedGames)
+        logWarn("%zu games from the game journals did not fit in CHESS_SERVER_MAX_GAMES and were dropped", recovery.numOfDroppedGames);
+}
+
+void gameManagerInit(HotUpgrade const* upgrade)
+{
+    for(uint8_t msgType = 0; msgType < NUM_OF_MESSAGE_TYPES; ++msgType)
+        assert( ! clientMessageSize(msgType, MSG_IN_GAME) || s_gameMessageHandlers[msgType] );
+
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    s_numOfGameWorkers = sysInfo.dwNumberOfProcessors > 0 ? sysInfo.dwNumberOfProcessors : 1;
+    s_numOfGameWorkers = min(s_numOfGameWorkers, (size_t)JOURNAL_MAX_FILES);
+    s_maxGamesPerWorker = (g_serverConfig.maxGames + s_numOfGameWorkers - 1) / s_numOfGameWorkers;
+    s_maxGamesPerWorker = min(s_maxGamesPerWorker, ((size_t)1 << RESUME_SLOT_BITS) - 1);
+
+    if(g_serverConfig.validateMoves)
+        chessRulesInit();
+
+    s_gameWorkers = calloc(s_numOfGameWorkers, sizeof(GameWorker));
+    if( ! s_gameWorkers || ! connectionIndexInit(&s_resumeIndex, 2 * s_numOfGameWorkers * s_maxGamesPerWorker) ||
+        ! connectionIndexInit(&s_spectateIndex, s_numOfGameWorkers * s_maxGamesPerWorker) )
+    {
+        logError("calloc failed to allocate the game workers", 0);
+        exit(0);
+    }
+
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+    {
+        GameWorker* worker = s_gameWorkers + i;
+        worker->index = i;
+        worker->gameSlots = calloc(s_maxGamesPerWorker, sizeof(ChessGame));
+        worker->games = calloc(s_maxGamesPerWorker, sizeof(ChessGame*));
+        worker->inbox = calloc(s_maxGamesPerWorker, sizeof(NewGame));
+        worker->resumeInbox = calloc(RESUME_INBOX_CAPACITY, sizeof(ResumingPlayer));
+        worker->spectateInbox = calloc(SPECTATE_INBOX_CAPACITY, sizeof(NewSpectator));
+        worker->pollFds = calloc(2 * s_maxGamesPerWorker + 1 + g_serverConfig.spectatorsPerWorker, sizeof(WSAPOLLFD));
+        worker->pollFdSpectators = calloc(2 * s_maxGamesPerWorker + 1 + g_serverConfig.spectatorsPerWorker, sizeof(Spectator*));
+        worker->spectatorSlots = calloc(g_serverConfig.spectatorsPerWorker, sizeof(Spectator));
+        worker->positions = g_serverConfig.validateMoves ? malloc(s_maxGamesPerWorker * sizeof(ChessPosition)) : NULL;
+        if( ! worker->gameSlots || ! worker->games || ! worker->inbox || ! worker->resumeInbox || ! worker->spectateInbox ||
+            ! worker->pollFds || ! worker->pollFdSpectators || (g_serverConfig.spectatorsPerWorker && ! worker->spectatorSlots) ||
+            (g_serverConfig.validateMoves && ! worker->positions) )
+        {
+            logError("calloc failed to allocate the games of a game worker", 0);
+            exit(0);
+        }
+
+        //every slot starts out free
+        for(size_t j = 0; j < s_maxGamesPerWorker; ++j)
+            worker->gameSlots[j].nextFree = (j + 1 < s_maxGamesPerWorker) ? (uint32_t)(j + 1) : GAME_SLOT_NONE;
+        worker->firstFreeSlot = 0;
+
+        for(size_t j = 0; j < g_serverConfig.spectatorsPerWorker; ++j)
+            worker->spectatorSlots[j].next = (j + 1 < g_serverConfig.spectatorsPerWorker) ? worker->spectatorSlots + j + 1 : NULL;
+        worker->firstFreeSpectator = worker->spectatorSlots;
+
+        timerWheelInit(&worker->resumeTimers, getWorkerNowMs());
+
+        if( ! wakeupSocketInit(&worker->wakeup) )
+            exit(0);
+
+        if(g_serverConfig.registeredIO)
+            registeredIOQueueInit(&worker->rio, i, &worker->wakeup);
+
+        worker->pollFds[0].fd = worker->wakeup.sock;
+        worker->pollFds[0].events = POLLRDNORM;
+
+        InitializeCriticalSection(&worker->inboxMutex);
+
+        worker->handedOverEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if( ! worker->handedOverEvent )
+        {
+            logError("CreateEvent() failed for a game worker", (int)GetLastError());
+            exit(0);
+        }
+    }
+
+    //before any worker runs, since the recovered games are handed straight to them
+    recoverGames(upgrade);
+
+    //the players themselves are in the connection pool, so a game only needs a few pointers and poll set registrations on its worker
+    //(plus its log while it is running, which grows with the game)
+    size_t const bytesPerGame = sizeof(ChessGame) + sizeof(ChessGame*) + sizeof(NewGame) + 2 * sizeof(WSAPOLLFD) +
+        (g_serverConfig.validateMoves ? sizeof(ChessPosition) : 0);
+    size_t const bytesPerSpectator = sizeof(Spectator) + sizeof(Spectator*) + sizeof(WSAPOLLFD);
+    logInfo("started %zu game workers (%zu games max, %zu bytes per game, %llu KB in total, move validation %s, "
+        "%zu spectators per worker, %zu bytes per spectator, Registered I/O %s)", s_numOfGameWorkers,
+        getMaxNumOfGames(), bytesPerGame, (unsigned long long)(getMaxNumOfGames() * bytesPerGame / 1024),
+        g_serverConfig.validateMoves ? "on" : "off", g_serverConfig.spectatorsPerWorker, bytesPerSpectator,
+        g_serverConfig.registeredIO ? "on" : "off");
+}
+
+void gameManagerStart(void)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    _beginthread(journalFlusherThreadStart, JOURNAL_FLUSHER_STACKSIZE, NULL);
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+        _beginthread(gameWorkerThreadStart, GAME_WORKER_STACKSIZE, s_gameWorkers + i);
+}
+
+//Seat a spectator a hot upgrade handed over. They send what they did not get yet of their game, and then go on with its feed.
+//If their game ended (or was not taken over) they send the rest of it, and the end of it if they did not have that yet
+static bool takeOverSpectator(HotUpgradeConnection* record)
+{
+    RecoveredGame const* entry = record->gameID ? findRecoveredGame(&s_takeOver, record->gameID) : NULL;
+    ChessGame* game = (entry && entry->gameID) ? entry->game : NULL;
+    GameWorker* worker = game ? entry->worker : NULL;
+    //no room on the game's worker. they get the rest of what they had on another one
+    if(worker && worker->numOfSpectators >= g_serverConfig.spectatorsPerWorker)
+    {
+        worker = NULL;
+        game = NULL;
+    }
+
+    for(size_t i = 0; i < s_numOfGameWorkers && ! worker; ++i)
+    {
+        if(s_gameWorkers[i].numOfSpectators < g_serverConfig.spectatorsPerWorker)
+            worker = s_gameWorkers + i;
+    }
+
+    if( ! worker )
+        return false;
+
+    Connection* p = hotUpgradeAdoptConnection(record);
+    if( ! p )
+        return false;
+
+    connectionSetState(p, CONNECTION_HANDED_OVER);
+
+    bool const hasEnd = ! record->gameID;
+    uint32_t const endSize = (game || hasEnd) ? 0 : SPECTATE_ENDED_MSGSIZE;
+    SpectatorChunk* tail = NULL;
+    if(game)
+    {
+        spectatorFeedStart(&game->feed);
+        tail = spectatorFeedSplit(&game->feed);
+    }
+
+    SpectatorChunk* pending = spectatorChunkNew(record->pendingSize + endSize, tail);
+    memcpy(pending->data, hotUpgradePendingBytes(record), record->pendingSize);
+    if(endSize)
+    {
+        pending->data[record->pendingSize] = SPECTATE_ENDED_MSGTYPE;
+        pending->data[record->pendingSize + 1] = SPECTATE_ENDED_MSGSIZE;
+    }
+
+    pending->size = record->pendingSize + endSize;
+    if(tail)
+        pending->feedOffset = tail->feedOffset - pending->size;
+
+    addSpectator(worker, game, p, pending);
+    spectatorChunkRelease(pending);
+    return true;
+}
+
+void gameManagerTakeOver(HotUpgrade* upgrade)
+{
+    size_t numOfPlayers = 0;
+    size_t numOfSpectators = 0;
+
+    for(size_t i = 0; i < upgrade->numOfConnections; ++i)
+    {
+        HotUpgradeConnection* record = upgrade->connections[i];
+        if(record->role == HOT_UPGRADE_SPECTATOR)
+        {
+            numOfSpectators += takeOverSpectator(record);
+            continue;
+        }
+
+        if(record->role != HOT_UPGRADE_PLAYER || record->playerIndex > 1 || ! record->gameID)
+            continue;
+
+        RecoveredGame const* entry = findRecoveredGame(&s_takeOver, record->gameID);
+        if( ! entry->gameID || entry->game->players[record->playerIndex] )
+            continue;
+
+        Connection* p = hotUpgradeAdoptConnection(record);
+        if( ! p )
+            continue;
+
+        connectionSetState(p, CONNECTION_HANDED_OVER);
+        attachPlayer(entry->worker, entry->game, record->playerIndex, p);
+        ++numOfPlayers;
+    }
+
+    //A player who was connected but could not be taken over is made away by the worker (see suspendLeftPlayers()), if the game can wait
+    //for them. A game that can not ends, like it does when a player of it is lost
+    for(size_t i = 0; i < upgrade->numOfGames; ++i)
+    {
+        HotUpgradeGame const* record = upgrade->games[i];
+        RecoveredGame const* entry = findRecoveredGame(&s_takeOver, record->gameID);
+        if( ! record->gameID || ! entry->gameID )
+            continue;
+
+        ChessGame* game = entry->game;
+        bool isOver = false;
+        for(int j = 0; j < 2; ++j)
+        {
+            if(game->players[j])
+                continue;
+
+            if( ! game->isResumable )
+                isOver = true;
+            else if(record->isConnected[j])
+                game->leftPlayers |= (uint8_t)(1 << j);
+        }
+
+        if(isOver)
+        {
+            forfeitAwayPlayers(game);
+            endGame(entry->worker, game->gameIndex);
+            continue;
+        }
+
+        scheduleResumeTimer(entry->worker, game);
+    }
+
+    free(s_takeOver.entries);
+    memset(&s_takeOver, 0, sizeof(s_takeOver));
+    logInfo("took over %zu players and %zu spectators", numOfPlayers, numOfSpectators);
+}
+
+void gameManagerHandOver(HotUpgradeBuffer* buffer)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+    {
+        InterlockedExchange(&s_gameWorkers[i].isHandingOver, 1);
+        signalWakeupSocket(&s_gameWorkers[i].wakeup);
+    }
+
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+    {
+        WaitForSingleObject(s_gameWorkers[i].handedOverEvent, INFINITE);
+        hotUpgradeAppendBuffer(buffer, &s_gameWorkers[i].handOver);
+    }
+}
+
+bool isGameRoomAvailable(void)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+    {
+        if((size_t)s_gameWorkers[i].load < s_maxGamesPerWorker)
+            return true;
+    }
+
+    return false;
+}
+
+//the worker whose completion queue the socket of player is tied to (see registeredIO.h), if it has room for another game
+static GameWorker* registeredIOWorkerOf(ConnectionHandle player)
+{
+    Connection const* p = connectionPoolGet(player);
+    if( ! p || ! p->rio.queue )
+        return NULL;
+
+    GameWorker* worker = s_gameWorkers + p->rio.queue->owner;
+    return ((size_t)worker->load < s_maxGamesPerWorker) ? worker : NULL;
+}
+
+//Take a place for a new game in worker. Every lobby thread starts games, so the load is only raised if it did not reach
+//s_maxGamesPerWorker in the meantime. returns false if the worker is full
+static bool takeGameRoom(GameWorker* worker)
+{
+    LONG load = worker->load;
+    while((size_t)load < s_maxGamesPerWorker)
+    {
+        LONG const prevLoad = InterlockedCompareExchange(&worker->load, load + 1, load);
+        if(prevLoad == load)
+            return true;
+
+        load = prevLoad;
+    }
+
+    return false;
+}
+
+bool startChessGame(ConnectionHandle player1, ConnectionHandle player2)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    //a player can only use Registered I/O on one worker, so that one gets their game if it can take it.
+    //otherwise find the least loaded worker
+    GameWorker* worker = registeredIOWorkerOf(player1);
+    bool hasRoom = worker && takeGameRoom(worker);
+    if( ! hasRoom )
+    {
+        worker = registeredIOWorkerOf(player2);
+        hasRoom = worker && takeGameRoom(worker);
+    }
+
+    if( ! hasRoom )
+    {
+        //another lobby thread can take the room between finding the least loaded worker and taking it, so look again.
+        //every time around someone else started a game, so this ends once every worker is full
+        do
+        {
+            worker = s_gameWorkers;
+            for(size_t i = 1; i < s_numOfGameWorkers; ++i)
+            {
+                if(s_gameWorkers[i].load < worker->load)
+                    worker = s_gameWorkers + i;
+            }
+
+            if((size_t)worker->load >= s_maxGamesPerWorker)
+                return false;
+        }
+        while( ! takeGameRoom(worker) );
+    }
+
+    metricsAdd(METRIC_GAMES_STARTED, 1);
+
+    EnterCriticalSection(&worker->inboxMutex);
+    NewGame* newGame = worker->inbox + worker->inboxSize++;
+    newGame->players[0] = player1;
+    newGame->players[1] = player2;
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    signalWakeupSocket(&worker->wakeup);
+    return true;
+}
+
+bool canResumeChessGame(uint64_t resumeToken)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    uint32_t value = 0;
+    if( ! lookupResumeToken(resumeToken, &value) )
+        return false;
+
+    GameWorker* worker = s_gameWorkers + (value >> RESUME_SLOT_BITS);
+    EnterCriticalSection(&worker->inboxMutex);
+    bool const hasRoom = worker->resumeInboxSize < RESUME_INBOX_CAPACITY;
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    return hasRoom;
+}
+
+void resumeChessGame(ConnectionHandle player, uint64_t resumeToken, uint32_t numOfMessagesReceived)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    //the game could have ended since canResumeChessGame()
+    uint32_t value = 0;
+    if( ! lookupResumeToken(resumeToken, &value) )
+    {
+        failResume(connectionPoolGet(player));
+        return;
+    }
+
+    GameWorker* worker = s_gameWorkers + (value >> RESUME_SLOT_BITS);
+
+    //another lobby thread could have taken the room canResumeChessGame() saw
+    EnterCriticalSection(&worker->inboxMutex);
+    bool const hasRoom = worker->resumeInboxSize < RESUME_INBOX_CAPACITY;
+    if(hasRoom)
+    {
+        ResumingPlayer* resuming = worker->resumeInbox + worker->resumeInboxSize++;
+        resuming->player = player;
+        resuming->gameSlot = value & ((1u << RESUME_SLOT_BITS) - 1);
+        resuming->resumeToken = resumeToken;
+        resuming->numOfMessagesReceived = numOfMessagesReceived;
+    }
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    if( ! hasRoom )
+    {
+        failResume(connectionPoolGet(player));
+        return;
+    }
+
+    signalWakeupSocket(&worker->wakeup);
+}
+
+//returns false if spectateID is not in s_spectateIndex, otherwise writes what it maps to to valueOut
+static bool lookupSpectateID(uint32_t spectateID, uint32_t* valueOut)
+{
+    if(spectateID == CONNECTION_INDEX_EMPTY_KEY || spectateID == CONNECTION_INDEX_TOMBSTONE_KEY)
+        return false;
+
+    return connectionIndexLookup(&s_spectateIndex, spectateID, valueOut);
+}
+
+bool canSpectateChessGame(uint32_t spectateID)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    uint32_t value = 0;
+    if( ! lookupSpectateID(spectateID, &value) )
+        return false;
+
+    GameWorker* worker = s_gameWorkers + (value >> RESUME_SLOT_BITS);
+    EnterCriticalSection(&worker->inboxMutex);
+    bool const hasRoom = worker->spectateInboxSize < SPECTATE_INBOX_CAPACITY;
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    return hasRoom;
+}
+
+void spectateChessGame(ConnectionHandle spectator, uint32_t spectateID)
+{
+    assert(s_gameWorkers);//assert that gameManagerInit() has been called
+
+    //the game could have ended since canSpectateChessGame()
+    uint32_t value = 0;
+    if( ! lookupSpectateID(spectateID, &value) )
+    {
+        failSpectate(connectionPoolGet(spectator));
+        return;
+    }
+
+    GameWorker* worker = s_gameWorkers + (value >> RESUME_SLOT_BITS);
+
+    //another lobby thread could have taken the room canSpectateChessGame() saw, same as in resumeChessGame()
+    EnterCriticalSection(&worker->inboxMutex);
+    bool const hasRoom = worker->spectateInboxSize < SPECTATE_INBOX_CAPACITY;
+    if(hasRoom)
+    {
+        NewSpectator* newSpectator = worker->spectateInbox + worker->spectateInboxSize++;
+        newSpectator->spectator = spectator;
+        newSpectator->gameSlot = value & ((1u << RESUME_SLOT_BITS) - 1);
+        newSpectator->spectateID = spectateID;
+    }
+    LeaveCriticalSection(&worker->inboxMutex);
+
+    if( ! hasRoom )
+    {
+        failSpectate(connectionPoolGet(spectator));
+        return;
+    }
+
+    signalWakeupSocket(&worker->wakeup);
+}
+
+size_t getMaxNumOfGames(void)
+{
+    return s_numOfGameWorkers * s_maxGamesPerWorker;
+}
+
+size_t getNumOfRunningGames(void)
+{
+    size_t numOfGames = 0;
+    for(size_t i = 0; i < s_numOfGameWorkers; ++i)
+        numOfGames += (size_t)s_gameWorkers[i].load;
+
+    return numOfGames;
+}
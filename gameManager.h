@@ -1,10 +1,67 @@
 #ifndef GAME_MANAGER_H
 #define GAME_MANAGER_H
 
-#define GAME_MANAGER_STACKSIZE 64000
+#include <stdbool.h>
+#include <stdint.h>
+#include "lobbyManager.h"
+#include "hotUpgrade.h"
 
-#define MAX_NUMOF_GAMES 50
+//the size of the stack used by each game worker thread in bytes
+#define GAME_WORKER_STACKSIZE 64000
 
-void __stdcall chessGameThreadStart(void*);
+//Sets up the pool of game workers (one per cpu core), which gameManagerStart() starts.
+//g_serverConfig.maxGames (see serverConfig.h) is split evenly between them.
+//The games that were running when the server last stopped are rebuilt from the game journals (see gameJournal.h) first,
+//and wait for their players to come back with RESUME_GAME_MSGTYPE. If upgrade is not NULL the games come from the
+//records of a hot upgrade instead (see hotUpgrade.h), and gameManagerTakeOver() seats their players and spectators.
+//Must be called before the lobby threads start pairing players.
+void gameManagerInit(HotUpgrade const* upgrade);
 
-#endif
\ No newline at end of file
+//The side of the new process of a hot upgrade. Called by main() after gameManagerInit(), lobbyManagerInit() and before gameManagerStart().
+//The players and spectators the old process handed over go back to their games. A game whose player could not be taken over
+//waits for them to come back if it is resumable, and ends if it is not
+void gameManagerTakeOver(HotUpgrade* upgrade);
+
+//starts the game worker threads and the journal flusher thread
+void gameManagerStart(void);
+
+//The side of the running server of a hot upgrade, called by the hot upgrade thread after lobbyPause(). Every game worker waits up to
+//HOT_UPGRADE_DRAIN_MS for what Registered I/O has in flight, writes its games, players and spectators into buffer and ends.
+//Blocks until all of them did
+void gameManagerHandOver(HotUpgradeBuffer* buffer);
+
+//false if every game worker is already managing as many games as it can
+bool isGameRoomAvailable(void);
+
+//Hands two paired players to the least loaded game worker, which will start their chess game.
+//The worker owns the two connections from now on, so the caller must have taken them out of the lobby already.
+//Returns false if every game worker is already managing as many games as it can.
+bool startChessGame(ConnectionHandle player1, ConnectionHandle player2);
+
+//false if no running game has the resume token (see RESUME_GAME_MSGTYPE in chessNetworkProtocol.h),
+//or its worker can not take another player coming back right now. Another lobby thread can still take the last place before
+//resumeChessGame(), which then sends the player back to the lobby with a RESUME_FAILED_MSGTYPE
+bool canResumeChessGame(uint64_t resumeToken);
+
+//Hands a player who sent RESUME_GAME_MSGTYPE to the worker of the game with resumeToken, which puts them back into it.
+//numOfMessagesReceived is the count from the RESUME_GAME_MSGTYPE. The worker owns the connection from now on, so the caller must have
+//taken it out of the lobby already. If the token turns out to be wrong (or the game ended in the meantime)
+//(or its worker filled up) the player gets a RESUME_FAILED_MSGTYPE and is put back in the lobby.
+void resumeChessGame(ConnectionHandle player, uint64_t resumeToken, uint32_t numOfMessagesReceived);
+
+//false if no running game has the spectate ID (see SPECTATE_MSGTYPE in chessNetworkProtocol.h), or its worker can not take
+//another spectator right now. Same as canResumeChessGame(), spectateChessGame() can still turn the spectator away
+bool canSpectateChessGame(uint32_t spectateID);
+
+//Hands a connection that sent SPECTATE_MSGTYPE to the worker of the game with spectateID, which starts sending it the game.
+//The worker owns the connection from now on, so the caller must have taken it out of the lobby already. If the game can not be watched
+//after all (it ended in the meantime, or has too many spectators) the spectator gets a SPECTATE_FAILED_MSGTYPE and is put back in the lobby.
+void spectateChessGame(ConnectionHandle spectator, uint32_t spectateID);
+
+//the most games that can be running at once across all of the game workers. only valid after gameManagerInit()
+size_t getMaxNumOfGames(void);
+
+//how many games are running (or waiting to be picked up by a worker) across all of the game workers
+size_t getNumOfRunningGames(void);
+
+#endif
@@ -0,0 +1,700 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "hotUpgrade.h"
+#include "connectionPool.h"
+#include "connectionsAcceptor.h"
+#include "lobbyManager.h"
+#include "gameManager.h"
+#include "admissionControl.h"
+#include "serverConfig.h"
+#include "errorLogger.h"
+
+//no record is anywhere near this big (a game's log is at most 64 KB). anything bigger means the stream is broken
+#define HOT_UPGRADE_MAX_RECORD_SIZE (1024 * 1024)
+
+//how long the hot upgrade thread waits before it waits on the pipe again after ConnectNamedPipe() failed
+#define HOT_UPGRADE_RETRY_MS 100
+
+#define HOT_UPGRADE_INITIAL_CAPACITY (64 * 1024)
+
+//what the pipe buffers each way. the records go through it in pieces of this
+#define HOT_UPGRADE_PIPE_BUFFER_SIZE (64 * 1024)
+
+//the process the running server is being handed over to. set before anything is duplicated for it
+static DWORD s_targetProcessID = 0;
+
+//signaled by the hot upgrade thread once the new process took everything over (or failed to), which is what hotUpgradeFinish() waits for
+static HANDLE s_finishedEvent = NULL;
+static int s_exitCode = EXIT_FAILURE;
+
+static void reserve(HotUpgradeBuffer* buffer, size_t size)
+{
+    if(buffer->size + size <= buffer->capacity)
+        return;
+
+    size_t newCapacity = buffer->capacity ? buffer->capacity : HOT_UPGRADE_INITIAL_CAPACITY;
+    while(newCapacity < buffer->size + size)
+        newCapacity *= 2;
+
+    char* newData = realloc(buffer->data, newCapacity);
+    if( ! newData )
+    {
+        logError("realloc failed to grow the records of a hot upgrade", 0);
+        exit(0);
+    }
+
+    buffer->data = newData;
+    buffer->capacity = newCapacity;
+}
+
+//Append the header of a record of type with payloadSize bytes of payload (padded to a multiple of 8 bytes, so every record
+//is aligned for the structs in it). Returns where the payload goes, which is zeroed
+static char* beginRecord(HotUpgradeBuffer* buffer, HotUpgradeRecordType type, size_t payloadSize)
+{
+    size_t const paddedSize = (payloadSize + 7) & ~(size_t)7;
+    reserve(buffer, sizeof(HotUpgradeRecordHeader) + paddedSize);
+
+    HotUpgradeRecordHeader const header = {(uint32_t)type, (uint32_t)paddedSize};
+    memcpy(buffer->data + buffer->size, &header, sizeof(header));
+
+    char* payload = buffer->data + buffer->size + sizeof(header);
+    memset(payload, 0, paddedSize);
+    buffer->size += sizeof(header) + paddedSize;
+    return payload;
+}
+
+//copy what is between the free running head and tail of a ring of capacity bytes (a power of 2) to dst, oldest byte first
+static void copyRing(char* dst, char const* ring, uint32_t capacity, uint32_t head, uint32_t tail)
+{
+    uint32_t const size = tail - head;
+    uint32_t const start = head & (capacity - 1);
+    uint32_t const firstPiece = min(size, capacity - start);
+    memcpy(dst, ring + start, firstPiece);
+    memcpy(dst + firstPiece, ring, size - firstPiece);
+}
+
+static bool duplicateSocket(SOCKET sock, WSAPROTOCOL_INFOA* info)
+{
+    if(WSADuplicateSocketA(sock, s_targetProcessID, info) == SOCKET_ERROR)
+    {
+        logError("WSADuplicateSocket() failed to hand a socket over to the new process", WSAGetLastError());
+        return false;
+    }
+
+    return true;
+}
+
+void hotUpgradeWriteGame(HotUpgradeBuffer* buffer, HotUpgradeGame const* game, char const* log)
+{
+    char* payload = beginRecord(buffer, HOT_UPGRADE_GAME, sizeof(*game) + game->logSize);
+    memcpy(payload, game, sizeof(*game));
+    if(game->logSize)
+        memcpy(payload + sizeof(*game), log, game->logSize);
+
+    ++buffer->numOfGames;
+}
+
+bool hotUpgradeWriteConnection(HotUpgradeBuffer* buffer, HotUpgradeConnection* record, Connection const* connection, char const* pending)
+{
+    if( ! duplicateSocket(connection->socket, &record->protocolInfo) )
+        return false;
+
+    record->socket = INVALID_SOCKET;
+    record->addr = connection->addr;
+    record->inSize = (uint16_t)messageFramerSize(&connection->in);
+    record->outSize = (uint16_t)outBufferSize(&connection->out);
+
+    char* payload = beginRecord(buffer, HOT_UPGRADE_CONNECTION, sizeof(*record) + record->inSize + record->outSize + record->pendingSize);
+    memcpy(payload, record, sizeof(*record));
+    payload += sizeof(*record);
+
+    copyRing(payload, connection->in.data, MESSAGE_FRAMER_CAPACITY, connection->in.head, connection->in.tail);
+    payload += record->inSize;
+
+    copyRing(payload, connection->out.data, OUT_BUFFER_CAPACITY, connection->out.head, connection->out.tail);
+    payload += record->outSize;
+
+    if(record->pendingSize)
+        memcpy(payload, pending, record->pendingSize);
+
+    ++buffer->numOfConnections;
+    return true;
+}
+
+bool hotUpgradeWriteListenSocket(HotUpgradeBuffer* buffer, SOCKET listenSocket)
+{
+    WSAPROTOCOL_INFOA info;
+    if( ! duplicateSocket(listenSocket, &info) )
+        return false;
+
+    memcpy(beginRecord(buffer, HOT_UPGRADE_LISTEN_SOCKET, sizeof(info)), &info, sizeof(info));
+    return true;
+}
+
+void hotUpgradeAppendBuffer(HotUpgradeBuffer* buffer, HotUpgradeBuffer* other)
+{
+    if(other->size)
+    {
+        reserve(buffer, other->size);
+        memcpy(buffer->data + buffer->size, other->data, other->size);
+        buffer->size += other->size;
+    }
+
+    buffer->numOfGames += other->numOfGames;
+    buffer->numOfConnections += other->numOfConnections;
+
+    free(other->data);
+    memset(other, 0, sizeof(*other));
+}
+
+//One end of the hot upgrade pipe. It is overlapped, so the two processes can give up on each other after HOT_UPGRADE_TIMEOUT_MS
+typedef struct
+{
+    HANDLE handle;
+    HANDLE event;//manual reset, for the one read or write in flight
+}UpgradePipe;
+
+//read or write all of size bytes. returns false if the pipe broke or the other process did not keep up in time
+static bool transferAll(UpgradePipe* pipe, void* data, size_t size, bool isWrite)
+{
+    char* bytes = data;
+    while(size)
+    {
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.hEvent = pipe->event;
+
+        DWORD const chunk = (DWORD)min(size, (size_t)MAXDWORD);
+        BOOL const isDone = isWrite ? WriteFile(pipe->handle, bytes, chunk, NULL, &overlapped) :
+                                      ReadFile(pipe->handle, bytes, chunk, NULL, &overlapped);
+
+        if( ! isDone && GetLastError() != ERROR_IO_PENDING )
+            return false;
+
+        DWORD numOfBytes = 0;
+        if( ! isDone && WaitForSingleObject(pipe->event, HOT_UPGRADE_TIMEOUT_MS) != WAIT_OBJECT_0 )
+        {
+            //the buffer has to outlive the read or write, so wait for the cancel to go through
+            CancelIo(pipe->handle);
+            GetOverlappedResult(pipe->handle, &overlapped, &numOfBytes, TRUE);
+            SetLastError(WAIT_TIMEOUT);
+            return false;
+        }
+
+        if( ! GetOverlappedResult(pipe->handle, &overlapped, &numOfBytes, FALSE) || numOfBytes == 0 )
+            return false;
+
+        bytes += numOfBytes;
+        size -= numOfBytes;
+    }
+
+    return true;
+}
+
+static bool sendAll(UpgradePipe* pipe, void const* data, size_t size)
+{
+    return transferAll(pipe, (void*)data, size, true);
+}
+
+static bool recvAll(UpgradePipe* pipe, void* data, size_t size)
+{
+    return transferAll(pipe, data, size, false);
+}
+
+//The user the process runs as (free() it). NULL (and logs why) if it can not be told
+static TOKEN_USER* getProcessUser(HANDLE process)
+{
+    HANDLE token = NULL;
+    if( ! OpenProcessToken(process, TOKEN_QUERY, &token) )
+    {
+        logError("OpenProcessToken() failed to tell who a process runs as", (int)GetLastError());
+        return NULL;
+    }
+
+    DWORD size = 0;
+    GetTokenInformation(token, TokenUser, NULL, 0, &size);
+    TOKEN_USER* user = size ? malloc(size) : NULL;
+    if( ! user || ! GetTokenInformation(token, TokenUser, user, size, &size) )
+    {
+        logError("GetTokenInformation() failed to tell who a process runs as", (int)GetLastError());
+        free(user);
+        user = NULL;
+    }
+
+    CloseHandle(token);
+    return user;
+}
+
+//Open the process on the other end of the hot upgrade pipe (which the pipe tells, so nothing the process sends is trusted for it).
+//Only a process that runs as the same user as this one is let in, since that user could do anything to this process anyway.
+//Returns NULL (and logs why) if it is someone else. The handle also keeps processID from being reused while it is open
+static HANDLE openPeerProcess(DWORD processID)
+{
+    HANDLE process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processID);
+    if( ! process )
+    {
+        logError("OpenProcess() failed to open the process on the other end of the hot upgrade pipe", (int)GetLastError());
+        return NULL;
+    }
+
+    TOKEN_USER* ownUser = getProcessUser(GetCurrentProcess());
+    TOKEN_USER* peerUser = getProcessUser(process);
+    bool const isSameUser = ownUser && peerUser && EqualSid(ownUser->User.Sid, peerUser->User.Sid);
+    free(ownUser);
+    free(peerUser);
+
+    if( ! isSameUser )
+    {
+        logWarn("process %lu on the other end of the hot upgrade pipe does not run as the same user as this server. ignoring it",
+            (unsigned long)processID);
+        CloseHandle(process);
+        return NULL;
+    }
+
+    return process;
+}
+
+//Only the user the server runs as can open the pipe, and it has a single instance, which this process has to be the first to create
+//(so nobody else can have created it first and be listening on it too). INVALID_HANDLE_VALUE if it could not be created
+static HANDLE createUpgradePipe(void)
+{
+    TOKEN_USER* user = getProcessUser(GetCurrentProcess());
+    if( ! user )
+        return INVALID_HANDLE_VALUE;
+
+    DWORD const aclSize = sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) + GetLengthSid(user->User.Sid);
+    ACL* acl = malloc(aclSize);
+    SECURITY_DESCRIPTOR descriptor;
+    bool const hasDescriptor = acl &&
+        InitializeAcl(acl, aclSize, ACL_REVISION) &&
+        AddAccessAllowedAce(acl, ACL_REVISION, GENERIC_READ | GENERIC_WRITE, user->User.Sid) &&
+        InitializeSecurityDescriptor(&descriptor, SECURITY_DESCRIPTOR_REVISION) &&
+        SetSecurityDescriptorDacl(&descriptor, TRUE, acl, FALSE);
+
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    if(hasDescriptor)
+    {
+        SECURITY_ATTRIBUTES attributes = {sizeof(attributes), &descriptor, FALSE};
+        pipe = CreateNamedPipeA(HOT_UPGRADE_PIPE_NAME, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1,
+            HOT_UPGRADE_PIPE_BUFFER_SIZE, HOT_UPGRADE_PIPE_BUFFER_SIZE, 0, &attributes);
+    }
+
+    if(pipe == INVALID_HANDLE_VALUE)
+        logError("could not create the hot upgrade pipe. this server can not be upgraded without downtime", (int)GetLastError());
+
+    free(acl);
+    free(user);
+    return pipe;
+}
+
+//Hand the whole server over to the new process on the other end of pipe, in the order hotUpgrade.h describes. Returns the exit code of the server
+static int handOver(UpgradePipe* pipe, DWORD processID)
+{
+    uint64_t const startUs = getMonotonicMicroseconds();
+    s_targetProcessID = processID;
+    logInfo("process %lu is taking over. handing the server over to it", (unsigned long)processID);
+
+    HotUpgradeBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+
+    connectionsAcceptorHandOver(&buffer);
+    lobbyPause();
+    gameManagerHandOver(&buffer);
+    lobbyHandOver(&buffer);
+
+    //after the lobby, which is the last to acquire IDs
+    HotUpgradeServer server;
+    memset(&server, 0, sizeof(server));
+    idAllocatorSave(&server.ids);
+    memcpy(beginRecord(&buffer, HOT_UPGRADE_SERVER, sizeof(server)), &server, sizeof(server));
+    beginRecord(&buffer, HOT_UPGRADE_END, 0);
+
+    //the new process answers once it made every socket
+    char answer = 0;
+    bool const isTakenOver = sendAll(pipe, buffer.data, buffer.size) && recvAll(pipe, &answer, sizeof(answer));
+    int const error = (int)GetLastError();
+
+    if( ! isTakenOver )
+    {
+        logError("the new process did not take the server over. exiting anyway, it recovers the games from the game journals", error);
+        free(buffer.data);
+        return EXIT_FAILURE;
+    }
+
+    logInfo("handed %zu games and %zu connections (%zu KB) over to process %lu in %llu ms. exiting", buffer.numOfGames,
+        buffer.numOfConnections, buffer.size / 1024, (unsigned long)processID,
+        (unsigned long long)((getMonotonicMicroseconds() - startUs) / 1000));
+
+    free(buffer.data);
+    return EXIT_SUCCESS;
+}
+
+//block until a process opens the pipe. returns false if it could not wait for one
+static bool waitForUpgradeClient(UpgradePipe* pipe)
+{
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = pipe->event;
+
+    if(ConnectNamedPipe(pipe->handle, &overlapped))
+        return true;
+
+    DWORD numOfBytes = 0;
+    switch(GetLastError())
+    {
+    case ERROR_PIPE_CONNECTED:
+        return true;
+    case ERROR_IO_PENDING:
+        return GetOverlappedResult(pipe->handle, &overlapped, &numOfBytes, TRUE);
+    default:
+        return false;
+    }
+}
+
+void __stdcall hotUpgradeThreadStart(void* arg)
+{
+    s_finishedEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    UpgradePipe pipe = {INVALID_HANDLE_VALUE, CreateEventA(NULL, TRUE, FALSE, NULL)};
+    if( ! s_finishedEvent || ! pipe.event )
+    {
+        logError("CreateEvent() failed for the hot upgrade thread", (int)GetLastError());
+        return;
+    }
+
+    pipe.handle = createUpgradePipe();
+    if(pipe.handle == INVALID_HANDLE_VALUE)
+        return;
+
+    HotUpgradeHello const ownHello = {HOT_UPGRADE_MAGIC, HOT_UPGRADE_VERSION};
+    while(true)
+    {
+        if( ! waitForUpgradeClient(&pipe) )
+        {
+            logError("ConnectNamedPipe() failed on the hot upgrade pipe", (int)GetLastError());
+            DisconnectNamedPipe(pipe.handle);
+            Sleep(HOT_UPGRADE_RETRY_MS);
+            continue;
+        }
+
+        //nothing is paused or duplicated for a process that is not let in
+        DWORD processID = 0;
+        HANDLE newProcess = GetNamedPipeClientProcessId(pipe.handle, &processID) ? openPeerProcess(processID) : NULL;
+        if( ! newProcess )
+        {
+            DisconnectNamedPipe(pipe.handle);
+            continue;
+        }
+
+        HotUpgradeHello hello;
+        if( ! recvAll(&pipe, &hello, sizeof(hello)) || hello.magic != HOT_UPGRADE_MAGIC || ! sendAll(&pipe, &ownHello, sizeof(ownHello)) )
+        {
+            logWarn("process %lu opened the hot upgrade pipe, but it is not a build of the server", (unsigned long)processID);
+            CloseHandle(newProcess);
+            DisconnectNamedPipe(pipe.handle);
+            continue;
+        }
+
+        //the new process exits when it sees the version in ownHello
+        if(hello.version != HOT_UPGRADE_VERSION)
+        {
+            logWarn("process %lu can not take over. it is of hot upgrade version %u and this server is of version %u",
+                (unsigned long)processID, hello.version, HOT_UPGRADE_VERSION);
+            CloseHandle(newProcess);
+            DisconnectNamedPipe(pipe.handle);
+            continue;
+        }
+
+        s_exitCode = handOver(&pipe, processID);
+        CloseHandle(newProcess);
+        CloseHandle(pipe.handle);
+        CloseHandle(pipe.event);
+        SetEvent(s_finishedEvent);
+        return;
+    }
+}
+
+int hotUpgradeFinish(void)
+{
+    WaitForSingleObject(s_finishedEvent, INFINITE);
+    return s_exitCode;
+}
+
+//the new process makes its own socket out of what WSADuplicateSocket() made for it. INVALID_SOCKET if it can not
+static SOCKET makeSocket(WSAPROTOCOL_INFOA* info)
+{
+    //the same flags as the listen socket (see createListenSocket() in connectionsAcceptor.c)
+    DWORD const socketFlags = g_serverConfig.registeredIO ? (WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO) : WSA_FLAG_OVERLAPPED;
+    SOCKET const sock = WSASocketA(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, info, 0, socketFlags);
+    if(sock == INVALID_SOCKET)
+        logError("WSASocket() failed to make a socket the old process handed over", WSAGetLastError());
+
+    return sock;
+}
+
+//Find the records in what receiveRecords() got, and make the sockets of the listen socket and every connection.
+//Returns NULL if the server record is missing
+static HotUpgrade* parseRecords(HotUpgradeBuffer* records)
+{
+    HotUpgrade* upgrade = calloc(1, sizeof(HotUpgrade));
+    if( ! upgrade )
+    {
+        logError("calloc failed to allocate a hot upgrade", 0);
+        exit(0);
+    }
+
+    upgrade->records = records->data;
+    upgrade->listenSocket = INVALID_SOCKET;
+    upgrade->games = calloc(records->numOfGames + 1, sizeof(HotUpgradeGame*));
+    upgrade->connections = calloc(records->numOfConnections + 1, sizeof(HotUpgradeConnection*));
+    if( ! upgrade->games || ! upgrade->connections )
+    {
+        logError("calloc failed to allocate the records of a hot upgrade", 0);
+        exit(0);
+    }
+
+    bool hasServer = false;
+    size_t numOfMalformed = 0;
+    for(size_t offset = 0; offset < records->size;)
+    {
+        HotUpgradeRecordHeader header;
+        memcpy(&header, records->data + offset, sizeof(header));
+        char* payload = records->data + offset + sizeof(header);
+        offset += sizeof(header) + header.size;
+
+        if(header.type == HOT_UPGRADE_SERVER && header.size >= sizeof(HotUpgradeServer))
+        {
+            memcpy(&upgrade->server, payload, sizeof(HotUpgradeServer));
+            hasServer = true;
+        }
+        else if(header.type == HOT_UPGRADE_LISTEN_SOCKET && header.size >= sizeof(WSAPROTOCOL_INFOA))
+        {
+            upgrade->listenSocket = makeSocket((WSAPROTOCOL_INFOA*)payload);
+        }
+        else if(header.type == HOT_UPGRADE_GAME && header.size >= sizeof(HotUpgradeGame))
+        {
+            HotUpgradeGame* game = (HotUpgradeGame*)payload;
+            if(sizeof(*game) + game->logSize <= header.size)
+                upgrade->games[upgrade->numOfGames++] = game;
+            else
+                ++numOfMalformed;
+        }
+        else if(header.type == HOT_UPGRADE_CONNECTION && header.size >= sizeof(HotUpgradeConnection))
+        {
+            HotUpgradeConnection* connection = (HotUpgradeConnection*)payload;
+            if(connection->inSize > MESSAGE_FRAMER_CAPACITY || connection->outSize > OUT_BUFFER_CAPACITY ||
+               sizeof(*connection) + connection->inSize + connection->outSize + (size_t)connection->pendingSize > header.size)
+            {
+                ++numOfMalformed;
+                continue;
+            }
+
+            connection->socket = makeSocket(&connection->protocolInfo);
+            upgrade->connections[upgrade->numOfConnections++] = connection;
+        }
+        else
+        {
+            ++numOfMalformed;
+        }
+    }
+
+    if(numOfMalformed)
+        logWarn("%zu records the old process handed over are malformed and were skipped", numOfMalformed);
+
+    if( ! hasServer )
+    {
+        logError("the old process did not hand over the state of the server", 0);
+        if(upgrade->listenSocket != INVALID_SOCKET)
+            closesocket(upgrade->listenSocket);
+
+        hotUpgradeFree(upgrade);
+        return NULL;
+    }
+
+    return upgrade;
+}
+
+//take every record up to HOT_UPGRADE_END. returns NULL if the old process stopped sending (or sent something that is not a record)
+static HotUpgrade* receiveRecords(UpgradePipe* oldProcess)
+{
+    HotUpgradeBuffer records;
+    memset(&records, 0, sizeof(records));
+
+    while(true)
+    {
+        HotUpgradeRecordHeader header;
+        if( ! recvAll(oldProcess, &header, sizeof(header)) || header.size > HOT_UPGRADE_MAX_RECORD_SIZE || header.size % 8 )
+            break;
+
+        if(header.type == HOT_UPGRADE_END)
+            return parseRecords(&records);
+
+        if( ! recvAll(oldProcess, beginRecord(&records, (HotUpgradeRecordType)header.type, header.size), header.size) )
+            break;
+
+        records.numOfGames += (header.type == HOT_UPGRADE_GAME);
+        records.numOfConnections += (header.type == HOT_UPGRADE_CONNECTION);
+    }
+
+    logError("the old process stopped handing the server over", (int)GetLastError());
+    free(records.data);
+    return NULL;
+}
+
+//open the pipe of the running server, waiting a while if another process has it open right now
+static HANDLE openUpgradePipe(void)
+{
+    HANDLE pipe = CreateFileA(HOT_UPGRADE_PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if(pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeA(HOT_UPGRADE_PIPE_NAME, HOT_UPGRADE_TIMEOUT_MS))
+        pipe = CreateFileA(HOT_UPGRADE_PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+
+    return pipe;
+}
+
+HotUpgrade* hotUpgradeTakeOver(void)
+{
+    uint64_t const startUs = getMonotonicMicroseconds();
+
+    UpgradePipe oldProcess = {openUpgradePipe(), NULL};
+    if(oldProcess.handle == INVALID_HANDLE_VALUE)
+    {
+        int const error = (int)GetLastError();
+        if(error == ERROR_FILE_NOT_FOUND)
+        {
+            logInfo("CHESS_SERVER_UPGRADE is on, but no server is running on this machine to take over from. starting empty");
+            return NULL;
+        }
+
+        //a server is running, and it keeps its ports until it exits
+        logError("could not open the hot upgrade pipe of the server that is running", error);
+        exit(EXIT_FAILURE);
+    }
+
+    //the server on the other end has to run as the same user as this process, or it could hand over whatever it wants.
+    //Its handle is opened before anything else, so its process ID can not be reused before it is waited for below
+    DWORD processID = 0;
+    HANDLE oldProcessHandle = GetNamedPipeServerProcessId(oldProcess.handle, &processID) ? openPeerProcess(processID) : NULL;
+    oldProcess.event = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if( ! oldProcessHandle || ! oldProcess.event )
+    {
+        logError("can not take over from the server that is running on this machine", (int)GetLastError());
+        exit(EXIT_FAILURE);
+    }
+
+    //the old process keeps its ports until it exits, so there is no point in starting if it does not hand over
+    HotUpgradeHello const ownHello = {HOT_UPGRADE_MAGIC, HOT_UPGRADE_VERSION};
+    HotUpgradeHello hello;
+    if( ! sendAll(&oldProcess, &ownHello, sizeof(ownHello)) || ! recvAll(&oldProcess, &hello, sizeof(hello)) || hello.magic != HOT_UPGRADE_MAGIC )
+    {
+        logError("the server running on this machine did not answer on the hot upgrade pipe", (int)GetLastError());
+        exit(EXIT_FAILURE);
+    }
+
+    if(hello.version != HOT_UPGRADE_VERSION)
+    {
+        char errMsg[256] = {0};
+        snprintf(errMsg, sizeof(errMsg), "can not take over from the server that is running. it is of hot upgrade version %u and this build is of version %u",
+            hello.version, HOT_UPGRADE_VERSION);
+        logError(errMsg, 0);
+        exit(EXIT_FAILURE);
+    }
+
+    //From here on the old process hands over and exits no matter what.
+    //If the records do not make it, the server starts like after a restart once it is gone (the games come back from the journals)
+    HotUpgrade* upgrade = receiveRecords(&oldProcess);
+
+    char const answer = 1;
+    if(upgrade && ! sendAll(&oldProcess, &answer, sizeof(answer)))
+        logWarn("could not answer the old process. it exits anyway");
+
+    CloseHandle(oldProcess.handle);
+    CloseHandle(oldProcess.event);
+
+    if(WaitForSingleObject(oldProcessHandle, HOT_UPGRADE_TIMEOUT_MS) != WAIT_OBJECT_0)
+        logError("the old process did not exit in time", 0);
+
+    CloseHandle(oldProcessHandle);
+
+    if(upgrade)
+    {
+        logInfo("took over %zu games and %zu connections from process %lu in %llu ms", upgrade->numOfGames, upgrade->numOfConnections,
+            (unsigned long)processID, (unsigned long long)((getMonotonicMicroseconds() - startUs) / 1000));
+    }
+
+    return upgrade;
+}
+
+Connection* hotUpgradeAdoptConnection(HotUpgradeConnection* record)
+{
+    SOCKET const sock = record->socket;
+    record->socket = INVALID_SOCKET;
+    if(sock == INVALID_SOCKET)
+        return NULL;
+
+    //the same as an accepted socket (see onAccepted() in connectionsAcceptor.c)
+    BOOL const noDelay = TRUE;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof(noDelay));
+
+    Connection* connection = NULL;
+    unsigned long nonBlocking = 1;
+    if(ioctlsocket(sock, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+    {
+        logError("ioctlsocket() failed to make a socket that was handed over non blocking", WSAGetLastError());
+    }
+    else if( ! admissionAdopt(record->addr.sin_addr) )
+    {
+        logWarn("the admission control table has no room for a connection that was handed over");
+    }
+    else if( ! (connection = connectionPoolAlloc(sock, &record->addr)) )
+    {
+        logWarn("the connection pool has no room for a connection that was handed over");
+        admissionRelease(record->addr.sin_addr);
+    }
+
+    if( ! connection )
+    {
+        closesocket(sock);
+        return NULL;
+    }
+
+    char const* bytes = (char const*)(record + 1);
+    memcpy(connection->in.data, bytes, record->inSize);
+    connection->in.tail = record->inSize;
+
+    memcpy(connection->out.data, bytes + record->inSize, record->outSize);
+    connection->out.tail = record->outSize;
+    connection->out.firstQueuedUs = getMonotonicMicroseconds();
+
+    return connection;
+}
+
+void hotUpgradeFree(HotUpgrade* upgrade)
+{
+    if( ! upgrade )
+        return;
+
+    size_t numOfClosed = 0;
+    for(size_t i = 0; i < upgrade->numOfConnections; ++i)
+    {
+        if(upgrade->connections[i]->socket != INVALID_SOCKET)
+        {
+            closesocket(upgrade->connections[i]->socket);
+            ++numOfClosed;
+        }
+    }
+
+    if(numOfClosed)
+        logWarn("%zu connections that were handed over had nowhere to go and were closed", numOfClosed);
+
+    free(upgrade->games);
+    free(upgrade->connections);
+    free(upgrade->records);
+    free(upgrade);
+}
@@ -0,0 +1,214 @@
+#ifndef HOT_UPGRADE_H
+#define HOT_UPGRADE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <winsock2.h>
+
+#include "idAllocator.h"
+
+//Zero downtime upgrades. A new build of the server that is started with CHESS_SERVER_UPGRADE=1 (see serverConfig.h) takes over
+//from the server that is running on the same machine: the running server hands it the listen socket, every lobby member and every
+//running game with its players and spectators, and exits. No client is disconnected, whatever they send in the meantime waits in their socket.
+//
+//Winsock has no SCM_RIGHTS, so a socket is handed over as the WSAPROTOCOL_INFO that WSADuplicateSocket() makes of it for the new process,
+//and the new process makes its own socket out of that with WSASocket(). The running server waits for the new process on the named pipe
+//HOT_UPGRADE_PIPE_NAME, which only the user the server runs as can open. The process on the other end of the pipe is checked to run as
+//that user too, and its process ID comes from the pipe and not from anything it sends (see hotUpgradeThreadStart()). Once it is let in,
+//  1 the acceptor threads stop (connections that come in from then on wait in the backlog of the listen socket)
+//  2 the lobby threads stop handing players to the game workers (see lobbyPause())
+//  3 every game worker writes down its games, players and spectators and ends (see gameManagerHandOver())
+//  4 the lobby threads write down their members, along with the players who came back from a game in the meantime, and end
+//and all of it goes to the new process as one stream of records. The new process makes every socket, answers and waits for the old one
+//to exit (which lets go of the ports and the game journals). Then it starts the way it would after a restart, except that the games,
+//the lobby and the listen socket come from the records (see hotUpgradeTakeOver()).
+//
+//A connection's record has everything it needs to go on where it was: what it sent that is not a whole message yet, what was queued for it,
+//and its ID, pair request and place in the matchmaking queue in the lobby, its seat in its game, or what it did not get yet of the game it watches.
+//A game's record has its resume tokens and spectate ID, and its log (see ChessGame::log in gameManager.c), which the new process plays back
+//the same way it plays back a game of the journals.
+
+#define HOT_UPGRADE_PIPE_NAME "\\\\.\\pipe\\chessServerHotUpgrade"
+#define HOT_UPGRADE_STACKSIZE 64000
+
+//has to be bumped whenever a record changes, a server only hands over to a build with the same version
+#define HOT_UPGRADE_MAGIC 0x50554843u
+#define HOT_UPGRADE_VERSION 2
+
+//how long a game worker waits for what Registered I/O has in flight before it hands its games over anyway (see gameManagerHandOver())
+#define HOT_UPGRADE_DRAIN_MS 1000
+
+//how long either process waits for the other one (to send the records or answer them, and to exit)
+#define HOT_UPGRADE_TIMEOUT_MS 10000
+
+//what the two processes send each other first
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+}HotUpgradeHello;
+
+typedef enum
+{
+    HOT_UPGRADE_SERVER = 1,//HotUpgradeServer
+    HOT_UPGRADE_LISTEN_SOCKET,//the WSAPROTOCOL_INFOA of the listen socket
+    HOT_UPGRADE_GAME,//HotUpgradeGame
+    HOT_UPGRADE_CONNECTION,//HotUpgradeConnection
+    HOT_UPGRADE_END//the last record. no payload
+}HotUpgradeRecordType;
+
+//every record starts with this. size is the size of the payload after it, which is padded to a multiple of 8 bytes
+typedef struct
+{
+    uint32_t type;
+    uint32_t size;
+}HotUpgradeRecordHeader;
+
+typedef struct
+{
+    IdAllocatorState ids;
+}HotUpgradeServer;
+
+//followed by logSize bytes of the game's log
+typedef struct
+{
+    uint64_t gameID;
+    uint64_t resumeTokens[2];
+    uint32_t spectateID;
+    uint32_t logSize;
+
+    //how far into the log each player got while they are still catching up after they came back
+    uint32_t replayOffsets[2];
+    uint8_t isReplaying[2];
+
+    //players[i] was connected (their connection is handed over too, unless it could not be), or has been away for awayMs[i]
+    uint8_t isConnected[2];
+    uint32_t awayMs[2];
+
+    //the sides now and at PAIRING_COMPLETE_MSGTYPE. a resumable game gets its sides now from playing back its log
+    uint8_t sides[2];
+    uint8_t startSides[2];
+    uint8_t isResumable;
+}HotUpgradeGame;
+
+typedef enum
+{
+    HOT_UPGRADE_LOBBY_MEMBER = 1,
+    HOT_UPGRADE_PLAYER,
+    HOT_UPGRADE_SPECTATOR
+}HotUpgradeRole;
+
+//followed by inSize bytes that were received and are not a whole message yet, outSize bytes that were queued,
+//and pendingSize bytes a spectator did not get yet of the feed of their game
+typedef struct
+{
+    //from WSADuplicateSocket() for the new process, which puts the socket it made of it in socket
+    WSAPROTOCOL_INFOA protocolInfo;
+    SOCKET socket;
+
+    SOCKADDR_IN addr;
+    uint8_t role;//HotUpgradeRole
+
+    //a player is players[playerIndex] of the game gameID. a spectator watches the game gameID, which is 0 if it ended
+    //(they still get the rest of it before they go back to the lobby)
+    uint8_t playerIndex;
+    uint64_t gameID;
+
+    //a lobby member. a pair request is outstanding for pairRequestMsLeft more ms if hasPairRequest is set,
+    //and a member in the matchmaking queue has waited in it for matchmakingWaitedMs
+    uint32_t uniqueID;
+    uint32_t pairRequestTargetID;
+    uint32_t pairRequestMsLeft;
+    uint8_t hasPairRequest;
+    uint8_t isPairRequestDeclined;
+    uint8_t isMatchmaking;
+    uint16_t rating;
+    uint32_t matchmakingWaitedMs;
+
+    uint16_t inSize;
+    uint16_t outSize;
+    uint32_t pendingSize;
+}HotUpgradeConnection;
+
+static inline char const* hotUpgradeGameLog(HotUpgradeGame const* game)
+{
+    return (char const*)(game + 1);
+}
+
+static inline char const* hotUpgradePendingBytes(HotUpgradeConnection const* connection)
+{
+    return (char const*)(connection + 1) + connection->inSize + connection->outSize;
+}
+
+//Where the records are written while the running server is being handed over. Every game worker writes into one of its own,
+//which are appended to the rest once they are done. Exits if it can not grow
+typedef struct
+{
+    char* data;
+    size_t size;
+    size_t capacity;
+
+    size_t numOfGames;
+    size_t numOfConnections;
+}HotUpgradeBuffer;
+
+//Everything the running server handed over, as the new process has it. Every record is in records,
+//which games and connections point into
+typedef struct
+{
+    HotUpgradeServer server;
+
+    //INVALID_SOCKET if the listen socket could not be made
+    SOCKET listenSocket;
+
+    HotUpgradeGame** games;
+    size_t numOfGames;
+
+    //the socket of a connection that could not be made is INVALID_SOCKET
+    HotUpgradeConnection** connections;
+    size_t numOfConnections;
+
+    char* records;
+}HotUpgrade;
+
+struct Connection;
+
+//The side of the running server
+
+//The start of the thread that waits for a new build of the server on HOT_UPGRADE_PIPE_NAME and hands the server over to it.
+//Start it once everything else runs. The lobby threads end once they were handed over, then main() calls hotUpgradeFinish()
+void __stdcall hotUpgradeThreadStart(void* arg);
+
+//Blocks until the new process took everything over (or failed to), and returns the exit code of the server
+int hotUpgradeFinish(void);
+
+void hotUpgradeWriteGame(HotUpgradeBuffer* buffer, HotUpgradeGame const* game, char const* log);
+
+//Write the record of connection, with what it received and what is queued for it, and its socket duplicated for the new process.
+//The caller fills in everything else of record (pendingSize and pending are what a spectator did not get yet, or 0 and NULL).
+//The socket stays open here until the process exits. Returns false (and logs why) if it could not be duplicated
+bool hotUpgradeWriteConnection(HotUpgradeBuffer* buffer, HotUpgradeConnection* record, struct Connection const* connection, char const* pending);
+
+//returns false if the socket could not be duplicated
+bool hotUpgradeWriteListenSocket(HotUpgradeBuffer* buffer, SOCKET listenSocket);
+
+//append what another buffer has (and free it)
+void hotUpgradeAppendBuffer(HotUpgradeBuffer* buffer, HotUpgradeBuffer* other);
+
+//The side of the new process
+
+//Called by main() if g_serverConfig.upgrade is on, after WSAStartup(). Opens the pipe of the running server, takes the records and the sockets
+//it hands over, and waits for it to exit. Returns NULL (and logs why) if no server is running or it could not be taken over,
+//in which case the server starts empty. Exits if the running server is of a different HOT_UPGRADE_VERSION or runs as another user
+HotUpgrade* hotUpgradeTakeOver(void);
+
+//Make a connection of the pool out of a connection record, with what it had received and what was queued for it. It counts towards
+//its address in admission control, and owns the record's socket from now on. Returns NULL if the pool has no room for it
+//(or the socket could not be made)
+struct Connection* hotUpgradeAdoptConnection(HotUpgradeConnection* record);
+
+//close the sockets of the connections that were not adopted and free upgrade (which can be NULL). the listen socket is left alone
+void hotUpgradeFree(HotUpgrade* upgrade);
+
+#endif //HOT_UPGRADE_H
@@ -0,0 +1,173 @@
+#define _CRT_RAND_S
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "idAllocator.h"
+#include "connectionIndex.h"
+#include "errorLogger.h"
+
+#define NUM_OF_FEISTEL_ROUNDS ID_ALLOCATOR_NUM_OF_KEYS
+
+//how many released IDs are remembered for reuse. it has to be a power of 2.
+//IDs released while this is full are just never handed out again
+#define RECYCLE_RING_CAPACITY 4096
+
+//one slot of the bounded multi producer multi consumer recycle ring.
+//sequence tells producers and consumers whose turn it is to use the slot
+typedef struct
+{
+    volatile LONG64 sequence;
+    uint32_t id;
+}RecycleSlot;
+
+static uint32_t s_roundKeys[NUM_OF_FEISTEL_ROUNDS];
+
+//the number of IDs drawn from the permutation so far. once this passes 2^32
+//every ID has been issued once, and only released IDs can be handed out
+static volatile LONG64 s_counter = 0;
+
+static RecycleSlot s_recycleRing[RECYCLE_RING_CAPACITY];
+static volatile LONG64 s_recycleHead = 0;//next slot to pop
+static volatile LONG64 s_recycleTail = 0;//next slot to push
+
+//The round function of the feistel network. It does not need to be invertible for the
+//network to be a permutation, it just has to mix the key and the half block well.
+static uint32_t feistelRound(uint32_t halfBlock, uint32_t key)
+{
+    uint32_t x = (halfBlock ^ key) * 0x9E3779B1u;
+    x ^= x >> 15;
+    x *= 0x85EBCA77u;
+    x ^= x >> 13;
+    return x & 0xFFFF;
+}
+
+//a keyed bijection of the 32 bit space. distinct counters always give distinct IDs
+static uint32_t permute(uint32_t counter)
+{
+    uint32_t left = counter >> 16;
+    uint32_t right = counter & 0xFFFF;
+
+    for(int i = 0; i < NUM_OF_FEISTEL_ROUNDS; ++i)
+    {
+        uint32_t const newRight = left ^ feistelRound(right, s_roundKeys[i]);
+        left = right;
+        right = newRight;
+    }
+
+    return (left << 16) | right;
+}
+
+static bool recyclePush(uint32_t id)
+{
+    LONG64 pos = s_recycleTail;
+    while(true)
+    {
+        RecycleSlot* slot = s_recycleRing + (pos & (RECYCLE_RING_CAPACITY - 1));
+        LONG64 const diff = ReadAcquire64(&slot->sequence) - pos;
+
+        if(diff == 0)
+        {
+            LONG64 const prevPos = InterlockedCompareExchange64(&s_recycleTail, pos + 1, pos);
+            if(prevPos == pos)
+            {
+                slot->id = id;
+                WriteRelease64(&slot->sequence, pos + 1);
+                return true;
+            }
+            pos = prevPos;
+        }
+        else if(diff < 0) return false;//full
+        else pos = s_recycleTail;
+    }
+}
+
+static bool recyclePop(uint32_t* idOut)
+{
+    LONG64 pos = s_recycleHead;
+    while(true)
+    {
+        RecycleSlot* slot = s_recycleRing + (pos & (RECYCLE_RING_CAPACITY - 1));
+        LONG64 const diff = ReadAcquire64(&slot->sequence) - (pos + 1);
+
+        if(diff == 0)
+        {
+            LONG64 const prevPos = InterlockedCompareExchange64(&s_recycleHead, pos + 1, pos);
+            if(prevPos == pos)
+            {
+                *idOut = slot->id;
+                WriteRelease64(&slot->sequence, pos + RECYCLE_RING_CAPACITY);
+                return true;
+            }
+            pos = prevPos;
+        }
+        else if(diff < 0) return false;//empty
+        else pos = s_recycleHead;
+    }
+}
+
+bool idAllocatorInit(void)
+{
+    for(int i = 0; i < NUM_OF_FEISTEL_ROUNDS; ++i)
+    {
+        unsigned int key = 0;
+        if(rand_s(&key))
+        {
+            logError("rand_s() failed to generate a key for the ID allocator", 0);
+            return false;
+        }
+        s_roundKeys[i] = key;
+    }
+
+    for(LONG64 i = 0; i < RECYCLE_RING_CAPACITY; ++i)
+        s_recycleRing[i].sequence = i;
+
+    return true;
+}
+
+uint32_t idAllocatorAcquire(void)
+{
+    while(true)
+    {
+        LONG64 const counter = InterlockedIncrement64(&s_counter) - 1;
+
+        if(counter <= UINT32_MAX)
+        {
+            //the permutation hits each reserved ID exactly once, so this loops at most twice in total
+            uint32_t const id = permute((uint32_t)counter);
+            if(id != CONNECTION_INDEX_EMPTY_KEY && id != CONNECTION_INDEX_TOMBSTONE_KEY)
+                return id;
+        }
+        else
+        {
+            uint32_t id = 0;
+            if(recyclePop(&id))
+                return id;
+
+            //every ID is in use, which would take 4 billion players, so this should never happen
+            logError("the ID allocator ran out of IDs", 0);
+            Sleep(1);
+        }
+    }
+}
+
+void idAllocatorRelease(uint32_t id)
+{
+    assert(id != CONNECTION_INDEX_EMPTY_KEY && id != CONNECTION_INDEX_TOMBSTONE_KEY);
+    recyclePush(id);
+}
+
+void idAllocatorSave(IdAllocatorState* state)
+{
+    memcpy(state->roundKeys, s_roundKeys, sizeof(s_roundKeys));
+    state->counter = (uint64_t)ReadAcquire64(&s_counter);
+}
+
+void idAllocatorRestore(IdAllocatorState const* state)
+{
+    memcpy(s_roundKeys, state->roundKeys, sizeof(s_roundKeys));
+    s_counter = (LONG64)state->counter;
+}
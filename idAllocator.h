@@ -0,0 +1,36 @@
+#ifndef ID_ALLOCATOR_H
+#define ID_ALLOCATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//the key of the permutation and how far into it the allocator is (see idAllocatorSave())
+#define ID_ALLOCATOR_NUM_OF_KEYS 8
+typedef struct
+{
+    uint32_t roundKeys[ID_ALLOCATOR_NUM_OF_KEYS];
+    uint64_t counter;
+}IdAllocatorState;
+
+//Hands out the uniqueIDs ("friend codes") of players in O(1) without ever handing out an ID that is in use.
+//IDs are a keyed permutation of a counter, so the first 2^32 IDs never collide, but
+//consecutive IDs look random to anyone who does not know the key (which is drawn from rand_s() at startup).
+//Every function is thread safe and lock free, so lobbyInsert() never waits on another thread for an ID.
+//0 and UINT32_MAX are never handed out (connectionIndex.h reserves them).
+
+//returns false if a random key could not be generated
+bool idAllocatorInit(void);
+
+uint32_t idAllocatorAcquire(void);
+
+//Give an ID back when its connection leaves the lobby. Released IDs are only handed out again
+//once every ID in the 32 bit space has been issued once, which keeps recently closed IDs from being reused.
+void idAllocatorRelease(uint32_t id);
+
+//A new build of the server that takes over from a running one (see hotUpgrade.h) goes on with the running server's permutation,
+//so the IDs of the lobby members it takes over are never handed out again. The released IDs waiting to be reused are not carried over.
+//idAllocatorRestore() has to be called after idAllocatorInit() and before any ID is acquired
+void idAllocatorSave(IdAllocatorState* state);
+void idAllocatorRestore(IdAllocatorState const* state);
+
+#endif //ID_ALLOCATOR_H
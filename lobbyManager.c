@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <limits.h>
+#include <stddef.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -17,159 +19,658 @@
 #include "chessNetworkProtocol.h"
 #include "errorLogger.h"
 #include "networkWrite.h"
-
-//this C file is responsible for the "lobby" thread. the lobby is like a waiting room where
+#include "wakeupSocket.h"
+#include "connectionIndex.h"
+#include "idAllocator.h"
+#include "metrics.h"
+#include "serverConfig.h"
+#include "admissionControl.h"
+#include "timerWheel.h"
+#include "matchmaking.h"
+#include "hotUpgrade.h"
+
+//this C file is responsible for the "lobby" threads. the lobby is like a waiting room where
 //players are connected to the server, but waiting for a request (or server waiting for them to make request)
-//to be paired with another lobby member and play chess, at which point a new thread will
-//start to manage the chess game. there is only one single lobby manager thread that sleeps when no one is connected
-//and manages all players in the lobby. there might be multiple lobby manager threads in the future if I decide to change it
-
-static LobbyConnection* s_lobbyConnections = NULL;
-static size_t s_numOfLobbyConnections = 0;
-
-CRITICAL_SECTION g_lobbyMutex;
+//to be paired with another lobby member and play chess, at which point they are handed
+//to one of the game worker threads (see gameManager.c).
+//The lobby is split into g_serverConfig.lobbyThreads shards with one thread each. A player is a member of the shard their uniqueID
+//hashes to (see homeShardOf()), so a friend code is enough to know which shard to ask for them. Each lobby thread blocks in WSAPoll()
+//until a member of its shard sends something or it gets mail, so it uses no cpu when its shard is idle.
+//Only a shard's own thread touches its arrays, index and timers. The acceptor threads, the game workers and the other shards
+//hand it connections and messages through its lock free inbox (see postLobbyMail()), so there is no lobby lock at all.
+//
+//Whatever a member does to a member of another shard goes through the inboxes:
+//  PAIR_REQUEST_MSGTYPE and PAIR_DECLINE_MSGTYPE are passed on to the shard of whoever they are for, which answers with
+//  a mail of its own if that player is not there (see LobbyMailType)
+//  a member who sends PAIR_ACCEPT_MSGTYPE moves to the shard of the requester, which starts their game (or sends them back home)
+//  a member who sends FIND_GAME_MSGTYPE moves to the matchmaking shard, which has the one matchmaking queue. they stay there
+//  until they leave the lobby, and their home shard passes on whatever comes in for them
+#define MATCHMAKING_SHARD 0
+
+//the index grows along with the shard, so it starts small
+#define LOBBY_INDEX_INITIAL_CAPACITY 1024
+
+//The uniqueIDs of lobby members with bytes queued in their OutBuffer (or who have to be disconnected), so that
+//the end of a lobby loop iteration only has to look at them. IDs of connections that left the shard in the meantime are just skipped.
+//Connection::isFlushScheduled keeps a member from being in the list more than once, so the list never holds more
+//than the shard's members plus the ones that left during one iteration.
+#define FLUSH_LIST_CAPACITY (2 * s_lobbyArrayCapacity)
+
+//What a shard gets in its inbox
+typedef enum
+{
+    //These carry a connection, which the shard owns from then on. A connection is only ever in one place,
+    //so there is a slot for every one of them (see LobbyShard::inbox)
+    LOBBY_MAIL_NEW_MEMBER,//lobbyInsert() put the connection into the lobby. its uniqueID was acquired already
+    LOBBY_MAIL_REJOIN,//a member who went to another shard to be paired comes back with their ID (and whatever was queued for them there)
+    LOBBY_MAIL_FIND_GAME,//a member sent FIND_GAME_MSGTYPE and comes to the matchmaking shard, with their rating in their matchmakingNode
+    LOBBY_MAIL_PAIR_ACCEPT,//a member accepted the pair request of memberID and comes to their shard
+
+    //These only carry IDs. An inbox holds at most LOBBY_MAX_ID_MAILS of them, one that does not fit is dropped
+    LOBBY_MAIL_PAIR_REQUEST,//otherID sent memberID a pair request
+    LOBBY_MAIL_PAIR_DECLINE,//otherID declined the pair request of memberID
+    LOBBY_MAIL_PAIR_REQUEST_FAILED,//the pair request memberID sent to otherID did not find them in the lobby
+    LOBBY_MAIL_NOT_IN_LOBBY//memberID answered a pair request of otherID, who is not in the lobby (or is not waiting on memberID)
+}LobbyMailType;
+
+#define LOBBY_MAX_ID_MAILS 4096
+
+//A bounded multi producer single consumer ring like the ID allocator's recycle ring (see idAllocator.c)
+typedef struct
+{
+    volatile LONG64 sequence;
+    ConnectionHandle handle;//CONNECTION_HANDLE_NONE for the mail that only carries IDs
+    uint32_t memberID;
+    uint32_t otherID;
+    uint32_t type;//LobbyMailType
+}LobbyInboxSlot;
+
+typedef struct
+{
+    //The members. The connections themselves are in the connection pool (see connectionPool.h) and never move,
+    //so removing a member only moves the last pointer (and poll set registration) into its place.
+    //There is room for every connection in the pool, since any of them can end up in the matchmaking shard.
+    Connection** connections;
+    size_t numOfConnections;
+
+    //The WSAPoll() set of the shard's thread. pollFds[0] is the wakeup socket and pollFds[i + 1] is the registration
+    //for connections[i]. Both arrays are kept in sync by addLobbyMember() and removeLobbyMember()
+    //so the set never has to be rebuilt before a WSAPoll() call.
+    WSAPOLLFD* pollFds;
+
+    //maps the uniqueID of every member to the ConnectionHandle of their connection
+    ConnectionIndex index;
+
+    //see FLUSH_LIST_CAPACITY
+    uint32_t* pendingFlushIDs;
+    size_t numOfPendingFlushIDs;
+
+    //Where everyone else puts mail for the shard (see postLobbyMail()). It has room for every connection the pool can hold
+    //plus LOBBY_MAX_ID_MAILS, so the mail that carries a connection never has to wait. Only the shard's thread pops,
+    //in takeLobbyMail(), so nothing but the ring's tail is ever contended.
+    LobbyInboxSlot* inbox;
+    volatile LONG64 inboxTail;
+    LONG64 inboxHead;
+    volatile LONG numOfIDMails;
+
+    //signaled by postLobbyMail() so the shard's thread takes the mail out of the inbox if it is blocked in WSAPoll()
+    WakeupSocket wakeup;
+
+    //the Connection::pairRequestTimer of every member with an outstanding pair request (and the matchmaking timer). on the getLobbyNowMs() clock
+    TimerWheel timers;
+
+    //The players who sent a FIND_GAME_MSGTYPE, only used by the matchmaking shard. They are paired in batches, every MATCHMAKING_TICK_MS
+    //while at least two are waiting. Matched players go straight to a game worker, their Connections come out of the queue itself
+    //so nothing is looked up by ID.
+    Matchmaker matchmaker;
+    TimerNode matchmakingTimer;
+
+    //the steps of a hot upgrade, see lobbyPause() and handOverLobby()
+    HANDLE pausedEvent;
+    HANDLE handOverEvent;
+    HANDLE handedOverEvent;
+}LobbyShard;
+
+static LobbyShard* s_lobbyShards = NULL;
+static size_t s_numOfLobbyShards = 0;
+
+//how many connections the arrays of every shard have room for, and the size of every inbox (a power of 2)
+static size_t s_lobbyArrayCapacity = 0;
+static size_t s_inboxCapacity = 0;
+
+//lobby members (and the ones on their way from one shard to another) plus reserved places plus connections in the inboxes.
+//the capacity check of the acceptor threads
+static volatile LONG64 s_lobbySize = 0;
+
+//How long a lobby member has to answer a PAIR_REQUEST_MSGTYPE, and how long the member who sent it has to wait
+//before they can send another one (see PAIR_NORESPONSE_MSGTYPE and PAIR_REQUEST_TOO_SOON_MSGTYPE in chessNetworkProtocol.h).
+//Has to be the same as in the client.
+#define PAIR_REQUEST_TIMEOUT_SECS 10
+
+#define MATCHMAKING_TICK_MS 100
+
+//Set by lobbyPause() when the server is handed over to a new process (see hotUpgrade.h). Every lobby thread stops right after its
+//next WSAPoll() and sets its pausedEvent, so it does not hand anyone to a game worker while they are being handed over.
+//Then lobbyHandOver() gives them s_handOverBuffer and sets their handOverEvent one after the other, and each lobby thread
+//writes its members into it, sets its handedOverEvent and ends
+static volatile LONG s_isHandingOver = 0;
+static HotUpgradeBuffer* s_handOverBuffer = NULL;
+
+static uint64_t getLobbyNowMs(void)
+{
+    return getMonotonicMicroseconds() / 1000;
+}
 
-//sleep on this if the lobby is empty so the lobby thread doesnt do any busy waiting
-CONDITION_VARIABLE g_lobbyEmptyCond;
+bool lobbyReserveRoom(void)
+{
+    if((size_t)InterlockedIncrement64(&s_lobbySize) <= g_serverConfig.lobbyCapacity)
+        return true;
 
-//sleep on this when calling sendToGameManager()
-//until the game manager thread has grabbed the info it needs and the lobby can proceed
-CONDITION_VARIABLE g_gameManagerIsReadyCond;
-extern bool g_gameConstructionInProgress;//bool for lobby to wait on with the above CV
+    InterlockedDecrement64(&s_lobbySize);
+    return false;
+}
 
-//get how much room is left in the lobby.
-size_t getAvailableLobbyRoom(void)
+void lobbyCancelReservation(void)
 {
-    EnterCriticalSection(&g_lobbyMutex);
-    size_t availableLobbyRoom = LOBBY_CAPACITY - s_numOfLobbyConnections;
-    LeaveCriticalSection(&g_lobbyMutex);
-    return availableLobbyRoom;
+    InterlockedDecrement64(&s_lobbySize);
 }
 
-//lock g_lobbyMutex before calling
-bool isLobbyEmpty(void)
+size_t getLobbyBytesPerConnection(void)
 {
-    EnterCriticalSection(&g_lobbyMutex);
-    bool isTheLobbyEmpty = 0 == s_numOfLobbyConnections;
-    LeaveCriticalSection(&g_lobbyMutex);
-    return isTheLobbyEmpty;
+    //the connections, pollFds, the flush list and the inbox (which is rounded up to a power of 2) of every shard
+    return (sizeof(Connection*) + sizeof(WSAPOLLFD) + 2 * sizeof(uint32_t) + 2 * sizeof(LobbyInboxSlot)) * g_serverConfig.lobbyThreads;
 }
 
-//This function is called after g_lobbyMutex is locked.
-static void lobbyConnectionCtor(LobbyConnection* const newConn, 
-    SOCKET const sock, struct sockaddr_in* addr)
+size_t getLobbySize(void)
 {
-    memset(newConn->msgBuff, 0, sizeof newConn->msgBuff);
-    newConn->msgBuffCurrentSize = 0;
+    LONG64 const lobbySize = ReadNoFence64(&s_lobbySize);
+    return lobbySize > 0 ? (size_t)lobbySize : 0;
+}
 
-    newConn->socket = sock;
-    memcpy(&newConn->addr, addr, sizeof(*addr));
-    InetNtopA(addr->sin_family, &addr->sin_addr, newConn->ipStr, INET6_ADDRSTRLEN);
+//The shard a player with uniqueID is a member of, unless they are matchmaking. The IDs already look random (see idAllocator.h),
+//the multiply just spreads them evenly over any number of shards
+static LobbyShard* homeShardOf(uint32_t const uniqueID)
+{
+    uint32_t const hash = uniqueID * 2654435761u;
+    return s_lobbyShards + (((uint64_t)hash * s_numOfLobbyShards) >> 32);
+}
 
-    uint32_t newID = (uint32_t)rand();
+//Lock free. Put mail into the inbox of shard and wake its thread up if it is blocked in WSAPoll().
+//handle is the connection the mail carries (see LobbyMailType), which shard owns as soon as it is in the inbox.
+//Returns false if the mail only carries IDs and the inbox already has LOBBY_MAX_ID_MAILS of those
+static bool postLobbyMail(LobbyShard* shard, LobbyMailType const type, ConnectionHandle const handle,
+    uint32_t const memberID, uint32_t const otherID)
+{
+    if(handle == CONNECTION_HANDLE_NONE && InterlockedIncrement(&shard->numOfIDMails) > LOBBY_MAX_ID_MAILS)
+    {
+        InterlockedDecrement(&shard->numOfIDMails);
+        return false;
+    }
 
-    //Check to make sure the new ID is unique. For now just does a linear search over every connection.
-    //This is fine because I dont plan on more than a few people ever being in the server at 1 time.
-    //In the future maybe I will make some type of self balancing bin search tree like a red black tree
-    //to store the connections so that this search will be log2(n).
-    for(int i = 0; i < s_numOfLobbyConnections; ++i)
+    LONG64 pos = shard->inboxTail;
+    while(true)
     {
-        //Make sure the new ID has not been taken yet.
-        if(newID == s_lobbyConnections[i].uniqueID)
+        LobbyInboxSlot* slot = shard->inbox + (pos & (s_inboxCapacity - 1));
+        LONG64 const diff = ReadAcquire64(&slot->sequence) - pos;
+
+        if(diff == 0)
         {
-            newID = (uint32_t)rand();
-            i = -1;//restart the loop
+            LONG64 const prevPos = InterlockedCompareExchange64(&shard->inboxTail, pos + 1, pos);
+            if(prevPos == pos)
+            {
+                slot->handle = handle;
+                slot->memberID = memberID;
+                slot->otherID = otherID;
+                slot->type = (uint32_t)type;
+                WriteRelease64(&slot->sequence, pos + 1);
+                break;
+            }
+            pos = prevPos;
+        }
+        else
+        {
+            assert(diff > 0);//full, which can not happen (see LobbyShard::inbox)
+            pos = shard->inboxTail;
         }
     }
 
-    newConn->uniqueID = newID;
+    signalWakeupSocket(&shard->wakeup);
+    return true;
+}
+
+//make sure flushLobbyConnections() looks at connection at the end of this lobby loop iteration
+static void scheduleLobbyFlush(LobbyShard* shard, Connection* connection)
+{
+    if(connection->isFlushScheduled) 
+        return;
+
+    assert(shard->numOfPendingFlushIDs < FLUSH_LIST_CAPACITY);
+    shard->pendingFlushIDs[shard->numOfPendingFlushIDs++] = connection->uniqueID;
+    connection->isFlushScheduled = true;
+}
+
+//Make connection a member of shard, with the uniqueID it has. It goes at the end of the shard's array and WSAPoll() set.
+//A pair request it sent before it came here goes on, and whatever is queued for it is sent at the end of this lobby loop iteration
+static void addLobbyMember(LobbyShard* shard, Connection* connection)
+{
+    assert(shard->numOfConnections < s_lobbyArrayCapacity);
+
+    //the allocator never hands out an ID that is in use, and a member is only ever in one shard, so the insert can not fail
+    bool const wasInserted = connectionIndexInsert(&shard->index, connection->uniqueID, (uint32_t)connection->handle);
+    assert(wasInserted);
+    (void)wasInserted;
+
+    connection->isFlushScheduled = false;
+    connection->lobbyIndex = (uint32_t)shard->numOfConnections;
+    shard->connections[shard->numOfConnections] = connection;
+
+    WSAPOLLFD* pollFd = shard->pollFds + shard->numOfConnections + 1;
+    pollFd->fd = connection->socket;
+    pollFd->events = POLLRDNORM;
+    pollFd->revents = 0;
+
+    ++shard->numOfConnections;
+
+    //removeLobbyMember() keeps the deadline of the request
+    if(connection->pairRequestTargetID)
+        timerWheelSchedule(&shard->timers, &connection->pairRequestTimer, connection->pairRequestTimer.deadlineTick * TIMER_WHEEL_TICK_MS);
+
+    if( ! outBufferIsEmpty(&connection->out) || connection->isDisconnecting )
+        scheduleLobbyFlush(shard, connection);
+}
+
+//Called by the lobby thread of shard for a connection that lobbyInsert() put into the lobby.
+static void lobbyConnectionCtor(LobbyShard* shard, Connection* const newConn)
+{
+    newConn->isReadPaused = false;
+    newConn->isDisconnecting = false;
+    newConn->pairRequestTargetID = 0;
+    newConn->isPairRequestDeclined = false;
+    assert( ! timerIsScheduled(&newConn->pairRequestTimer) );
+    assert( ! matchmakingNodeIsQueued(&newConn->matchmakingNode) );
 
     //send the randomly generated ID to the client so they can use it like a "friend code"
     char newIDMessage[NEW_ID_MSGSIZE] = {NEW_ID_MSGTYPE, NEW_ID_MSGSIZE};
-    uint32_t nwByteOrder_ID = (uint32_t)htonl(newID);
+    uint32_t nwByteOrder_ID = (uint32_t)htonl(newConn->uniqueID);
     memcpy(newIDMessage + 2, &nwByteOrder_ID, sizeof(nwByteOrder_ID));
 
-    printf("sending a NEW_ID_MSGTYPE to %s (ID: %u)\n", newConn->ipStr, newConn->uniqueID);
-    networkSendAll(sock, newIDMessage, sizeof newIDMessage);
+    logDebug("sending a NEW_ID_MSGTYPE to %s (ID: %u)", newConn->ipStr, newConn->uniqueID);
+    if(networkQueueSend(newConn->socket, &newConn->out, newIDMessage, sizeof newIDMessage) == SOCKET_ERROR)
+        newConn->isDisconnecting = true;
+
+    //sent (along with whatever a game left queued) at the end of this lobby loop iteration
+    addLobbyMember(shard, newConn);
 }
 
-void lobbyInsert(SOCKET const sock, SOCKADDR_IN* addr)
+void lobbyInsert(ConnectionHandle const handle, bool const hasReservedRoom)
 {
-    EnterCriticalSection(&g_lobbyMutex);
+    assert(s_lobbyShards);//assert that lobbyManagerInit() has been called
+    Connection* connection = connectionPoolGet(handle);
+    assert(connection);//the caller owns the connection, so their handle can not be stale
 
-    assert(s_lobbyConnections);//assert that the lobby thread has been initialized
-    lobbyConnectionCtor(s_lobbyConnections + s_numOfLobbyConnections, sock, addr);
-    ++s_numOfLobbyConnections;
+    //the lobby thread of its shard owns the connection as soon as the handle is in the inbox
+    connectionSetState(connection, CONNECTION_IN_LOBBY);
 
-    LeaveCriticalSection(&g_lobbyMutex);
+    if( ! hasReservedRoom )
+        InterlockedIncrement64(&s_lobbySize);
+
+    //the ID says which shard the connection goes to, so it is acquired here (lock free as well) instead of by the shard
+    connection->uniqueID = idAllocatorAcquire();
+    postLobbyMail(homeShardOf(connection->uniqueID), LOBBY_MAIL_NEW_MEMBER, handle, 0, 0);
 }
 
+//Take client out of shard without letting go of their ID (they are going to another shard or to a game worker).
+//Their pair request timer is cancelled, but keeps its deadline for addLobbyMember().
 //also shrinks the lobby range on this loop iteration if necessary
-static void closeLobbyConnection(LobbyConnection* client, 
+static void removeLobbyMember(LobbyShard* shard, Connection* client, size_t* connectionRange)
+{
+    connectionIndexRemove(&shard->index, client->uniqueID);
+    timerWheelCancel(&shard->timers, &client->pairRequestTimer);
+    matchmakerRemove(&shard->matchmaker, &client->matchmakingNode);
+    
+    //if the client isnt at the end of the array, then move the member at the back of the array
+    //(and their poll set registration) into their place, otherwise just decrement the num of connections
+    size_t const clientIndex = client->lobbyIndex;
+    size_t const lastIndex = shard->numOfConnections - 1;
+    if(clientIndex != lastIndex)
+    {
+        shard->connections[clientIndex] = shard->connections[lastIndex];
+        shard->connections[clientIndex]->lobbyIndex = (uint32_t)clientIndex;
+        shard->pollFds[clientIndex + 1] = shard->pollFds[lastIndex + 1];
+    }
+
+    --shard->numOfConnections;
+
+    if(*connectionRange > shard->numOfConnections)
+        *connectionRange = shard->numOfConnections;
+}
+
+//Take client out of the lobby. If shouldCloseSock is true the socket is closed and the connection goes back to the pool,
+//otherwise the connection is being handed to a game worker.
+//also shrinks the lobby range on this loop iteration if necessary
+static void closeLobbyConnection(LobbyShard* shard, Connection* client, 
     size_t* connectionRange, bool shouldCloseSock)
 {
-    EnterCriticalSection(&g_lobbyMutex);
+    removeLobbyMember(shard, client, connectionRange);
+    idAllocatorRelease(client->uniqueID);
+    InterlockedDecrement64(&s_lobbySize);
 
-    if(shouldCloseSock) closesocket(client->socket);
-    
-    //if the client isnt at the end of the array, then just overwrite the client we are
-    //closing with the client at the back of the array, otherwise just decrement the num of lobby connections
-    LobbyConnection* clientAtBackOfArray = s_lobbyConnections + (s_numOfLobbyConnections - 1);
-    if(client != clientAtBackOfArray)
-        memcpy(client, clientAtBackOfArray, sizeof(*client));
+    //whoever they sent a pair request to can not accept it anymore, so there is nothing to time out
+    client->pairRequestTargetID = 0;
+
+    if(shouldCloseSock)
+    {
+        closesocket(client->socket);
+        admissionRelease(client->addr.sin_addr);
+        connectionPoolFree(client);
+    }
+    else
+    {
+        connectionSetState(client, CONNECTION_HANDED_OVER);
+    }
+}
 
-    --s_numOfLobbyConnections;
+//Queue a message for a lobby member. It is sent by flushLobbyConnections() at the end of this lobby loop iteration.
+static void lobbySend(LobbyShard* shard, Connection* connection, char const* msg, size_t msgSize)
+{
+    if(connection->isDisconnecting)
+        return;
 
-    if(*connectionRange > s_numOfLobbyConnections)
-        *connectionRange = s_numOfLobbyConnections;
+    if(networkQueueSend(connection->socket, &connection->out, msg, msgSize) == SOCKET_ERROR)
+    {
+        //the message handlers might still use the connection after this,
+        //so the connection is closed later by flushLobbyConnections()
+        logError("a lobby member went past their write queue limit or send() failed", WSAGetLastError());
+        connection->isDisconnecting = true;
+    }
 
-    LeaveCriticalSection(&g_lobbyMutex);
+    scheduleLobbyFlush(shard, connection);
+}
+
+//queue an ID_NOT_IN_LOBBY_MSGTYPE about the player with nwByteOrderID for a lobby member
+static void sendIDNotInLobby(LobbyShard* shard, Connection* connection, uint32_t const nwByteOrderID)
+{
+    char buff[ID_NOT_IN_LOBBY_MSGSIZE] = {ID_NOT_IN_LOBBY_MSGTYPE, ID_NOT_IN_LOBBY_MSGSIZE};
+    memcpy(buff + 2, &nwByteOrderID, sizeof(nwByteOrderID));
+    lobbySend(shard, connection, buff, sizeof buff);
+    logDebug("sending ID_NOT_IN_LOBBY_MSGTYPE to %s", connection->ipStr);
 }
 
-//Gets a client from their "friend code" (unique identifier). 
-//If no one is connected with uniqueID returns null pointer.
-static LobbyConnection* getClientByUniqueID(const uint32_t hostByteOrderUniqueID)
+//Send a member who was taken out of their shard to be paired in another one back home with msg. They keep their ID,
+//and their home shard sends msg (and whatever else is queued for them) once they are back.
+//The home shard owns member from then on (it can close them), so the caller can not touch member after this
+static void sendLobbyMemberHome(Connection* member, char const* msg, size_t msgSize)
 {
-    //For now since I dont expect more than 2-10 people to be connected at one time,
-    //I am just going to loop over every person connected to search for them.
-    //in the future I will make some kind of hash function to have O(1) 
-    //lookups in a hash table that associates the client's unique ID with where they are in memory.
-    for(int i = 0; i < s_numOfLobbyConnections; ++i)
+    if(networkQueueSend(member->socket, &member->out, msg, msgSize) == SOCKET_ERROR)
     {
-        //if the requested ID is connected to the server
-        if(hostByteOrderUniqueID == s_lobbyConnections[i].uniqueID)
-            return s_lobbyConnections + i;
+        logError("a lobby member went past their write queue limit or send() failed", WSAGetLastError());
+        member->isDisconnecting = true;
     }
-    
-    //return null pointer signifying that no one with networkByteOrderUniqueID is connected to the server.
+
+    postLobbyMail(homeShardOf(member->uniqueID), LOBBY_MAIL_REJOIN, (ConnectionHandle)member->handle, 0, 0);
+}
+
+//returns null pointer if no one is connected with uniqueID in shard
+static Connection* lookupLobbyConnection(LobbyShard* shard, const uint32_t hostByteOrderUniqueID)
+{
+    uint32_t handle = CONNECTION_HANDLE_NONE;
+    if( ! connectionIndexLookup(&shard->index, hostByteOrderUniqueID, &handle) )
+        return NULL;//no one with hostByteOrderUniqueID is in the shard
+
+    return connectionPoolGet(handle);
+}
+
+//Gets a member of shard from their "friend code" (unique identifier). 
+//If no one is connected with uniqueID in shard (or they are being disconnected) returns null pointer.
+static Connection* getClientByUniqueID(LobbyShard* shard, const uint32_t hostByteOrderUniqueID)
+{
+    Connection* client = lookupLobbyConnection(shard, hostByteOrderUniqueID);
+    return (client && ! client->isDisconnecting) ? client : NULL;
+}
+
+//Find the lobby member with uniqueID from shard. Returns them if they are a member of shard. Otherwise *askOut is the shard
+//that could have them, or null pointer if no shard could (they are not in the lobby, or are being disconnected).
+//A player is a member of their home shard, unless they went to the matchmaking shard, so a shard that gets mail for someone who is not
+//there (isMail) only passes it on to the matchmaking shard if it is their home shard. That way mail never goes around in circles.
+static Connection* findLobbyMember(LobbyShard* shard, uint32_t const uniqueID, bool const isMail, LobbyShard** askOut)
+{
+    *askOut = NULL;
+
+    Connection* member = lookupLobbyConnection(shard, uniqueID);
+    if(member)
+        return member->isDisconnecting ? NULL : member;
+
+    LobbyShard* homeShard = homeShardOf(uniqueID);
+    if(homeShard != shard)
+        *askOut = isMail ? NULL : homeShard;
+    else if(shard != s_lobbyShards + MATCHMAKING_SHARD)
+        *askOut = s_lobbyShards + MATCHMAKING_SHARD;
+
     return NULL;
 }
 
-static void sendLobbyMembersToGameManager(LobbyConnection* client1, 
-    LobbyConnection* client2, size_t* currentRange)
+//stop reading from a lobby member who does not read what is sent back to them until their queue drains,
+//and wait for POLLWRNORM while their socket is full
+static void updateLobbyPollEvents(LobbyShard* shard, Connection* connection)
 {
-    //ensure that client1 and 2 pointers are in contiguous memory here..
-    LobbyConnection* newChessPair[2] = {client1, client2};
+    WSAPOLLFD* pollFd = shard->pollFds + connection->lobbyIndex + 1;
+    bool const isReadPaused = outBufferUpdateBackpressure(&connection->out, &connection->isReadPaused);
+    pollFd->events = (isReadPaused ? 0 : POLLRDNORM) | (connection->out.isBlocked ? POLLWRNORM : 0);
+}
 
-    HANDLE newGameThread = (HANDLE)_beginthread(
-        chessGameThreadStart, GAME_MANAGER_STACKSIZE, newChessPair);
-    
-    EnterCriticalSection(&g_lobbyMutex);
+//Hand two members who were taken out of their shards (see removeLobbyMember()) to a game worker. Another lobby thread could have
+//taken the last room since isGameRoomAvailable() was checked, in which case they get a SERVER_FULL_MSGTYPE and go back home.
+//returns true if the game was started
+static bool startLobbyGame(Connection* player1, Connection* player2)
+{
+    //the game worker owns the connections as soon as startChessGame() hands them over,
+    //so they have to be handed over before that. nothing is copied, only the handles are passed on
+    uint32_t const id1 = player1->uniqueID;
+    uint32_t const id2 = player2->uniqueID;
+    ConnectionHandle const handle1 = (ConnectionHandle)player1->handle;
+    ConnectionHandle const handle2 = (ConnectionHandle)player2->handle;
+    connectionSetState(player1, CONNECTION_HANDED_OVER);
+    connectionSetState(player2, CONNECTION_HANDED_OVER);
+
+    if(startChessGame(handle1, handle2))
+    {
+        idAllocatorRelease(id1);
+        idAllocatorRelease(id2);
+        InterlockedDecrement64(&s_lobbySize);
+        InterlockedDecrement64(&s_lobbySize);
+        return true;
+    }
 
-    //dont check for spurious wake (this is temporary)
-    SleepConditionVariableCS(&g_gameManagerIsReadyCond, &g_lobbyMutex, INFINITE);
+    connectionSetState(player1, CONNECTION_IN_LOBBY);
+    connectionSetState(player2, CONNECTION_IN_LOBBY);
 
-    //now that we are awake (the game thread has started and has coppied newChessPair)
-    //we can close the lobby connections for client1 and client2
+    //logged first, the home shards own the players as soon as they are sent home
+    logWarn("every game worker filled up. sending SERVER_FULL_MSGTYPE to %s and %s", player1->ipStr, player2->ipStr);
+    char buff[SERVER_FULL_MSGSIZE] = {SERVER_FULL_MSGTYPE, SERVER_FULL_MSGSIZE};
+    sendLobbyMemberHome(player1, buff, sizeof buff);
+    sendLobbyMemberHome(player2, buff, sizeof buff);
+    return false;
+}
+
+//returns true if the two members left shard (to a game worker, or back home if the game could not be started after all)
+static bool sendLobbyMembersToGameManager(LobbyShard* shard, Connection* client1, 
+    Connection* client2, size_t* currentRange)
+{
+    if( ! isGameRoomAvailable() )
+    {
+        char buff[SERVER_FULL_MSGSIZE] = {SERVER_FULL_MSGTYPE, SERVER_FULL_MSGSIZE};
+        lobbySend(shard, client1, buff, sizeof buff);
+        lobbySend(shard, client2, buff, sizeof buff);
+        logWarn("every game worker is full. sending SERVER_FULL_MSGTYPE to %s and %s", client1->ipStr, client2->ipStr);
+        return false;
+    }
+
+    removeLobbyMember(shard, client1, currentRange);
+    removeLobbyMember(shard, client2, currentRange);
+    startLobbyGame(client1, client2);
+    return true;
+}
+
+typedef enum
+{
+    MESSAGE_CONSUMED,
+    MESSAGE_INVALID,//the connection has to be closed
+    CONNECTION_LEFT_LOBBY//the message started, resumed or started watching a chess game (or moved the member to another shard), so the connection is not in the shard anymore
+}ConsumeResult;
+
+//true if requester has a pair request to the player with targetID that was not answered yet
+//(it did not time out and was not declined)
+static bool hasPairRequestTo(Connection const* requester, uint32_t const targetID)
+{
+    return requester->uniqueID != targetID && timerIsScheduled(&requester->pairRequestTimer) &&
+        requester->pairRequestTargetID == targetID && ! requester->isPairRequestDeclined;
+}
+
+//the request was answered with a PAIR_ACCEPT_MSGTYPE, so the requester can send another one right away
+//(if the game could not be started because every game worker was full)
+static void clearPairRequest(LobbyShard* shard, Connection* requester)
+{
+    timerWheelCancel(&shard->timers, &requester->pairRequestTimer);
+    requester->pairRequestTargetID = 0;
+}
+
+//queue a PAIR_REQUEST_MSGTYPE from the player with requesterID for target
+static void sendPairRequest(LobbyShard* shard, Connection* target, uint32_t const requesterID)
+{
+    uint32_t nwByteOrderRequesterID = htonl(requesterID);
+    char buff[PAIR_REQUEST_MSGSIZE] = {PAIR_REQUEST_MSGTYPE, PAIR_REQUEST_MSGSIZE};
+    memcpy(buff + 2, &nwByteOrderRequesterID, sizeof(nwByteOrderRequesterID));
+
+    lobbySend(shard, target, buff, sizeof buff);
+    logDebug("sending PAIR_REQUEST_MSGTYPE to %s", target->ipStr);
+}
+
+//queue a PAIR_DECLINE_MSGTYPE from the player with declinerID for requester (who has a pair request to them, see hasPairRequestTo())
+static void declinePairRequest(LobbyShard* shard, Connection* requester, uint32_t const declinerID)
+{
+    logDebug("sending a PAIR_DECLINE_MSGTYPE to %s", requester->ipStr);
+    char pairDeclineMsg[PAIR_DECLINE_MSGSIZE] = {PAIR_DECLINE_MSGTYPE, PAIR_DECLINE_MSGSIZE};
+    uint32_t nwByteOrderDeclinerID = htonl(declinerID);
+    memcpy(pairDeclineMsg + 2, &nwByteOrderDeclinerID, sizeof(nwByteOrderDeclinerID));
+    lobbySend(shard, requester, pairDeclineMsg, sizeof pairDeclineMsg);
+
+    //the requester still has to wait out PAIR_REQUEST_TIMEOUT_SECS before their next request,
+    //but there is no PAIR_NORESPONSE_MSGTYPE when the timer goes off
+    requester->isPairRequestDeclined = true;
+}
+
+static void handleIDMail(LobbyShard* shard, LobbyMailType type, uint32_t memberID, uint32_t otherID);
+
+//Mail that only carries IDs from shard to wherever memberID is (handled right away if that is shard).
+//Dropped if memberID is not in the lobby, or the inbox it has to go to is full
+static void sendLobbyMail(LobbyShard* shard, LobbyMailType const type, uint32_t const memberID, uint32_t const otherID)
+{
+    LobbyShard* askShard = NULL;
+    if(findLobbyMember(shard, memberID, false, &askShard))
+        handleIDMail(shard, type, memberID, otherID);
+    else if(askShard && ! postLobbyMail(askShard, type, CONNECTION_HANDLE_NONE, memberID, otherID))
+        logWarn("the inbox of lobby shard %zu is full. dropping a mail for %u", (size_t)(askShard - s_lobbyShards), memberID);
+}
+
+//Mail that only carries IDs (see LobbyMailType) came in for memberID, who is a member of shard or was sent here
+//by a shard that does not have them
+static void handleIDMail(LobbyShard* shard, LobbyMailType const type, uint32_t const memberID, uint32_t const otherID)
+{
+    LobbyShard* askShard = NULL;
+    Connection* member = findLobbyMember(shard, memberID, true, &askShard);
+    if( ! member && askShard )
+    {
+        //this is their home shard, so they are matchmaking (or were, and the matchmaking shard answers whoever is waiting)
+        if( ! postLobbyMail(askShard, type, CONNECTION_HANDLE_NONE, memberID, otherID) )
+            logWarn("the inbox of lobby shard %zu is full. dropping a mail for %u", (size_t)(askShard - s_lobbyShards), memberID);
+
+        return;
+    }
+
+    switch(type)
+    {
+    case LOBBY_MAIL_PAIR_REQUEST:
+    {
+        if(member)
+            sendPairRequest(shard, member, otherID);
+        else
+            sendLobbyMail(shard, LOBBY_MAIL_PAIR_REQUEST_FAILED, otherID, memberID);
+
+        break;
+    }
+    case LOBBY_MAIL_PAIR_DECLINE:
+    {
+        if(member && hasPairRequestTo(member, otherID))
+            declinePairRequest(shard, member, otherID);
+        else
+            sendLobbyMail(shard, LOBBY_MAIL_NOT_IN_LOBBY, otherID, memberID);
+
+        break;
+    }
+    case LOBBY_MAIL_PAIR_REQUEST_FAILED:
+    {
+        if( ! member )
+            break;
+
+        sendIDNotInLobby(shard, member, htonl(otherID));
 
-    closeLobbyConnection(client1, currentRange, false);
-    closeLobbyConnection(client2, currentRange, false);
+        //they can send another one right away, the same as if otherID had not been in their own shard
+        if(member->pairRequestTargetID == otherID && timerIsScheduled(&member->pairRequestTimer))
+            clearPairRequest(shard, member);
 
-    LeaveCriticalSection(&g_lobbyMutex);
+        break;
+    }
+    case LOBBY_MAIL_NOT_IN_LOBBY:
+    {
+        if(member)
+            sendIDNotInLobby(shard, member, htonl(otherID));
+
+        break;
+    }
+    default:
+        assert(false);
+    }
+}
+
+//A member who accepted the pair request of requesterID came to shard (see LOBBY_MAIL_PAIR_ACCEPT). If the requester is still waiting
+//on them they go to a game worker together, otherwise the accepter goes back home
+static void onPairAcceptMail(LobbyShard* shard, Connection* accepter, uint32_t const requesterID, size_t* currentRange)
+{
+    LobbyShard* askShard = NULL;
+    Connection* requester = findLobbyMember(shard, requesterID, true, &askShard);
+    if( ! requester && askShard )
+    {
+        postLobbyMail(askShard, LOBBY_MAIL_PAIR_ACCEPT, (ConnectionHandle)accepter->handle, requesterID, 0);
+        return;
+    }
+
+    if( ! requester || ! hasPairRequestTo(requester, accepter->uniqueID) )
+    {
+        char buff[ID_NOT_IN_LOBBY_MSGSIZE] = {ID_NOT_IN_LOBBY_MSGTYPE, ID_NOT_IN_LOBBY_MSGSIZE};
+        uint32_t nwByteOrderRequesterID = htonl(requesterID);
+        memcpy(buff + 2, &nwByteOrderRequesterID, sizeof(nwByteOrderRequesterID));
+        sendLobbyMemberHome(accepter, buff, sizeof buff);
+        return;
+    }
+
+    clearPairRequest(shard, requester);
+
+    if( ! isGameRoomAvailable() )
+    {
+        //logged first, the accepter's home shard owns them as soon as they are sent home
+        logWarn("every game worker is full. sending SERVER_FULL_MSGTYPE to %s and %s", requester->ipStr, accepter->ipStr);
+        char buff[SERVER_FULL_MSGSIZE] = {SERVER_FULL_MSGTYPE, SERVER_FULL_MSGSIZE};
+        lobbySend(shard, requester, buff, sizeof buff);
+        sendLobbyMemberHome(accepter, buff, sizeof buff);
+        return;
+    }
+
+    removeLobbyMember(shard, requester, currentRange);
+    startLobbyGame(requester, accepter);
 }
 
-//Handles the PAIR_ACCEPT_MSGTYPE message type (defined in chessAppLevelProtocol.h).
-static void handlePairAcceptMessage(const char* msg, LobbyConnection* client, size_t* currentRange)
+//Handles the PAIR_ACCEPT_MSGTYPE message type (defined in chessNetworkProtocol.h).
+static ConsumeResult handlePairAcceptMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
 {
     uint32_t networkByteOrderUniqueID = 0;
 
@@ -177,23 +678,41 @@ static void handlePairAcceptMessage(const char* msg, LobbyConnection* client, si
     //This is why the src param in memcpy is msg + 2.
     //memcpy will "step over" that 2 byte message header.
     memcpy(&networkByteOrderUniqueID, msg + 2, sizeof(networkByteOrderUniqueID));
+    uint32_t const requesterID = ntohl(networkByteOrderUniqueID);
 
-    LobbyConnection* opponent = getClientByUniqueID(ntohl(networkByteOrderUniqueID));
-    if( ! opponent )//if the person who originally sent PAIR_REQUEST_MSGTYPE is no longer in the lobby
+    LobbyShard* askShard = NULL;
+    Connection* opponent = findLobbyMember(shard, requesterID, false, &askShard);
+    if( ! opponent && askShard )
     {
-        char buff[ID_NOT_IN_LOBBY_MSGSIZE] = {ID_NOT_IN_LOBBY_MSGTYPE, ID_NOT_IN_LOBBY_MSGSIZE};
-        networkSendAll(client->socket, buff, sizeof buff);
-        printf("sending ID_NOT_IN_LOBBY_MSGTYPE to %s\n", client->ipStr);
+        //the requester's shard starts the game, so client goes there (with their ID, see onPairAcceptMail())
+        removeLobbyMember(shard, client, currentRange);
+        postLobbyMail(askShard, LOBBY_MAIL_PAIR_ACCEPT, (ConnectionHandle)client->handle, requesterID, 0);
+        return CONNECTION_LEFT_LOBBY;
     }
-    else
+
+    //if the person who originally sent PAIR_REQUEST_MSGTYPE is no longer in the lobby (or their request timed out)
+    if( ! opponent || ! hasPairRequestTo(opponent, client->uniqueID) )
     {
-        sendLobbyMembersToGameManager(client, opponent, currentRange);
+        sendIDNotInLobby(shard, client, networkByteOrderUniqueID);
+        return MESSAGE_CONSUMED;
     }
+
+    clearPairRequest(shard, opponent);
+    return sendLobbyMembersToGameManager(shard, client, opponent, currentRange) ? CONNECTION_LEFT_LOBBY : MESSAGE_CONSUMED;
 }
 
-//Handles the PAIR_REQUEST_MSGTYPE message type (defined in chessAppLevelProtocol.h)
-static void handlePairRequestMessage(const char* msg, LobbyConnection* client)
+//Handles the PAIR_REQUEST_MSGTYPE message type (defined in chessNetworkProtocol.h)
+static ConsumeResult handlePairRequestMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
 {
+    //one outstanding request at a time, and no more than one every PAIR_REQUEST_TIMEOUT_SECS unless it is accepted
+    if(timerIsScheduled(&client->pairRequestTimer))
+    {
+        char buff[PAIR_REQUEST_TOO_SOON_MSGSIZE] = {PAIR_REQUEST_TOO_SOON_MSGTYPE, PAIR_REQUEST_TOO_SOON_MSGSIZE};
+        lobbySend(shard, client, buff, sizeof buff);
+        logDebug("sending PAIR_REQUEST_TOO_SOON_MSGTYPE to %s", client->ipStr);
+        return MESSAGE_CONSUMED;
+    }
+
     //This number comes in as network byte order, and stays as network byte order.
     //This is because uniqueIdentifier will be re-sent immediately to the client
     //of the person that client(the client param) anyway.
@@ -203,242 +722,721 @@ static void handlePairRequestMessage(const char* msg, LobbyConnection* client)
     //macro defined in chessAppLevelProtocol.h to signify what the following bytes represent.
     //This is why the src in memcpy is msg + 2, since we are "stepping over" that 1 byte message header.
     memcpy(&networkByteOrderUniqueID, msg + 2, sizeof(networkByteOrderUniqueID));
+    uint32_t const targetID = ntohl(networkByteOrderUniqueID);
+
+    //a target in another shard gets the request through its inbox. if they are not there after all,
+    //LOBBY_MAIL_PAIR_REQUEST_FAILED comes back and client gets their ID_NOT_IN_LOBBY_MSGTYPE then
+    LobbyShard* askShard = NULL;
+    Connection* potentialOpponent = findLobbyMember(shard, targetID, false, &askShard);
+    bool const wasPassedOn = ! potentialOpponent && askShard &&
+        postLobbyMail(askShard, LOBBY_MAIL_PAIR_REQUEST, CONNECTION_HANDLE_NONE, targetID, client->uniqueID);
 
-    LobbyConnection* potentialOpponent = getClientByUniqueID(ntohl(networkByteOrderUniqueID));
-    if( ! potentialOpponent || potentialOpponent == client )
+    if( ! wasPassedOn && ( ! potentialOpponent || potentialOpponent == client ) )
     {
-        char buff[ID_NOT_IN_LOBBY_MSGSIZE] = {ID_NOT_IN_LOBBY_MSGTYPE, ID_NOT_IN_LOBBY_MSGSIZE};
-        memcpy(buff + 2, &networkByteOrderUniqueID, sizeof(networkByteOrderUniqueID));
-        networkSendAll(client->socket, buff, sizeof buff);
-        printf("sending ID_NOT_IN_LOBBY_MSGTYPE tp %s\n", client->ipStr);
+        sendIDNotInLobby(shard, client, networkByteOrderUniqueID);
+        return MESSAGE_CONSUMED;
     }
-    else
-    {
-        uint32_t nwByteOrderClientID = htonl(client->uniqueID);
-        char buff[PAIR_REQUEST_MSGSIZE] = {PAIR_REQUEST_MSGTYPE, PAIR_REQUEST_MSGSIZE};
-        memcpy(buff + 2, &nwByteOrderClientID, sizeof(nwByteOrderClientID));
 
-        networkSendAll(potentialOpponent->socket, buff, sizeof buff);
-        printf("sending PAIR_REQUEST_MSGTYPE to %s\n", potentialOpponent->ipStr);
-    }
+    if(potentialOpponent)
+        sendPairRequest(shard, potentialOpponent, client->uniqueID);
+
+    //onPairRequestTimeout() sends a PAIR_NORESPONSE_MSGTYPE if the target does not answer in time
+    client->pairRequestTargetID = targetID;
+    client->isPairRequestDeclined = false;
+    timerWheelSchedule(&shard->timers, &client->pairRequestTimer, getLobbyNowMs() + PAIR_REQUEST_TIMEOUT_SECS * 1000);
+    return MESSAGE_CONSUMED;
 }
 
-static void handlePairDeclineMessage(const char* msg, LobbyConnection* client)
+static ConsumeResult handlePairDeclineMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
 {
     uint32_t networkByteOrderID = 0;
     memcpy(&networkByteOrderID, msg + 2, sizeof(networkByteOrderID));
-
-    LobbyConnection* potentialOpponent = getClientByUniqueID(ntohl(networkByteOrderID));
-    if( ! potentialOpponent )//If the player to send the PAIR_DECLINE_MSGTYPE to is not in the lobby.
+    uint32_t const requesterID = ntohl(networkByteOrderID);
+
+    //a requester in another shard gets the decline through its inbox, which answers with LOBBY_MAIL_NOT_IN_LOBBY
+    //if they are not waiting on client anymore
+    LobbyShard* askShard = NULL;
+    Connection* requester = findLobbyMember(shard, requesterID, false, &askShard);
+    if( ! requester && askShard && 
+        postLobbyMail(askShard, LOBBY_MAIL_PAIR_DECLINE, CONNECTION_HANDLE_NONE, requesterID, client->uniqueID) )
     {
-        printf("sending a ID_NOT_IN_LOBBY_MSGTYPE to %s\n", client->ipStr);
-        char idNotInLobbyMsg[ID_NOT_IN_LOBBY_MSGSIZE] = {ID_NOT_IN_LOBBY_MSGTYPE, ID_NOT_IN_LOBBY_MSGSIZE};
-        networkSendAll(client->socket, idNotInLobbyMsg, sizeof idNotInLobbyMsg);
+        return MESSAGE_CONSUMED;
     }
-    else//If the player to send the PAIR_DECLINE_MSGTYPE to is in the lobby.
+
+    //If the player to send the PAIR_DECLINE_MSGTYPE to is not in the lobby (or is not waiting on an answer from client).
+    if( ! requester || ! hasPairRequestTo(requester, client->uniqueID) )
+        sendIDNotInLobby(shard, client, networkByteOrderID);
+    else
+        declinePairRequest(shard, requester, client->uniqueID);
+
+    return MESSAGE_CONSUMED;
+}
+
+//only wake up for matchmaking while there are at least two players in the queue (one player has no one to be matched with)
+static void scheduleMatchmaking(LobbyShard* shard)
+{
+    if(matchmakerSize(&shard->matchmaker) >= 2 && ! timerIsScheduled(&shard->matchmakingTimer))
+        timerWheelSchedule(&shard->timers, &shard->matchmakingTimer, getLobbyNowMs() + MATCHMAKING_TICK_MS);
+}
+
+//Handles the FIND_GAME_MSGTYPE message type (defined in chessNetworkProtocol.h)
+static ConsumeResult handleFindGameMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
+{
+    if(matchmakingNodeIsQueued(&client->matchmakingNode))
+        return MESSAGE_CONSUMED;
+
+    uint16_t nwByteOrderRating = 0;
+    memcpy(&nwByteOrderRating, msg + 2, sizeof(nwByteOrderRating));
+
+    if(shard == s_lobbyShards + MATCHMAKING_SHARD)
     {
-        printf("sending a PAIR_DECLINE_MSGTYPE to %s\n", potentialOpponent->ipStr);
-        char pairDeclineMsg[PAIR_DECLINE_MSGSIZE] = {PAIR_DECLINE_MSGTYPE, PAIR_DECLINE_MSGSIZE};
-        uint32_t nwByteOrderClientID = htonl(client->uniqueID);
-        memcpy(pairDeclineMsg + 2, &nwByteOrderClientID, sizeof(nwByteOrderClientID));
-        networkSendAll(potentialOpponent->socket, pairDeclineMsg, sizeof pairDeclineMsg);
+        matchmakerEnqueue(&shard->matchmaker, &client->matchmakingNode, ntohs(nwByteOrderRating), getLobbyNowMs());
+        scheduleMatchmaking(shard);
+        return MESSAGE_CONSUMED;
     }
+
+    //there is one queue so that anyone can be matched with anyone. client is queued once they got there (see LOBBY_MAIL_FIND_GAME)
+    removeLobbyMember(shard, client, currentRange);
+    client->matchmakingNode.rating = ntohs(nwByteOrderRating);
+    client->matchmakingNode.queuedMs = getLobbyNowMs();
+    postLobbyMail(s_lobbyShards + MATCHMAKING_SHARD, LOBBY_MAIL_FIND_GAME, (ConnectionHandle)client->handle, 0, 0);
+    return CONNECTION_LEFT_LOBBY;
 }
 
-//close connection and return false if msg size doesnt match the type
-static bool confirmMsgSize(size_t msgSize, size_t correctSize)
+//Handles the CANCEL_FIND_GAME_MSGTYPE message type (defined in chessNetworkProtocol.h).
+//a member who went to the matchmaking shard stays there
+static ConsumeResult handleCancelFindGameMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
 {
-    if(msgSize == correctSize) 
-        return true;
-    
-    logError("wrong message size for the given type sent from the client uh oh", 0);
-    return false;
+    matchmakerRemove(&shard->matchmaker, &client->matchmakingNode);
+    return MESSAGE_CONSUMED;
 }
 
-//return false if connection was disconnected.
-static bool consumeMessage(const char* msg, LobbyConnection* connection, size_t* currLobbyRange)
+//the pairRequestTimer of a lobby member went off (see LobbyShard::timers)
+static void onPairRequestTimeout(LobbyShard* shard, TimerNode* timer)
 {
-    char const msgType = msg[0];
-    char const msgSize = msg[1];
+    Connection* requester = (Connection*)((char*)timer - offsetof(Connection, pairRequestTimer));
 
-    switch(msgType)
+    if( ! requester->isPairRequestDeclined )
     {
-    case PAIR_REQUEST_MSGTYPE:
+        char buff[PAIR_NORESPONSE_MSGSIZE] = {PAIR_NORESPONSE_MSGTYPE, PAIR_NORESPONSE_MSGSIZE};
+        lobbySend(shard, requester, buff, sizeof buff);
+        logDebug("sending PAIR_NORESPONSE_MSGTYPE to %s", requester->ipStr);
+    }
+
+    requester->pairRequestTargetID = 0;
+}
+
+//Handles the RESUME_GAME_MSGTYPE message type (defined in chessNetworkProtocol.h).
+static ConsumeResult handleResumeGameMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
+{
+    uint32_t nwByteOrderToken[2] = {0};
+    uint32_t nwByteOrderNumOfMessages = 0;
+    memcpy(nwByteOrderToken, msg + 2, sizeof(nwByteOrderToken));
+    memcpy(&nwByteOrderNumOfMessages, msg + 2 + sizeof(nwByteOrderToken), sizeof(nwByteOrderNumOfMessages));
+    uint64_t const resumeToken = ((uint64_t)ntohl(nwByteOrderToken[0]) << 32) | ntohl(nwByteOrderToken[1]);
+
+    if( ! canResumeChessGame(resumeToken) )
     {
-        if( ! confirmMsgSize(msgSize, PAIR_REQUEST_MSGSIZE) ) {return false;}
+        char buff[RESUME_FAILED_MSGSIZE] = {RESUME_FAILED_MSGTYPE, RESUME_FAILED_MSGSIZE};
+        lobbySend(shard, client, buff, sizeof buff);
+        metricsAdd(METRIC_RESUMES_FAILED, 1);
+        logDebug("sending RESUME_FAILED_MSGTYPE to %s", client->ipStr);
+        return MESSAGE_CONSUMED;
+    }
 
-        printf("recieved a PAIR_REQUEST_MSGTYPE from %s\n", connection->ipStr);
-        handlePairRequestMessage(msg, connection);
-        break;
+    //the game worker owns the connection as soon as resumeChessGame() hands it over, the same as in startLobbyGame()
+    ConnectionHandle const handle = (ConnectionHandle)client->handle;
+    closeLobbyConnection(shard, client, currentRange, false);
+    resumeChessGame(handle, resumeToken, ntohl(nwByteOrderNumOfMessages));
+    return CONNECTION_LEFT_LOBBY;
+}
+
+//Handles the SPECTATE_MSGTYPE message type (defined in chessNetworkProtocol.h).
+static ConsumeResult handleSpectateMessage(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange)
+{
+    uint32_t nwByteOrderID = 0;
+    memcpy(&nwByteOrderID, msg + 2, sizeof(nwByteOrderID));
+    uint32_t const spectateID = ntohl(nwByteOrderID);
+
+    if( ! canSpectateChessGame(spectateID) )
+    {
+        char buff[SPECTATE_FAILED_MSGSIZE] = {SPECTATE_FAILED_MSGTYPE, SPECTATE_FAILED_MSGSIZE};
+        lobbySend(shard, client, buff, sizeof buff);
+        logDebug("sending SPECTATE_FAILED_MSGTYPE to %s", client->ipStr);
+        return MESSAGE_CONSUMED;
     }
-    case PAIR_ACCEPT_MSGTYPE:
+
+    //the game worker owns the connection as soon as spectateChessGame() hands it over, same as in handleResumeGameMessage()
+    ConnectionHandle const handle = (ConnectionHandle)client->handle;
+    closeLobbyConnection(shard, client, currentRange, false);
+    spectateChessGame(handle, spectateID);
+    return CONNECTION_LEFT_LOBBY;
+}
+
+//what matchmakerRun() is given as the ctx of onMatchmakingMatch()
+typedef struct
+{
+    LobbyShard* shard;
+    uint64_t nowMs;
+}MatchmakingRun;
+
+//called by matchmakerRun() for every two players it matched
+static void onMatchmakingMatch(MatchmakingNode* older, MatchmakingNode* newer, void* ctx)
+{
+    MatchmakingRun const* run = ctx;
+    Connection* player1 = (Connection*)((char*)older - offsetof(Connection, matchmakingNode));
+    Connection* player2 = (Connection*)((char*)newer - offsetof(Connection, matchmakingNode));
+
+    //a member who is being disconnected is closed at the end of this lobby loop iteration,
+    //so the other one goes back in the queue (keeping how long they waited) for the next tick
+    if(player1->isDisconnecting || player2->isDisconnecting)
     {
-        if( ! confirmMsgSize(msgSize, PAIR_ACCEPT_MSGSIZE) ) {return false;}
+        if( ! player1->isDisconnecting )
+            matchmakerEnqueue(&run->shard->matchmaker, older, older->rating, older->queuedMs);
+        else if( ! player2->isDisconnecting )
+            matchmakerEnqueue(&run->shard->matchmaker, newer, newer->rating, newer->queuedMs);
 
-        printf("revieced a PAIR_ACCEPT_MSGTYPE from %s\n", connection->ipStr);
-        handlePairAcceptMessage(msg, connection, currLobbyRange); 
-        break;
+        return;
     }
-    case PAIR_DECLINE_MSGTYPE:
+
+    uint64_t const waitedNs1 = (run->nowMs - older->queuedMs) * 1000000;
+    uint64_t const waitedNs2 = (run->nowMs - newer->queuedMs) * 1000000;
+
+    //if every game worker is full they both get a SERVER_FULL_MSGTYPE and are not in the queue anymore
+    size_t unusedRange = 0;
+    if(sendLobbyMembersToGameManager(run->shard, player1, player2, &unusedRange))
     {
-        if( ! confirmMsgSize(msgSize, PAIR_DECLINE_MSGSIZE) ) {return false;}
+        metricsAdd(METRIC_MATCHMAKING_MATCHES, 1);
+        metricsRecord(METRIC_HISTOGRAM_MATCHMAKING_WAIT, waitedNs1);
+        metricsRecord(METRIC_HISTOGRAM_MATCHMAKING_WAIT, waitedNs2);
+    }
+}
 
-        printf("recieved a PAIR_DECLINE_MSGTYPE from %s\n", connection->ipStr);
-        handlePairDeclineMessage(msg, connection);
-        break;
+static void runMatchmaking(LobbyShard* shard)
+{
+    MatchmakingRun run = {shard, getLobbyNowMs()};
+    matchmakerRun(&shard->matchmaker, run.nowMs, onMatchmakingMatch, &run);
+    scheduleMatchmaking(shard);
+}
+
+//every timer in LobbyShard::timers goes off here. ctx is the shard
+static void onLobbyTimer(TimerNode* timer, void* ctx)
+{
+    LobbyShard* shard = ctx;
+    if(timer == &shard->matchmakingTimer)
+        runMatchmaking(shard);
+    else
+        onPairRequestTimeout(shard, timer);
+}
+
+//The WSAPoll() timeout until whichever comes first: the next lobby timer (a pair request timeout or the matchmaking tick) or flushTimeoutMs
+//(from flushLobbyConnections(), -1 if nothing is waiting to be flushed). -1 if there is neither
+static int getLobbyPollTimeout(LobbyShard* shard, int const flushTimeoutMs)
+{
+    uint64_t const deadlineMs = timerWheelNextDeadline(&shard->timers);
+    if(deadlineMs == UINT64_MAX)
+        return flushTimeoutMs;
+
+    uint64_t const nowMs = getLobbyNowMs();
+    int const timerTimeoutMs = (deadlineMs > nowMs) ? (int)min(deadlineMs - nowMs, (uint64_t)INT_MAX) : 0;
+    return (flushTimeoutMs < 0) ? timerTimeoutMs : min(flushTimeoutMs, timerTimeoutMs);
+}
+
+typedef ConsumeResult (*LobbyMessageHandler)(LobbyShard* shard, const char* msg, Connection* client, size_t* currentRange);
+
+//indexed by MessageType. every type a client can send in the lobby (see CHESS_MESSAGE_TABLE) has a handler. checked in lobbyManagerInit()
+static LobbyMessageHandler const s_lobbyMessageHandlers[NUM_OF_MESSAGE_TYPES] =
+{
+    [PAIR_REQUEST_MSGTYPE] = handlePairRequestMessage,
+    [PAIR_ACCEPT_MSGTYPE] = handlePairAcceptMessage,
+    [PAIR_DECLINE_MSGTYPE] = handlePairDeclineMessage,
+    [FIND_GAME_MSGTYPE] = handleFindGameMessage,
+    [CANCEL_FIND_GAME_MSGTYPE] = handleCancelFindGameMessage,
+    [RESUME_GAME_MSGTYPE] = handleResumeGameMessage,
+    [SPECTATE_MSGTYPE] = handleSpectateMessage
+};
+
+static ConsumeResult consumeMessage(LobbyShard* shard, MessageView const* msg, Connection* connection, size_t* currLobbyRange)
+{
+    uint8_t const msgType = (uint8_t)msg->data[0];
+    metricsCountMessage(msgType);
+
+    //0 for anything that is not a type a client can send in the lobby, which never matches a size the framer lets through
+    if(clientMessageSize(msgType, MSG_IN_LOBBY) != msg->size)
+    {
+        logError("invalid message type (or size) sent from client... uh oh", 0);
+        return MESSAGE_INVALID;
     }
-    default:
+
+    logDebug("recieved a %s from %s", messageTypeName(msgType), connection->ipStr);
+    return s_lobbyMessageHandlers[msgType](shard, msg->data, connection, currLobbyRange);
+}
+
+//Handle every whole message that is in the framer of a member of shard, straight out of the framer.
+//returns true if the connection was closed (or left the shard)
+static bool consumeReceivedMessages(LobbyShard* shard, Connection* const connection, size_t* const lobbyConnectionRange)
+{
+    MessageView msg;
+    FramerResult framerResult;
+    while((framerResult = messageFramerNext(&connection->in, &msg)) == FRAMER_MESSAGE_READY)
     {
-        logError("invalid message type sent from client... uh oh", 0);
-        return false;
+        ConsumeResult const consumeResult = consumeMessage(shard, &msg, connection, lobbyConnectionRange);
+        if(consumeResult == CONNECTION_LEFT_LOBBY)
+            return true;
+
+        if(consumeResult == MESSAGE_INVALID)
+        {
+            closeLobbyConnection(shard, connection, lobbyConnectionRange, true);
+            return true;
+        }
     }
+
+    if(framerResult == FRAMER_MALFORMED_MESSAGE)
+    {
+        logError("a lobby member sent a message with an invalid size", 0);
+        closeLobbyConnection(shard, connection, lobbyConnectionRange, true);
+        return true;
     }
-    
-    //if there are extra bytes in the buffer past this message, move them to the front of the buffer
-    if(connection->msgBuffCurrentSize > msgSize)
+
+    return false;
+}
+
+//Called by the lobby thread of shard after it drained the wakeup socket. Handles every mail in the inbox.
+//The connections that come with it are appended past the range the lobby loop is working with, so they are polled
+//from the next iteration on. Whatever a member who moved here (or a player who came back from a game) sent after the message
+//that moved them is handled right away, since WSAPoll() does not report bytes that were already read.
+//While the shard is being handed over (see handOverLobby()) no one is paired anymore: a member who came to accept a pair request
+//stays here with an ID_NOT_IN_LOBBY_MSGTYPE, and the mail that only carries IDs is dropped
+static void takeLobbyMail(LobbyShard* shard, size_t* lobbyConnectionRange, bool const isHandingOver)
+{
+    while(true)
     {
-        //memmove instead of memcpy since the pointers might overlap
-        memmove(connection->msgBuff, connection->msgBuff + msgSize, 
-            (connection->msgBuffCurrentSize) - msgSize);
+        LobbyInboxSlot* slot = shard->inbox + (shard->inboxHead & (s_inboxCapacity - 1));
+        if(ReadAcquire64(&slot->sequence) != shard->inboxHead + 1)
+            return;//empty, or the next push is not done yet. it signals the wakeup socket once it is
+
+        ConnectionHandle const handle = slot->handle;
+        LobbyMailType const type = (LobbyMailType)slot->type;
+        uint32_t const memberID = slot->memberID;
+        uint32_t const otherID = slot->otherID;
+        WriteRelease64(&slot->sequence, shard->inboxHead + (LONG64)s_inboxCapacity);
+        ++shard->inboxHead;
+
+        if(handle == CONNECTION_HANDLE_NONE)
+        {
+            InterlockedDecrement(&shard->numOfIDMails);
+            if( ! isHandingOver )
+                handleIDMail(shard, type, memberID, otherID);
+
+            continue;
+        }
+
+        Connection* const connection = connectionPoolGet(handle);
+        assert(connection);
+
+        switch(type)
+        {
+        case LOBBY_MAIL_NEW_MEMBER:
+            lobbyConnectionCtor(shard, connection);
+            break;
+
+        case LOBBY_MAIL_REJOIN:
+            addLobbyMember(shard, connection);
+            break;
+
+        case LOBBY_MAIL_FIND_GAME:
+            addLobbyMember(shard, connection);
+            matchmakerEnqueue(&shard->matchmaker, &connection->matchmakingNode,
+                connection->matchmakingNode.rating, connection->matchmakingNode.queuedMs);
+            scheduleMatchmaking(shard);
+            break;
+
+        case LOBBY_MAIL_PAIR_ACCEPT:
+            if( ! isHandingOver )
+            {
+                onPairAcceptMail(shard, connection, memberID, lobbyConnectionRange);
+                continue;
+            }
+
+            addLobbyMember(shard, connection);
+            sendIDNotInLobby(shard, connection, htonl(memberID));
+            break;
+
+        default:
+            assert(false);
+        }
+
+        if( ! isHandingOver && ! connection->isDisconnecting )
+            consumeReceivedMessages(shard, connection, lobbyConnectionRange);
     }
+}
 
-    connection->msgBuffCurrentSize -= msgSize;
+//Send what is queued for the members of shard if it is due (see OUTBOUND_LATENCY_CAP_US), and close the ones that are
+//being disconnected. Every lobby member gets at most one WSASend() per lobby loop iteration, and it never blocks.
+//Whatever a full socket does not take is sent after WSAPoll() reports POLLWRNORM for it.
+//Returns the WSAPoll() timeout in milliseconds until the next buffer that was held back is due, or -1 if nothing was held back.
+static int flushLobbyConnections(LobbyShard* shard)
+{
+    uint64_t const nowUs = getMonotonicMicroseconds();
+    uint64_t nextDeadlineUs = UINT64_MAX;
+    size_t numOfStillPending = 0;
 
-    return true;
+    for(size_t i = 0; i < shard->numOfPendingFlushIDs; ++i)
+    {
+        Connection* connection = lookupLobbyConnection(shard, shard->pendingFlushIDs[i]);
+        if( ! connection )
+            continue;//they left the shard
+
+        connection->isFlushScheduled = false;
+
+        if( ! connection->isDisconnecting && outBufferIsFlushDue(&connection->out, nowUs) &&
+            networkFlush(connection->socket, &connection->out) == SOCKET_ERROR )
+        {
+            logError("send() failed to a lobby member", WSAGetLastError());
+            connection->isDisconnecting = true;
+        }
+
+        if(connection->isDisconnecting)
+        {
+            //the lobby loop is done with its range, so there is nothing to shrink
+            size_t unusedRange = 0;
+            closeLobbyConnection(shard, connection, &unusedRange, true);
+            continue;
+        }
+
+        if( ! outBufferIsEmpty(&connection->out) && ! connection->out.isBlocked )
+        {
+            nextDeadlineUs = min(nextDeadlineUs, outBufferFlushDeadline(&connection->out));
+            shard->pendingFlushIDs[numOfStillPending++] = shard->pendingFlushIDs[i];
+            connection->isFlushScheduled = true;
+        }
+
+        updateLobbyPollEvents(shard, connection);
+    }
+
+    shard->numOfPendingFlushIDs = numOfStillPending;
+    return (nextDeadlineUs == UINT64_MAX) ? -1 : (int)((nextDeadlineUs - nowUs + 999) / 1000);
 }
 
-//just to save space in lobbyManagerThreadStart
-static void lobbyInit()
+static void lobbyShardInit(LobbyShard* shard)
 {
-    assert( ! s_lobbyConnections );
-    s_lobbyConnections = calloc(LOBBY_CAPACITY, sizeof(LobbyConnection));
-    if( ! s_lobbyConnections ) 
+    shard->connections = calloc(s_lobbyArrayCapacity, sizeof(Connection*));
+    shard->pollFds = calloc(s_lobbyArrayCapacity + 1, sizeof(WSAPOLLFD));
+    shard->pendingFlushIDs = calloc(FLUSH_LIST_CAPACITY, sizeof(uint32_t));
+    shard->inbox = calloc(s_inboxCapacity, sizeof(LobbyInboxSlot));
+
+    if( ! shard->connections || ! shard->pollFds || ! shard->pendingFlushIDs || ! shard->inbox ) 
     {
         char errBuff[128] = {0};
-        snprintf(errBuff, sizeof(errBuff), 
-            "calloc failed to allocate %llu bytes for the lobby\n", LOBBY_CAPACITY * sizeof(LobbyConnection));
+        snprintf(errBuff, sizeof(errBuff), "calloc failed to allocate %llu bytes for the lobby\n", 
+            (unsigned long long)(s_lobbyArrayCapacity * getLobbyBytesPerConnection()));
         logError(errBuff, 0);
 
         //if we cant even allocate enough memory for the lobby connections then just shut down
         exit(0);
     }
 
-    InitializeCriticalSection(&g_lobbyMutex);
-    InitializeConditionVariable(&g_lobbyEmptyCond);
-    InitializeConditionVariable(&g_gameManagerIsReadyCond);
+    if( ! wakeupSocketInit(&shard->wakeup) || ! connectionIndexInit(&shard->index, LOBBY_INDEX_INITIAL_CAPACITY) )
+        exit(0);
+
+    shard->pollFds[0].fd = shard->wakeup.sock;
+    shard->pollFds[0].events = POLLRDNORM;
+
+    for(size_t i = 0; i < s_inboxCapacity; ++i)
+        shard->inbox[i].sequence = (LONG64)i;
+
+    timerWheelInit(&shard->timers, getLobbyNowMs());
+    timerNodeInit(&shard->matchmakingTimer);
+    matchmakerInit(&shard->matchmaker);
+
+    shard->pausedEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    shard->handOverEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    shard->handedOverEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if( ! shard->pausedEvent || ! shard->handOverEvent || ! shard->handedOverEvent )
+    {
+        logError("CreateEvent() failed for the lobby", (int)GetLastError());
+        exit(0);
+    }
 }
 
-//just to save space in lobbyManagerThreadStart
-static void handleSelectErr()
+void lobbyManagerInit(void)
 {
-    //for now just exit after logging the error
-    logError("select() failed with error: ", WSAGetLastError());
+    assert( ! s_lobbyShards );
+    for(uint8_t msgType = 0; msgType < NUM_OF_MESSAGE_TYPES; ++msgType)
+        assert( ! clientMessageSize(msgType, MSG_IN_LOBBY) || s_lobbyMessageHandlers[msgType] );
+
+    s_lobbyArrayCapacity = connectionPoolMaxCapacity();
+    s_inboxCapacity = 1;
+    while(s_inboxCapacity < s_lobbyArrayCapacity + LOBBY_MAX_ID_MAILS)
+        s_inboxCapacity <<= 1;
+
+    s_numOfLobbyShards = g_serverConfig.lobbyThreads;
+    s_lobbyShards = calloc(s_numOfLobbyShards, sizeof(LobbyShard));
+    if( ! s_lobbyShards )
+    {
+        logError("calloc failed to allocate the lobby shards", 0);
+        exit(0);
+    }
+
+    for(size_t i = 0; i < s_numOfLobbyShards; ++i)
+        lobbyShardInit(s_lobbyShards + i);
+
+    logInfo("the lobby is split between %zu lobby threads", s_numOfLobbyShards);
 }
 
-//return true if the whole message has been received.
-static bool isMessageReady(const char* msgBuff, size_t currentSize)
+void lobbyTakeOver(HotUpgrade* upgrade)
 {
-    size_t expectedMsgSize = msgBuff[1];
-    return expectedMsgSize <= currentSize;
+    uint64_t const nowMs = getLobbyNowMs();
+    size_t numOfMembers = 0;
+
+    for(size_t i = 0; i < upgrade->numOfConnections; ++i)
+    {
+        HotUpgradeConnection* record = upgrade->connections[i];
+        if(record->role != HOT_UPGRADE_LOBBY_MEMBER)
+            continue;
+
+        Connection* connection = hotUpgradeAdoptConnection(record);
+        if( ! connection )
+            continue;
+
+        connectionSetState(connection, CONNECTION_IN_LOBBY);
+        InterlockedIncrement64(&s_lobbySize);
+        ++numOfMembers;
+
+        //they keep their ID, which the ID allocator does not hand out again (see idAllocatorRestore()),
+        //and go back to their home shard or the matchmaking shard
+        uint32_t const uniqueID = record->uniqueID;
+        LobbyShard* shard = record->isMatchmaking ? s_lobbyShards + MATCHMAKING_SHARD : homeShardOf(uniqueID);
+        uint32_t unusedHandle = CONNECTION_HANDLE_NONE;
+        if(uniqueID != CONNECTION_INDEX_EMPTY_KEY && uniqueID != CONNECTION_INDEX_TOMBSTONE_KEY &&
+            ! connectionIndexLookup(&shard->index, uniqueID, &unusedHandle))
+        {
+            connection->isReadPaused = false;
+            connection->isDisconnecting = false;
+            connection->uniqueID = uniqueID;
+            connection->isPairRequestDeclined = record->isPairRequestDeclined;
+
+            //addLobbyMember() schedules the pair request timer with the deadline it has
+            connection->pairRequestTargetID = record->hasPairRequest ? record->pairRequestTargetID : 0;
+            connection->pairRequestTimer.deadlineTick = (nowMs + record->pairRequestMsLeft + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+
+            addLobbyMember(shard, connection);
+
+            if(record->isMatchmaking)
+            {
+                uint64_t const queuedMs = nowMs > record->matchmakingWaitedMs ? nowMs - record->matchmakingWaitedMs : 0;
+                matchmakerEnqueue(&shard->matchmaker, &connection->matchmakingNode, record->rating, queuedMs);
+            }
+        }
+        else
+        {
+            connection->uniqueID = idAllocatorAcquire();
+            lobbyConnectionCtor(homeShardOf(connection->uniqueID), connection);
+        }
+    }
+
+    scheduleMatchmaking(s_lobbyShards + MATCHMAKING_SHARD);
+    logInfo("took over %zu lobby members", numOfMembers);
 }
 
-//just a helper func to save space in onSelectReady. returns true if connection was closed
-static bool onMessageReady(LobbyConnection* connection, size_t* lobbyConnectionRange)
+void lobbyPause(void)
 {
-    const uint8_t msgSize = connection->msgBuff[1];
+    InterlockedExchange(&s_isHandingOver, 1);
+    for(size_t i = 0; i < s_numOfLobbyShards; ++i)
+        signalWakeupSocket(&s_lobbyShards[i].wakeup);
 
-    char* msgCopy = calloc(msgSize, sizeof(char));
-    if( ! msgCopy ) 
+    for(size_t i = 0; i < s_numOfLobbyShards; ++i)
+        WaitForSingleObject(s_lobbyShards[i].pausedEvent, INFINITE);
+}
+
+void lobbyHandOver(HotUpgradeBuffer* buffer)
+{
+    //one shard at a time, since they all write into buffer
+    s_handOverBuffer = buffer;
+    for(size_t i = 0; i < s_numOfLobbyShards; ++i)
     {
-        char buff[128] = {0};
-        snprintf(buff, sizeof buff, "calloc failed to allocate %d bytes", msgSize);
-        logError(buff, 0);
-        exit(0);//if we can't even allocate msgSize bytes something is very wrong
+        SetEvent(s_lobbyShards[i].handOverEvent);
+        WaitForSingleObject(s_lobbyShards[i].handedOverEvent, INFINITE);
     }
-    
-    memcpy(msgCopy, connection->msgBuff, msgSize);
-    
-    if( ! consumeMessage(msgCopy, connection, &lobbyConnectionRange) )
+}
+
+//Called by the lobby thread of shard once lobbyPause() was called. Waits for lobbyHandOver() (the game workers hand their games over in the meantime,
+//and the players who are done with their game come back to the lobby) and writes every member of shard for the new process.
+//the members who were on their way to shard are in its inbox, since every lobby thread stopped before any of them hands over
+static void handOverLobby(LobbyShard* shard)
+{
+    SetEvent(shard->pausedEvent);
+    WaitForSingleObject(shard->handOverEvent, INFINITE);
+
+    size_t unusedRange = 0;
+    drainWakeupSocket(&shard->wakeup);
+    takeLobbyMail(shard, &unusedRange, true);
+
+    uint64_t const nowMs = getLobbyNowMs();
+    for(size_t i = 0; i < shard->numOfConnections; ++i)
     {
-        closeLobbyConnection(connection, &lobbyConnectionRange, true);
+        Connection* connection = shard->connections[i];
+        if(connection->isDisconnecting)
+            continue;
+
+        HotUpgradeConnection record;
+        memset(&record, 0, sizeof(record));
+        record.role = HOT_UPGRADE_LOBBY_MEMBER;
+        record.uniqueID = connection->uniqueID;
+        record.pairRequestTargetID = connection->pairRequestTargetID;
+        record.isPairRequestDeclined = connection->isPairRequestDeclined;
+
+        if(timerIsScheduled(&connection->pairRequestTimer))
+        {
+            uint64_t const deadlineMs = connection->pairRequestTimer.deadlineTick * TIMER_WHEEL_TICK_MS;
+            record.hasPairRequest = true;
+            record.pairRequestMsLeft = deadlineMs > nowMs ? (uint32_t)(deadlineMs - nowMs) : 0;
+        }
 
-        free(msgCopy);
-        return true;
+        if(matchmakingNodeIsQueued(&connection->matchmakingNode))
+        {
+            record.isMatchmaking = true;
+            record.rating = connection->matchmakingNode.rating;
+            record.matchmakingWaitedMs = (uint32_t)(nowMs - connection->matchmakingNode.queuedMs);
+        }
+
+        hotUpgradeWriteConnection(s_handOverBuffer, &record, connection, NULL);
     }
-    
-    free(msgCopy);
-    return false;
+
+    SetEvent(shard->handedOverEvent);
 }
 
-//just to save space in lobbyManagerThreadStart. returns true if the connection was closed
-static bool onSelectReady(LobbyConnection* const connection, size_t* const lobbyConnectionRange)
+//just to save space in lobbyManagerThreadStart
+static void handlePollErr()
 {
-    int recvRet = recv(connection->socket, connection->msgBuff, LOBBY_READ_BUFF_SIZE, 0);
+    //for now just log the error and poll again
+    logError("WSAPoll() failed with error: ", WSAGetLastError());
+}
+
+//just to save space in lobbyManagerThreadStart. returns true if the connection was closed (or left the shard)
+static bool onPollReady(LobbyShard* shard, Connection* const connection, size_t* const lobbyConnectionRange)
+{
+    //nothing this member sends matters anymore. they are closed at the end of the loop iteration
+    if(connection->isDisconnecting)
+        return false;
+
+    //dont read more than can be answered. every lobby message gets at most the same number of bytes back
+    size_t const maxBytes = OUT_BUFFER_CAPACITY - outBufferSize(&connection->out);
+    int recvRet = messageFramerRecv(connection->socket, &connection->in, maxBytes);
 
     if(recvRet == 0)
     {
-        closeLobbyConnection(connection, lobbyConnectionRange, true);
+        closeLobbyConnection(shard, connection, lobbyConnectionRange, true);
         return true;
     }
     else if(recvRet == SOCKET_ERROR)
     {
+        if(WSAGetLastError() == WSAEWOULDBLOCK)
+            return false;//the socket is non blocking and there was nothing to read after all
+
         logError("recv() error", WSAGetLastError());
-        closeLobbyConnection(connection, lobbyConnectionRange, true);
+        closeLobbyConnection(shard, connection, lobbyConnectionRange, true);
         return true;
     }
 
-    //recvRet contains the number of bytes, and wrote
-    //those bytes to connection->msgBuff by this point
-
-    connection->msgBuffCurrentSize += recvRet;
-
-    if(isMessageReady(connection->msgBuff, connection->msgBuffCurrentSize))
-        return onMessageReady(connection, lobbyConnectionRange);
-
-    return false;
+    metricsAdd(METRIC_BYTES_IN, (uint64_t)recvRet);
+    return consumeReceivedMessages(shard, connection, lobbyConnectionRange);
 }
 
 //the "lobby" is like a waiting room where players are connected but not paired and playing chess.
-//this func is the start of the lobby manager thread (only 1 thread) which will manage the lobby connections.
-void __stdcall lobbyManagerThreadStart(void* arg)
+//this func is the start of a lobby thread, which manages the members of the shard whose index is arg.
+unsigned __stdcall lobbyManagerThreadStart(void* arg)
 {
-    lobbyInit();
+    metricsRegisterThread();
+
+    LobbyShard* const shard = s_lobbyShards + (uintptr_t)arg;
+    assert((uintptr_t)arg < s_numOfLobbyShards);
 
-    TIMEVAL selectWaitTime = {.tv_usec = 20};//20 microseconds
-    fd_set readSockSet;
-    FD_ZERO(&readSockSet);
+    //-1 (block forever) unless some output is being held back for coalescing
+    int pollTimeoutMs = -1;
 
     while(true)
     {
-        EnterCriticalSection(&g_lobbyMutex);
-        while(s_numOfLobbyConnections == 0)
+        //capture only the current number of members. This way
+        //the loop below will only work with the members that were polled and not ones
+        //that are taken out of the inbox after WSAPoll() returns
+        size_t lobbyConnectionRange = shard->numOfConnections;
+
+        if(lobbyConnectionRange == 0)
+            logDebug("lobby shard %zu is empty. its thread is going to sleep", (size_t)(uintptr_t)arg);
+
+        //block until a member has bytes to read (or hung up), or until the shard gets mail.
+        //one syscall for the whole shard instead of one select() per lobby member
+        int pollRet = WSAPoll(shard->pollFds, (ULONG)lobbyConnectionRange + 1, pollTimeoutMs);
+
+        if(pollRet == SOCKET_ERROR)
         {
-            puts("The lobby is empty. Lobby thread is going to sleep");
-            SleepConditionVariableCS(&g_lobbyEmptyCond, &g_lobbyMutex, INFINITE);
+            handlePollErr();
+            continue;
         }
-        
-        //capture only the current number of lobby connections. This way
-        //the loop below will only work with the lobby members currently connected and not ones
-        //that might be inserted while the below loop is doing it's thing
-        size_t lobbyConnectionRange = s_numOfLobbyConnections;
-        LeaveCriticalSection(&g_lobbyMutex);
-
-        for(int i = 0; i < lobbyConnectionRange; ++i)
+
+        //the server is being handed over to a new process (see lobbyPause()). nothing is read from here on
+        if(ReadAcquire(&s_isHandingOver))
+        {
+            handOverLobby(shard);
+            break;
+        }
+
+        uint64_t const wakeUpNs = getMonotonicNanoseconds();
+
+        if(shard->pollFds[0].revents)
         {
-            FD_ZERO(&readSockSet);
-            FD_SET(s_lobbyConnections[i].socket, &readSockSet);
-            int selectRet = select(0, &readSockSet, NULL, NULL, &selectWaitTime);
+            //drained before the inbox is emptied, so mail posted after this signals the wakeup socket again
+            drainWakeupSocket(&shard->wakeup);
+            takeLobbyMail(shard, &lobbyConnectionRange, false);
+            --pollRet;
+        }
 
-            if(selectRet == SOCKET_ERROR) 
-            { 
-                handleSelectErr(); 
+        for(size_t i = 0; i < lobbyConnectionRange && pollRet > 0;)
+        {
+            WSAPOLLFD* const pollFd = shard->pollFds + i + 1;
+            if( ! pollFd->revents )
+            {
+                ++i;
+                continue;
             }
-            else if(selectRet > 0)
+
+            --pollRet;
+
+            Connection* const connection = shard->connections[i];
+            short const revents = pollFd->revents;
+            pollFd->revents = 0;
+
+            //the socket has room again, so send the rest of what is queued at the end of this iteration
+            if(revents & POLLWRNORM)
             {
-                if(onSelectReady(s_lobbyConnections + i, &lobbyConnectionRange)) { --i; }
+                connection->out.isBlocked = false;
+                scheduleLobbyFlush(shard, connection);
             }
+
+            //POLLHUP and POLLERR are also handled by onPollReady() since recv() will report them.
+            //if the connection was closed, a different connection was moved into slot i, so look at slot i again
+            if(revents & POLLNVAL)
+                closeLobbyConnection(shard, connection, &lobbyConnectionRange, true);
+            else if( ! (revents & ~POLLWRNORM) || ! onPollReady(shard, connection, &lobbyConnectionRange) )
+                ++i;
         }
+
+        //the pair requests that were not answered in time get their PAIR_NORESPONSE_MSGTYPE queued before the flush,
+        //and the matchmaking queue is run if its tick is due
+        timerWheelExpire(&shard->timers, getLobbyNowMs(), onLobbyTimer, shard);
+
+        //sleep until the next flush or lobby timer is due, whichever is first
+        pollTimeoutMs = getLobbyPollTimeout(shard, flushLobbyConnections(shard));
+
+        metricsRecord(METRIC_HISTOGRAM_LOOP_ITERATION, getMonotonicNanoseconds() - wakeUpNs);
     }
 
-    free(s_lobbyConnections);
-}
\ No newline at end of file
+    free(shard->inbox);
+    free(shard->pendingFlushIDs);
+    wakeupSocketDestroy(&shard->wakeup);
+    connectionIndexDestroy(&shard->index);
+    free(shard->pollFds);
+    free(shard->connections);
+    return 0;
+}
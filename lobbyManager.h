@@ -6,41 +6,49 @@
 #include <time.h>
 #include <stdint.h>
 
-#define LOBBY_READ_BUFF_SIZE 128
+#include "connectionPool.h"
+#include "hotUpgrade.h"
 
-typedef struct
-{
-    SOCKET socket;
-    struct sockaddr_in addr;
-    char ipStr[INET6_ADDRSTRLEN];
-
-    //Everyone connected and in the lobby has a unique identifier (0 - RAND_MAX).
-    //In the future this identifier will be used as a key in some type 
-    //of associative data structure, like a hash table.
-    uint32_t uniqueID;
-
-    //everyone needs their own message buffer
-    char msgBuff[LOBBY_READ_BUFF_SIZE];
-    size_t msgBuffCurrentSize;
-
-}LobbyConnection;
-
-//the size of the stack used by the lobby manager thread in bytes
+//the size of the stack used by each lobby thread in bytes
 #define LOBBY_MANAGER_STACKSIZE 64000
 
-#define LOBBY_CAPACITY 50
-
 //the lobby is like a waiting room where players are connected but not paired and playing chess.
-//this func is the start of the lobby manager thread (only 1 thread for now maybe more later)
-//which will manage the "lobby" connections.
-void __stdcall lobbyManagerThreadStart(void*);
-
-//insert a new connected client into the lobby. 
-void lobbyInsert(SOCKET socketFd, SOCKADDR_IN* addr);
-
-//Get how much room is left in the lobby. 
-size_t getAvailableLobbyRoom(void);
-
-bool isLobbyEmpty(void);
+//It is split into g_serverConfig.lobbyThreads shards (see serverConfig.h). this func is the start of the lobby thread
+//of one of them, arg is the index of the shard (0 up to g_serverConfig.lobbyThreads - 1, cast to a pointer).
+//The lobby threads end after a hot upgrade, so main() waits for them. That is why they are started with _beginthreadex().
+unsigned __stdcall lobbyManagerThreadStart(void* arg);
+
+//Has to be called once before lobbyInsert() or lobbyReserveRoom() are called (so before the acceptor threads are started)
+//and after connectionPoolInit(). Exits if the lobby can not be allocated.
+void lobbyManagerInit(void);
+
+//Lock free. Reserve a place in the lobby for a newly accepted connection, so that any number of acceptor threads
+//can check the capacity (g_serverConfig.lobbyCapacity, see serverConfig.h) without a lock.
+//Returns false if the lobby is full. A reserved place has to be filled with lobbyInsert() or given back with lobbyCancelReservation().
+bool lobbyReserveRoom(void);
+void lobbyCancelReservation(void);
+
+//Lock free. Insert a connection (a newly accepted one, or a player coming back from a chess game) into the lobby.
+//hasReservedRoom is true if the caller got a place from lobbyReserveRoom() for it. players coming back from a game dont need one.
+//the connection gets a new ID, and the lobby thread of the ID's shard owns it from now on. whatever is still queued in its OutBuffer
+//is sent before anything from the lobby. the connection is only queued for that lobby thread, which it wakes up if it is blocked waiting for lobby activity.
+void lobbyInsert(ConnectionHandle handle, bool hasReservedRoom);
+
+//Get how many players are in the lobby (counting the places that are reserved and the connections that are queued for a lobby thread).
+size_t getLobbySize(void);
+
+//Every lobby shard keeps a few arrays with a slot for every connection the pool can hold (see lobbyManagerInit()).
+//This is how many bytes that is per connection for all of them, for the memory budget.
+size_t getLobbyBytesPerConnection(void);
+
+//The side of the new process of a hot upgrade (see hotUpgrade.h). Called by main() after lobbyManagerInit() and before the lobby threads start.
+//Every lobby member the old process handed over goes back into the lobby with their ID, pair request and place in the matchmaking queue
+void lobbyTakeOver(HotUpgrade* upgrade);
+
+//The side of the running server of a hot upgrade, called by the hot upgrade thread. lobbyPause() blocks until every lobby thread
+//stopped (so none of them hands anyone to the game workers while they hand over their games), then lobbyHandOver() blocks until
+//the lobby threads wrote every member into buffer. The lobby threads end after that
+void lobbyPause(void);
+void lobbyHandOver(HotUpgradeBuffer* buffer);
 
 #endif //LOBBY_MANAGER_H
\ No newline at end of file
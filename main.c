@@ -8,15 +8,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "lobbyManager.h"
+#include "gameManager.h"
 #include "errorLogger.h"
 #include "connectionsAcceptor.h"
+#include "idAllocator.h"
+#include "connectionPool.h"
+#include "serverConfig.h"
+#include "admissionControl.h"
+#include "metrics.h"
+#include "registeredIO.h"
+#include "hotUpgrade.h"
 
 #include <winsock2.h>
 #include <process.h>
 #include <ConsoleApi.h>
 
+//A full lobby plus both players of every game, or as many connections as fit in the memory budget if that is less.
+//Logs what one connection costs so the limits in serverConfig.h can be picked with the footprint in mind.
+static size_t computeMaxConnections(void)
+{
+    size_t const bytesPerConnection = sizeof(Connection) + getLobbyBytesPerConnection() + getAdmissionBytesPerConnection();
+    size_t const neededConnections = g_serverConfig.lobbyCapacity + 2 * getMaxNumOfGames();
+    size_t const budgetConnections = g_serverConfig.memoryBudgetMB * 1024 * 1024 / bytesPerConnection;
+    size_t const maxConnections = min(min(neededConnections, budgetConnections), CONNECTION_POOL_MAX_CAPACITY);
+
+    logInfo("every connection takes %zu bytes (%zu in the connection pool, %zu in the lobby and %zu in admission control). "
+        "up to %zu connections (%llu MB) with a lobby capacity of %zu, %zu games max and a %zu MB memory budget", 
+        bytesPerConnection, sizeof(Connection), getLobbyBytesPerConnection(), getAdmissionBytesPerConnection(), maxConnections,
+        (unsigned long long)(maxConnections * bytesPerConnection / (1024 * 1024)),
+        g_serverConfig.lobbyCapacity, getMaxNumOfGames(), g_serverConfig.memoryBudgetMB);
+
+    if(maxConnections < neededConnections)
+        logWarn("a full lobby and every game need %zu connections, which is more than fit in the memory budget", neededConnections);
+
+    return maxConnections;
+}
+
 int main(void)
 {
+    //everything the server logs is written out by the logger's own thread
+    loggerInit();
+    metricsInit();
+
+    //the capacity limits and memory budget from the environment
+    serverConfigInit();
+
     BOOL WINAPI signalHandler(_In_ DWORD ctrlSignalType);
     SetConsoleCtrlHandler(signalHandler, TRUE);
 
@@ -26,23 +62,79 @@ int main(void)
         logError("winsock initialization failed! ", WSAGetLastError());
         return EXIT_FAILURE;
     }
+
+    //the game workers fall back to recv() and WSASend() if winsock has no Registered I/O
+    if(g_serverConfig.registeredIO && ! registeredIOInit())
+        g_serverConfig.registeredIO = false;
+
+    //The key of the player ID permutation has to be picked before anyone can be put into the lobby.
+    if( ! idAllocatorInit() )
+        return EXIT_FAILURE;
+
+    //A new build of the server takes over from the one that is running (see hotUpgrade.h). The lobby members keep their IDs,
+    //so the ID allocator goes on where the old process left off
+    HotUpgrade* upgrade = g_serverConfig.upgrade ? hotUpgradeTakeOver() : NULL;
+    if(upgrade)
+        idAllocatorRestore(&upgrade->server.ids);
+
+    //Set up the pool of game workers that the lobby hands paired players to.
+    gameManagerInit(upgrade);
+
+    //Every connection lives in the connection pool, which grows as connections come in.
+    size_t const maxConnections = computeMaxConnections();
+    connectionPoolInit(maxConnections);
+
+    //The per IP connection limits the acceptor threads check before anything else.
+    admissionControlInit(maxConnections);
     
-    //The thread responsible for listening to incomming TCP connection attempts.
-    //Once a connection is made, the lobby manager thread will be notified
-    //and woken up via a condition variable if it is asleep due to no one being on the server.
-    HANDLE connectionAccepterThreadHandle = (HANDLE)_beginthread(
-        acceptConnectionsThreadStart, ACCEPT_CONNECTIONS_STACKSIZE, NULL);
-
-    //The thread responsible for 
-    HANDLE lobbyManagerThreadHandle = (HANDLE)_beginthread(
-        lobbyManagerThreadStart, LOBBY_MANAGER_STACKSIZE, NULL);
-
-    //These will be waiting forever.
-    //For now the server keeps going until you press ctrl C or close the console.
-    WaitForSingleObject(connectionAccepterThreadHandle, INFINITE);
-    WaitForSingleObject(lobbyManagerThreadHandle, INFINITE);
+    //The lobby has to be ready before anyone can be put into it.
+    lobbyManagerInit();
+
+    //Everyone the old process handed over goes back where they were before any thread runs
+    if(upgrade)
+    {
+        gameManagerTakeOver(upgrade);
+        lobbyTakeOver(upgrade);
+    }
+
+    gameManagerStart();
+
+    //The threads responsible for listening to incomming TCP connection attempts. They all accept from one listen socket.
+    //Once a connection is made, it is queued for the lobby thread of its shard,
+    //which is woken up if it is blocked waiting for lobby activity.
+    SOCKET const listenSocket = connectionsAcceptorInit(upgrade ? upgrade->listenSocket : INVALID_SOCKET);
+    hotUpgradeFree(upgrade);
+    for(size_t i = 0; i < g_serverConfig.acceptThreads; ++i)
+        _beginthread(acceptConnectionsThreadStart, ACCEPT_CONNECTIONS_STACKSIZE, (void*)(uintptr_t)listenSocket);
+
+    //Serves the counters and latency histograms as plain text on 127.0.0.1:METRICS_PORT.
+    _beginthread(metricsThreadStart, METRICS_STACKSIZE, NULL);
+
+    //The threads responsible for the players who are connected but not playing a chess game, one per lobby shard.
+    HANDLE lobbyThreadHandles[MAX_LOBBY_THREADS];
+    for(size_t i = 0; i < g_serverConfig.lobbyThreads; ++i)
+    {
+        //_beginthreadex() and not _beginthread(), since the CRT closes a _beginthread() handle as soon as the thread ends
+        lobbyThreadHandles[i] = (HANDLE)_beginthreadex(NULL, LOBBY_MANAGER_STACKSIZE, lobbyManagerThreadStart, (void*)(uintptr_t)i, 0, NULL);
+        if( ! lobbyThreadHandles[i] )
+        {
+            logError("could not start a lobby thread", (int)GetLastError());
+            exit(0);
+        }
+    }
+
+    //Waits for a new build of the server to take over.
+    _beginthread(hotUpgradeThreadStart, HOT_UPGRADE_STACKSIZE, NULL);
+
+    //The lobby threads only end once the server was handed over to a new process.
+    //Otherwise the server keeps going until you press ctrl C or close the console.
+    WaitForMultipleObjects((DWORD)g_serverConfig.lobbyThreads, lobbyThreadHandles, TRUE, INFINITE);
+    for(size_t i = 0; i < g_serverConfig.lobbyThreads; ++i)
+        CloseHandle(lobbyThreadHandles[i]);
+
+    int const exitCode = hotUpgradeFinish();
     WSACleanup();
-    return EXIT_SUCCESS;
+    return exitCode;
 }
 
 BOOL WINAPI signalHandler(_In_ DWORD signalType)
@@ -50,12 +142,12 @@ BOOL WINAPI signalHandler(_In_ DWORD signalType)
     switch(signalType)
     {
     case CTRL_C_EVENT: 
-        puts("ctrl c event being handled..."); 
+        logInfo("ctrl c event being handled..."); 
         break; 
     case CTRL_CLOSE_EVENT://the console was closed
         break;
     case CTRL_BREAK_EVENT:
-        puts("ctrl break/pause event being handled...");
+        logInfo("ctrl break/pause event being handled...");
         break;
 
     default:
@@ -64,6 +156,8 @@ BOOL WINAPI signalHandler(_In_ DWORD signalType)
 
     //TODO Send server shutdown message to client.
 
+    //ExitProcess() does not run the atexit() handlers, so write out what is still in the log ring here
+    loggerShutdown();
     ExitProcess(signalType);
     return TRUE;
 }
\ No newline at end of file
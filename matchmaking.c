@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <intrin.h>
+
+#include "matchmaking.h"
+
+static_assert(MATCHMAKING_NUM_OF_BUCKETS % 64 == 0, "the bucket bitmap is made of 64 bit words");
+static_assert(MATCHMAKING_BUCKET_WIDTH <= MATCHMAKING_BASE_BAND, "matchmakerRun() pairs the players of a bucket without looking at their ratings");
+
+static size_t bucketOf(uint16_t rating)
+{
+    return rating / MATCHMAKING_BUCKET_WIDTH;
+}
+
+static bool isBucketEmpty(Matchmaker const* matchmaker, size_t bucket)
+{
+    MatchmakingNode const* head = matchmaker->buckets + bucket;
+    return head->next == head;
+}
+
+//how far from their own rating a player takes an opponent after waiting since node->queuedMs
+static uint64_t ratingBand(MatchmakingNode const* node, uint64_t nowMs)
+{
+    uint64_t const waitedMs = (nowMs > node->queuedMs) ? nowMs - node->queuedMs : 0;
+    uint64_t const band = MATCHMAKING_BASE_BAND + waitedMs * MATCHMAKING_BAND_WIDENING_PER_SEC / 1000;
+    return band < MATCHMAKING_MAX_RATING ? band : MATCHMAKING_MAX_RATING;
+}
+
+static bool areCloseEnough(MatchmakingNode const* a, MatchmakingNode const* b, uint64_t nowMs)
+{
+    uint64_t const difference = (a->rating > b->rating) ? a->rating - b->rating : b->rating - a->rating;
+    return difference <= ratingBand(a, nowMs) || difference <= ratingBand(b, nowMs);
+}
+
+void matchmakerInit(Matchmaker* matchmaker)
+{
+    for(size_t i = 0; i < MATCHMAKING_NUM_OF_BUCKETS; ++i)
+        matchmaker->buckets[i].next = matchmaker->buckets[i].prev = matchmaker->buckets + i;
+
+    for(size_t i = 0; i < MATCHMAKING_NUM_OF_BUCKETS / 64; ++i)
+        matchmaker->occupied[i] = 0;
+
+    matchmaker->numOfQueued = 0;
+}
+
+void matchmakerEnqueue(Matchmaker* matchmaker, MatchmakingNode* node, uint16_t rating, uint64_t queuedMs)
+{
+    assert( ! matchmakingNodeIsQueued(node) );
+
+    node->rating = (rating < MATCHMAKING_MAX_RATING) ? rating : MATCHMAKING_MAX_RATING;
+    node->queuedMs = queuedMs;
+
+    size_t const bucket = bucketOf(node->rating);
+    MatchmakingNode* head = matchmaker->buckets + bucket;
+
+    //at the back, so the buckets stay in the order the players started waiting (unless a MatchCallback puts one back)
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+
+    matchmaker->occupied[bucket / 64] |= 1ull << (bucket % 64);
+    ++matchmaker->numOfQueued;
+}
+
+void matchmakerRemove(Matchmaker* matchmaker, MatchmakingNode* node)
+{
+    if( ! matchmakingNodeIsQueued(node) )
+        return;
+
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+
+    size_t const bucket = bucketOf(node->rating);
+    if(isBucketEmpty(matchmaker, bucket))
+        matchmaker->occupied[bucket / 64] &= ~(1ull << (bucket % 64));
+
+    --matchmaker->numOfQueued;
+}
+
+static void match(Matchmaker* matchmaker, MatchmakingNode* older, MatchmakingNode* newer, MatchCallback callback, void* ctx)
+{
+    matchmakerRemove(matchmaker, older);
+    matchmakerRemove(matchmaker, newer);
+    callback(older, newer, ctx);
+}
+
+size_t matchmakerRun(Matchmaker* matchmaker, uint64_t nowMs, MatchCallback callback, void* ctx)
+{
+    size_t numOfMatches = 0;
+
+    //the one player left over in the last bucket that had players, who can still be matched with the next bucket's oldest player
+    MatchmakingNode* leftOver = NULL;
+
+    for(size_t word = 0; word < MATCHMAKING_NUM_OF_BUCKETS / 64; ++word)
+    {
+        //the buckets are visited in order, and a callback can only put players back in a bucket that was already visited
+        //(or this one), so looking at each word of the bitmap once is enough
+        uint64_t bits = matchmaker->occupied[word];
+        while(bits)
+        {
+            unsigned long index = 0;
+            _BitScanForward64(&index, bits);
+            bits &= bits - 1;
+
+            size_t const bucket = word * 64 + index;
+            MatchmakingNode* head = matchmaker->buckets + bucket;
+            if(isBucketEmpty(matchmaker, bucket))
+                continue;
+
+            if(leftOver && matchmakingNodeIsQueued(leftOver) && areCloseEnough(leftOver, head->next, nowMs))
+            {
+                MatchmakingNode* other = head->next;
+                if(other->queuedMs < leftOver->queuedMs)
+                    match(matchmaker, other, leftOver, callback, ctx);
+                else
+                    match(matchmaker, leftOver, other, callback, ctx);
+
+                ++numOfMatches;
+            }
+
+            leftOver = NULL;
+
+            //everyone in a bucket is within MATCHMAKING_BUCKET_WIDTH (< MATCHMAKING_BASE_BAND) of each other
+            while( ! isBucketEmpty(matchmaker, bucket) && head->next->next != head )
+            {
+                match(matchmaker, head->next, head->next->next, callback, ctx);
+                ++numOfMatches;
+            }
+
+            if( ! isBucketEmpty(matchmaker, bucket) )
+                leftOver = head->next;
+        }
+    }
+
+    return numOfMatches;
+}
@@ -0,0 +1,90 @@
+#ifndef MATCHMAKING_H
+#define MATCHMAKING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//The automatic matchmaking queue of the matchmaking lobby shard (players who sent FIND_GAME_MSGTYPE, see lobbyManager.c).
+//Queued players are kept in buckets of MATCHMAKING_BUCKET_WIDTH rating points, and every bucket is a FIFO list,
+//so the players who waited the longest are matched first. A bitmap of the buckets that have players lets
+//matchmakerRun() skip the empty ones.
+//
+//matchmakerRun() is called once per matchmaking tick and pairs as many players as it can in one pass over the buckets:
+//the players of a bucket are paired with each other two at a time, and the one left over is paired with the oldest
+//player of the next bucket that has players if their ratings are close enough. "Close enough" is a band around a
+//player's rating that starts at MATCHMAKING_BASE_BAND and widens by MATCHMAKING_BAND_WIDENING_PER_SEC every second they wait,
+//and two players are matched if either of them would take the other, so no one waits forever just because the queue is thin.
+//
+//Players are MatchmakingNodes embedded in whatever they are the node of, so enqueueing and removing are O(1) and never allocate,
+//and a run costs O(number of buckets + number of matches) no matter how many players are queued.
+//Not thread safe.
+
+#define MATCHMAKING_BUCKET_WIDTH 32
+
+//has to be a multiple of 64
+#define MATCHMAKING_NUM_OF_BUCKETS 128
+
+//higher ratings are treated as this one
+#define MATCHMAKING_MAX_RATING (MATCHMAKING_BUCKET_WIDTH * MATCHMAKING_NUM_OF_BUCKETS - 1)
+
+#define MATCHMAKING_BASE_BAND 64
+#define MATCHMAKING_BAND_WIDENING_PER_SEC 32
+
+typedef struct MatchmakingNode
+{
+    //NULL while the node is not queued
+    struct MatchmakingNode* next;
+    struct MatchmakingNode* prev;
+
+    //when the node was queued, on the clock the matchmaker is used with
+    uint64_t queuedMs;
+
+    uint16_t rating;
+}MatchmakingNode;
+
+typedef struct
+{
+    //the list head of every bucket. a bucket whose head points at itself is empty
+    MatchmakingNode buckets[MATCHMAKING_NUM_OF_BUCKETS];
+
+    //bit i is set if buckets[i] has players
+    uint64_t occupied[MATCHMAKING_NUM_OF_BUCKETS / 64];
+
+    size_t numOfQueued;
+
+}Matchmaker;
+
+//called for every two players matchmakerRun() matched. both are already out of the queue
+typedef void (*MatchCallback)(MatchmakingNode* player1, MatchmakingNode* player2, void* ctx);
+
+void matchmakerInit(Matchmaker* matchmaker);
+
+//make a node that is not queued. has to be called on a MatchmakingNode before anything else
+static inline void matchmakingNodeInit(MatchmakingNode* node)
+{
+    node->next = node->prev = NULL;
+}
+
+static inline bool matchmakingNodeIsQueued(MatchmakingNode const* node)
+{
+    return node->next != NULL;
+}
+
+static inline size_t matchmakerSize(Matchmaker const* matchmaker)
+{
+    return matchmaker->numOfQueued;
+}
+
+//O(1). Put node (which must not be queued already) at the back of the bucket of rating.
+//queuedMs is when the player started waiting, which is what their band widens from.
+void matchmakerEnqueue(Matchmaker* matchmaker, MatchmakingNode* node, uint16_t rating, uint64_t queuedMs);
+
+//O(1). Does nothing if node is not queued.
+void matchmakerRemove(Matchmaker* matchmaker, MatchmakingNode* node);
+
+//Pair up as many queued players as possible at nowMs, and call callback for every pair (the player who waited longer first).
+//callback can put one of the two players back in the queue (with matchmakerEnqueue()). Returns how many pairs were made.
+size_t matchmakerRun(Matchmaker* matchmaker, uint64_t nowMs, MatchCallback callback, void* ctx);
+
+#endif //MATCHMAKING_H
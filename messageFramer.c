@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <winsock2.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "messageFramer.h"
+#include "chessNetworkProtocol.h"
+
+//every message in the protocol has to fit in MessageFramer::wrapped
+#define ASSERT_MESSAGE_FITS(name, size, direction, state) \
+    static_assert((size) >= 2 && (size) <= MESSAGE_FRAMER_MAX_MESSAGE_SIZE, #name "_MSGSIZE does not fit in a MessageFramer");
+CHESS_MESSAGE_TABLE(ASSERT_MESSAGE_FITS)
+#undef ASSERT_MESSAGE_FITS
+
+#define RING_INDEX(pos) ((pos) & (MESSAGE_FRAMER_CAPACITY - 1))
+
+void messageFramerInit(MessageFramer* framer)
+{
+    framer->head = 0;
+    framer->tail = 0;
+}
+
+int messageFramerRecv(SOCKET sock, MessageFramer* framer, size_t maxBytes)
+{
+    size_t const freeSize = min(maxBytes, MESSAGE_FRAMER_CAPACITY - messageFramerSize(framer));
+    if(freeSize == 0)
+    {
+        //a recv() of 0 bytes would look like the connection was closed
+        WSASetLastError(WSAEWOULDBLOCK);
+        return SOCKET_ERROR;
+    }
+
+    //the free part of the ring is at most two pieces: from tail to the end of data, and from the start of data to head
+    uint32_t const writePos = RING_INDEX(framer->tail);
+    size_t const firstPieceSize = min(freeSize, MESSAGE_FRAMER_CAPACITY - writePos);
+
+    WSABUF buffers[2];
+    buffers[0].buf = framer->data + writePos;
+    buffers[0].len = (ULONG)firstPieceSize;
+    buffers[1].buf = framer->data;
+    buffers[1].len = (ULONG)(freeSize - firstPieceSize);
+
+    DWORD numBytesReceived = 0;
+    DWORD flags = 0;
+    if(WSARecv(sock, buffers, buffers[1].len ? 2 : 1, &numBytesReceived, &flags, NULL, NULL) == SOCKET_ERROR)
+        return SOCKET_ERROR;
+
+    framer->tail += numBytesReceived;
+    return (int)numBytesReceived;
+}
+
+FramerResult messageFramerNext(MessageFramer* framer, MessageView* view)
+{
+    uint32_t const bufferedSize = messageFramerSize(framer);
+    if(bufferedSize < 2)
+        return FRAMER_NEED_MORE_BYTES;
+
+    uint8_t const msgSize = (uint8_t)framer->data[RING_INDEX(framer->head + 1)];
+    if(msgSize < 2 || msgSize > MESSAGE_FRAMER_MAX_MESSAGE_SIZE)
+        return FRAMER_MALFORMED_MESSAGE;
+
+    if(bufferedSize < msgSize)
+        return FRAMER_NEED_MORE_BYTES;
+
+    uint32_t const readPos = RING_INDEX(framer->head);
+    if(readPos + msgSize <= MESSAGE_FRAMER_CAPACITY)
+    {
+        view->data = framer->data + readPos;
+    }
+    else
+    {
+        size_t const firstPieceSize = MESSAGE_FRAMER_CAPACITY - readPos;
+        memcpy(framer->wrapped, framer->data + readPos, firstPieceSize);
+        memcpy(framer->wrapped + firstPieceSize, framer->data, msgSize - firstPieceSize);
+        view->data = framer->wrapped;
+    }
+
+    view->size = msgSize;
+    framer->head += msgSize;
+    return FRAMER_MESSAGE_READY;
+}
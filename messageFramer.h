@@ -0,0 +1,61 @@
+#ifndef MESSAGE_FRAMER_H
+#define MESSAGE_FRAMER_H
+
+#include <winsock2.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//Splits the bytes received from a connection into messages (a 2 byte header of type and size, see chessNetworkProtocol.h).
+//Bytes are received straight into a ring buffer (one WSARecv() into both free pieces of the ring), and every complete
+//message is handed out as a view into the ring, so nothing is allocated or moved around per message.
+//Only a message that wraps around the end of the ring is copied, into MessageFramer::wrapped.
+//The lobby and the game workers drain every complete message after each read.
+
+//must be a power of 2
+#define MESSAGE_FRAMER_CAPACITY 512
+
+//No message in the protocol is bigger than this. A header with a bigger size (or a size smaller than the header)
+//is rejected as soon as the header arrives, instead of waiting on the rest of a message that is never coming.
+#define MESSAGE_FRAMER_MAX_MESSAGE_SIZE 16
+
+typedef struct
+{
+    char data[MESSAGE_FRAMER_CAPACITY];
+
+    //free running read and write positions. (tail - head) bytes are buffered
+    uint32_t head;
+    uint32_t tail;
+
+    //where a message that wraps around the end of data is put back together
+    char wrapped[MESSAGE_FRAMER_MAX_MESSAGE_SIZE];
+
+}MessageFramer;
+
+//a message inside a MessageFramer. size is the size of the whole message, header included
+typedef struct
+{
+    char const* data;
+    size_t size;
+}MessageView;
+
+typedef enum
+{
+    FRAMER_MESSAGE_READY,
+    FRAMER_NEED_MORE_BYTES,
+    FRAMER_MALFORMED_MESSAGE//the connection should be closed
+}FramerResult;
+
+void messageFramerInit(MessageFramer* framer);
+
+static inline uint32_t messageFramerSize(MessageFramer const* framer) {return framer->tail - framer->head;}
+
+//Receive at most maxBytes (and no more than there is room for) into framer.
+//Returns the same thing recv() would: the number of bytes received, 0 if the connection was closed, or SOCKET_ERROR.
+int messageFramerRecv(SOCKET sock, MessageFramer* framer, size_t maxBytes);
+
+//Take the next complete message out of framer. view is only valid until the next messageFramerRecv().
+//On FRAMER_NEED_MORE_BYTES and FRAMER_MALFORMED_MESSAGE nothing is taken out.
+FramerResult messageFramerNext(MessageFramer* framer, MessageView* view);
+
+#endif //MESSAGE_FRAMER_H
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "metrics.h"
+#include "errorLogger.h"
+#include "lobbyManager.h"
+#include "gameManager.h"
+#include "chessNetworkProtocol.h"
+
+//the acceptor, the lobby, the game workers and a few spare
+#define MAX_METRICS_SHARDS 256
+
+//big enough for every counter and histogram line
+#define METRICS_REPORT_SIZE 8192
+
+_Thread_local MetricsShard* g_metricsShard = NULL;
+
+//every shard ever registered. shards are never freed, so the admin thread can read them
+//while their threads keep recording. the lock only guards adding to the array
+static MetricsShard* s_shards[MAX_METRICS_SHARDS];
+static size_t s_numOfShards = 0;
+static CRITICAL_SECTION s_shardsMutex;
+
+static char const* const s_counterNames[METRIC_COUNTER_COUNT] =
+{
+    "connections_accepted",
+    "connections_rejected",
+    "connections_throttled",
+    "games_started",
+    "matchmaking_matches",
+    "illegal_moves",
+    "players_away",
+    "games_resumed",
+    "resumes_failed",
+    "spectators_joined",
+    "spectators_dropped",
+    "game_io_syscalls",
+    "bytes_in",
+    "bytes_out"
+};
+
+static char const* const s_histogramNames[METRIC_HISTOGRAM_COUNT] =
+{
+    "forward_latency_ns",
+    "loop_iteration_ns",
+    "matchmaking_wait_ns"
+};
+
+void metricsInit(void)
+{
+    InitializeCriticalSection(&s_shardsMutex);
+}
+
+void metricsRegisterThread(void)
+{
+    if(g_metricsShard)
+        return;
+
+    MetricsShard* shard = calloc(1, sizeof(MetricsShard));
+    if( ! shard )
+    {
+        logError("calloc failed to allocate a metrics shard", 0);
+        exit(0);
+    }
+
+    EnterCriticalSection(&s_shardsMutex);
+    bool const hasRoom = s_numOfShards < MAX_METRICS_SHARDS;
+    if(hasRoom) s_shards[s_numOfShards++] = shard;
+    LeaveCriticalSection(&s_shardsMutex);
+
+    if( ! hasRoom )
+    {
+        //this thread just wont record anything
+        logWarn("there are more than %d threads recording metrics", MAX_METRICS_SHARDS);
+        free(shard);
+        return;
+    }
+
+    g_metricsShard = shard;
+}
+
+//the highest value that falls in the bucket of the given percentile (0 - 100)
+static uint64_t histogramPercentile(uint64_t const* buckets, uint64_t totalCount, double percentile)
+{
+    uint64_t const rank = (uint64_t)(totalCount * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if(seen >= rank && buckets[i])
+            return (i + 1 < METRIC_HISTOGRAM_BUCKETS) ? metricBucketLowestValue(i + 1) - 1 : UINT64_MAX;
+    }
+
+    return 0;
+}
+
+//Add every shard up and write the report into buff. Other threads keep recording while this reads,
+//so the numbers are not a snapshot of one instant, but every single value is read whole.
+static int buildMetricsReport(char* buff, size_t buffSize)
+{
+    uint64_t counters[METRIC_COUNTER_COUNT] = {0};
+    uint64_t messagesIn[METRIC_MESSAGE_TYPE_SLOTS] = {0};
+    static uint64_t histograms[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS];//only the admin thread uses this
+    memset(histograms, 0, sizeof(histograms));
+
+    EnterCriticalSection(&s_shardsMutex);
+    for(size_t s = 0; s < s_numOfShards; ++s)
+    {
+        MetricsShard const* shard = s_shards[s];
+
+        for(int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+            counters[i] += shard->counters[i];
+
+        for(int i = 0; i < METRIC_MESSAGE_TYPE_SLOTS; ++i)
+            messagesIn[i] += shard->messagesIn[i];
+
+        for(int h = 0; h < METRIC_HISTOGRAM_COUNT; ++h)
+            for(int i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+                histograms[h][i] += shard->histograms[h][i];
+    }
+    LeaveCriticalSection(&s_shardsMutex);
+
+    int len = 0;
+    #define APPEND(...) do { \
+        len += snprintf(buff + len, buffSize - len, __VA_ARGS__); \
+        if(len >= (int)buffSize) return (int)buffSize - 1; \
+    } while(0)
+
+    for(int i = 0; i < METRIC_COUNTER_COUNT; ++i)
+        APPEND("%s %llu\n", s_counterNames[i], (unsigned long long)counters[i]);
+
+    APPEND("lobby_size %zu\n", getLobbySize());
+    APPEND("active_games %zu\n", getNumOfRunningGames());
+
+    for(int i = 0; i < METRIC_MESSAGE_TYPE_SLOTS; ++i)
+    {
+        if(messagesIn[i])
+            APPEND("messages_in{type=\"%s\"} %llu\n", messageTypeName((uint8_t)i), (unsigned long long)messagesIn[i]);
+    }
+
+    for(int h = 0; h < METRIC_HISTOGRAM_COUNT; ++h)
+    {
+        uint64_t totalCount = 0;
+        for(int i = 0; i < METRIC_HISTOGRAM_BUCKETS; ++i)
+            totalCount += histograms[h][i];
+
+        APPEND("%s count=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n", s_histogramNames[h],
+            (unsigned long long)totalCount,
+            (unsigned long long)histogramPercentile(histograms[h], totalCount, 50.0),
+            (unsigned long long)histogramPercentile(histograms[h], totalCount, 90.0),
+            (unsigned long long)histogramPercentile(histograms[h], totalCount, 99.0),
+            (unsigned long long)histogramPercentile(histograms[h], totalCount, 99.9),
+            (unsigned long long)histogramPercentile(histograms[h], totalCount, 100.0));
+    }
+
+    #undef APPEND
+    return len;
+}
+
+static SOCKET createMetricsListenSocket(void)
+{
+    SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(listenSocket == INVALID_SOCKET)
+    {
+        logError("socket() failed for the metrics admin port", WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+
+    SOCKADDR_IN addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(METRICS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(bind(listenSocket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+       listen(listenSocket, 8) == SOCKET_ERROR)
+    {
+        logError("failed to listen on the metrics admin port", WSAGetLastError());
+        closesocket(listenSocket);
+        return INVALID_SOCKET;
+    }
+
+    return listenSocket;
+}
+
+//answer one admin connection. it is answered as http so a browser or curl can be pointed at it,
+//but anything that connects (like netcat) just gets the report
+static void serveMetrics(SOCKET sock)
+{
+    //read the request if there is one, but dont wait on it for long
+    DWORD const recvTimeoutMs = 200;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char const*)&recvTimeoutMs, sizeof(recvTimeoutMs));
+    char request[1024];
+    recv(sock, request, sizeof(request), 0);
+
+    static char report[METRICS_REPORT_SIZE];//only the admin thread uses this
+    int const reportSize = buildMetricsReport(report, sizeof(report));
+
+    char header[128] = {0};
+    int const headerSize = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n", reportSize);
+
+    send(sock, header, headerSize, 0);
+    send(sock, report, reportSize, 0);
+    shutdown(sock, SD_SEND);
+    closesocket(sock);
+}
+
+void __stdcall metricsThreadStart(void* arg)
+{
+    SOCKET listenSocket = createMetricsListenSocket();
+    if(listenSocket == INVALID_SOCKET)
+        return;
+
+    logInfo("metrics are served on 127.0.0.1:%d", METRICS_PORT);
+
+    while(true)
+    {
+        SOCKET sock = accept(listenSocket, NULL, NULL);
+        if(sock == INVALID_SOCKET)
+        {
+            logError("accept() failed on the metrics admin port", WSAGetLastError());
+            continue;
+        }
+
+        serveMetrics(sock);
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <intrin.h>
+
+//Counters and latency histograms about what the server is doing. Every thread that records something
+//has its own MetricsShard, so recording is a plain add to memory no other thread writes to (no atomics, no locks).
+//The shards are only added up when someone connects to the admin port (see metricsThreadStart()).
+
+//the admin port only listens on the loopback address
+#define METRICS_PORT 42070
+#define METRICS_STACKSIZE 64000
+
+typedef enum
+{
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_REJECTED,//sent SERVER_FULL_MSGTYPE because the lobby was full
+    METRIC_CONNECTIONS_THROTTLED,//reset by admission control (see admissionControl.h)
+    METRIC_GAMES_STARTED,
+    METRIC_MATCHMAKING_MATCHES,//games started by the FIND_GAME_MSGTYPE queue (see matchmaking.h). also counted in METRIC_GAMES_STARTED
+    METRIC_ILLEGAL_MOVES,//MOVE_MSGTYPEs rejected by the server side move validation (see CHESS_SERVER_VALIDATE_MOVES in serverConfig.h)
+    METRIC_PLAYERS_AWAY,//players who lost their connection in a game that waited for them to come back with RESUME_GAME_MSGTYPE
+    METRIC_GAMES_RESUMED,//players who came back with RESUME_GAME_MSGTYPE in time
+    METRIC_RESUMES_FAILED,//RESUME_GAME_MSGTYPEs answered with RESUME_FAILED_MSGTYPE
+    METRIC_SPECTATORS_JOINED,//SPECTATE_MSGTYPEs answered with SPECTATE_START_MSGTYPE
+    METRIC_SPECTATORS_DROPPED,//spectators disconnected for falling too far behind their game
+    METRIC_GAME_IO_SYSCALLS,//WSAPoll() calls of the game workers and the recv(), WSASend() (or RIO receive, send and notify, see registeredIO.h) calls for their players
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_COUNTER_COUNT
+}MetricCounter;
+
+typedef enum
+{
+    METRIC_HISTOGRAM_FORWARD_LATENCY,//from recv() of a game message to forwardMessage() queueing it for the opponent
+    METRIC_HISTOGRAM_LOOP_ITERATION,//time the lobby or a game worker spends handling one WSAPoll() wake up
+    METRIC_HISTOGRAM_MATCHMAKING_WAIT,//from FIND_GAME_MSGTYPE to being matched
+    METRIC_HISTOGRAM_COUNT
+}MetricHistogram;
+
+//Histograms are log-linear like HdrHistogram: every power of 2 is split into 8 linear sub buckets,
+//so a recorded value is off by at most 12.5%. Values are in nanoseconds.
+#define METRIC_SUB_BUCKET_BITS 3
+#define METRIC_SUB_BUCKET_COUNT (1 << METRIC_SUB_BUCKET_BITS)
+#define METRIC_HISTOGRAM_BUCKETS ((64 - METRIC_SUB_BUCKET_BITS + 1) * METRIC_SUB_BUCKET_COUNT)
+
+//messages received are counted by their first byte (MessageType). anything past this is counted in the last slot
+#define METRIC_MESSAGE_TYPE_SLOTS 32
+
+typedef struct
+{
+    //only ever written by the thread that owns the shard
+    volatile uint64_t counters[METRIC_COUNTER_COUNT];
+    volatile uint64_t messagesIn[METRIC_MESSAGE_TYPE_SLOTS];
+    volatile uint64_t histograms[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS];
+
+    //keeps the next shard off of this shard's last cache line
+    char padding[64];
+
+}MetricsShard;
+
+//the shard of the calling thread, or NULL if it did not call metricsRegisterThread()
+extern _Thread_local MetricsShard* g_metricsShard;
+
+//has to be called before any thread calls metricsRegisterThread()
+void metricsInit(void);
+
+//Give the calling thread its own shard. Has to be called by every thread that records metrics,
+//otherwise what it records is dropped.
+void metricsRegisterThread(void);
+
+//the index of the histogram bucket that value falls in
+static inline uint32_t metricBucketIndex(uint64_t value)
+{
+    if(value < METRIC_SUB_BUCKET_COUNT)
+        return (uint32_t)value;
+
+    unsigned long msb = 0;
+    _BitScanReverse64(&msb, value);
+
+    uint32_t const subBucket = (uint32_t)(value >> (msb - METRIC_SUB_BUCKET_BITS)) & (METRIC_SUB_BUCKET_COUNT - 1);
+    return (msb - METRIC_SUB_BUCKET_BITS + 1) * METRIC_SUB_BUCKET_COUNT + subBucket;
+}
+
+//the smallest value that falls in bucket index (the inverse of metricBucketIndex())
+static inline uint64_t metricBucketLowestValue(uint32_t index)
+{
+    if(index < METRIC_SUB_BUCKET_COUNT)
+        return index;
+
+    uint32_t const msb = index / METRIC_SUB_BUCKET_COUNT + METRIC_SUB_BUCKET_BITS - 1;
+    uint64_t const subBucket = index % METRIC_SUB_BUCKET_COUNT;
+    return (METRIC_SUB_BUCKET_COUNT + subBucket) << (msb - METRIC_SUB_BUCKET_BITS);
+}
+
+static inline void metricsAdd(MetricCounter counter, uint64_t amount)
+{
+    MetricsShard* shard = g_metricsShard;
+    if(shard) shard->counters[counter] += amount;
+}
+
+static inline void metricsCountMessage(uint8_t msgType)
+{
+    MetricsShard* shard = g_metricsShard;
+    if(shard) ++shard->messagesIn[msgType < METRIC_MESSAGE_TYPE_SLOTS ? msgType : METRIC_MESSAGE_TYPE_SLOTS - 1];
+}
+
+static inline void metricsRecord(MetricHistogram histogram, uint64_t nanoseconds)
+{
+    MetricsShard* shard = g_metricsShard;
+    if(shard) ++shard->histograms[histogram][metricBucketIndex(nanoseconds)];
+}
+
+//the start of the admin thread. every connection to 127.0.0.1:METRICS_PORT gets a plain text
+//report of the metrics added up over every shard, and is then closed.
+void __stdcall metricsThreadStart(void*);
+
+#endif //METRICS_H
@@ -1,19 +1,123 @@
 #include <WS2tcpip.h>
 #include <stdint.h>
+#include <string.h>
 
-//returns -1 if send() fails
-int networkSendAll(SOCKET sock, char const* data, size_t const dataSize)
+#include "networkWrite.h"
+#include "errorLogger.h"
+#include "metrics.h"
+
+void outBufferInit(OutBuffer* out)
+{
+    out->head = 0;
+    out->tail = 0;
+    out->firstQueuedUs = 0;
+    out->isBlocked = false;
+}
+
+//returns false if data does not fit
+static bool outBufferAppend(OutBuffer* out, char const* data, size_t dataSize)
+{
+    if(dataSize > OUT_BUFFER_CAPACITY - (out->tail - out->head))
+        return false;
+
+    if(outBufferIsEmpty(out))
+        out->firstQueuedUs = getMonotonicMicroseconds();
+
+    //copy in at most two pieces since the data might wrap around the end of the ring
+    uint32_t const writePos = out->tail & (OUT_BUFFER_CAPACITY - 1);
+    size_t const firstPieceSize = min(dataSize, OUT_BUFFER_CAPACITY - writePos);
+    memcpy(out->data + writePos, data, firstPieceSize);
+    memcpy(out->data, data + firstPieceSize, dataSize - firstPieceSize);
+
+    out->tail += (uint32_t)dataSize;
+    return true;
+}
+
+int networkQueueSend(SOCKET sock, OutBuffer* out, char const* data, size_t dataSize)
+{
+    if(outBufferAppend(out, data, dataSize))
+        return 0;
+
+    //if the socket is known to be full there is no point in trying
+    if(out->isBlocked || networkFlush(sock, out) == SOCKET_ERROR)
+        return SOCKET_ERROR;
+
+    return outBufferAppend(out, data, dataSize) ? 0 : SOCKET_ERROR;
+}
+
+bool outBufferAppendBuffer(OutBuffer* dst, OutBuffer const* src)
+{
+    uint32_t const readPos = src->head & (OUT_BUFFER_CAPACITY - 1);
+    uint32_t const queuedSize = src->tail - src->head;
+    uint32_t const firstPieceSize = min(queuedSize, OUT_BUFFER_CAPACITY - readPos);
+
+    if(queuedSize > OUT_BUFFER_CAPACITY - (dst->tail - dst->head))
+        return false;
+
+    bool const wasEmpty = outBufferIsEmpty(dst);
+    outBufferAppend(dst, src->data + readPos, firstPieceSize);
+    outBufferAppend(dst, src->data, queuedSize - firstPieceSize);
+
+    //the bytes from src have been waiting since src->firstQueuedUs
+    if(queuedSize && (wasEmpty || src->firstQueuedUs < dst->firstQueuedUs))
+        dst->firstQueuedUs = src->firstQueuedUs;
+
+    return true;
+}
+
+int networkFlush(SOCKET sock, OutBuffer* out)
 {
-    int32_t numBytesSent = 0, numBytesToSend = dataSize;
-    while(numBytesSent < dataSize)
+    while( ! outBufferIsEmpty(out) )
     {
-        int sendResult = send(sock, data + numBytesSent, numBytesToSend, 0);
+        //gather the (at most two) pieces of the ring into one WSASend() call
+        uint32_t const readPos = out->head & (OUT_BUFFER_CAPACITY - 1);
+        uint32_t const queuedSize = out->tail - out->head;
+        uint32_t const firstPieceSize = min(queuedSize, OUT_BUFFER_CAPACITY - readPos);
 
-        if(sendResult == SOCKET_ERROR) return -1;
+        WSABUF pieces[2] = 
+        {
+            {.len = firstPieceSize, .buf = out->data + readPos},
+            {.len = queuedSize - firstPieceSize, .buf = out->data}
+        };
 
-        numBytesSent += sendResult;
-        numBytesToSend -= sendResult;
+        DWORD numBytesSent = 0;
+        if(WSASend(sock, pieces, pieces[1].len ? 2 : 1, &numBytesSent, 0, NULL, NULL) == SOCKET_ERROR)
+        {
+            if(WSAGetLastError() != WSAEWOULDBLOCK)
+                return SOCKET_ERROR;
+
+            //the socket's send buffer is full. the rest stays queued until the socket is writable
+            out->isBlocked = true;
+            return 0;
+        }
+
+        out->head += numBytesSent;
+        metricsAdd(METRIC_BYTES_OUT, numBytesSent);
     }
 
+    out->isBlocked = false;
     return 0;
-}
\ No newline at end of file
+}
+
+bool outBufferIsFlushDue(OutBuffer const* out, uint64_t nowUs)
+{
+    if(outBufferIsEmpty(out) || out->isBlocked) 
+        return false;
+
+    return (out->tail - out->head) > OUT_BUFFER_CAPACITY / 2 || nowUs >= outBufferFlushDeadline(out);
+}
+
+uint64_t outBufferFlushDeadline(OutBuffer const* out)
+{
+    return out->firstQueuedUs + OUTBOUND_LATENCY_CAP_US;
+}
+
+bool outBufferUpdateBackpressure(OutBuffer const* out, bool* isProducerPaused)
+{
+    if(outBufferSize(out) > OUT_BUFFER_HIGH_WATERMARK)
+        *isProducerPaused = true;
+    else if(outBufferSize(out) < OUT_BUFFER_LOW_WATERMARK)
+        *isProducerPaused = false;
+
+    return *isProducerPaused;
+}
@@ -1,5 +1,72 @@
 #pragma once
 #include <WS2tcpip.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-int networkSendAll(SOCKET sock, char const* data, size_t dataSize);
+//The outgoing bytes of a connection are queued in an OutBuffer and sent with one
+//gathered WSASend() per event loop iteration, instead of one send() per (2 - 10 byte) message.
+//Since the server does its own coalescing, accepted sockets have nagle's algorithm turned off (TCP_NODELAY).
+//
+//Every accepted socket is non blocking, so a client that stops reading can never stall a thread.
+//Whatever the socket does not take stays queued until WSAPoll() reports it as writable (POLLWRNORM).
+//The capacity of the OutBuffer is the limit of the queue. A connection whose queue would go past it is disconnected.
 
+//must be a power of 2
+#define OUT_BUFFER_CAPACITY 512
+
+//When more than OUT_BUFFER_HIGH_WATERMARK bytes are queued for a connection, the event loops stop reading
+//from whoever is producing those bytes (the connection itself in the lobby, the opponent in a game)
+//until the queue drains below OUT_BUFFER_LOW_WATERMARK.
+#define OUT_BUFFER_HIGH_WATERMARK 384
+#define OUT_BUFFER_LOW_WATERMARK  128
+
+//How long (in microseconds) an event loop may hold queued bytes back to coalesce them with
+//messages from later loop iterations. 0 means every OutBuffer is flushed at the end of the
+//iteration that queued it. A buffer that is more than half full is always flushed.
+#define OUTBOUND_LATENCY_CAP_US 0
+
+//a ring buffer of bytes waiting to be sent
+typedef struct
+{
+    char data[OUT_BUFFER_CAPACITY];
+
+    //free running read and write positions. (tail - head) bytes are queued
+    uint32_t head;
+    uint32_t tail;
+
+    //when the oldest queued byte was queued (getMonotonicMicroseconds())
+    uint64_t firstQueuedUs;
+
+    //set when the last networkFlush() stopped because the socket's send buffer was full.
+    //the owner of the connection should poll for POLLWRNORM and only flush again once it is writable
+    bool isBlocked;
+
+}OutBuffer;
+
+void outBufferInit(OutBuffer* out);
+
+static inline bool outBufferIsEmpty(OutBuffer const* out) {return out->head == out->tail;}
+static inline uint32_t outBufferSize(OutBuffer const* out) {return out->tail - out->head;}
+
+//queue a message to be sent by the next networkFlush(). if it does not fit, a non blocking flush is tried
+//to make room. returns SOCKET_ERROR if the queue limit is still exceeded (or the flush fails),
+//in which case the connection should be disconnected
+int networkQueueSend(SOCKET sock, OutBuffer* out, char const* data, size_t dataSize);
+
+//copy the bytes queued in src to the back of dst (used when a connection moves between the lobby and a game)
+//returns false if they dont fit
+bool outBufferAppendBuffer(OutBuffer* dst, OutBuffer const* src);
+
+//send as much of what is queued in out as the socket takes without blocking. 
+//sets out->isBlocked if something is left over. returns SOCKET_ERROR if sending fails
+int networkFlush(SOCKET sock, OutBuffer* out);
+
+//returns true if out is not empty, not blocked and should be flushed now (see OUTBOUND_LATENCY_CAP_US)
+bool outBufferIsFlushDue(OutBuffer const* out, uint64_t nowUs);
+
+//Updates *isProducerPaused with the high/low watermark hysteresis for the queue out.
+//returns the new value
+bool outBufferUpdateBackpressure(OutBuffer const* out, bool* isProducerPaused);
+
+//the time (getMonotonicMicroseconds()) at which a non empty out has to be flushed
+uint64_t outBufferFlushDeadline(OutBuffer const* out);
@@ -0,0 +1,389 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <process.h>
+
+#include <winsock2.h>
+#include <mswsock.h>
+
+#include "registeredIO.h"
+#include "connectionPool.h"
+#include "errorLogger.h"
+#include "metrics.h"
+
+#define REGISTERED_IO_NOTIFY_STACKSIZE 16000
+
+//every request queue has room for one receive and the two sends of the two pieces of an OutBuffer,
+//and the completion queue it is tied to has room for all three of their completions
+#define RECEIVES_PER_SOCKET 1
+#define SENDS_PER_SOCKET 2
+#define COMPLETIONS_PER_SOCKET (RECEIVES_PER_SOCKET + SENDS_PER_SOCKET)
+
+//room for the completions of this many sockets at first. a full completion queue doubles (see registeredIOAttach())
+#define INITIAL_SOCKETS_PER_QUEUE 1024
+
+//how many completions registeredIODequeue() takes off the queue at a time
+#define DEQUEUE_BATCH 64
+
+//the RequestContext of a receive. a send's is its size shifted left by one with the low bit set
+#define RECEIVE_REQUEST 0
+
+static RIO_EXTENSION_FUNCTION_TABLE s_rio;
+
+//the RIO buffer of each chunk of the connection pool (see connectionPool.h), or RIO_INVALID_BUFFERID until a worker
+//registers it. a chunk never moves, so its buffer is never deregistered
+#define MAX_NUM_OF_CHUNKS ((CONNECTION_POOL_MAX_CAPACITY + CONNECTION_POOL_CHUNK_SIZE - 1) / CONNECTION_POOL_CHUNK_SIZE)
+static RIO_BUFFERID volatile s_chunkBuffers[MAX_NUM_OF_CHUNKS];
+static CRITICAL_SECTION s_registerMutex;
+
+bool registeredIOInit(void)
+{
+    //the function table can only be asked for through a socket that was created for RIO
+    SOCKET sock = WSASocketA(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+    if(sock == INVALID_SOCKET)
+    {
+        logError("WSASocket() failed to make a socket for Registered I/O, so it is off", WSAGetLastError());
+        return false;
+    }
+
+    GUID functionTableID = WSAID_MULTIPLE_RIO;
+    DWORD numOfBytes = 0;
+    s_rio.cbSize = sizeof(s_rio);
+    if(WSAIoctl(sock, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableID, sizeof(functionTableID),
+        &s_rio, sizeof(s_rio), &numOfBytes, NULL, NULL) == SOCKET_ERROR)
+    {
+        logError("winsock has no Registered I/O, so it is off", WSAGetLastError());
+        closesocket(sock);
+        return false;
+    }
+
+    closesocket(sock);
+
+    for(size_t i = 0; i < MAX_NUM_OF_CHUNKS; ++i)
+        s_chunkBuffers[i] = RIO_INVALID_BUFFERID;
+
+    InitializeCriticalSection(&s_registerMutex);
+    logInfo("the game workers use Registered I/O");
+    return true;
+}
+
+//turns every completion queue event into a signal of its worker's wakeup socket
+static void __stdcall notifyThreadStart(void* arg)
+{
+    RegisteredIOQueue* queue = arg;
+    while(true)
+    {
+        if(WaitForSingleObject(queue->event, INFINITE) == WAIT_OBJECT_0)
+            signalWakeupSocket(queue->wakeup);
+    }
+}
+
+void registeredIOQueueInit(RegisteredIOQueue* queue, size_t owner, WakeupSocket* wakeup)
+{
+    queue->owner = owner;
+    queue->wakeup = wakeup;
+    queue->numOfReserved = 0;
+    queue->numOfInFlight = 0;
+    queue->capacity = INITIAL_SOCKETS_PER_QUEUE * COMPLETIONS_PER_SOCKET;
+
+    //auto reset, so the notify thread signals the wakeup socket once per registeredIONotify()
+    queue->event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if( ! queue->event )
+    {
+        logError("CreateEvent() failed to make the event of a RIO completion queue", GetLastError());
+        exit(0);
+    }
+
+    RIO_NOTIFICATION_COMPLETION notification;
+    notification.Type = RIO_EVENT_COMPLETION;
+    notification.Event.EventHandle = queue->event;
+    notification.Event.NotifyReset = FALSE;
+
+    queue->completionQueue = s_rio.RIOCreateCompletionQueue(queue->capacity, &notification);
+    if(queue->completionQueue == RIO_INVALID_CQ)
+    {
+        logError("RIOCreateCompletionQueue() failed", WSAGetLastError());
+        exit(0);
+    }
+
+    _beginthread(notifyThreadStart, REGISTERED_IO_NOTIFY_STACKSIZE, queue);
+}
+
+void registeredIOSocketInit(RegisteredIOSocket* rio)
+{
+    rio->requestQueue = RIO_INVALID_RQ;
+    rio->queue = NULL;
+    rio->isUnusable = false;
+    rio->numOfSendsInFlight = 0;
+    rio->sendSize = 0;
+    rio->hasSendFailed = false;
+    rio->isReceivePosted = false;
+    rio->hasReceived = false;
+    rio->received = 0;
+    rio->receiveError = 0;
+}
+
+void registeredIOSocketClosed(RegisteredIOSocket* rio)
+{
+    //closing the socket freed its request queue, and so the room it had in the completion queue
+    assert(registeredIOIsIdle(rio));
+    if(rio->queue)
+        InterlockedExchangeAdd(&rio->queue->numOfReserved, -COMPLETIONS_PER_SOCKET);
+
+    registeredIOSocketInit(rio);
+}
+
+//the RIO buffer of the connection pool chunk that connection is in, registered the first time it is asked for.
+//chunkStart is set to where the chunk starts. returns RIO_INVALID_BUFFERID if it can not be registered
+static RIO_BUFFERID chunkBufferOf(Connection* connection, char** chunkStart)
+{
+    uint32_t const index = (uint32_t)connection->handle & CONNECTION_POOL_MAX_CAPACITY;
+    Connection* chunk = connection - (index & (CONNECTION_POOL_CHUNK_SIZE - 1));
+    RIO_BUFFERID volatile* buffer = s_chunkBuffers + index / CONNECTION_POOL_CHUNK_SIZE;
+    *chunkStart = (char*)chunk;
+
+    RIO_BUFFERID bufferID = ReadPointerAcquire((PVOID const volatile*)buffer);
+    if(bufferID != RIO_INVALID_BUFFERID)
+        return bufferID;
+
+    //the workers share the chunks, so only one of them registers each
+    EnterCriticalSection(&s_registerMutex);
+
+    bufferID = *buffer;
+    if(bufferID == RIO_INVALID_BUFFERID)
+    {
+        bufferID = s_rio.RIORegisterBuffer((char*)chunk, (DWORD)(CONNECTION_POOL_CHUNK_SIZE * sizeof(Connection)));
+        if(bufferID == RIO_INVALID_BUFFERID)
+            logError("RIORegisterBuffer() failed to register a chunk of the connection pool", WSAGetLastError());
+        else
+            InterlockedExchangePointer((PVOID volatile*)buffer, bufferID);
+    }
+
+    LeaveCriticalSection(&s_registerMutex);
+    return bufferID;
+}
+
+//make room for the completions of another request queue in queue. returns false if it is as big as it gets
+static bool reserveCompletions(RegisteredIOQueue* queue)
+{
+    LONG const numOfReserved = InterlockedExchangeAdd(&queue->numOfReserved, COMPLETIONS_PER_SOCKET) + COMPLETIONS_PER_SOCKET;
+    if((DWORD)numOfReserved <= queue->capacity)
+        return true;
+
+    DWORD const newCapacity = min(2 * queue->capacity, (DWORD)RIO_MAX_CQ_SIZE);
+    if(newCapacity < (DWORD)numOfReserved || ! s_rio.RIOResizeCompletionQueue(queue->completionQueue, newCapacity))
+    {
+        logError("RIOResizeCompletionQueue() failed to grow a completion queue", WSAGetLastError());
+        InterlockedExchangeAdd(&queue->numOfReserved, -COMPLETIONS_PER_SOCKET);
+        return false;
+    }
+
+    queue->capacity = newCapacity;
+    return true;
+}
+
+bool registeredIOAttach(RegisteredIOQueue* queue, Connection* connection)
+{
+    RegisteredIOSocket* rio = &connection->rio;
+    if(rio->queue || rio->isUnusable)
+        return rio->queue == queue;
+
+    char* chunkStart = NULL;
+    if(chunkBufferOf(connection, &chunkStart) == RIO_INVALID_BUFFERID || ! reserveCompletions(queue))
+    {
+        rio->isUnusable = true;
+        return false;
+    }
+
+    rio->requestQueue = s_rio.RIOCreateRequestQueue(connection->socket, RECEIVES_PER_SOCKET, 1, SENDS_PER_SOCKET, 1,
+        queue->completionQueue, queue->completionQueue, connection);
+
+    if(rio->requestQueue == RIO_INVALID_RQ)
+    {
+        //a socket that was not accepted from a listen socket made for RIO (see connectionsAcceptor.c)
+        logError("RIOCreateRequestQueue() failed. the player uses WSAPoll() instead", WSAGetLastError());
+        InterlockedExchangeAdd(&queue->numOfReserved, -COMPLETIONS_PER_SOCKET);
+        rio->isUnusable = true;
+        return false;
+    }
+
+    rio->queue = queue;
+    return true;
+}
+
+//the RIO_BUF of size bytes at data, which is inside connection
+static RIO_BUF bufferAt(Connection* connection, char const* data, size_t size)
+{
+    char* chunkStart = NULL;
+    RIO_BUF buf;
+    buf.BufferId = chunkBufferOf(connection, &chunkStart);
+    buf.Offset = (ULONG)(data - chunkStart);
+    buf.Length = (ULONG)size;
+    return buf;
+}
+
+//the result of a receive that never got to the kernel
+static void failReceive(RegisteredIOSocket* rio, int error)
+{
+    rio->hasReceived = true;
+    rio->received = SOCKET_ERROR;
+    rio->receiveError = error;
+}
+
+void registeredIOPostReceive(Connection* connection, size_t maxBytes)
+{
+    RegisteredIOSocket* rio = &connection->rio;
+    MessageFramer* in = &connection->in;
+    assert(rio->queue && ! rio->isReceivePosted && ! rio->hasReceived);
+
+    //a request only takes one buffer, so the receive goes up to the end of the ring at most. the rest comes with the next one
+    uint32_t const writePos = in->tail & (MESSAGE_FRAMER_CAPACITY - 1);
+    size_t const freeSize = min(maxBytes, MESSAGE_FRAMER_CAPACITY - messageFramerSize(in));
+    size_t const size = min(freeSize, (size_t)(MESSAGE_FRAMER_CAPACITY - writePos));
+    if(size == 0)
+    {
+        //same as messageFramerRecv()
+        failReceive(rio, WSAEWOULDBLOCK);
+        return;
+    }
+
+    RIO_BUF buf = bufferAt(connection, in->data + writePos, size);
+    metricsAdd(METRIC_GAME_IO_SYSCALLS, 1);
+    if( ! s_rio.RIOReceive(rio->requestQueue, &buf, 1, 0, (PVOID)RECEIVE_REQUEST) )
+    {
+        failReceive(rio, WSAGetLastError());
+        return;
+    }
+
+    rio->isReceivePosted = true;
+    ++rio->queue->numOfInFlight;
+}
+
+int registeredIOTakeReceived(Connection* connection)
+{
+    RegisteredIOSocket* rio = &connection->rio;
+    assert(rio->hasReceived);
+
+    rio->hasReceived = false;
+    if(rio->received == SOCKET_ERROR)
+        WSASetLastError(rio->receiveError);
+
+    return rio->received;
+}
+
+int registeredIOPostSend(Connection* connection)
+{
+    RegisteredIOSocket* rio = &connection->rio;
+    OutBuffer* out = &connection->out;
+    assert(rio->queue);
+
+    if(rio->numOfSendsInFlight || outBufferIsEmpty(out))
+        return 0;
+
+    //the (at most two) pieces of the ring. all but the last are deferred, so the last one submits them together
+    uint32_t const readPos = out->head & (OUT_BUFFER_CAPACITY - 1);
+    uint32_t const queuedSize = outBufferSize(out);
+    uint32_t const firstPieceSize = min(queuedSize, OUT_BUFFER_CAPACITY - readPos);
+    RIO_BUF pieces[SENDS_PER_SOCKET] =
+    {
+        bufferAt(connection, out->data + readPos, firstPieceSize),
+        bufferAt(connection, out->data, queuedSize - firstPieceSize)
+    };
+
+    DWORD const numOfPieces = pieces[1].Length ? 2 : 1;
+    metricsAdd(METRIC_GAME_IO_SYSCALLS, 1);
+    for(DWORD i = 0; i < numOfPieces; ++i)
+    {
+        DWORD const flags = (i + 1 < numOfPieces) ? RIO_MSG_DEFER : 0;
+        if( ! s_rio.RIOSend(rio->requestQueue, pieces + i, 1, flags, (PVOID)(((uintptr_t)pieces[i].Length << 1) | 1)) )
+        {
+            //a deferred piece that got in is failed by the caller closing the socket
+            rio->hasSendFailed = true;
+            return SOCKET_ERROR;
+        }
+
+        ++rio->numOfSendsInFlight;
+        ++rio->queue->numOfInFlight;
+    }
+
+    //nothing sends out of the buffer until the whole send completed (see registeredIODequeue())
+    rio->sendSize = queuedSize;
+    out->isBlocked = true;
+    return 0;
+}
+
+//returns true if the worker has to get to the connection right away (see registeredIODequeue())
+static bool onCompletion(RIORESULT const* result)
+{
+    Connection* connection = (Connection*)(uintptr_t)result->SocketContext;
+    RegisteredIOSocket* rio = &connection->rio;
+
+    if(result->RequestContext == RECEIVE_REQUEST)
+    {
+        rio->isReceivePosted = false;
+        rio->hasReceived = true;
+        rio->received = result->Status ? SOCKET_ERROR : (int)result->BytesTransferred;
+        rio->receiveError = result->Status;
+        connection->in.tail += result->BytesTransferred;
+        return true;
+    }
+
+    //a send that did not go out whole fails the connection, since the rest of it is behind the next one in the byte stream
+    if(result->Status || result->BytesTransferred != (result->RequestContext >> 1))
+        rio->hasSendFailed = true;
+
+    if(--rio->numOfSendsInFlight)
+        return false;
+
+    //the pieces can complete in any order, so the buffer moves on once all of them did
+    if( ! rio->hasSendFailed )
+    {
+        connection->out.head += rio->sendSize;
+        metricsAdd(METRIC_BYTES_OUT, rio->sendSize);
+    }
+
+    uint32_t const sentSize = rio->sendSize;
+    rio->sendSize = 0;
+    connection->out.isBlocked = false;
+
+    //the worker has to flush the rest, drop the connection, or let its opponent read again if they stopped because of
+    //this queue (see OUT_BUFFER_HIGH_WATERMARK)
+    return rio->hasSendFailed || ! outBufferIsEmpty(&connection->out) || sentSize >= OUT_BUFFER_LOW_WATERMARK;
+}
+
+size_t registeredIODequeue(RegisteredIOQueue* queue)
+{
+    size_t numOfDue = 0;
+    RIORESULT results[DEQUEUE_BATCH];
+    ULONG numOfResults = DEQUEUE_BATCH;
+
+    while(queue->numOfInFlight && numOfResults == DEQUEUE_BATCH)
+    {
+        numOfResults = s_rio.RIODequeueCompletion(queue->completionQueue, results, DEQUEUE_BATCH);
+        if(numOfResults == RIO_CORRUPT_CQ)
+        {
+            logError("RIODequeueCompletion() found a corrupt completion queue", WSAGetLastError());
+            exit(0);
+        }
+
+        for(ULONG i = 0; i < numOfResults; ++i)
+        {
+            if(onCompletion(results + i))
+                ++numOfDue;
+        }
+
+        queue->numOfInFlight -= numOfResults;
+    }
+
+    return numOfDue;
+}
+
+void registeredIONotify(RegisteredIOQueue* queue)
+{
+    metricsAdd(METRIC_GAME_IO_SYSCALLS, 1);
+
+    //WSAEALREADY if the last notify did not go off yet, which is as good
+    int const error = s_rio.RIONotify(queue->completionQueue);
+    if(error && error != WSAEALREADY)
+        logError("RIONotify() failed", error);
+}
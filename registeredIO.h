@@ -0,0 +1,125 @@
+#ifndef REGISTERED_IO_H
+#define REGISTERED_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <winsock2.h>
+#include <mswsock.h>
+
+#include "wakeupSocket.h"
+
+//Registered I/O (RIO) for the players of the game workers, used instead of recv() and WSASend() when
+//g_serverConfig.registeredIO is on (see serverConfig.h).
+//
+//A game worker posts a receive for every player WSAPoll() reported as readable, and a send of what is queued for every player
+//whose OutBuffer is due. The two pieces of the ring go in with RIO_MSG_DEFER, so they take one call into the kernel.
+//A send the socket can not take yet stays in flight in the kernel, so players are never polled for POLLWRNORM.
+//The results of all of a worker's requests are taken off its completion queue at once by registeredIODequeue(),
+//which does not enter the kernel. The bytes go straight into the connection's MessageFramer and out of its OutBuffer:
+//every chunk of the connection pool is registered as a RIO buffer the first time one of its connections is used.
+//
+//A posted receive can not be cancelled, and a player goes back to the lobby (which uses WSAPoll() and recv()) after a game.
+//So receives are only posted for players that WSAPoll() reported as readable, and the bytes are already there when they are posted.
+//A send stays in flight until the socket took all of it. A connection with something in flight is not given back to the lobby
+//(or the connection pool) until it completes (see registeredIOIsIdle()). A worker that waits for a completion arms the
+//completion queue's event, and a thread of its own turns the event into a signal of the worker's wakeup socket.
+//
+//The request queue of a socket stays tied to the completion queue of the worker that created it for as long as the socket
+//is open, so a player only uses RIO on that worker (startChessGame() prefers it). On the other workers they use WSAPoll() as usual.
+
+struct Connection;
+struct RegisteredIOQueue;
+
+//the RIO state of a connection (see Connection::rio). only touched by the game worker its request queue is tied to
+typedef struct
+{
+    //RIO_INVALID_RQ until a game worker created the socket's request queue
+    RIO_RQ requestQueue;
+
+    //the completion queue requestQueue is tied to, or NULL. isUnusable is set if the request queue could not be created
+    struct RegisteredIOQueue* queue;
+    bool isUnusable;
+
+    //the sends in flight, and how many bytes at the front of the OutBuffer they are
+    uint32_t numOfSendsInFlight;
+    uint32_t sendSize;
+    bool hasSendFailed;
+
+    //a receive is posted until it completes. then hasReceived is set and received is what recv() would have returned
+    //(with the error in receiveError if that is SOCKET_ERROR), until the worker took it with registeredIOTakeReceived()
+    bool isReceivePosted;
+    bool hasReceived;
+    int received;
+    int receiveError;
+
+}RegisteredIOSocket;
+
+//the completion queue of a game worker
+typedef struct RegisteredIOQueue
+{
+    RIO_CQ completionQueue;
+    DWORD capacity;
+
+    //the completions the request queues tied to this queue can have outstanding. the sockets are closed by whichever thread
+    //owns them at the time (see registeredIOSocketClosed()), so this goes down on other threads
+    volatile LONG numOfReserved;
+
+    //the index of the game worker
+    size_t owner;
+
+    //how many receives and sends of the request queues tied to this queue are in flight. only touched by the worker
+    uint32_t numOfInFlight;
+
+    //signaled by RIO when a completion comes in after registeredIONotify(). the notify thread signals wakeup when it is
+    HANDLE event;
+    WakeupSocket* wakeup;
+
+}RegisteredIOQueue;
+
+//Looks up the RIO functions. Has to be called after WSAStartup() and before anything else in here.
+//Returns false (and logs why) if winsock has no RIO, in which case the caller turns g_serverConfig.registeredIO off
+bool registeredIOInit(void);
+
+//Create the completion queue of the game worker with the index owner, and start its notify thread, which signals wakeup
+//(see registeredIONotify()). exits if it can not be created
+void registeredIOQueueInit(RegisteredIOQueue* queue, size_t owner, WakeupSocket* wakeup);
+
+//called by connectionPoolAlloc() and connectionPoolFree() (after the socket was closed)
+void registeredIOSocketInit(RegisteredIOSocket* rio);
+void registeredIOSocketClosed(RegisteredIOSocket* rio);
+
+//Ties the connection's socket to queue if it is not tied to a queue yet. Returns true if the connection can use RIO
+//on queue's worker, false if it uses WSAPoll() there (it is tied to another queue or the socket can not use RIO)
+bool registeredIOAttach(RegisteredIOQueue* queue, struct Connection* connection);
+
+static inline bool registeredIOIsAttached(RegisteredIOQueue const* queue, RegisteredIOSocket const* rio)
+{
+    return rio->queue == queue;
+}
+
+static inline bool registeredIOIsIdle(RegisteredIOSocket const* rio)
+{
+    return ! rio->isReceivePosted && ! rio->numOfSendsInFlight;
+}
+
+//Post a receive of up to maxBytes into the connection's MessageFramer.
+//If it can not be posted, the error is its result right away (see RegisteredIOSocket::hasReceived)
+void registeredIOPostReceive(struct Connection* connection, size_t maxBytes);
+
+//what the last receive returned (see RegisteredIOSocket::received). sets the last winsock error if it is SOCKET_ERROR
+int registeredIOTakeReceived(struct Connection* connection);
+
+//Post a send of what is queued in the connection's OutBuffer, unless one is in flight already. The OutBuffer is isBlocked
+//while the send is in flight, so nothing else sends from it. returns SOCKET_ERROR if it can not be posted
+int registeredIOPostSend(struct Connection* connection);
+
+//Take the results of the completed receives and sends off of queue into their connections. Returns how many of them the worker
+//has to get to right away: the receives, and the sends that failed, left something queued or drained enough of the queue
+//for the opponent to be read from again
+size_t registeredIODequeue(RegisteredIOQueue* queue);
+
+//have queue's event signaled (and so the worker woken up) when the next completion comes in
+void registeredIONotify(RegisteredIOQueue* queue);
+
+#endif //REGISTERED_IO_H
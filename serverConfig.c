@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "serverConfig.h"
+
+ServerConfig g_serverConfig =
+{
+    DEFAULT_LOBBY_CAPACITY,
+    DEFAULT_MAX_GAMES,
+    DEFAULT_MEMORY_BUDGET_MB,
+    DEFAULT_ACCEPT_THREADS,
+    DEFAULT_LOBBY_THREADS,
+    DEFAULT_CONNECTIONS_PER_IP,
+    DEFAULT_CONNECT_RATE_PER_IP,
+    DEFAULT_CONNECT_BURST_PER_IP,
+    DEFAULT_VALIDATE_MOVES,
+    DEFAULT_RESUME_GRACE_SECS,
+    DEFAULT_JOURNAL_MB,
+    DEFAULT_SPECTATORS_PER_WORKER,
+    DEFAULT_REGISTERED_IO,
+    DEFAULT_UPGRADE
+};
+
+static size_t sizeFromEnvironment(char const* name, size_t defaultValue)
+{
+    char const* valueStr = getenv(name);
+    if( ! valueStr )
+        return defaultValue;
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long long const value = strtoull(valueStr, &end, 10);
+    if(errno || end == valueStr || *end != '\0' || value == 0 || value > SIZE_MAX)
+    {
+        fprintf(stderr, "%s must be a positive number, not %s. using %zu\n", name, valueStr, defaultValue);
+        return defaultValue;
+    }
+
+    return (size_t)value;
+}
+
+static bool boolFromEnvironment(char const* name, bool defaultValue)
+{
+    char const* valueStr = getenv(name);
+    if( ! valueStr )
+        return defaultValue;
+
+    if(strcmp(valueStr, "0") && strcmp(valueStr, "1"))
+    {
+        fprintf(stderr, "%s must be 0 or 1, not %s. using %d\n", name, valueStr, (int)defaultValue);
+        return defaultValue;
+    }
+
+    return valueStr[0] == '1';
+}
+
+void serverConfigInit(void)
+{
+    g_serverConfig.lobbyCapacity = sizeFromEnvironment("CHESS_SERVER_LOBBY_CAPACITY", DEFAULT_LOBBY_CAPACITY);
+    g_serverConfig.maxGames = sizeFromEnvironment("CHESS_SERVER_MAX_GAMES", DEFAULT_MAX_GAMES);
+    g_serverConfig.memoryBudgetMB = sizeFromEnvironment("CHESS_SERVER_MEMORY_BUDGET_MB", DEFAULT_MEMORY_BUDGET_MB);
+
+    g_serverConfig.acceptThreads = sizeFromEnvironment("CHESS_SERVER_ACCEPT_THREADS", DEFAULT_ACCEPT_THREADS);
+    if(g_serverConfig.acceptThreads > MAX_ACCEPT_THREADS)
+    {
+        fprintf(stderr, "CHESS_SERVER_ACCEPT_THREADS can not be more than %d. using %d\n", MAX_ACCEPT_THREADS, MAX_ACCEPT_THREADS);
+        g_serverConfig.acceptThreads = MAX_ACCEPT_THREADS;
+    }
+
+    g_serverConfig.lobbyThreads = sizeFromEnvironment("CHESS_SERVER_LOBBY_THREADS", DEFAULT_LOBBY_THREADS);
+    if(g_serverConfig.lobbyThreads > MAX_LOBBY_THREADS)
+    {
+        fprintf(stderr, "CHESS_SERVER_LOBBY_THREADS can not be more than %d. using %d\n", MAX_LOBBY_THREADS, MAX_LOBBY_THREADS);
+        g_serverConfig.lobbyThreads = MAX_LOBBY_THREADS;
+    }
+
+    g_serverConfig.connectionsPerIP = sizeFromEnvironment("CHESS_SERVER_CONNECTIONS_PER_IP", DEFAULT_CONNECTIONS_PER_IP);
+    g_serverConfig.connectRatePerIP = sizeFromEnvironment("CHESS_SERVER_CONNECT_RATE_PER_IP", DEFAULT_CONNECT_RATE_PER_IP);
+    g_serverConfig.connectBurstPerIP = sizeFromEnvironment("CHESS_SERVER_CONNECT_BURST_PER_IP", DEFAULT_CONNECT_BURST_PER_IP);
+
+    g_serverConfig.validateMoves = boolFromEnvironment("CHESS_SERVER_VALIDATE_MOVES", DEFAULT_VALIDATE_MOVES);
+
+    g_serverConfig.resumeGraceSecs = sizeFromEnvironment("CHESS_SERVER_RESUME_GRACE_SECS", DEFAULT_RESUME_GRACE_SECS);
+    g_serverConfig.journalMB = sizeFromEnvironment("CHESS_SERVER_JOURNAL_MB", DEFAULT_JOURNAL_MB);
+
+    g_serverConfig.spectatorsPerWorker = sizeFromEnvironment("CHESS_SERVER_SPECTATORS_PER_WORKER", DEFAULT_SPECTATORS_PER_WORKER);
+    g_serverConfig.registeredIO = boolFromEnvironment("CHESS_SERVER_REGISTERED_IO", DEFAULT_REGISTERED_IO);
+    g_serverConfig.upgrade = boolFromEnvironment("CHESS_SERVER_UPGRADE", DEFAULT_UPGRADE);
+}
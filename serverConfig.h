@@ -0,0 +1,88 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+//The capacity limits of the server (and how many acceptor and lobby threads it runs). They are read from environment variables by serverConfigInit()
+//(the same way as CHESS_SERVER_LOG_LEVEL, see errorLogger.h), so they can be changed without rebuilding the server.
+//Memory for connections is only allocated as they come in (see connectionPool.h), so high limits cost nothing while the server is idle.
+typedef struct
+{
+    //CHESS_SERVER_LOBBY_CAPACITY. new connections are turned away (with a SERVER_FULL_MSGTYPE) once the lobby has this many members.
+    //players coming back from a chess game are always let back in, so the lobby can briefly hold more than this
+    size_t lobbyCapacity;
+
+    //CHESS_SERVER_MAX_GAMES. the most chess games running at once across all of the game workers
+    size_t maxGames;
+
+    //CHESS_SERVER_MEMORY_BUDGET_MB. the most memory (in MB) the connections can take. if a full lobby plus
+    //both players of every game would not fit in it, the pool of connections stops growing once it is used up
+    size_t memoryBudgetMB;
+
+    //CHESS_SERVER_ACCEPT_THREADS. how many threads accept new connections (see connectionsAcceptor.h)
+    size_t acceptThreads;
+
+    //CHESS_SERVER_LOBBY_THREADS. how many threads the lobby is split between (see lobbyManager.c). every lobby thread
+    //has its own members, so this is how many cores the lobby can use
+    size_t lobbyThreads;
+
+    //CHESS_SERVER_CONNECTIONS_PER_IP. the most connections one IP address can have open at once (see admissionControl.h)
+    size_t connectionsPerIP;
+
+    //CHESS_SERVER_CONNECT_RATE_PER_IP and CHESS_SERVER_CONNECT_BURST_PER_IP. how many new connections per second
+    //one IP address can open, and how many it can open at once after it was quiet for a while
+    size_t connectRatePerIP;
+    size_t connectBurstPerIP;
+
+    //CHESS_SERVER_VALIDATE_MOVES (0 or 1). check every MOVE_MSGTYPE against the rules of chess (see chessRules.h) before
+    //forwarding it, and end the game of a player who sends an illegal one. off by default, since the clients check their own moves
+    bool validateMoves;
+
+    //CHESS_SERVER_RESUME_GRACE_SECS. how long a game waits for a player whose connection dropped to come back
+    //with RESUME_GAME_MSGTYPE before their opponent gets OPPONENT_CLOSED_CONNECTION_MSGTYPE
+    size_t resumeGraceSecs;
+
+    //CHESS_SERVER_JOURNAL_MB. the size of each of the two journal files of every game worker (see gameJournal.h).
+    //a worker whose running games do not fit in one file stops journaling, so its games do not survive a restart
+    size_t journalMB;
+
+    //CHESS_SERVER_SPECTATORS_PER_WORKER. how many connections can watch the games of one game worker at once (see SPECTATE_MSGTYPE).
+    //every spectator of a game is on the game's worker, so this is also the most spectators one game can have
+    size_t spectatorsPerWorker;
+
+    //CHESS_SERVER_REGISTERED_IO (0 or 1). have the game workers receive from and send to their players with Registered I/O
+    //(see registeredIO.h) instead of recv() and WSASend(). off by default. turned off at startup if winsock does not have RIO
+    bool registeredIO;
+
+    //CHESS_SERVER_UPGRADE (0 or 1). take over the listen socket, the lobby and every running game from the server that is running
+    //on this machine, without disconnecting anyone (see hotUpgrade.h), instead of starting empty. starts empty if no server is running
+    bool upgrade;
+
+}ServerConfig;
+
+#define DEFAULT_LOBBY_CAPACITY 100000
+#define DEFAULT_MAX_GAMES 50000
+#define DEFAULT_MEMORY_BUDGET_MB 512
+#define DEFAULT_ACCEPT_THREADS 2
+#define MAX_ACCEPT_THREADS 64
+#define DEFAULT_LOBBY_THREADS 2
+#define MAX_LOBBY_THREADS 64
+#define DEFAULT_CONNECTIONS_PER_IP 32
+#define DEFAULT_CONNECT_RATE_PER_IP 10
+#define DEFAULT_CONNECT_BURST_PER_IP 20
+#define DEFAULT_VALIDATE_MOVES false
+#define DEFAULT_RESUME_GRACE_SECS 30
+#define DEFAULT_JOURNAL_MB 64
+#define DEFAULT_SPECTATORS_PER_WORKER 16384
+#define DEFAULT_REGISTERED_IO false
+#define DEFAULT_UPGRADE false
+
+//only written by serverConfigInit()
+extern ServerConfig g_serverConfig;
+
+//has to be called before any of the other threads are started. a variable that is not set
+//(or is not a positive number) gets its default
+void serverConfigInit(void);
+
+#endif //SERVER_CONFIG_H
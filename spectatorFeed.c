@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spectatorFeed.h"
+#include "errorLogger.h"
+#include "metrics.h"
+
+SpectatorChunk* spectatorChunkNew(uint32_t capacity, SpectatorChunk* next)
+{
+    SpectatorChunk* chunk = malloc(sizeof(SpectatorChunk) + capacity);
+    if( ! chunk )
+    {
+        logError("malloc failed to allocate a chunk of a spectator feed", 0);
+        exit(0);
+    }
+
+    chunk->next = next;
+    chunk->refCount = 1;
+    chunk->size = 0;
+    chunk->capacity = capacity;
+    chunk->feedOffset = 0;
+
+    if(next)
+        spectatorChunkAcquire(next);
+
+    return chunk;
+}
+
+void spectatorChunkRelease(SpectatorChunk* chunk)
+{
+    //the reference a freed chunk held to the one after it goes along with it
+    while(chunk && --chunk->refCount == 0)
+    {
+        SpectatorChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void spectatorFeedStart(SpectatorFeed* feed)
+{
+    if(feed->tail)
+        return;
+
+    feed->tail = spectatorChunkNew(SPECTATOR_CHUNK_SIZE, NULL);
+    feed->tail->feedOffset = feed->size;
+}
+
+void spectatorFeedStop(SpectatorFeed* feed)
+{
+    spectatorChunkRelease(feed->tail);
+    feed->tail = NULL;
+}
+
+//put a new empty chunk after the tail. the old tail's hold on the new one is the reference spectatorChunkNew() gives out,
+//and the feed takes one of its own
+static void appendChunk(SpectatorFeed* feed)
+{
+    SpectatorChunk* chunk = spectatorChunkNew(SPECTATOR_CHUNK_SIZE, NULL);
+    chunk->feedOffset = feed->size;
+    spectatorChunkAcquire(chunk);
+
+    SpectatorChunk* oldTail = feed->tail;
+    oldTail->next = chunk;
+    feed->tail = chunk;
+    spectatorChunkRelease(oldTail);
+}
+
+void spectatorFeedAppend(SpectatorFeed* feed, void const* data, size_t size)
+{
+    assert(feed->tail && size <= SPECTATOR_CHUNK_SIZE);
+
+    if(feed->tail->capacity - feed->tail->size < size)
+        appendChunk(feed);
+
+    memcpy(feed->tail->data + feed->tail->size, data, size);
+    feed->tail->size += (uint32_t)size;
+    feed->size += size;
+}
+
+SpectatorChunk* spectatorFeedSplit(SpectatorFeed* feed)
+{
+    assert(feed->tail);
+
+    if(feed->tail->size)
+        appendChunk(feed);
+
+    return feed->tail;
+}
+
+void spectatorCursorInit(SpectatorCursor* cursor, SpectatorChunk* chunk)
+{
+    spectatorChunkAcquire(chunk);
+    cursor->chunk = chunk;
+    cursor->offset = 0;
+}
+
+void spectatorCursorRelease(SpectatorCursor* cursor)
+{
+    spectatorChunkRelease(cursor->chunk);
+    cursor->chunk = NULL;
+    cursor->offset = 0;
+}
+
+bool spectatorCursorHasPending(SpectatorCursor const* cursor)
+{
+    SpectatorChunk const* chunk = cursor->chunk;
+    return chunk && (cursor->offset < chunk->size || (chunk->next && chunk->next->size));
+}
+
+uint64_t spectatorCursorLag(SpectatorCursor const* cursor, SpectatorFeed const* feed)
+{
+    SpectatorChunk const* chunk = cursor->chunk;
+    if( ! chunk )
+        return 0;
+
+    return feed->size - (chunk->feedOffset + cursor->offset);
+}
+
+size_t spectatorCursorPendingSize(SpectatorCursor const* cursor)
+{
+    size_t pendingSize = 0;
+    uint32_t offset = cursor->offset;
+    for(SpectatorChunk const* chunk = cursor->chunk; chunk; chunk = chunk->next, offset = 0)
+        pendingSize += chunk->size - offset;
+
+    return pendingSize;
+}
+
+void spectatorCursorCopyPending(SpectatorCursor const* cursor, char* dst)
+{
+    uint32_t offset = cursor->offset;
+    for(SpectatorChunk const* chunk = cursor->chunk; chunk; chunk = chunk->next, offset = 0)
+    {
+        memcpy(dst, chunk->data + offset, chunk->size - offset);
+        dst += chunk->size - offset;
+    }
+}
+
+//move the cursor numBytes forward, into the next chunks if it has to
+static void advanceCursor(SpectatorCursor* cursor, size_t numBytes)
+{
+    while(true)
+    {
+        SpectatorChunk* chunk = cursor->chunk;
+        size_t const step = min(numBytes, (size_t)(chunk->size - cursor->offset));
+        cursor->offset += (uint32_t)step;
+        numBytes -= step;
+
+        if(cursor->offset < chunk->size || ! chunk->next)
+            break;
+
+        //done with this chunk
+        spectatorChunkAcquire(chunk->next);
+        cursor->chunk = chunk->next;
+        cursor->offset = 0;
+        spectatorChunkRelease(chunk);
+    }
+
+    assert(numBytes == 0);
+}
+
+int spectatorCursorSend(SpectatorCursor* cursor, SOCKET sock, bool* isBlocked)
+{
+    *isBlocked = false;
+
+    //gather the pending part of the first few chunks into one WSASend() call
+    WSABUF pieces[SPECTATOR_MAX_GATHER];
+    DWORD numOfPieces = 0;
+    size_t pendingSize = 0;
+    uint32_t offset = cursor->offset;
+    for(SpectatorChunk* chunk = cursor->chunk; chunk && numOfPieces < SPECTATOR_MAX_GATHER; chunk = chunk->next, offset = 0)
+    {
+        if(chunk->size > offset)
+        {
+            pieces[numOfPieces].buf = chunk->data + offset;
+            pieces[numOfPieces].len = chunk->size - offset;
+            pendingSize += pieces[numOfPieces].len;
+            ++numOfPieces;
+        }
+    }
+
+    if( ! numOfPieces )
+        return 0;
+
+    DWORD numBytesSent = 0;
+    if(WSASend(sock, pieces, numOfPieces, &numBytesSent, 0, NULL, NULL) == SOCKET_ERROR)
+    {
+        if(WSAGetLastError() != WSAEWOULDBLOCK)
+            return SOCKET_ERROR;
+
+        *isBlocked = true;
+        return 0;
+    }
+
+    advanceCursor(cursor, numBytesSent);
+    metricsAdd(METRIC_BYTES_OUT, numBytesSent);
+
+    //the socket did not take everything
+    *isBlocked = numBytesSent < pendingSize;
+    return 0;
+}
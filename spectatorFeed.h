@@ -0,0 +1,102 @@
+#ifndef SPECTATOR_FEED_H
+#define SPECTATOR_FEED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <winsock2.h>
+
+//The bytes a game sends to its spectators (see SPECTATE_MSGTYPE in chessNetworkProtocol.h and gameManager.c).
+//Every message is written once, into the tail chunk of the feed, and every spectator sends straight out of the chunks
+//with a SpectatorCursor, so a move costs one copy no matter how many spectators the game has.
+//
+//The chunks are refcounted. A chunk is held by the cursors in it, by the chunk before it (through its next pointer)
+//and by the feed while it is the tail, so the chunks nobody can get to anymore free themselves one after the other
+//when the last cursor leaves them. Cursors can outlive the feed (a spectator finishing the last bytes of a game that ended).
+//Not thread safe, a feed and its cursors belong to the game worker that owns the game.
+
+#define SPECTATOR_CHUNK_SIZE 4096
+
+typedef struct SpectatorChunk
+{
+    struct SpectatorChunk* next;
+    uint32_t refCount;
+    uint32_t size;
+    uint32_t capacity;
+
+    //where data starts in the feed (see SpectatorFeed::size). only differences of these are meaningful, so a chunk
+    //that leads into the feed can start "before" 0 (it wraps around)
+    uint64_t feedOffset;
+
+    char data[];
+}SpectatorChunk;
+
+typedef struct
+{
+    //NULL until the first spectator joins (see spectatorFeedStart())
+    SpectatorChunk* tail;
+
+    //how many bytes were appended since the feed started
+    uint64_t size;
+}SpectatorFeed;
+
+typedef struct
+{
+    //NULL once the cursor was released
+    SpectatorChunk* chunk;
+    uint32_t offset;
+}SpectatorCursor;
+
+//Start appending to feed. Nothing is kept while a feed has not started, and a started feed has a tail chunk.
+void spectatorFeedStart(SpectatorFeed* feed);
+
+//drop the feed's hold on its chunks. cursors that are still in them can keep sending. the feed can be started again
+void spectatorFeedStop(SpectatorFeed* feed);
+
+static inline bool spectatorFeedIsStarted(SpectatorFeed const* feed)
+{
+    return feed->tail != NULL;
+}
+
+//copy data into the tail chunk (or a new one, if it is full). size has to be at most SPECTATOR_CHUNK_SIZE
+void spectatorFeedAppend(SpectatorFeed* feed, void const* data, size_t size);
+
+//Begin a new, empty tail chunk if the tail has anything in it, so a chunk that leads into the feed from here can be put in front of it
+//(see spectatorChunkNew()). Returns the (empty) tail.
+SpectatorChunk* spectatorFeedSplit(SpectatorFeed* feed);
+
+//A chunk of capacity bytes that is not in any feed, with a refCount of 1 (for the caller). If next is not NULL,
+//the new chunk leads into it (it holds a reference to it). The caller fills in data, size and feedOffset
+//(next->feedOffset - size, for a chunk that leads into a feed)
+SpectatorChunk* spectatorChunkNew(uint32_t capacity, SpectatorChunk* next);
+
+static inline void spectatorChunkAcquire(SpectatorChunk* chunk)
+{
+    ++chunk->refCount;
+}
+
+//drop a reference to chunk, and free it (and the chunks after it nobody holds anymore) if it was the last one
+void spectatorChunkRelease(SpectatorChunk* chunk);
+
+//a cursor at the start of chunk (which is acquired for the cursor)
+void spectatorCursorInit(SpectatorCursor* cursor, SpectatorChunk* chunk);
+
+void spectatorCursorRelease(SpectatorCursor* cursor);
+
+//true if there is something after the cursor
+bool spectatorCursorHasPending(SpectatorCursor const* cursor);
+
+//how many bytes of feed the cursor has not sent yet
+uint64_t spectatorCursorLag(SpectatorCursor const* cursor, SpectatorFeed const* feed);
+
+//how many bytes are after the cursor (in every chunk up to the end of the feed), and a copy of them for a hot upgrade (see hotUpgrade.h).
+//dst has room for spectatorCursorPendingSize() bytes
+size_t spectatorCursorPendingSize(SpectatorCursor const* cursor);
+void spectatorCursorCopyPending(SpectatorCursor const* cursor, char* dst);
+
+//Send what is after the cursor with one WSASend() (of up to SPECTATOR_MAX_GATHER chunks) and move the cursor past what was sent.
+//sets *isBlocked if the socket did not take all of it. returns SOCKET_ERROR if sending fails
+#define SPECTATOR_MAX_GATHER 8
+int spectatorCursorSend(SpectatorCursor* cursor, SOCKET sock, bool* isBlocked);
+
+#endif //SPECTATOR_FEED_H
@@ -0,0 +1,144 @@
+#include <assert.h>
+#include <intrin.h>
+
+#include "timerWheel.h"
+
+static size_t slotOf(uint64_t tick)
+{
+    return (size_t)(tick % TIMER_WHEEL_SLOTS);
+}
+
+static void linkTimer(TimerWheel* wheel, TimerNode* timer)
+{
+    size_t const slot = slotOf(timer->deadlineTick);
+    TimerNode* head = wheel->slots + slot;
+
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+
+    wheel->occupied[slot / 64] |= 1ull << (slot % 64);
+}
+
+static void unlinkTimer(TimerWheel* wheel, TimerNode* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+
+    size_t const slot = slotOf(timer->deadlineTick);
+    TimerNode const* head = wheel->slots + slot;
+    if(head->next == head)
+        wheel->occupied[slot / 64] &= ~(1ull << (slot % 64));
+}
+
+//the smallest offset >= fromOffset for which the slot of firstTick + offset has timers, or TIMER_WHEEL_SLOTS if there is none.
+//one bit scan per 64 slots
+static uint64_t findOccupied(TimerWheel const* wheel, uint64_t firstTick, uint64_t fromOffset)
+{
+    while(fromOffset < TIMER_WHEEL_SLOTS)
+    {
+        size_t const slot = slotOf(firstTick + fromOffset);
+        uint64_t const bits = wheel->occupied[slot / 64] >> (slot % 64);
+        if(bits)
+        {
+            unsigned long index = 0;
+            _BitScanForward64(&index, bits);
+
+            //past the end means it wrapped around to a slot that was already looked at
+            uint64_t const offset = fromOffset + index;
+            return offset < TIMER_WHEEL_SLOTS ? offset : TIMER_WHEEL_SLOTS;
+        }
+
+        fromOffset += 64 - slot % 64;
+    }
+
+    return TIMER_WHEEL_SLOTS;
+}
+
+void timerWheelInit(TimerWheel* wheel, uint64_t nowMs)
+{
+    for(size_t i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+        wheel->slots[i].next = wheel->slots[i].prev = wheel->slots + i;
+
+    for(size_t i = 0; i < TIMER_WHEEL_SLOTS / 64; ++i)
+        wheel->occupied[i] = 0;
+
+    wheel->currentTick = nowMs / TIMER_WHEEL_TICK_MS;
+}
+
+void timerWheelSchedule(TimerWheel* wheel, TimerNode* timer, uint64_t deadlineMs)
+{
+    assert( ! timerIsScheduled(timer) );
+
+    uint64_t tick = (deadlineMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    if(tick < wheel->currentTick)
+        tick = wheel->currentTick;
+    else if(tick >= wheel->currentTick + TIMER_WHEEL_SLOTS)
+        tick = wheel->currentTick + TIMER_WHEEL_SLOTS - 1;
+
+    timer->deadlineTick = tick;
+    linkTimer(wheel, timer);
+}
+
+void timerWheelCancel(TimerWheel* wheel, TimerNode* timer)
+{
+    if(timerIsScheduled(timer))
+        unlinkTimer(wheel, timer);
+}
+
+void timerWheelExpire(TimerWheel* wheel, uint64_t nowMs, TimerCallback callback, void* ctx)
+{
+    uint64_t const nowTick = nowMs / TIMER_WHEEL_TICK_MS;
+    uint64_t const firstTick = wheel->currentTick;
+    if(nowTick < firstTick)
+        return;
+
+    //if the wheel went around more than once since the last call, every slot is due
+    uint64_t const numOfTicks = (nowTick - firstTick < TIMER_WHEEL_SLOTS) ? nowTick - firstTick + 1 : TIMER_WHEEL_SLOTS;
+
+    //timers the callbacks schedule go after nowTick
+    wheel->currentTick = nowTick + 1;
+
+    for(uint64_t offset = findOccupied(wheel, firstTick, 0); offset < numOfTicks; offset = findOccupied(wheel, firstTick, offset + 1))
+    {
+        TimerNode* head = wheel->slots + slotOf(firstTick + offset);
+
+        //move the slot's timers out first, so a callback can schedule and cancel any timer (even the one it was called for)
+        TimerNode due = {head->next, head->prev, 0};
+        due.next->prev = &due;
+        due.prev->next = &due;
+        head->next = head->prev = head;
+
+        size_t const slot = slotOf(firstTick + offset);
+        wheel->occupied[slot / 64] &= ~(1ull << (slot % 64));
+
+        while(due.next != &due)
+        {
+            TimerNode* timer = due.next;
+            due.next = timer->next;
+            timer->next->prev = &due;
+
+            //a timer a callback scheduled into this slot (after nowTick) has to wait for its turn
+            if(timer->deadlineTick > nowTick)
+            {
+                timer->next = timer->prev = NULL;
+                linkTimer(wheel, timer);
+                continue;
+            }
+
+            timer->next = timer->prev = NULL;
+            callback(timer, ctx);
+        }
+    }
+}
+
+uint64_t timerWheelNextDeadline(TimerWheel const* wheel)
+{
+    uint64_t const offset = findOccupied(wheel, wheel->currentTick, 0);
+    if(offset == TIMER_WHEEL_SLOTS)
+        return UINT64_MAX;
+
+    return (wheel->currentTick + offset) * TIMER_WHEEL_TICK_MS;
+}
@@ -0,0 +1,80 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//A hashed timing wheel for the timers of one thread (a lobby thread's pair request timeouts, see lobbyManager.c).
+//Time is cut into TIMER_WHEEL_TICK_MS ticks and every tick has a slot with a doubly linked list of the timers that are due in it.
+//The wheel covers TIMER_WHEEL_SLOTS ticks ahead, and no timer can be scheduled further out than that,
+//so every timer in a slot is due when the slot comes up and expiring never looks at a timer that is not due yet.
+//A bitmap of the slots that have timers lets timerWheelExpire() and timerWheelNextDeadline() skip the empty ones.
+//
+//Timers are TimerNodes embedded in whatever they are the timer of, so scheduling and cancelling are O(1) and never allocate.
+//Not thread safe.
+
+#define TIMER_WHEEL_TICK_MS 16
+
+//has to be a multiple of 64. 1024 ticks of 16ms is a bit more than 16 seconds
+#define TIMER_WHEEL_SLOTS 1024
+
+//the furthest out a timer can be scheduled
+#define TIMER_WHEEL_MAX_DELAY_MS ((uint64_t)(TIMER_WHEEL_SLOTS - 1) * TIMER_WHEEL_TICK_MS)
+
+typedef struct TimerNode
+{
+    //NULL while the timer is not scheduled
+    struct TimerNode* next;
+    struct TimerNode* prev;
+
+    //the tick the timer goes off in. says which slot it is in
+    uint64_t deadlineTick;
+}TimerNode;
+
+typedef struct
+{
+    //the list head of every slot. a slot whose head points at itself is empty
+    TimerNode slots[TIMER_WHEEL_SLOTS];
+
+    //bit i is set if slots[i] has timers
+    uint64_t occupied[TIMER_WHEEL_SLOTS / 64];
+
+    //every tick before this one has been expired
+    uint64_t currentTick;
+
+}TimerWheel;
+
+//called for every timer that is due. the timer is not scheduled anymore, so it can be scheduled again from in here
+typedef void (*TimerCallback)(TimerNode* timer, void* ctx);
+
+//nowMs is on the clock the wheel is going to be used with (for the lobby, getMonotonicMicroseconds() / 1000)
+void timerWheelInit(TimerWheel* wheel, uint64_t nowMs);
+
+//make a timer that is not scheduled. has to be called on a TimerNode before anything else
+static inline void timerNodeInit(TimerNode* timer)
+{
+    timer->next = timer->prev = NULL;
+}
+
+static inline bool timerIsScheduled(TimerNode const* timer)
+{
+    return timer->next != NULL;
+}
+
+//O(1). Schedule timer (which must not be scheduled already) to go off at deadlineMs, rounded up to a tick.
+//A deadline in the past goes off on the next timerWheelExpire(). A deadline past the end of the wheel
+//(TIMER_WHEEL_MAX_DELAY_MS after the last timerWheelExpire()) is moved to the end of the wheel.
+void timerWheelSchedule(TimerWheel* wheel, TimerNode* timer, uint64_t deadlineMs);
+
+//O(1). Does nothing if timer is not scheduled.
+void timerWheelCancel(TimerWheel* wheel, TimerNode* timer);
+
+//Call callback for every timer that is due at nowMs. Only the slots that have timers are looked at.
+void timerWheelExpire(TimerWheel* wheel, uint64_t nowMs, TimerCallback callback, void* ctx);
+
+//When the next timer goes off (in ms on the wheel's clock), or UINT64_MAX if no timer is scheduled.
+//Looks at the bitmap, not the timers.
+uint64_t timerWheelNextDeadline(TimerWheel const* wheel);
+
+#endif //TIMER_WHEEL_H
@@ -0,0 +1,69 @@
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "wakeupSocket.h"
+#include "errorLogger.h"
+
+bool wakeupSocketInit(WakeupSocket* wakeup)
+{
+    wakeup->isSignaled = 0;
+    wakeup->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(wakeup->sock == INVALID_SOCKET)
+    {
+        logError("a call to socket() failed when trying to make a wakeup socket", WSAGetLastError());
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;//let the OS pick a port
+    int addrLen = (int)sizeof(addr);
+
+    //bind to an ephemeral loopback port and then connect the socket to itself
+    unsigned long nonBlocking = 1;
+    if(bind(wakeup->sock, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+       getsockname(wakeup->sock, (SOCKADDR*)&addr, &addrLen) == SOCKET_ERROR ||
+       connect(wakeup->sock, (SOCKADDR*)&addr, addrLen) == SOCKET_ERROR ||
+       ioctlsocket(wakeup->sock, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+    {
+        logError("failed to set up a wakeup socket", WSAGetLastError());
+        closesocket(wakeup->sock);
+        wakeup->sock = INVALID_SOCKET;
+        return false;
+    }
+
+    return true;
+}
+
+void wakeupSocketDestroy(WakeupSocket* wakeup)
+{
+    if(wakeup->sock != INVALID_SOCKET)
+        closesocket(wakeup->sock);
+
+    wakeup->sock = INVALID_SOCKET;
+}
+
+void signalWakeupSocket(WakeupSocket* wakeup)
+{
+    //only the first signaler since the last drain has to pay for a send()
+    if(InterlockedExchange(&wakeup->isSignaled, 1) == 0)
+    {
+        char const byte = 0;
+        send(wakeup->sock, &byte, sizeof(byte), 0);
+    }
+}
+
+void drainWakeupSocket(WakeupSocket* wakeup)
+{
+    //clear the flag before draining so a signal that races with the drain is not lost
+    InterlockedExchange(&wakeup->isSignaled, 0);
+
+    char buff[64];
+    while(recv(wakeup->sock, buff, sizeof(buff), 0) > 0) {}
+}
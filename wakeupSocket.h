@@ -0,0 +1,30 @@
+#ifndef WAKEUP_SOCKET_H
+#define WAKEUP_SOCKET_H
+
+#include <winsock2.h>
+#include <stdbool.h>
+
+//A loopback UDP socket connected to itself. It lives in a thread's WSAPoll() set
+//so that other threads can interrupt a blocking WSAPoll() call (winsock has no eventfd or self pipe).
+typedef struct
+{
+    SOCKET sock;
+
+    //Set by signalWakeupSocket() and cleared by drainWakeupSocket(), so that
+    //a burst of signals from other threads only costs one datagram.
+    volatile LONG isSignaled;
+
+}WakeupSocket;
+
+//returns false if the socket could not be created
+bool wakeupSocketInit(WakeupSocket* wakeup);
+
+void wakeupSocketDestroy(WakeupSocket* wakeup);
+
+//thread safe. wakes up the thread polling wakeup->sock
+void signalWakeupSocket(WakeupSocket* wakeup);
+
+//called by the polling thread when wakeup->sock is readable
+void drainWakeupSocket(WakeupSocket* wakeup);
+
+#endif //WAKEUP_SOCKET_H